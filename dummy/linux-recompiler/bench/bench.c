@@ -0,0 +1,287 @@
+/* Hot path benchmarks for the native parser.
+ *
+ *   bench [-c] [-n] [-i iterations] <elf-file>...
+ *
+ * Each file is run through header parsing, section table load, symbol
+ * dumping and .text extraction; every phase reports time per iteration,
+ * throughput, the peak RSS seen so far and how much of the file sits in
+ * the page cache afterwards.  Output of the phases goes to /dev/null so
+ * that formatting, not the terminal, is measured.
+ * Files are read through the page cache: run once to warm it, or pass
+ * -c to evict the file before every iteration and measure cold I/O.
+ * -n turns the page cache hints off to compare against them.
+ *
+ * Build with -O2 -DNDEBUG against the parser sources, see run.sh.
+ */
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "../elf-parser.h"
+#include "../elf-file.h"
+#include "../elf-advise.h"
+
+typedef struct phase {
+	const char *name;
+	uint64_t iterations;
+	uint64_t items;		/* per iteration */
+	uint64_t bytes;		/* per iteration */
+	double seconds;
+} phase_t;
+
+static int32_t saved_stdout = -1;
+static bool cold;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss_kb(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+/* Clean pages only, which is all a reader leaves behind */
+static void evict(int32_t fd)
+{
+	if(cold)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static long cached_kb(int32_t fd)
+{
+	struct stat st;
+	uint64_t pages, i, n = 0;
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned char *vec;
+	void *map;
+
+	if(fstat(fd, &st) || st.st_size == 0)
+		return 0;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		return -1;
+	pages = (st.st_size + page - 1) / page;
+	vec = malloc(pages);
+	if(vec && mincore(map, st.st_size, vec) == 0) {
+		for(i=0; i<pages; i++)
+			n += vec[i] & 1;
+	}
+	free(vec);
+	munmap(map, st.st_size);
+	return n * page / 1024;
+}
+
+static void mute(void)
+{
+	int32_t null = open("/dev/null", O_WRONLY);
+
+	fflush(stdout);
+	saved_stdout = dup(1);
+	if(null >= 0) {
+		dup2(null, 1);
+		close(null);
+	}
+}
+
+static void unmute(void)
+{
+	fflush(stdout);
+	if(saved_stdout >= 0) {
+		dup2(saved_stdout, 1);
+		close(saved_stdout);
+		saved_stdout = -1;
+	}
+}
+
+static void report(const phase_t *ph, int32_t fd)
+{
+	double per = ph->seconds / ph->iterations;
+
+	printf("  %-10s %8lu %12.1f us", ph->name, ph->iterations, per * 1e6);
+	if(ph->items)
+		printf(" %12.0f items/s", ph->items / per);
+	else
+		printf(" %20s", "");
+	if(ph->bytes)
+		printf(" %10.1f MB/s", ph->bytes / per / (1 << 20));
+	else
+		printf(" %15s", "");
+	printf(" %10ld KB %10ld KB\n", peak_rss_kb(), cached_kb(fd));
+}
+
+static uint64_t count_symbols(elf_file_t *ef, uint64_t *bytes)
+{
+	uint32_t i, shnum = elf_section_count(ef);
+	uint64_t n = 0;
+
+	*bytes = 0;
+	for(i=0; i<shnum; i++) {
+		uint32_t type = elf_is64(ef) ? elf_shdrs64(ef)[i].sh_type : elf_shdrs(ef)[i].sh_type;
+		uint64_t size = elf_is64(ef) ? elf_shdrs64(ef)[i].sh_size : elf_shdrs(ef)[i].sh_size;
+		if(type == SHT_SYMTAB || type == SHT_DYNSYM) {
+			n += size / (elf_is64(ef) ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym));
+			*bytes += size;
+		}
+	}
+	return n;
+}
+
+static uint64_t text_size(elf_file_t *ef)
+{
+	uint32_t idx;
+
+	if(elf_find_section(ef, ".text", &idx) != ELF_OK)
+		return 0;
+	return elf_is64(ef) ? elf_shdrs64(ef)[idx].sh_size : elf_shdrs(ef)[idx].sh_size;
+}
+
+static bool bench_file(const char *path, uint64_t iterations)
+{
+	elf_file_t *ef, *tmp;
+	elf_status_t status;
+	phase_t ph;
+	uint64_t i, shnum, shentsize;
+	char dir[] = "/tmp/elf-bench.XXXXXX";
+	char *cwd;
+	struct stat st;
+	double t;
+
+	status = elf_open(path, &ef);
+	if(status == ELF_OK)
+		status = elf_read_shdrs(ef);
+	if(status != ELF_OK) {
+		printf("%s: %s\n", path, elf_strerror(status));
+		elf_close(ef);
+		return false;
+	}
+
+	fstat(elf_fd(ef), &st);
+	shnum = elf_section_count(ef);
+	shentsize = elf_is64(ef) ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+	printf("%s: ELF%d, %lu bytes, %lu sections\n", path, elf_is64(ef) ? 64 : 32,
+			(uint64_t)st.st_size, shnum);
+	printf("  %-10s %8s %15s %18s %15s %13s %13s\n",
+			"phase", "iters", "per iter", "items", "throughput", "peak RSS", "cached");
+
+	/* Header: too cheap to time one at a time */
+	memset(&ph, 0, sizeof(ph));
+	ph.name = "header";
+	ph.iterations = iterations * 1000;
+	ph.bytes = elf_is64(ef) ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+	t = now();
+	for(i=0; i<ph.iterations; i++) {
+		if(elf_is64(ef)) {
+			Elf64_Ehdr eh;
+			read_elf_header64(elf_fd(ef), &eh);
+		} else {
+			Elf32_Ehdr eh;
+			read_elf_header(elf_fd(ef), &eh);
+		}
+	}
+	ph.seconds = now() - t;
+	report(&ph, elf_fd(ef));
+
+	/* Section table: a fresh handle every time, nothing is reused */
+	memset(&ph, 0, sizeof(ph));
+	ph.name = "sections";
+	ph.iterations = iterations;
+	ph.items = shnum;
+	ph.bytes = shnum * shentsize;
+	for(i=0; i<iterations; i++) {
+		evict(elf_fd(ef));
+		t = now();
+		if(elf_open_fd(elf_fd(ef), &tmp) == ELF_OK) {
+			elf_read_shdrs(tmp);
+			elf_close(tmp);
+		}
+		ph.seconds += now() - t;
+	}
+	report(&ph, elf_fd(ef));
+
+	memset(&ph, 0, sizeof(ph));
+	ph.name = "symbols";
+	ph.iterations = iterations;
+	ph.items = count_symbols(ef, &ph.bytes);
+	mute();
+	for(i=0; i<iterations; i++) {
+		evict(elf_fd(ef));
+		t = now();
+		if(elf_is64(ef))
+			print_symbols64(elf_fd(ef), *elf_ehdr64(ef), elf_shdrs64(ef));
+		else
+			print_symbols(elf_fd(ef), *elf_ehdr(ef), elf_shdrs(ef));
+		fflush(stdout);
+		ph.seconds += now() - t;
+	}
+	unmute();
+	report(&ph, elf_fd(ef));
+
+	/* save_text_section writes ./text.S, keep it out of the caller's cwd */
+	memset(&ph, 0, sizeof(ph));
+	ph.name = "text";
+	ph.iterations = iterations;
+	ph.bytes = text_size(ef);
+	cwd = getcwd(NULL, 0);
+	if(cwd && mkdtemp(dir) && chdir(dir) == 0) {
+		mute();
+		for(i=0; i<iterations; i++) {
+			evict(elf_fd(ef));
+			t = now();
+			if(elf_is64(ef))
+				save_text_section64(elf_fd(ef), *elf_ehdr64(ef), elf_shdrs64(ef));
+			else
+				save_text_section(elf_fd(ef), *elf_ehdr(ef), elf_shdrs(ef));
+			ph.seconds += now() - t;
+			unlink("text.S");
+		}
+		unmute();
+		report(&ph, elf_fd(ef));
+		if(chdir(cwd) < 0)
+			printf("Error %d returning to %s\n", errno, cwd);
+		rmdir(dir);
+	}
+	free(cwd);
+
+	printf("\n");
+	elf_close(ef);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t iterations = 10;
+	bool ok = true;
+	int c;
+
+	while((c = getopt(argc, argv, "cni:")) != -1) {
+		switch(c)
+		{
+			case 'c': cold = true; break;
+			case 'n': advise_use(0); break;
+			case 'i': iterations = strtoull(optarg, NULL, 0); break;
+			default:
+				printf("usage: %s [-c] [-n] [-i iterations] <elf-file>...\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(optind == argc || iterations == 0) {
+		printf("usage: %s [-c] [-n] [-i iterations] <elf-file>...\n", argv[0]);
+		return 1;
+	}
+
+	for(; optind<argc; optind++)
+		ok &= bench_file(argv[optind], iterations);
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,491 @@
+/* Synthetic ELF generator for the benchmarks.
+ *
+ * Writes a relocatable object with a chosen number of sections, symbols
+ * and relocations, a .text of any size and symbol names padded to a
+ * chosen length so the string table can be scaled independently.
+ * Filler sections are placed before the symbol and string tables, so
+ * past SHN_LORESERVE sections the file uses extended numbering for
+ * e_shnum, e_shstrndx and st_shndx (SHT_SYMTAB_SHNDX).
+ *
+ *   elf-gen [-3] [-n sections] [-s symbols] [-r relocs] [-l name-len]
+ *           [-t text-size[K|M|G]] [-z] -o out
+ *
+ * -3 writes ELF32 (EM_386) instead of ELF64 (EM_X86_64).  -z leaves
+ * .text as a hole so multi-GB files cost no disk space.
+ */
+#include <getopt.h>
+
+#include "../elf-parser.h"
+
+#define ST_INFO(b, t)	(((b) << 4) | ((t) & 0xf))
+#define ALIGN(x, a)	(((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+#define BUILD_ID_SIZE	20
+
+typedef struct gen_params {
+	bool elf32;
+	uint32_t sections;	/* filler sections */
+	uint32_t symbols;
+	uint32_t relocs;
+	uint32_t name_len;
+	uint64_t text_size;
+	bool sparse;
+} gen_params_t;
+
+/* Section indexes, fillers sit between .text and the tables */
+typedef struct gen_layout {
+	uint32_t shnum;
+	uint32_t text, filler, note, rela, symtab, shndx, strtab, shstrtab;
+	bool xindex;
+} gen_layout_t;
+
+static uint64_t parse_size(const char *s)
+{
+	char *end;
+	uint64_t v = strtoull(s, &end, 0);
+
+	switch(*end)
+	{
+		case 'g': case 'G': v <<= 10;	/* fall through */
+		case 'm': case 'M': v <<= 10;	/* fall through */
+		case 'k': case 'K': v <<= 10;
+	}
+	return v;
+}
+
+static bool write_at(int32_t fd, uint64_t offset, const void *buf, size_t size)
+{
+	const char *p = buf;
+	ssize_t len;
+
+	while(size > 0) {
+		len = pwrite(fd, p, size, (off_t)offset);
+		if(len <= 0)
+			return false;
+		p += len;
+		offset += len;
+		size -= len;
+	}
+	return true;
+}
+
+typedef struct strtab {
+	char *data;
+	uint64_t size;
+	uint64_t capacity;
+} strtab_t;
+
+static uint32_t strtab_add(strtab_t *st, const char *s, uint32_t pad)
+{
+	uint64_t len = strlen(s), need = len + pad + 1, off = st->size;
+
+	if(st->size + need > st->capacity) {
+		st->capacity = (st->size + need) * 2;
+		st->data = realloc(st->data, st->capacity);
+		if(!st->data) {
+			printf("Failed to allocate %ldbytes!!\n", st->capacity);
+			exit(1);
+		}
+	}
+	memcpy(st->data + off, s, len);
+	memset(st->data + off + len, '_', pad);
+	st->data[off + len + pad] = '\0';
+	st->size += need;
+	return (uint32_t)off;
+}
+
+static void layout_sections(const gen_params_t *p, gen_layout_t *l)
+{
+	uint32_t i = 1;
+
+	l->text = i++;
+	l->filler = i;
+	i += p->sections;
+	l->note = i++;
+	l->rela = i++;
+	l->symtab = i++;
+	l->xindex = i + 3 >= SHN_LORESERVE;
+	l->shndx = l->xindex ? i++ : 0;
+	l->strtab = i++;
+	l->shstrtab = i++;
+	l->shnum = i;
+}
+
+static uint32_t symbol_section(const gen_params_t *p, const gen_layout_t *l, uint32_t i)
+{
+	/* Half the symbols are functions in .text, the rest spread over
+	 * the fillers so that high section indexes are referenced.
+	 */
+	if(i % 2 || !p->sections)
+		return l->text;
+	return l->filler + (i / 2) % p->sections;
+}
+
+/* Tables are built as ELF64 and narrowed on write for -3 */
+static Elf64_Shdr * build_shdrs(const gen_params_t *p, const gen_layout_t *l,
+		strtab_t *shstr, uint64_t offsets[], uint64_t sizes[])
+{
+	Elf64_Shdr *sh = calloc(l->shnum, sizeof(Elf64_Shdr));
+	char name[32];
+	uint32_t i;
+
+	if(!sh)
+		return NULL;
+
+	strtab_add(shstr, "", 0);
+	sh[l->text].sh_name = strtab_add(shstr, ".text", 0);
+	sh[l->text].sh_type = SHT_PROGBITS;
+	sh[l->text].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+	sh[l->text].sh_addralign = 16;
+
+	for(i=0; i<p->sections; i++) {
+		snprintf(name, sizeof(name), ".data.s%u", i);
+		sh[l->filler + i].sh_name = strtab_add(shstr, name, 0);
+		sh[l->filler + i].sh_type = SHT_PROGBITS;
+		sh[l->filler + i].sh_flags = SHF_ALLOC | SHF_WRITE;
+		sh[l->filler + i].sh_addralign = 1;
+	}
+
+	sh[l->note].sh_name = strtab_add(shstr, ".note.gnu.build-id", 0);
+	sh[l->note].sh_type = SHT_NOTE;
+	sh[l->note].sh_flags = SHF_ALLOC;
+	sh[l->note].sh_addralign = 4;
+
+	sh[l->rela].sh_name = strtab_add(shstr, ".rela.text", 0);
+	sh[l->rela].sh_type = SHT_RELA;
+	sh[l->rela].sh_link = l->symtab;
+	sh[l->rela].sh_info = l->text;
+	sh[l->rela].sh_addralign = 8;
+
+	sh[l->symtab].sh_name = strtab_add(shstr, ".symtab", 0);
+	sh[l->symtab].sh_type = SHT_SYMTAB;
+	sh[l->symtab].sh_link = l->strtab;
+	sh[l->symtab].sh_info = 1;	/* every symbol past the null one is global */
+	sh[l->symtab].sh_addralign = 8;
+
+	if(l->xindex) {
+		sh[l->shndx].sh_name = strtab_add(shstr, ".symtab_shndx", 0);
+		sh[l->shndx].sh_type = SHT_SYMTAB_SHNDX;
+		sh[l->shndx].sh_link = l->symtab;
+		sh[l->shndx].sh_addralign = 4;
+		sh[l->shndx].sh_entsize = sizeof(Elf32_Word);
+	}
+
+	sh[l->strtab].sh_name = strtab_add(shstr, ".strtab", 0);
+	sh[l->strtab].sh_type = SHT_STRTAB;
+	sh[l->strtab].sh_addralign = 1;
+
+	sh[l->shstrtab].sh_name = strtab_add(shstr, ".shstrtab", 0);
+	sh[l->shstrtab].sh_type = SHT_STRTAB;
+	sh[l->shstrtab].sh_addralign = 1;
+
+	for(i=1; i<l->shnum; i++) {
+		sh[i].sh_offset = offsets[i];
+		sh[i].sh_size = sizes[i];
+	}
+
+	/* Extended numbering lives in section 0 */
+	if(l->shnum >= SHN_LORESERVE)
+		sh[0].sh_size = l->shnum;
+	if(l->shstrtab >= SHN_LORESERVE)
+		sh[0].sh_link = l->shstrtab;
+
+	return sh;
+}
+
+static bool write_text(int32_t fd, const gen_params_t *p, uint64_t offset)
+{
+	/* nop; nop; nop; ret repeated, decodes cleanly at any 4-byte step */
+	static const uint8_t pattern[4] = { 0x90, 0x90, 0x90, 0xc3 };
+	uint64_t done, chunk, size = 1 << 20;
+	uint8_t *buf;
+	bool ok = true;
+	uint32_t i;
+
+	if(p->sparse || p->text_size == 0)
+		return true;
+
+	buf = malloc(size);
+	if(!buf)
+		return false;
+	for(i=0; i<size; i++)
+		buf[i] = pattern[i % 4];
+
+	for(done=0; ok && done<p->text_size; done+=chunk) {
+		chunk = p->text_size - done < size ? p->text_size - done : size;
+		ok = write_at(fd, offset + done, buf, chunk);
+	}
+
+	free(buf);
+	return ok;
+}
+
+static bool generate(int32_t fd, const gen_params_t *p)
+{
+	uint64_t off, sym_size, rela_size, ehdr_size, shdr_size;
+	uint64_t *soff, *ssize;
+	uint8_t note[16 + BUILD_ID_SIZE];
+	Elf32_Word *shndx = NULL;
+	Elf64_Sym *sym = NULL;
+	Elf64_Rela *rela = NULL;
+	Elf64_Shdr *sh = NULL;
+	strtab_t str = { 0 }, shstr = { 0 };
+	gen_layout_t l;
+	uint64_t text_step, hash;
+	uint32_t i, sec;
+	char name[32];
+	bool ok = false;
+
+	layout_sections(p, &l);
+	soff = calloc(l.shnum, sizeof(uint64_t));
+	ssize = calloc(l.shnum, sizeof(uint64_t));
+	sym = calloc((uint64_t)p->symbols + 1, sizeof(Elf64_Sym));
+	rela = calloc(p->relocs ? p->relocs : 1, sizeof(Elf64_Rela));
+	if(l.xindex)
+		shndx = calloc((uint64_t)p->symbols + 1, sizeof(Elf32_Word));
+	if(!soff || !ssize || !sym || !rela || (l.xindex && !shndx)) {
+		printf("Failed to allocate tables!!\n");
+		goto EXIT;
+	}
+
+	/* Symbols: one function every text_step bytes, names padded */
+	text_step = p->symbols ? (p->text_size / p->symbols) & ~(uint64_t)3 : 0;
+	strtab_add(&str, "", 0);
+	for(i=1; i<=p->symbols; i++) {
+		sec = symbol_section(p, &l, i);
+		snprintf(name, sizeof(name), "sym_%u", i);
+		sym[i].st_name = strtab_add(&str, name,
+				p->name_len > strlen(name) ? p->name_len - strlen(name) : 0);
+		sym[i].st_info = ST_INFO(STB_GLOBAL, sec == l.text ? STT_FUNC : STT_OBJECT);
+		sym[i].st_value = sec == l.text ? (i - 1) * text_step : 0;
+		sym[i].st_size = sec == l.text ? text_step : 0;
+		sym[i].st_shndx = sec >= SHN_LORESERVE ? SHN_XINDEX : sec;
+		if(shndx)
+			shndx[i] = sec;
+	}
+
+	for(i=0; i<p->relocs; i++) {
+		rela[i].r_offset = p->text_size > 4 ? ((uint64_t)i * 4) % (p->text_size - 4) : 0;
+		rela[i].r_info = ((uint64_t)(p->symbols ? i % p->symbols + 1 : 0) << 32) | 2;	/* PC32 */
+		rela[i].r_addend = -4;
+	}
+
+	/* Build-id derived from the parameters, so every scale has its own */
+	hash = 14695981039346656037ULL;
+	for(i=0; i<sizeof(*p); i++)
+		hash = (hash ^ ((const uint8_t *)p)[i]) * 1099511628211ULL;
+	memset(note, 0, sizeof(note));
+	((uint32_t *)note)[0] = 4;
+	((uint32_t *)note)[1] = BUILD_ID_SIZE;
+	((uint32_t *)note)[2] = NT_GNU_BUILD_ID;
+	memcpy(note + 12, "GNU", 4);
+	for(i=0; i<BUILD_ID_SIZE; i++)
+		note[16 + i] = (uint8_t)(hash >> ((i % 8) * 8)) ^ (uint8_t)i;
+
+	/* File layout */
+	ehdr_size = p->elf32 ? sizeof(Elf32_Ehdr) : sizeof(Elf64_Ehdr);
+	sym_size = p->elf32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym);
+	rela_size = p->elf32 ? sizeof(Elf32_Rela) : sizeof(Elf64_Rela);
+	shdr_size = p->elf32 ? sizeof(Elf32_Shdr) : sizeof(Elf64_Shdr);
+
+	off = ALIGN(ehdr_size, 16);
+	soff[l.text] = off;
+	ssize[l.text] = p->text_size;
+	off = ALIGN(off + p->text_size, 8);
+	for(i=0; i<p->sections; i++)
+		soff[l.filler + i] = off;
+	soff[l.note] = off;
+	ssize[l.note] = sizeof(note);
+	off = ALIGN(off + sizeof(note), 8);
+	soff[l.rela] = off;
+	ssize[l.rela] = p->relocs * rela_size;
+	off = ALIGN(off + ssize[l.rela], 8);
+	soff[l.symtab] = off;
+	ssize[l.symtab] = ((uint64_t)p->symbols + 1) * sym_size;
+	off = ALIGN(off + ssize[l.symtab], 8);
+	if(l.xindex) {
+		soff[l.shndx] = off;
+		ssize[l.shndx] = ((uint64_t)p->symbols + 1) * sizeof(Elf32_Word);
+		off = ALIGN(off + ssize[l.shndx], 8);
+	}
+	soff[l.strtab] = off;
+	ssize[l.strtab] = str.size;
+	off += str.size;
+
+	/* .shstrtab's own size is only known once every name is added */
+	sh = build_shdrs(p, &l, &shstr, soff, ssize);
+	if(!sh)
+		goto EXIT;
+	sh[l.shstrtab].sh_offset = off;
+	sh[l.shstrtab].sh_size = shstr.size;
+	sh[l.symtab].sh_entsize = sym_size;
+	sh[l.rela].sh_entsize = rela_size;
+	off = ALIGN(off + shstr.size, 8);
+
+	if(ftruncate(fd, off + l.shnum * shdr_size) < 0)
+		goto EXIT;
+	if(!write_text(fd, p, soff[l.text])
+			|| !write_at(fd, soff[l.note], note, sizeof(note))
+			|| !write_at(fd, soff[l.strtab], str.data, str.size)
+			|| !write_at(fd, sh[l.shstrtab].sh_offset, shstr.data, shstr.size)
+			|| (l.xindex && !write_at(fd, soff[l.shndx], shndx, ssize[l.shndx])))
+		goto EXIT;
+
+	if(!p->elf32) {
+		Elf64_Ehdr eh;
+
+		memset(&eh, 0, sizeof(eh));
+		memcpy(eh.e_ident, "\177ELF", 4);
+		eh.e_ident[EI_CLASS] = ELFCLASS64;
+		eh.e_ident[EI_DATA] = ELFDATA2LSB;
+		eh.e_ident[EI_VERSION] = EV_CURRENT;
+		eh.e_type = ET_REL;
+		eh.e_machine = EM_X86_64;
+		eh.e_version = EV_CURRENT;
+		eh.e_shoff = off;
+		eh.e_ehsize = sizeof(Elf64_Ehdr);
+		eh.e_shentsize = sizeof(Elf64_Shdr);
+		eh.e_shnum = l.shnum >= SHN_LORESERVE ? 0 : l.shnum;
+		eh.e_shstrndx = l.shstrtab >= SHN_LORESERVE ? SHN_XINDEX : l.shstrtab;
+
+		ok = write_at(fd, 0, &eh, sizeof(eh))
+			&& write_at(fd, soff[l.rela], rela, ssize[l.rela])
+			&& write_at(fd, soff[l.symtab], sym, ssize[l.symtab])
+			&& write_at(fd, off, sh, l.shnum * sizeof(Elf64_Shdr));
+	} else {
+		Elf32_Ehdr eh;
+		Elf32_Shdr *sh32 = calloc(l.shnum, sizeof(Elf32_Shdr));
+		Elf32_Sym *sym32 = calloc((uint64_t)p->symbols + 1, sizeof(Elf32_Sym));
+		Elf32_Rela *rela32 = calloc(p->relocs ? p->relocs : 1, sizeof(Elf32_Rela));
+
+		if(!sh32 || !sym32 || !rela32) {
+			printf("Failed to allocate tables!!\n");
+			free(sh32);
+			free(sym32);
+			free(rela32);
+			goto EXIT;
+		}
+
+		for(i=0; i<l.shnum; i++) {
+			sh32[i].sh_name = sh[i].sh_name;
+			sh32[i].sh_type = sh[i].sh_type;
+			sh32[i].sh_flags = sh[i].sh_flags;
+			sh32[i].sh_offset = sh[i].sh_offset;
+			sh32[i].sh_size = sh[i].sh_size;
+			sh32[i].sh_link = sh[i].sh_link;
+			sh32[i].sh_info = sh[i].sh_info;
+			sh32[i].sh_addralign = sh[i].sh_addralign;
+			sh32[i].sh_entsize = sh[i].sh_entsize;
+		}
+		for(i=0; i<=p->symbols; i++) {
+			sym32[i].st_name = sym[i].st_name;
+			sym32[i].st_value = sym[i].st_value;
+			sym32[i].st_size = sym[i].st_size;
+			sym32[i].st_info = sym[i].st_info;
+			sym32[i].st_shndx = sym[i].st_shndx;
+		}
+		for(i=0; i<p->relocs; i++) {
+			rela32[i].r_offset = rela[i].r_offset;
+			rela32[i].r_info = ELF32_R_INFO((uint32_t)(rela[i].r_info >> 32), 2);
+			rela32[i].r_addend = rela[i].r_addend;
+		}
+
+		memset(&eh, 0, sizeof(eh));
+		memcpy(eh.e_ident, "\177ELF", 4);
+		eh.e_ident[EI_CLASS] = ELFCLASS32;
+		eh.e_ident[EI_DATA] = ELFDATA2LSB;
+		eh.e_ident[EI_VERSION] = EV_CURRENT;
+		eh.e_type = ET_REL;
+		eh.e_machine = EM_386;
+		eh.e_version = EV_CURRENT;
+		eh.e_shoff = off;
+		eh.e_ehsize = sizeof(Elf32_Ehdr);
+		eh.e_shentsize = sizeof(Elf32_Shdr);
+		eh.e_shnum = l.shnum >= SHN_LORESERVE ? 0 : l.shnum;
+		eh.e_shstrndx = l.shstrtab >= SHN_LORESERVE ? SHN_XINDEX : l.shstrtab;
+
+		ok = write_at(fd, 0, &eh, sizeof(eh))
+			&& write_at(fd, soff[l.rela], rela32, ssize[l.rela])
+			&& write_at(fd, soff[l.symtab], sym32, ssize[l.symtab])
+			&& write_at(fd, off, sh32, l.shnum * sizeof(Elf32_Shdr));
+		free(sh32);
+		free(sym32);
+		free(rela32);
+	}
+
+	if(ok)
+		printf("%u sections, %u symbols, %u relocations, %lu bytes\n",
+				l.shnum, p->symbols, p->relocs, off + l.shnum * shdr_size);
+
+EXIT:
+	free(soff);
+	free(ssize);
+	free(sym);
+	free(rela);
+	free(shndx);
+	free(sh);
+	free(str.data);
+	free(shstr.data);
+	return ok;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-3] [-n sections] [-s symbols] [-r relocs] [-l name-len]\n"
+			"       [-t text-size[K|M|G]] [-z] -o out\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	gen_params_t p;
+	const char *out = NULL;
+	int32_t fd;
+	int c;
+
+	memset(&p, 0, sizeof(p));
+	p.symbols = 1000;
+	p.relocs = 1000;
+	p.name_len = 16;
+	p.text_size = 1 << 20;
+
+	while((c = getopt(argc, argv, "3n:s:r:l:t:zo:")) != -1) {
+		switch(c)
+		{
+			case '3': p.elf32 = true; break;
+			case 'n': p.sections = strtoul(optarg, NULL, 0); break;
+			case 's': p.symbols = strtoul(optarg, NULL, 0); break;
+			case 'r': p.relocs = strtoul(optarg, NULL, 0); break;
+			case 'l': p.name_len = strtoul(optarg, NULL, 0); break;
+			case 't': p.text_size = parse_size(optarg); break;
+			case 'z': p.sparse = true; break;
+			case 'o': out = optarg; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(!out || optind != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	if(p.elf32 && p.text_size > UINT32_MAX / 2) {
+		printf("ELF32 .text is limited to 2GB\n");
+		return 1;
+	}
+
+	fd = open(out, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if(fd < 0) {
+		printf("Error %d Unable to open %s\n", errno, out);
+		return 1;
+	}
+
+	if(!generate(fd, &p)) {
+		printf("Failed to write %s\n", out);
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Builds the generator and the benchmark, writes a synthetic corpus and
+# runs every phase over it.
+#
+#   ./run.sh [corpus-dir]
+#
+# ITERATIONS (default 5) and BIG_TEXT (default 1G, sparse) can be set
+# in the environment.  Pass the corpus files to
+# `linux-recompiler --bench` to time disassembly on the managed side.
+set -e
+
+cd "$(dirname "$0")"
+OUT=${1:-/tmp/elf-bench-corpus}
+ITERATIONS=${ITERATIONS:-5}
+BIG_TEXT=${BIG_TEXT:-1G}
+CFLAGS="-O2 -DNDEBUG -flto"
+SRC="../elf-parser.c ../elf-note.c ../elf-cache.c ../elf-swap.c ../elf-file.c
+	../elf-stats.c ../elf-arena.c ../elf-filter.c ../elf-demangle.c
+	../elf-advise.c ../elf-pipeline.c ../elf-hash.c"
+
+mkdir -p "$OUT"
+cc $CFLAGS -o "$OUT/elf-gen" elf-gen.c
+cc $CFLAGS -o "$OUT/bench" bench.c $SRC -lpthread -lstdc++
+
+gen() {
+	name=$1; shift
+	[ -f "$OUT/$name" ] || "$OUT/elf-gen" "$@" -o "$OUT/$name"
+}
+
+gen small.o          -n 100   -s 10000   -r 10000   -t 1M
+gen sections-70k.o   -n 70000 -s 100000  -r 100000  -t 16M
+gen symbols-2m.o              -s 2000000 -r 1000000 -l 32 -t 64M
+gen strtab-wide.o             -s 200000  -r 0       -l 512
+gen text-big.o                -s 1000    -r 0       -t "$BIG_TEXT" -z
+gen small32.o        -3 -n 100   -s 10000  -r 10000 -t 1M
+gen sections-70k32.o -3 -n 70000 -s 100000 -r 0     -t 16M
+
+"$OUT/bench" -i "$ITERATIONS" "$OUT"/*.o
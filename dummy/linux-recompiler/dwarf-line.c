@@ -0,0 +1,1279 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dwarf-line.h"
+#include "elf-stats.h"
+#include "elf-arena.h"
+
+/* Line number standard opcodes */
+#define DW_LNS_copy			0x01
+#define DW_LNS_advance_pc		0x02
+#define DW_LNS_advance_line		0x03
+#define DW_LNS_set_file			0x04
+#define DW_LNS_set_column		0x05
+#define DW_LNS_negate_stmt		0x06
+#define DW_LNS_set_basic_block		0x07
+#define DW_LNS_const_add_pc		0x08
+#define DW_LNS_fixed_advance_pc		0x09
+#define DW_LNS_set_prologue_end		0x0a
+#define DW_LNS_set_epilogue_begin	0x0b
+#define DW_LNS_set_isa			0x0c
+
+/* Line number extended opcodes */
+#define DW_LNE_end_sequence		0x01
+#define DW_LNE_set_address		0x02
+#define DW_LNE_define_file		0x03
+#define DW_LNE_set_discriminator	0x04
+
+/* Line number header entry formats (DWARF 5) */
+#define DW_LNCT_path			0x1
+#define DW_LNCT_directory_index		0x2
+
+#define DW_AT_stmt_list			0x10
+
+#define DW_UT_skeleton			0x04
+#define DW_UT_split_compile		0x05
+#define DW_UT_type			0x02
+#define DW_UT_split_type		0x06
+
+/* Attribute forms */
+#define DW_FORM_addr			0x01
+#define DW_FORM_block2			0x03
+#define DW_FORM_block4			0x04
+#define DW_FORM_data2			0x05
+#define DW_FORM_data4			0x06
+#define DW_FORM_data8			0x07
+#define DW_FORM_string			0x08
+#define DW_FORM_block			0x09
+#define DW_FORM_block1			0x0a
+#define DW_FORM_data1			0x0b
+#define DW_FORM_flag			0x0c
+#define DW_FORM_sdata			0x0d
+#define DW_FORM_strp			0x0e
+#define DW_FORM_udata			0x0f
+#define DW_FORM_ref_addr		0x10
+#define DW_FORM_ref1			0x11
+#define DW_FORM_ref2			0x12
+#define DW_FORM_ref4			0x13
+#define DW_FORM_ref8			0x14
+#define DW_FORM_ref_udata		0x15
+#define DW_FORM_indirect		0x16
+#define DW_FORM_sec_offset		0x17
+#define DW_FORM_exprloc			0x18
+#define DW_FORM_flag_present		0x19
+#define DW_FORM_strx			0x1a
+#define DW_FORM_addrx			0x1b
+#define DW_FORM_ref_sup4		0x1c
+#define DW_FORM_strp_sup		0x1d
+#define DW_FORM_data16			0x1e
+#define DW_FORM_line_strp		0x1f
+#define DW_FORM_ref_sig8		0x20
+#define DW_FORM_implicit_const		0x21
+#define DW_FORM_loclistx		0x22
+#define DW_FORM_rnglistx		0x23
+#define DW_FORM_ref_sup8		0x24
+#define DW_FORM_strx1			0x25
+#define DW_FORM_strx2			0x26
+#define DW_FORM_strx3			0x27
+#define DW_FORM_strx4			0x28
+#define DW_FORM_addrx1			0x29
+#define DW_FORM_addrx2			0x2a
+#define DW_FORM_addrx3			0x2b
+#define DW_FORM_addrx4			0x2c
+#define DW_FORM_GNU_addr_index		0x1f01
+#define DW_FORM_GNU_str_index		0x1f02
+#define DW_FORM_GNU_ref_alt		0x1f20
+#define DW_FORM_GNU_strp_alt		0x1f21
+
+#define SHF_COMPRESSED			0x800
+
+/* file index of a row that terminates a sequence */
+#define LINE_END_SEQUENCE		0xffffffff
+
+enum {
+	SEC_LINE,
+	SEC_LINE_STR,
+	SEC_STR,
+	SEC_ARANGES,
+	SEC_INFO,
+	SEC_ABBREV,
+	SEC_MAX
+};
+
+static const char *section_names[SEC_MAX] = {
+	".debug_line",
+	".debug_line_str",
+	".debug_str",
+	".debug_aranges",
+	".debug_info",
+	".debug_abbrev",
+};
+
+typedef struct section_map {
+	void *base;		/* page aligned mapping */
+	size_t length;
+	const uint8_t *data;	/* start of the section inside the mapping */
+	uint64_t size;
+} section_map_t;
+
+typedef struct cursor {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool error;
+	bool big_endian;
+} cursor_t;
+
+typedef struct line_row {
+	uint64_t addr;
+	uint32_t file;		/* LINE_END_SEQUENCE terminates a sequence */
+	uint32_t line;
+} line_row_t;
+
+typedef struct line_unit {
+	uint64_t offset;	/* unit offset in .debug_line */
+	uint64_t end;		/* one past the last byte of the unit */
+	uint64_t program;	/* first opcode */
+	uint16_t version;
+	uint8_t offset_size;
+	uint8_t address_size;
+	uint8_t min_inst_length;
+	uint8_t default_is_stmt;
+	int8_t line_base;
+	uint8_t line_range;
+	uint8_t opcode_base;
+
+	/* Filled in on first use */
+	bool decoded;
+	bool covered;		/* reachable through .debug_aranges */
+	const char **dirs;
+	uint32_t dir_count;
+	const char **files;
+	uint32_t *file_dirs;
+	uint32_t file_count;
+	uint32_t file_base;	/* 1 before DWARF 5, 0 after */
+	line_row_t *rows;
+	uint32_t row_count;
+	uint64_t lo, hi;
+} line_unit_t;
+
+typedef struct arange {
+	uint64_t lo, hi;
+	uint64_t info_offset;	/* CU offset in .debug_info */
+	int64_t unit;		/* index into units, -1 until resolved */
+} arange_t;
+
+struct dwarf_line {
+	int32_t fd;
+	section_map_t sec[SEC_MAX];
+	line_unit_t *units;
+	uint32_t unit_count;
+	uint32_t decoded_count;
+	arange_t *aranges;
+	uint32_t arange_count;
+	bool coverage_resolved;
+	bool big_endian;	/* ELFDATA2MSB target */
+};
+
+static long page_size;
+
+static bool map_section(int32_t fd, uint64_t offset, uint64_t size, section_map_t *map)
+{
+	uint64_t start;
+	struct stat st;
+
+	/* Pages past EOF would only fault on first touch */
+	if(fstat(fd, &st) || offset > (uint64_t)st.st_size
+			|| size > (uint64_t)st.st_size - offset)
+		return false;
+
+	if(!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	start = offset & ~((uint64_t)page_size - 1);
+	map->length = size + (offset - start);
+	map->base = mmap(NULL, map->length, PROT_READ, MAP_PRIVATE, fd, (off_t)start);
+	stats_add(STAT_SYSCALLS, 1);
+	if(map->base == MAP_FAILED) {
+		map->base = NULL;
+		return false;
+	}
+
+	map->data = (const uint8_t *)map->base + (offset - start);
+	map->size = size;
+	return true;
+}
+
+static void unmap_section(section_map_t *map)
+{
+	if(map->base)
+		munmap(map->base, map->length);
+	memset(map, 0, sizeof(*map));
+}
+
+static uint8_t rd_u8(cursor_t *c)
+{
+	if(c->p + 1 > c->end) {
+		c->error = true;
+		return 0;
+	}
+	return *c->p++;
+}
+
+static uint64_t rd_un(cursor_t *c, uint32_t n)
+{
+	uint64_t v = 0;
+	uint32_t i;
+
+	if(n > 8 || c->p + n > c->end) {
+		c->error = true;
+		return 0;
+	}
+
+	/* DWARF is in target byte order */
+	if(c->big_endian) {
+		for(i=0; i<n; i++)
+			v = (v << 8) | c->p[i];
+	} else {
+		for(i=0; i<n; i++)
+			v |= (uint64_t)c->p[i] << (i * 8);
+	}
+	c->p += n;
+	return v;
+}
+
+static uint64_t rd_uleb(cursor_t *c)
+{
+	uint64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+
+	do {
+		if(c->p >= c->end) {
+			c->error = true;
+			return 0;
+		}
+		b = *c->p++;
+		if(shift < 64)
+			v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while(b & 0x80);
+
+	return v;
+}
+
+static int64_t rd_sleb(cursor_t *c)
+{
+	int64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+
+	do {
+		if(c->p >= c->end) {
+			c->error = true;
+			return 0;
+		}
+		b = *c->p++;
+		if(shift < 64)
+			v |= (int64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while(b & 0x80);
+
+	if(shift < 64 && (b & 0x40))
+		v |= -((int64_t)1 << shift);
+	return v;
+}
+
+static const char * rd_cstr(cursor_t *c)
+{
+	const char *s = (const char *)c->p;
+	const uint8_t *nul = memchr(c->p, 0, c->end - c->p);
+
+	if(!nul) {
+		c->error = true;
+		return NULL;
+	}
+	c->p = nul + 1;
+	return s;
+}
+
+static void skip(cursor_t *c, uint64_t n)
+{
+	if(n > (uint64_t)(c->end - c->p)) {
+		c->error = true;
+		c->p = c->end;
+		return;
+	}
+	c->p += n;
+}
+
+/* unit_length, returns the offset size (4 or 8) or 0 on error */
+static uint8_t rd_length(cursor_t *c, uint64_t *length)
+{
+	*length = rd_un(c, 4);
+	if(*length == 0xffffffff) {
+		*length = rd_un(c, 8);
+		return c->error ? 0 : 8;
+	}
+	if(*length >= 0xfffffff0)
+		return 0;
+	return c->error ? 0 : 4;
+}
+
+static const char * section_string(dwarf_line_t *dl, uint32_t sec, uint64_t off)
+{
+	const section_map_t *map = &dl->sec[sec];
+
+	if(!map->data || off >= map->size
+			|| !memchr(map->data + off, 0, map->size - off))
+		return NULL;
+	return (const char *)map->data + off;
+}
+
+/* Read (or skip) one attribute value.  Constants and offsets land in
+ * *value, strings that can be resolved locally in *str.
+ */
+static void read_form(dwarf_line_t *dl,
+		cursor_t *c,
+		uint64_t form,
+		uint8_t offset_size,
+		uint8_t address_size,
+		uint16_t version,
+		uint64_t *value,
+		const char **str)
+{
+	uint64_t v = 0;
+	const char *s = NULL;
+
+	switch(form)
+	{
+		case DW_FORM_addr:
+			v = rd_un(c, address_size);
+			break;
+
+		case DW_FORM_block1:
+			skip(c, rd_u8(c));
+			break;
+
+		case DW_FORM_block2:
+			skip(c, rd_un(c, 2));
+			break;
+
+		case DW_FORM_block4:
+			skip(c, rd_un(c, 4));
+			break;
+
+		case DW_FORM_block:
+		case DW_FORM_exprloc:
+			skip(c, rd_uleb(c));
+			break;
+
+		case DW_FORM_data1:
+		case DW_FORM_flag:
+		case DW_FORM_ref1:
+		case DW_FORM_strx1:
+		case DW_FORM_addrx1:
+			v = rd_un(c, 1);
+			break;
+
+		case DW_FORM_data2:
+		case DW_FORM_ref2:
+		case DW_FORM_strx2:
+		case DW_FORM_addrx2:
+			v = rd_un(c, 2);
+			break;
+
+		case DW_FORM_strx3:
+		case DW_FORM_addrx3:
+			v = rd_un(c, 3);
+			break;
+
+		case DW_FORM_data4:
+		case DW_FORM_ref4:
+		case DW_FORM_ref_sup4:
+		case DW_FORM_strx4:
+		case DW_FORM_addrx4:
+			v = rd_un(c, 4);
+			break;
+
+		case DW_FORM_data8:
+		case DW_FORM_ref8:
+		case DW_FORM_ref_sig8:
+		case DW_FORM_ref_sup8:
+			v = rd_un(c, 8);
+			break;
+
+		case DW_FORM_data16:
+			skip(c, 16);
+			break;
+
+		case DW_FORM_string:
+			s = rd_cstr(c);
+			break;
+
+		case DW_FORM_sdata:
+			v = (uint64_t)rd_sleb(c);
+			break;
+
+		case DW_FORM_udata:
+		case DW_FORM_ref_udata:
+		case DW_FORM_strx:
+		case DW_FORM_addrx:
+		case DW_FORM_loclistx:
+		case DW_FORM_rnglistx:
+		case DW_FORM_GNU_addr_index:
+		case DW_FORM_GNU_str_index:
+			v = rd_uleb(c);
+			break;
+
+		case DW_FORM_strp:
+			v = rd_un(c, offset_size);
+			s = section_string(dl, SEC_STR, v);
+			break;
+
+		case DW_FORM_line_strp:
+			v = rd_un(c, offset_size);
+			s = section_string(dl, SEC_LINE_STR, v);
+			break;
+
+		case DW_FORM_ref_addr:
+			v = rd_un(c, version <= 2 ? address_size : offset_size);
+			break;
+
+		case DW_FORM_sec_offset:
+		case DW_FORM_strp_sup:
+		case DW_FORM_GNU_ref_alt:
+		case DW_FORM_GNU_strp_alt:
+			v = rd_un(c, offset_size);
+			break;
+
+		case DW_FORM_indirect:
+			read_form(dl, c, rd_uleb(c), offset_size, address_size,
+					version, &v, &s);
+			break;
+
+		case DW_FORM_flag_present:
+		case DW_FORM_implicit_const:
+			break;
+
+		default:
+			c->error = true;
+			break;
+	}
+
+	if(value)
+		*value = v;
+	if(str)
+		*str = s;
+}
+
+/* Walk the unit headers only; the programs are left untouched. */
+static bool index_units(dwarf_line_t *dl)
+{
+	const section_map_t *line = &dl->sec[SEC_LINE];
+	uint32_t capacity = 0;
+	uint64_t off = 0;
+
+	while(off < line->size) {
+		cursor_t c = { line->data + off, line->data + line->size, false, dl->big_endian };
+		line_unit_t *u;
+		uint64_t length, header_length;
+		uint8_t offset_size;
+
+		offset_size = rd_length(&c, &length);
+		if(!offset_size || length > (uint64_t)(c.end - c.p))
+			break;
+
+		if(dl->unit_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			u = realloc(dl->units, capacity * sizeof(line_unit_t));
+			if(!u)
+				return false;
+			dl->units = u;
+		}
+
+		u = &dl->units[dl->unit_count];
+		memset(u, 0, sizeof(*u));
+		u->offset = off;
+		u->end = (c.p - line->data) + length;
+		u->offset_size = offset_size;
+		c.end = line->data + u->end;
+
+		u->version = rd_un(&c, 2);
+		if(u->version < 2 || u->version > 5) {
+			off = u->end;
+			continue;
+		}
+
+		u->address_size = 8;
+		if(u->version >= 5) {
+			u->address_size = rd_u8(&c);
+			rd_u8(&c);	/* segment_selector_size */
+		}
+
+		header_length = rd_un(&c, offset_size);
+		u->program = (c.p - line->data) + header_length;
+		u->min_inst_length = rd_u8(&c);
+		if(u->version >= 4)
+			rd_u8(&c);	/* maximum_operations_per_instruction */
+		u->default_is_stmt = rd_u8(&c);
+		u->line_base = (int8_t)rd_u8(&c);
+		u->line_range = rd_u8(&c);
+		u->opcode_base = rd_u8(&c);
+
+		if(!c.error && u->line_range && u->program <= u->end)
+			dl->unit_count++;
+		off = u->end;
+	}
+
+	return true;
+}
+
+static bool push_string(const char ***tbl, uint32_t *count, uint32_t *capacity, const char *s)
+{
+	const char **t;
+
+	if(*count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 16;
+		t = realloc(*tbl, *capacity * sizeof(char *));
+		if(!t)
+			return false;
+		*tbl = t;
+	}
+	(*tbl)[(*count)++] = s;
+	return true;
+}
+
+static bool push_file(line_unit_t *u, uint32_t *capacity, const char *name, uint32_t dir)
+{
+	uint32_t *d;
+	uint32_t cap = *capacity;
+
+	if(!push_string(&u->files, &u->file_count, capacity, name))
+		return false;
+
+	if(*capacity != cap || !u->file_dirs) {
+		d = realloc(u->file_dirs, *capacity * sizeof(uint32_t));
+		if(!d)
+			return false;
+		u->file_dirs = d;
+	}
+	u->file_dirs[u->file_count - 1] = dir;
+	return true;
+}
+
+/* DWARF 5 directory/file tables are described by (content, form) pairs */
+static bool read_entry_table(dwarf_line_t *dl, line_unit_t *u, cursor_t *c, bool files)
+{
+	uint64_t formats[2 * 16];
+	uint64_t count, i, v;
+	uint32_t j, format_count, capacity = 0;
+	const char *s;
+
+	format_count = rd_u8(c);
+	if(format_count > 16)
+		return false;
+	for(j=0; j<format_count; j++) {
+		formats[j*2] = rd_uleb(c);
+		formats[j*2+1] = rd_uleb(c);
+	}
+
+	count = rd_uleb(c);
+	for(i=0; i<count && !c->error; i++) {
+		const char *path = NULL;
+		uint32_t dir = 0;
+
+		for(j=0; j<format_count; j++) {
+			read_form(dl, c, formats[j*2+1], u->offset_size,
+					u->address_size, u->version, &v, &s);
+			if(formats[j*2] == DW_LNCT_path)
+				path = s;
+			else if(formats[j*2] == DW_LNCT_directory_index)
+				dir = (uint32_t)v;
+		}
+
+		if(files) {
+			if(!push_file(u, &capacity, path, dir))
+				return false;
+		} else if(!push_string(&u->dirs, &u->dir_count, &capacity, path)) {
+			return false;
+		}
+	}
+
+	return !c->error;
+}
+
+static bool read_file_tables(dwarf_line_t *dl, line_unit_t *u, cursor_t *c)
+{
+	uint32_t capacity = 0;
+	const char *s;
+
+	if(u->version >= 5) {
+		u->file_base = 0;
+		return read_entry_table(dl, u, c, false)
+			&& read_entry_table(dl, u, c, true);
+	}
+
+	/* DWARF 2-4: directory 0 is the compilation directory, which is
+	 * not listed; file numbers start at 1.
+	 */
+	u->file_base = 1;
+	if(!push_string(&u->dirs, &u->dir_count, &capacity, NULL))
+		return false;
+	while((s = rd_cstr(c)) && *s) {
+		if(!push_string(&u->dirs, &u->dir_count, &capacity, s))
+			return false;
+	}
+
+	capacity = 0;
+	while((s = rd_cstr(c)) && *s) {
+		uint32_t dir = (uint32_t)rd_uleb(c);
+		rd_uleb(c);	/* mtime */
+		rd_uleb(c);	/* length */
+		if(!push_file(u, &capacity, s, dir))
+			return false;
+	}
+
+	return !c->error;
+}
+
+typedef struct sequence {
+	uint32_t first, count;
+	uint64_t lo;
+} sequence_t;
+
+static int compare_sequence(const void *a, const void *b)
+{
+	const sequence_t *x = a, *y = b;
+
+	if(x->lo != y->lo)
+		return x->lo < y->lo ? -1 : 1;
+	return x->first < y->first ? -1 : (x->first > y->first);
+}
+
+/* Sequences come in any order but rows inside one are ascending, so
+ * sorting sequences by start address sorts the whole table.
+ */
+static bool sort_rows(line_unit_t *u)
+{
+	sequence_t *seq;
+	line_row_t *rows;
+	uint32_t i, n = 0, start = 0, k = 0;
+
+	for(i=0; i<u->row_count; i++)
+		if(u->rows[i].file == LINE_END_SEQUENCE)
+			n++;
+	if(n <= 1)
+		goto RANGE;
+
+	seq = malloc(n * sizeof(sequence_t));
+	rows = malloc(u->row_count * sizeof(line_row_t));
+	if(!seq || !rows) {
+		free(seq);
+		free(rows);
+		return false;
+	}
+
+	for(i=0, n=0; i<u->row_count; i++) {
+		if(u->rows[i].file == LINE_END_SEQUENCE) {
+			seq[n].first = start;
+			seq[n].count = i - start + 1;
+			seq[n].lo = u->rows[start].addr;
+			n++;
+			start = i + 1;
+		}
+	}
+
+	qsort(seq, n, sizeof(sequence_t), compare_sequence);
+	for(i=0; i<n; i++) {
+		memcpy(rows + k, u->rows + seq[i].first, seq[i].count * sizeof(line_row_t));
+		k += seq[i].count;
+	}
+
+	free(seq);
+	free(u->rows);
+	u->rows = rows;
+	u->row_count = k;
+
+RANGE:
+	u->lo = u->row_count ? u->rows[0].addr : 0;
+	u->hi = u->row_count ? u->rows[u->row_count - 1].addr : 0;
+	return true;
+}
+
+static bool emit_row(line_unit_t *u, uint32_t *capacity, uint64_t addr, uint32_t file, uint32_t line)
+{
+	line_row_t *r;
+
+	if(u->row_count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 256;
+		r = realloc(u->rows, *capacity * sizeof(line_row_t));
+		if(!r)
+			return false;
+		u->rows = r;
+	}
+
+	r = &u->rows[u->row_count++];
+	r->addr = addr;
+	r->file = file;
+	r->line = line;
+	return true;
+}
+
+static bool decode_unit(dwarf_line_t *dl, line_unit_t *u)
+{
+	const section_map_t *line = &dl->sec[SEC_LINE];
+	cursor_t c = { NULL, line->data + u->end, false, dl->big_endian };
+	uint8_t std_lengths[256];
+	uint64_t addr = 0;
+	uint32_t file, row, capacity = 0;
+	int64_t ln = 1;
+	uint32_t i;
+
+	if(u->decoded)
+		return true;
+	u->decoded = true;
+	dl->decoded_count++;
+
+	/* Re-read the part of the header the index skipped */
+	c.p = line->data + u->offset + (u->offset_size == 8 ? 12 : 4) + 2;
+	if(u->version >= 5)
+		c.p += 2;
+	c.p += u->offset_size + 5 + (u->version >= 4);
+	memset(std_lengths, 0, sizeof(std_lengths));
+	for(i=1; i<u->opcode_base; i++)
+		std_lengths[i] = rd_u8(&c);
+
+	if(!read_file_tables(dl, u, &c))
+		debug("bad file table in line unit 0x%lx\n", u->offset);
+
+	c.p = line->data + u->program;
+	c.error = false;
+	file = 1;
+
+	while(c.p < c.end && !c.error) {
+		uint8_t op = rd_u8(&c);
+
+		if(op >= u->opcode_base) {
+			/* Special opcode: advance address and line, emit row */
+			uint32_t adj = op - u->opcode_base;
+			addr += (adj / u->line_range) * u->min_inst_length;
+			ln += u->line_base + (int32_t)(adj % u->line_range);
+			if(!emit_row(u, &capacity, addr, file, (uint32_t)ln))
+				return false;
+			continue;
+		}
+
+		switch(op)
+		{
+			case 0: {
+				uint64_t len = rd_uleb(&c);
+				const uint8_t *next = c.p + len;
+				uint8_t sub;
+
+				if(len == 0 || len > (uint64_t)(c.end - c.p)) {
+					c.error = true;
+					break;
+				}
+
+				sub = rd_u8(&c);
+				if(sub == DW_LNE_end_sequence) {
+					if(!emit_row(u, &capacity, addr, LINE_END_SEQUENCE, 0))
+						return false;
+					addr = 0;
+					file = 1;
+					ln = 1;
+				} else if(sub == DW_LNE_set_address) {
+					addr = rd_un(&c, (uint32_t)(len - 1));
+				}
+				/* define_file and set_discriminator are ignored */
+				c.p = next;
+				break;
+			}
+
+			case DW_LNS_copy:
+				if(!emit_row(u, &capacity, addr, file, (uint32_t)ln))
+					return false;
+				break;
+
+			case DW_LNS_advance_pc:
+				addr += rd_uleb(&c) * u->min_inst_length;
+				break;
+
+			case DW_LNS_advance_line:
+				ln += rd_sleb(&c);
+				break;
+
+			case DW_LNS_set_file:
+				file = (uint32_t)rd_uleb(&c);
+				break;
+
+			case DW_LNS_const_add_pc:
+				addr += ((255 - u->opcode_base) / u->line_range) * u->min_inst_length;
+				break;
+
+			case DW_LNS_fixed_advance_pc:
+				addr += rd_un(&c, 2);
+				break;
+
+			case DW_LNS_set_column:
+			case DW_LNS_set_isa:
+			case DW_LNS_negate_stmt:
+			case DW_LNS_set_basic_block:
+			case DW_LNS_set_prologue_end:
+			case DW_LNS_set_epilogue_begin:
+			default:
+				/* Operands of standard opcodes are all ULEB128 */
+				for(row=0; row<std_lengths[op]; row++)
+					rd_uleb(&c);
+				break;
+		}
+	}
+
+	return sort_rows(u);
+}
+
+static bool unit_lookup(const line_unit_t *u, uint64_t addr, uint32_t *row)
+{
+	uint32_t lo = 0, hi = u->row_count;
+
+	/* last row with rows[i].addr <= addr */
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(u->rows[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if(lo == 0)
+		return false;
+
+	/* Rows at addr that end a sequence do not cover it */
+	while(lo > 0 && u->rows[lo - 1].file == LINE_END_SEQUENCE) {
+		if(u->rows[lo - 1].addr != addr)
+			return false;
+		lo--;
+	}
+	if(lo == 0 || lo == u->row_count)
+		return false;
+
+	/* Of several rows at one address the last wins, as in addr2line */
+	*row = lo - 1;
+	return true;
+}
+
+static void fill_info(const line_unit_t *u, const line_row_t *r, line_info_t *info)
+{
+	uint32_t f = r->file - u->file_base;
+
+	info->addr = r->addr;
+	info->line = r->line;
+	info->file = NULL;
+	info->dir = NULL;
+	if(r->file >= u->file_base && f < u->file_count) {
+		info->file = u->files[f];
+		if(u->file_dirs[f] < u->dir_count)
+			info->dir = u->dirs[u->file_dirs[f]];
+	}
+}
+
+static int compare_arange(const void *a, const void *b)
+{
+	const arange_t *x = a, *y = b;
+	return x->lo < y->lo ? -1 : (x->lo > y->lo);
+}
+
+static bool index_aranges(dwarf_line_t *dl)
+{
+	const section_map_t *ar = &dl->sec[SEC_ARANGES];
+	uint32_t capacity = 0;
+	uint64_t off = 0;
+
+	while(off < ar->size) {
+		cursor_t c = { ar->data + off, ar->data + ar->size, false, dl->big_endian };
+		uint64_t length, info_offset, unit_start = off;
+		uint8_t offset_size, address_size, tuple;
+
+		offset_size = rd_length(&c, &length);
+		if(!offset_size || length > (uint64_t)(c.end - c.p))
+			break;
+		c.end = c.p + length;
+		off = c.end - ar->data;
+
+		rd_un(&c, 2);	/* version */
+		info_offset = rd_un(&c, offset_size);
+		address_size = rd_u8(&c);
+		rd_u8(&c);	/* segment_selector_size */
+		if(c.error || (address_size != 4 && address_size != 8))
+			continue;
+
+		/* Tuples are aligned to twice the address size from the unit start */
+		tuple = address_size * 2;
+		skip(&c, (tuple - ((c.p - ar->data - unit_start) % tuple)) % tuple);
+
+		while(!c.error) {
+			uint64_t lo = rd_un(&c, address_size);
+			uint64_t len = rd_un(&c, address_size);
+			arange_t *a;
+
+			if(c.error || (lo == 0 && len == 0))
+				break;
+			if(len == 0)
+				continue;
+
+			if(dl->arange_count == capacity) {
+				capacity = capacity ? capacity * 2 : 256;
+				a = realloc(dl->aranges, capacity * sizeof(arange_t));
+				if(!a)
+					return false;
+				dl->aranges = a;
+			}
+
+			a = &dl->aranges[dl->arange_count++];
+			a->lo = lo;
+			a->hi = lo + len;
+			a->info_offset = info_offset;
+			a->unit = -1;
+		}
+	}
+
+	qsort(dl->aranges, dl->arange_count, sizeof(arange_t), compare_arange);
+	return true;
+}
+
+static int64_t find_unit(dwarf_line_t *dl, uint64_t offset)
+{
+	uint32_t lo = 0, hi = dl->unit_count;
+
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(dl->units[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if(lo < dl->unit_count && dl->units[lo].offset == offset)
+		return lo;
+	return -1;
+}
+
+/* DW_AT_stmt_list of the unit DIE at info_offset, located by walking
+ * just that DIE's abbreviation.
+ */
+static int64_t resolve_stmt_list(dwarf_line_t *dl, uint64_t info_offset)
+{
+	const section_map_t *info = &dl->sec[SEC_INFO];
+	const section_map_t *abbrev = &dl->sec[SEC_ABBREV];
+	cursor_t c, a;
+	uint64_t length, abbrev_offset, code, value;
+	uint16_t version;
+	uint8_t offset_size, address_size, unit_type = 0;
+
+	if(!info->data || !abbrev->data || info_offset >= info->size)
+		return -1;
+
+	c.p = info->data + info_offset;
+	c.end = info->data + info->size;
+	c.error = false;
+	c.big_endian = dl->big_endian;
+	offset_size = rd_length(&c, &length);
+	if(!offset_size)
+		return -1;
+
+	version = rd_un(&c, 2);
+	if(version >= 5) {
+		unit_type = rd_u8(&c);
+		address_size = rd_u8(&c);
+		abbrev_offset = rd_un(&c, offset_size);
+		if(unit_type == DW_UT_skeleton || unit_type == DW_UT_split_compile)
+			skip(&c, 8);
+		else if(unit_type == DW_UT_type || unit_type == DW_UT_split_type)
+			skip(&c, 8 + offset_size);
+	} else {
+		abbrev_offset = rd_un(&c, offset_size);
+		address_size = rd_u8(&c);
+	}
+
+	code = rd_uleb(&c);
+	if(c.error || !code || abbrev_offset >= abbrev->size)
+		return -1;
+
+	a.p = abbrev->data + abbrev_offset;
+	a.end = abbrev->data + abbrev->size;
+	a.error = false;
+	a.big_endian = dl->big_endian;
+
+	/* Find the declaration for code */
+	while(!a.error) {
+		uint64_t decl = rd_uleb(&a);
+		if(!decl)
+			return -1;
+		rd_uleb(&a);	/* tag */
+		rd_u8(&a);	/* children */
+		if(decl == code)
+			break;
+		for(;;) {
+			uint64_t name = rd_uleb(&a);
+			uint64_t form = rd_uleb(&a);
+			if(form == DW_FORM_implicit_const)
+				rd_sleb(&a);
+			if((!name && !form) || a.error)
+				break;
+		}
+	}
+
+	while(!a.error && !c.error) {
+		uint64_t name = rd_uleb(&a);
+		uint64_t form = rd_uleb(&a);
+
+		if(!name && !form)
+			break;
+		if(form == DW_FORM_implicit_const) {
+			value = (uint64_t)rd_sleb(&a);
+			if(name == DW_AT_stmt_list)
+				return find_unit(dl, value);
+			continue;
+		}
+
+		read_form(dl, &c, form, offset_size, address_size, version, &value, NULL);
+		if(name == DW_AT_stmt_list)
+			return c.error ? -1 : find_unit(dl, value);
+	}
+
+	return -1;
+}
+
+static dwarf_line_t * dwarf_line_open_common(int32_t fd,
+		uint64_t offsets[],
+		uint64_t sizes[],
+		bool big_endian)
+{
+	dwarf_line_t *dl;
+	uint32_t i;
+
+	if(!sizes[SEC_LINE])
+		return NULL;
+
+	dl = calloc(1, sizeof(dwarf_line_t));
+	if(!dl)
+		return NULL;
+	dl->fd = fd;
+	dl->big_endian = big_endian;
+
+	for(i=0; i<SEC_MAX; i++) {
+		if(sizes[i] && !map_section(fd, offsets[i], sizes[i], &dl->sec[i]))
+			debug("failed to map %s\n", section_names[i]);
+	}
+
+	if(!dl->sec[SEC_LINE].data || !index_units(dl)) {
+		dwarf_line_close(dl);
+		return NULL;
+	}
+
+	if(dl->sec[SEC_ARANGES].data && !index_aranges(dl)) {
+		dwarf_line_close(dl);
+		return NULL;
+	}
+
+	return dl;
+}
+
+/* Resolve every arange once so that units missing from .debug_aranges
+ * (clang does not emit it by default) can be told apart.  Only needed
+ * when a lookup misses the ranges.
+ */
+static void resolve_coverage(dwarf_line_t *dl)
+{
+	uint64_t last_offset = UINT64_MAX;
+	int64_t last_unit = -1;
+	uint32_t i;
+
+	for(i=0; i<dl->arange_count; i++) {
+		arange_t *a = &dl->aranges[i];
+
+		if(a->unit < 0) {
+			if(a->info_offset != last_offset)
+				last_unit = resolve_stmt_list(dl, a->info_offset);
+			a->unit = last_unit;
+		}
+		last_offset = a->info_offset;
+		last_unit = a->unit;
+		if(a->unit >= 0)
+			dl->units[a->unit].covered = true;
+	}
+	dl->coverage_resolved = true;
+}
+
+static bool lookup_ranges(dwarf_line_t *dl, uint64_t addr, line_info_t *info)
+{
+	uint32_t lo = 0, hi = dl->arange_count, row;
+	arange_t *a;
+	line_unit_t *u;
+
+	while(lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if(dl->aranges[mid].lo <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == 0)
+		return false;
+
+	a = &dl->aranges[lo - 1];
+	if(addr >= a->hi)
+		return false;
+
+	if(a->unit < 0)
+		a->unit = resolve_stmt_list(dl, a->info_offset);
+	if(a->unit < 0)
+		return false;
+
+	u = &dl->units[a->unit];
+	if(!decode_unit(dl, u) || !unit_lookup(u, addr, &row))
+		return false;
+
+	fill_info(u, &u->rows[row], info);
+	return true;
+}
+
+bool dwarf_line_lookup(dwarf_line_t *dl, uint64_t addr, line_info_t *info)
+{
+	uint32_t i, row;
+
+	if(lookup_ranges(dl, addr, info))
+		return true;
+
+	if(dl->arange_count && !dl->coverage_resolved)
+		resolve_coverage(dl);
+
+	/* Units without aranges are decoded in order until one matches */
+	for(i=0; i<dl->unit_count; i++) {
+		line_unit_t *u = &dl->units[i];
+
+		if(u->covered)
+			continue;
+		if(!decode_unit(dl, u))
+			return false;
+		if(addr < u->lo || addr >= u->hi)
+			continue;
+		if(unit_lookup(u, addr, &row)) {
+			fill_info(u, &u->rows[row], info);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint32_t dwarf_line_unit_count(dwarf_line_t *dl)
+{
+	return dl->unit_count;
+}
+
+uint32_t dwarf_line_decoded_count(dwarf_line_t *dl)
+{
+	return dl->decoded_count;
+}
+
+void dwarf_line_close(dwarf_line_t *dl)
+{
+	uint32_t i;
+
+	if(!dl)
+		return;
+
+	for(i=0; i<dl->unit_count; i++) {
+		free(dl->units[i].dirs);
+		free(dl->units[i].files);
+		free(dl->units[i].file_dirs);
+		free(dl->units[i].rows);
+	}
+	for(i=0; i<SEC_MAX; i++)
+		unmap_section(&dl->sec[i]);
+
+	free(dl->units);
+	free(dl->aranges);
+	free(dl);
+}
+
+dwarf_line_t * dwarf_line_open64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+{
+	uint64_t offsets[SEC_MAX], sizes[SEC_MAX];
+	uint32_t i, j, shnum, shstrndx;
+	char* sh_str;
+	const char *name;
+	dwarf_line_t *dl;
+
+	shstrndx = section_strndx64(eh, sh_table);
+	shnum = section_count64(eh, sh_table);
+	if(shstrndx >= shnum)
+		return NULL;
+	sh_str = read_section64(fd, sh_table[shstrndx]);
+	if(!sh_str)
+		return NULL;
+
+	memset(sizes, 0, sizeof(sizes));
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_NOBITS
+				|| (sh_table[i].sh_flags & SHF_COMPRESSED))
+			continue;
+		name = table_string(sh_str, sh_table[shstrndx].sh_size, sh_table[i].sh_name);
+		if(!name)
+			continue;
+		for(j=0; j<SEC_MAX; j++) {
+			if(!strcmp(section_names[j], name)) {
+				offsets[j] = sh_table[i].sh_offset;
+				sizes[j] = sh_table[i].sh_size;
+			}
+		}
+	}
+	section_free(sh_str);
+
+	dl = dwarf_line_open_common(fd, offsets, sizes,
+			eh.e_ident[EI_DATA] == ELFDATA2MSB);
+	if(dl)
+		debug("%u line units indexed\n", dl->unit_count);
+	return dl;
+}
+
+dwarf_line_t * dwarf_line_open(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+{
+	uint64_t offsets[SEC_MAX], sizes[SEC_MAX];
+	uint32_t i, j, shnum, shstrndx;
+	char* sh_str;
+	const char *name;
+	dwarf_line_t *dl;
+
+	shstrndx = section_strndx(eh, sh_table);
+	shnum = section_count(eh, sh_table);
+	if(shstrndx >= shnum)
+		return NULL;
+	sh_str = read_section(fd, sh_table[shstrndx]);
+	if(!sh_str)
+		return NULL;
+
+	memset(sizes, 0, sizeof(sizes));
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_NOBITS
+				|| (sh_table[i].sh_flags & SHF_COMPRESSED))
+			continue;
+		name = table_string(sh_str, sh_table[shstrndx].sh_size, sh_table[i].sh_name);
+		if(!name)
+			continue;
+		for(j=0; j<SEC_MAX; j++) {
+			if(!strcmp(section_names[j], name)) {
+				offsets[j] = sh_table[i].sh_offset;
+				sizes[j] = sh_table[i].sh_size;
+			}
+		}
+	}
+	section_free(sh_str);
+
+	dl = dwarf_line_open_common(fd, offsets, sizes,
+			eh.e_ident[EI_DATA] == ELFDATA2MSB);
+	if(dl)
+		debug("%u line units indexed\n", dl->unit_count);
+	return dl;
+}
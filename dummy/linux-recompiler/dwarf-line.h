@@ -0,0 +1,34 @@
+#ifndef _DWARF_LINE_H
+#define _DWARF_LINE_H
+
+#include "elf-parser.h"
+
+/* Lazy address -> source line index over .debug_line.
+ *
+ * Opening the index only walks the line program unit headers (one
+ * small read per compilation unit) and .debug_aranges when present.
+ * A unit's line program is decoded the first time a lookup falls
+ * inside it and kept as a sorted row table, so a single lookup on a
+ * multi-GB debug binary touches a handful of pages.
+ *
+ * Debug sections are mapped, not read; returned strings point into the
+ * mappings and stay valid until dwarf_line_close().
+ */
+
+typedef struct dwarf_line dwarf_line_t;
+
+typedef struct line_info {
+	uint64_t addr;		/* address of the matching row */
+	const char *dir;	/* may be NULL */
+	const char *file;	/* may be NULL */
+	uint32_t line;
+} line_info_t;
+
+dwarf_line_t * dwarf_line_open64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+dwarf_line_t * dwarf_line_open(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+bool dwarf_line_lookup(dwarf_line_t *dl, uint64_t addr, line_info_t *info);
+uint32_t dwarf_line_unit_count(dwarf_line_t *dl);
+uint32_t dwarf_line_decoded_count(dwarf_line_t *dl);
+void dwarf_line_close(dwarf_line_t *dl);
+
+#endif /* _DWARF_LINE_H */
@@ -0,0 +1,704 @@
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "eh-frame.h"
+#include "elf-stats.h"
+#include "elf-arena.h"
+
+/* Pointer encodings (DW_EH_PE_*) */
+#define DW_EH_PE_absptr		0x00
+#define DW_EH_PE_uleb128	0x01
+#define DW_EH_PE_udata2		0x02
+#define DW_EH_PE_udata4		0x03
+#define DW_EH_PE_udata8		0x04
+#define DW_EH_PE_sleb128	0x09
+#define DW_EH_PE_sdata2		0x0a
+#define DW_EH_PE_sdata4		0x0b
+#define DW_EH_PE_sdata8		0x0c
+#define DW_EH_PE_pcrel		0x10
+#define DW_EH_PE_textrel	0x20
+#define DW_EH_PE_datarel	0x30
+#define DW_EH_PE_funcrel	0x40
+#define DW_EH_PE_aligned	0x50
+#define DW_EH_PE_indirect	0x80
+#define DW_EH_PE_omit		0xff
+
+/* Below this many FDEs threads cost more than they save */
+#define PARALLEL_MIN_FDES	4096
+#define MAX_THREADS		8
+
+typedef struct segment {
+	uint64_t vaddr;
+	uint64_t offset;
+	uint64_t filesz;
+} segment_t;
+
+/* A mapped, contiguous range of the file together with its load address */
+typedef struct region {
+	void *base;
+	size_t length;
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t vaddr;
+} region_t;
+
+typedef struct cfi {
+	region_t frame;		/* .eh_frame */
+	uint8_t addr_size;
+	uint64_t datarel;	/* base for DW_EH_PE_datarel (.eh_frame_hdr) */
+	bool big_endian;	/* ELFDATA2MSB target */
+} cfi_t;
+
+typedef struct cursor {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool error;
+	bool big_endian;
+} cursor_t;
+
+static long page_size;
+
+static bool map_region(int32_t fd, uint64_t offset, uint64_t size, uint64_t vaddr, region_t *r)
+{
+	uint64_t start;
+
+	if(!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	if(size == 0)
+		return false;
+
+	start = offset & ~((uint64_t)page_size - 1);
+	r->length = size + (offset - start);
+	r->base = mmap(NULL, r->length, PROT_READ, MAP_PRIVATE, fd, (off_t)start);
+	stats_add(STAT_SYSCALLS, 1);
+	if(r->base == MAP_FAILED) {
+		r->base = NULL;
+		return false;
+	}
+
+	r->data = (const uint8_t *)r->base + (offset - start);
+	r->size = size;
+	r->vaddr = vaddr;
+	return true;
+}
+
+static void unmap_region(region_t *r)
+{
+	if(r->base)
+		munmap(r->base, r->length);
+	memset(r, 0, sizeof(*r));
+}
+
+static uint64_t rd_un(cursor_t *c, uint32_t n)
+{
+	uint64_t v = 0;
+	uint32_t i;
+
+	if(c->p + n > c->end) {
+		c->error = true;
+		return 0;
+	}
+	if(c->big_endian) {
+		for(i=0; i<n; i++)
+			v = (v << 8) | c->p[i];
+	} else {
+		for(i=0; i<n; i++)
+			v |= (uint64_t)c->p[i] << (i * 8);
+	}
+	c->p += n;
+	return v;
+}
+
+static uint64_t rd_uleb(cursor_t *c)
+{
+	uint64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+
+	do {
+		if(c->p >= c->end) {
+			c->error = true;
+			return 0;
+		}
+		b = *c->p++;
+		if(shift < 64)
+			v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while(b & 0x80);
+
+	return v;
+}
+
+static int64_t rd_sleb(cursor_t *c)
+{
+	int64_t v = 0;
+	uint32_t shift = 0;
+	uint8_t b;
+
+	do {
+		if(c->p >= c->end) {
+			c->error = true;
+			return 0;
+		}
+		b = *c->p++;
+		if(shift < 64)
+			v |= (int64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while(b & 0x80);
+
+	if(shift < 64 && (b & 0x40))
+		v |= -((int64_t)1 << shift);
+	return v;
+}
+
+/* Decode an encoded pointer.  pc is the load address of the field,
+ * needed for DW_EH_PE_pcrel.
+ */
+static uint64_t rd_encoded(cursor_t *c, uint8_t enc, uint64_t pc, const cfi_t *cfi)
+{
+	uint64_t v;
+
+	if(enc == DW_EH_PE_omit)
+		return 0;
+
+	switch(enc & 0x0f)
+	{
+		case DW_EH_PE_absptr:	v = rd_un(c, cfi->addr_size); break;
+		case DW_EH_PE_uleb128:	v = rd_uleb(c); break;
+		case DW_EH_PE_udata2:	v = rd_un(c, 2); break;
+		case DW_EH_PE_udata4:	v = rd_un(c, 4); break;
+		case DW_EH_PE_udata8:	v = rd_un(c, 8); break;
+		case DW_EH_PE_sleb128:	v = (uint64_t)rd_sleb(c); break;
+		case DW_EH_PE_sdata2:	v = (uint64_t)(int64_t)(int16_t)rd_un(c, 2); break;
+		case DW_EH_PE_sdata4:	v = (uint64_t)(int64_t)(int32_t)rd_un(c, 4); break;
+		case DW_EH_PE_sdata8:	v = rd_un(c, 8); break;
+		default:
+			c->error = true;
+			return 0;
+	}
+
+	switch(enc & 0x70)
+	{
+		case DW_EH_PE_absptr:
+			break;
+		case DW_EH_PE_pcrel:
+			v += pc;
+			break;
+		case DW_EH_PE_datarel:
+			v += cfi->datarel;
+			break;
+		default:
+			/* textrel/funcrel/aligned never appear in FDE addresses */
+			c->error = true;
+			break;
+	}
+
+	if(cfi->addr_size == 4)
+		v &= 0xffffffff;
+	return v;
+}
+
+static uint64_t vaddr_of(const region_t *r, const uint8_t *p)
+{
+	return r->vaddr + (uint64_t)(p - r->data);
+}
+
+/* FDE pointer encoding from the CIE augmentation ('R'), or absptr */
+static bool read_cie_encoding(const cfi_t *cfi, uint64_t cie_off, uint8_t *fde_enc)
+{
+	const region_t *fr = &cfi->frame;
+	cursor_t c = { fr->data + cie_off, fr->data + fr->size, false, cfi->big_endian };
+	const char *aug;
+	uint64_t length;
+	uint8_t version;
+
+	length = rd_un(&c, 4);
+	if(length == 0xffffffff)
+		length = rd_un(&c, 8);
+	if(c.error || length > (uint64_t)(c.end - c.p))
+		return false;
+	c.end = c.p + length;
+
+	if(rd_un(&c, 4) != 0)	/* CIE id */
+		return false;
+	version = rd_un(&c, 1);
+
+	aug = (const char *)c.p;
+	if(!memchr(c.p, 0, c.end - c.p))
+		return false;
+	c.p += strlen(aug) + 1;
+
+	if(strstr(aug, "eh"))
+		c.p += cfi->addr_size;
+	rd_uleb(&c);		/* code alignment */
+	rd_sleb(&c);		/* data alignment */
+	if(version == 1)
+		rd_un(&c, 1);	/* return address register */
+	else
+		rd_uleb(&c);
+
+	*fde_enc = DW_EH_PE_absptr;
+	if(aug[0] != 'z')
+		return !c.error;
+
+	rd_uleb(&c);		/* augmentation length */
+	for(aug++; *aug && !c.error; aug++) {
+		switch(*aug)
+		{
+			case 'R':
+				*fde_enc = rd_un(&c, 1);
+				return !c.error;
+
+			case 'P': {
+				uint8_t enc = rd_un(&c, 1);
+				rd_encoded(&c, enc & ~DW_EH_PE_indirect, vaddr_of(fr, c.p), cfi);
+				break;
+			}
+
+			case 'L':
+				rd_un(&c, 1);
+				break;
+
+			default:
+				/* 'S', 'B', ... carry no data */
+				break;
+		}
+	}
+
+	return !c.error;
+}
+
+/* Decode the FDE at fde_off into [start, end); false for CIEs and
+ * zero-length FDEs.
+ */
+static bool read_fde(const cfi_t *cfi, uint64_t fde_off, uint64_t *last_cie,
+		uint8_t *last_enc, func_range_t *range)
+{
+	const region_t *fr = &cfi->frame;
+	cursor_t c = { fr->data + fde_off, fr->data + fr->size, false, cfi->big_endian };
+	const uint8_t *id_field;
+	uint64_t length, cie_ptr, cie_off, range_len;
+	uint8_t enc;
+
+	length = rd_un(&c, 4);
+	if(length == 0 || length == 0xffffffff || c.error
+			|| length > (uint64_t)(c.end - c.p))
+		return false;
+	c.end = c.p + length;
+
+	id_field = c.p;
+	cie_ptr = rd_un(&c, 4);
+	if(cie_ptr == 0 || cie_ptr > (uint64_t)(id_field - fr->data))
+		return false;
+	cie_off = (id_field - fr->data) - cie_ptr;
+
+	/* FDEs of one CIE are adjacent, remember the last one */
+	if(cie_off != *last_cie) {
+		if(!read_cie_encoding(cfi, cie_off, last_enc))
+			return false;
+		*last_cie = cie_off;
+	}
+	enc = *last_enc;
+
+	range->start = rd_encoded(&c, enc, vaddr_of(fr, c.p), cfi);
+	range_len = rd_encoded(&c, enc & 0x0f, 0, cfi);
+	range->end = range->start + range_len;
+
+	return !c.error && range_len != 0;
+}
+
+static int compare_range(const void *a, const void *b)
+{
+	const func_range_t *x = a, *y = b;
+	return x->start < y->start ? -1 : (x->start > y->start);
+}
+
+typedef struct fde_job {
+	const cfi_t *cfi;
+	const uint64_t *offsets;
+	uint32_t count;
+	func_range_t *out;
+	uint32_t found;
+} fde_job_t;
+
+static void * decode_fdes(void *arg)
+{
+	fde_job_t *job = arg;
+	uint64_t last_cie = UINT64_MAX;
+	uint8_t last_enc = 0;
+	uint32_t i;
+
+	for(i=0; i<job->count; i++) {
+		if(read_fde(job->cfi, job->offsets[i], &last_cie, &last_enc,
+					&job->out[job->found]))
+			job->found++;
+	}
+	return NULL;
+}
+
+/* Fallback without .eh_frame_hdr: hop over the length fields to find
+ * every FDE, then decode them in parallel slices.
+ */
+static bool scan_eh_frame(const cfi_t *cfi, func_range_t **ranges, uint32_t *count)
+{
+	const region_t *fr = &cfi->frame;
+	fde_job_t jobs[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	uint64_t *offsets = NULL, off = 0;
+	uint32_t n = 0, capacity = 0, i, k, nthreads, slice;
+	func_range_t *out;
+
+	while(off + 8 <= fr->size) {
+		cursor_t c = { fr->data + off, fr->data + fr->size, false, cfi->big_endian };
+		uint64_t length = rd_un(&c, 4);
+		uint64_t *o;
+
+		if(length == 0)
+			break;	/* terminator */
+		if(length == 0xffffffff)
+			length = rd_un(&c, 8);
+		if(c.error || length > (uint64_t)(c.end - c.p))
+			break;
+
+		if(rd_un(&c, 4) != 0) {	/* not a CIE */
+			if(n == capacity) {
+				capacity = capacity ? capacity * 2 : 1024;
+				o = realloc(offsets, capacity * sizeof(uint64_t));
+				if(!o) {
+					free(offsets);
+					return false;
+				}
+				offsets = o;
+			}
+			offsets[n++] = off;
+		}
+		off = (c.p - 4 - fr->data) + length;
+	}
+
+	out = malloc((n ? n : 1) * sizeof(func_range_t));
+	if(!out) {
+		free(offsets);
+		return false;
+	}
+
+	nthreads = 1;
+	if(n >= PARALLEL_MIN_FDES) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(nthreads < 1)
+			nthreads = 1;
+		if(nthreads > MAX_THREADS)
+			nthreads = MAX_THREADS;
+	}
+
+	slice = (n + nthreads - 1) / nthreads;
+	for(i=0; i<nthreads; i++) {
+		uint32_t first = i * slice;
+		jobs[i].cfi = cfi;
+		jobs[i].offsets = offsets + (first < n ? first : n);
+		jobs[i].count = first < n ? (n - first < slice ? n - first : slice) : 0;
+		jobs[i].out = out + (first < n ? first : n);
+		jobs[i].found = 0;
+	}
+
+	for(i=1; i<nthreads; i++) {
+		if(pthread_create(&threads[i], NULL, decode_fdes, &jobs[i])) {
+			/* No thread, do the slice here */
+			decode_fdes(&jobs[i]);
+			threads[i] = 0;
+		}
+	}
+	decode_fdes(&jobs[0]);
+	for(i=1; i<nthreads; i++) {
+		if(threads[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	/* Compact the per-slice results */
+	for(i=0, k=0; i<nthreads; i++) {
+		memmove(out + k, jobs[i].out, jobs[i].found * sizeof(func_range_t));
+		k += jobs[i].found;
+	}
+
+	qsort(out, k, sizeof(func_range_t), compare_range);
+	free(offsets);
+	*ranges = out;
+	*count = k;
+	return true;
+}
+
+/* Walk the sorted .eh_frame_hdr table; only the FDEs it points at are
+ * touched, so this is near free for any binary size.
+ */
+static bool read_hdr_table(cfi_t *cfi, const region_t *hdr, func_range_t **ranges, uint32_t *count)
+{
+	cursor_t c = { hdr->data, hdr->data + hdr->size, false, cfi->big_endian };
+	uint8_t version, frame_enc, count_enc, table_enc;
+	uint64_t fde_count, i, last_cie = UINT64_MAX;
+	uint8_t last_enc = 0;
+	func_range_t *out;
+	uint32_t k = 0;
+
+	version = rd_un(&c, 1);
+	frame_enc = rd_un(&c, 1);
+	count_enc = rd_un(&c, 1);
+	table_enc = rd_un(&c, 1);
+	if(c.error || version != 1 || count_enc == DW_EH_PE_omit
+			|| table_enc == DW_EH_PE_omit)
+		return false;
+
+	cfi->datarel = hdr->vaddr;
+	rd_encoded(&c, frame_enc, vaddr_of(hdr, c.p), cfi);
+	fde_count = rd_encoded(&c, count_enc, vaddr_of(hdr, c.p), cfi);
+	if(c.error || fde_count > (uint64_t)(c.end - c.p))
+		return false;
+
+	out = malloc((fde_count ? fde_count : 1) * sizeof(func_range_t));
+	if(!out)
+		return false;
+
+	for(i=0; i<fde_count && !c.error; i++) {
+		uint64_t loc, fde;
+
+		loc = rd_encoded(&c, table_enc, vaddr_of(hdr, c.p), cfi);
+		fde = rd_encoded(&c, table_enc, vaddr_of(hdr, c.p), cfi);
+		if(fde < cfi->frame.vaddr || fde - cfi->frame.vaddr >= cfi->frame.size)
+			continue;
+
+		if(read_fde(cfi, fde - cfi->frame.vaddr, &last_cie, &last_enc, &out[k])
+				&& out[k].start == loc)
+			k++;
+	}
+
+	if(c.error) {
+		free(out);
+		return false;
+	}
+
+	*ranges = out;
+	*count = k;
+	return true;
+}
+
+static const segment_t * find_segment(const segment_t *load, uint32_t nload, uint64_t vaddr)
+{
+	uint32_t i;
+
+	for(i=0; i<nload; i++)
+		if(vaddr >= load[i].vaddr && vaddr - load[i].vaddr < load[i].filesz)
+			return &load[i];
+	return NULL;
+}
+
+/* hdr:     PT_GNU_EH_FRAME, or zero size
+ * frame:   .eh_frame from the section table, or zero size
+ */
+static bool eh_frame_functions_common(int32_t fd,
+		uint8_t addr_size,
+		bool big_endian,
+		const segment_t *load,
+		uint32_t nload,
+		const segment_t *hdr,
+		const segment_t *frame,
+		func_range_t **ranges,
+		uint32_t *count)
+{
+	region_t hdr_map;
+	cfi_t cfi;
+	bool ok = false;
+
+	memset(&cfi, 0, sizeof(cfi));
+	memset(&hdr_map, 0, sizeof(hdr_map));
+	cfi.addr_size = addr_size;
+	cfi.big_endian = big_endian;
+
+	if(hdr->filesz && map_region(fd, hdr->offset, hdr->filesz, hdr->vaddr, &hdr_map)) {
+		cursor_t c = { hdr_map.data + 1, hdr_map.data + hdr_map.size, false, big_endian };
+		uint8_t frame_enc;
+		uint64_t frame_vaddr;
+		const segment_t *seg;
+
+		/* .eh_frame starts at eh_frame_ptr and cannot run past the end
+		 * of its PT_LOAD segment.
+		 */
+		cfi.datarel = hdr->vaddr;
+		frame_enc = rd_un(&c, 1);
+		c.p += 2;
+		frame_vaddr = rd_encoded(&c, frame_enc, vaddr_of(&hdr_map, c.p), &cfi);
+		seg = find_segment(load, nload, frame_vaddr);
+
+		if(!c.error && seg && map_region(fd,
+					seg->offset + (frame_vaddr - seg->vaddr),
+					seg->filesz - (frame_vaddr - seg->vaddr),
+					frame_vaddr, &cfi.frame))
+			ok = read_hdr_table(&cfi, &hdr_map, ranges, count);
+		unmap_region(&hdr_map);
+
+		if(ok) {
+			debug("%u functions from .eh_frame_hdr\n", *count);
+			unmap_region(&cfi.frame);
+			return true;
+		}
+		unmap_region(&cfi.frame);
+	}
+
+	if(frame->filesz && map_region(fd, frame->offset, frame->filesz, frame->vaddr, &cfi.frame)) {
+		ok = scan_eh_frame(&cfi, ranges, count);
+		if(ok)
+			debug("%u functions from .eh_frame\n", *count);
+		unmap_region(&cfi.frame);
+	}
+
+	return ok;
+}
+
+/* A corrupt sh_name may point past .shstrtab or at an unterminated tail */
+static bool has_name(const char *str, uint64_t size, uint32_t off, const char *name)
+{
+	size_t len = strlen(name);
+
+	return off < size && size - off > len && !memcmp(str + off, name, len + 1);
+}
+
+bool eh_frame_functions64(int32_t fd,
+		Elf64_Ehdr eh,
+		Elf64_Shdr sh_table[],
+		func_range_t **ranges,
+		uint32_t *count)
+{
+	Elf64_Phdr* ph_tbl = NULL;
+	segment_t* load = NULL;
+	segment_t hdr, frame;
+	uint32_t i, nload = 0, shnum, strndx;
+	char* sh_str;
+	bool ok;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(&frame, 0, sizeof(frame));
+
+	if(eh.e_phnum > 0 && eh.e_phentsize == sizeof(Elf64_Phdr)) {
+		ph_tbl = malloc(eh.e_phnum * sizeof(Elf64_Phdr));
+		load = malloc(eh.e_phnum * sizeof(segment_t));
+		if(!ph_tbl || !load) {
+			free(ph_tbl);
+			free(load);
+			return false;
+		}
+
+		if(!read_program_header_table64(fd, eh, ph_tbl)) {
+			free(ph_tbl);
+			free(load);
+			return false;
+		}
+		for(i=0; i<eh.e_phnum; i++) {
+			segment_t s = { ph_tbl[i].p_vaddr, ph_tbl[i].p_offset, ph_tbl[i].p_filesz };
+			if(ph_tbl[i].p_type == PT_LOAD)
+				load[nload++] = s;
+			else if(ph_tbl[i].p_type == PT_GNU_EH_FRAME)
+				hdr = s;
+		}
+		free(ph_tbl);
+	}
+
+	/* Section table is only needed for the fallback */
+	if(sh_table) {
+		shnum = section_count64(eh, sh_table);
+		strndx = section_strndx64(eh, sh_table);
+		sh_str = strndx < shnum ? read_section64(fd, sh_table[strndx]) : NULL;
+		if(!sh_str)
+			shnum = 0;
+		for(i=0; i<shnum; i++) {
+			if(sh_table[i].sh_type != SHT_NOBITS
+					&& has_name(sh_str, sh_table[strndx].sh_size,
+						sh_table[i].sh_name, ".eh_frame")) {
+				frame.vaddr = sh_table[i].sh_addr;
+				frame.offset = sh_table[i].sh_offset;
+				frame.filesz = sh_table[i].sh_size;
+				break;
+			}
+		}
+		section_free(sh_str);
+	}
+
+	ok = eh_frame_functions_common(fd, 8, eh.e_ident[EI_DATA] == ELFDATA2MSB,
+			load, nload, &hdr, &frame, ranges, count);
+	free(load);
+	return ok;
+}
+
+bool eh_frame_functions(int32_t fd,
+		Elf32_Ehdr eh,
+		Elf32_Shdr sh_table[],
+		func_range_t **ranges,
+		uint32_t *count)
+{
+	Elf32_Phdr* ph_tbl = NULL;
+	segment_t* load = NULL;
+	segment_t hdr, frame;
+	uint32_t i, nload = 0, shnum, strndx;
+	char* sh_str;
+	bool ok;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(&frame, 0, sizeof(frame));
+
+	if(eh.e_phnum > 0 && eh.e_phentsize == sizeof(Elf32_Phdr)) {
+		ph_tbl = malloc(eh.e_phnum * sizeof(Elf32_Phdr));
+		load = malloc(eh.e_phnum * sizeof(segment_t));
+		if(!ph_tbl || !load) {
+			free(ph_tbl);
+			free(load);
+			return false;
+		}
+
+		if(!read_program_header_table(fd, eh, ph_tbl)) {
+			free(ph_tbl);
+			free(load);
+			return false;
+		}
+		for(i=0; i<eh.e_phnum; i++) {
+			segment_t s = { ph_tbl[i].p_vaddr, ph_tbl[i].p_offset, ph_tbl[i].p_filesz };
+			if(ph_tbl[i].p_type == PT_LOAD)
+				load[nload++] = s;
+			else if(ph_tbl[i].p_type == PT_GNU_EH_FRAME)
+				hdr = s;
+		}
+		free(ph_tbl);
+	}
+
+	if(sh_table) {
+		shnum = section_count(eh, sh_table);
+		strndx = section_strndx(eh, sh_table);
+		sh_str = strndx < shnum ? read_section(fd, sh_table[strndx]) : NULL;
+		if(!sh_str)
+			shnum = 0;
+		for(i=0; i<shnum; i++) {
+			if(sh_table[i].sh_type != SHT_NOBITS
+					&& has_name(sh_str, sh_table[strndx].sh_size,
+						sh_table[i].sh_name, ".eh_frame")) {
+				frame.vaddr = sh_table[i].sh_addr;
+				frame.offset = sh_table[i].sh_offset;
+				frame.filesz = sh_table[i].sh_size;
+				break;
+			}
+		}
+		section_free(sh_str);
+	}
+
+	ok = eh_frame_functions_common(fd, 4, eh.e_ident[EI_DATA] == ELFDATA2MSB,
+			load, nload, &hdr, &frame, ranges, count);
+	free(load);
+	return ok;
+}
+
+void print_functions(func_range_t *ranges, uint32_t count)
+{
+	uint32_t i;
+
+	printf("%d functions\n", count);
+	for(i=0; i<count; i++) {
+		printf("0x%08lx ", ranges[i].start);
+		printf("0x%08lx ", ranges[i].end);
+		printf("%ld\n", ranges[i].end - ranges[i].start);
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef _EH_FRAME_H
+#define _EH_FRAME_H
+
+#include "elf-parser.h"
+
+/* Function boundaries recovered from call frame information.
+ *
+ * Stripped binaries keep .eh_frame because the unwinder needs it, and
+ * PT_GNU_EH_FRAME points at .eh_frame_hdr whose binary-search table
+ * already lists every FDE sorted by start address.  Each FDE gives the
+ * exact [start, end) of one function.  Without a usable header the FDEs
+ * are located by walking .eh_frame and decoded on several threads.
+ */
+
+typedef struct func_range {
+	uint64_t start;
+	uint64_t end;
+} func_range_t;
+
+bool eh_frame_functions64(int32_t fd,
+		Elf64_Ehdr eh,
+		Elf64_Shdr sh_table[],
+		func_range_t **ranges,
+		uint32_t *count);
+bool eh_frame_functions(int32_t fd,
+		Elf32_Ehdr eh,
+		Elf32_Shdr sh_table[],
+		func_range_t **ranges,
+		uint32_t *count);
+void print_functions(func_range_t *ranges, uint32_t count);
+
+#endif /* _EH_FRAME_H */
@@ -0,0 +1,125 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "elf-advise.h"
+#include "elf-stats.h"
+
+#ifndef __NR_cachestat
+#define __NR_cachestat	451	/* Linux 6.5, same number on every architecture */
+#endif
+
+struct cachestat_range {
+	uint64_t off;
+	uint64_t len;
+};
+
+struct cachestat {
+	uint64_t nr_cache;
+	uint64_t nr_dirty;
+	uint64_t nr_writeback;
+	uint64_t nr_evicted;
+	uint64_t nr_recently_evicted;
+};
+
+static uint32_t policy = ADVISE_HINTS;
+
+void advise_use(uint32_t flags)
+{
+	policy = flags;
+}
+
+uint32_t advise_flags(void)
+{
+	return policy;
+}
+
+static void fadvise(int32_t fd, uint64_t offset, uint64_t size, int advice)
+{
+	posix_fadvise(fd, (off_t)offset, (off_t)size, advice);
+	stats_add(STAT_SYSCALLS, 1);
+}
+
+void advise_open(int32_t fd)
+{
+	if(policy & ADVISE_HINTS)
+		fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+}
+
+/* Not with ADVISE_DROP: a range read ahead would look cached to the
+ * check in advise_begin() and never be dropped
+ */
+void advise_prefetch(int32_t fd, uint64_t offset, uint64_t size)
+{
+	if(policy == ADVISE_HINTS && size)
+		fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+}
+
+/* True only if the kernel says no page of the range is cached */
+static bool uncached(int32_t fd, uint64_t offset, uint64_t size)
+{
+	struct cachestat_range range = { offset, size };
+	struct cachestat cs;
+
+	stats_add(STAT_SYSCALLS, 1);
+	if(syscall(__NR_cachestat, fd, &range, &cs, 0))
+		return false;
+	return cs.nr_cache == 0;
+}
+
+void advise_begin(advice_t *a, int32_t fd, uint64_t offset, uint64_t size,
+		advise_access_t access)
+{
+	uint64_t page, first, end;
+
+	a->fd = -1;
+	if(!policy || !size)
+		return;
+
+	a->fd = fd;
+	a->offset = offset;
+	a->size = size;
+	a->access = access;
+	a->drop = false;
+	if(policy & ADVISE_DROP) {
+		/* Only whole pages are dropped, so only they are checked: the
+		 * edges are shared with whatever was read next to the range
+		 */
+		page = sysconf(_SC_PAGESIZE);
+		first = (offset + page - 1) & ~(page - 1);
+		end = (offset + size) & ~(page - 1);
+		if(end > first && uncached(fd, first, end - first)) {
+			a->offset = first;
+			a->size = end - first;
+			a->drop = true;
+		}
+	}
+
+	if(!(policy & ADVISE_HINTS))
+		return;
+	if(access == ACCESS_STREAM)
+		fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);	/* the whole file, on Linux */
+	else
+		fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+}
+
+/* The range has been copied out: restore the file's mode and give back
+ * the pages the read brought in
+ */
+void advise_end(advice_t *a)
+{
+	if(a->fd < 0)
+		return;
+	if((policy & ADVISE_HINTS) && a->access == ACCESS_STREAM)
+		fadvise(a->fd, 0, 0, POSIX_FADV_RANDOM);
+	if(a->drop)
+		fadvise(a->fd, a->offset, a->size, POSIX_FADV_DONTNEED);
+	a->fd = -1;
+}
+
+void advise_map(void *addr, size_t length, advise_access_t access)
+{
+	if(!(policy & ADVISE_HINTS) || !length)
+		return;
+	madvise(addr, length, access == ACCESS_STREAM ? MADV_SEQUENTIAL : MADV_WILLNEED);
+	stats_add(STAT_SYSCALLS, 1);
+}
@@ -0,0 +1,51 @@
+#ifndef _ELF_ADVISE_H
+#define _ELF_ADVISE_H
+
+#include "elf-parser.h"
+
+/* Page cache hints for the reads the parser is about to do.
+ *
+ * A dump touches a few tables scattered over the file, so a file is
+ * opened with readahead off (POSIX_FADV_RANDOM) and every table read is
+ * announced with WILLNEED for exactly its range: the kernel neither
+ * reads ahead into debug sections nobody asked for nor waits for the
+ * first fault to start.  Long front to back reads such as the .text
+ * extraction switch the file to SEQUENTIAL while they run.
+ *
+ * With ADVISE_DROP, used for batch runs, the pages of a range are
+ * dropped again once it has been consumed, but only when none of its
+ * whole pages were cached before the read: whatever somebody else had
+ * cached stays.
+ * The check is cachestat(2); without it nothing is dropped.
+ *
+ * Like the cache and the arena the policy is a process wide switch,
+ * advise_use(0) turns it off.
+ */
+
+#define ADVISE_HINTS	0x01
+#define ADVISE_DROP	0x02
+
+typedef enum advise_access {
+	ACCESS_TABLE,		/* read whole, now */
+	ACCESS_STREAM,		/* a long range, front to back */
+} advise_access_t;
+
+typedef struct advice {
+	int32_t fd;		/* -1 when there is nothing to undo */
+	uint64_t offset;
+	uint64_t size;
+	advise_access_t access;
+	bool drop;		/* nothing of it was cached before */
+} advice_t;
+
+void advise_use(uint32_t flags);
+uint32_t advise_flags(void);
+
+void advise_open(int32_t fd);
+void advise_prefetch(int32_t fd, uint64_t offset, uint64_t size);
+void advise_begin(advice_t *a, int32_t fd, uint64_t offset, uint64_t size,
+		advise_access_t access);
+void advise_end(advice_t *a);
+void advise_map(void *addr, size_t length, advise_access_t access);
+
+#endif /* _ELF_ADVISE_H */
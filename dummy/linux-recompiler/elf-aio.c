@@ -0,0 +1,411 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "elf-aio.h"
+#include "elf-stats.h"
+
+#define POOL_THREADS	16	/* reads block, so more of them than CPUs */
+
+typedef struct aio_req {
+	int32_t fd;
+	uint64_t offset;
+	uint8_t *buf;
+	size_t size;
+	size_t done;		/* bytes in so far */
+	int64_t error;		/* -errno, 0 while all is well */
+	uint32_t calls;		/* system calls spent, pool only */
+	struct iovec iov;
+	aio_done_t cb;
+	void *arg;
+	struct aio_req *next;
+} aio_req_t;
+
+typedef struct ring {
+	int32_t fd;
+	uint32_t entries;
+	uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+	uint32_t *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+	uint32_t unsubmitted;	/* in the SQ, not taken by the kernel yet */
+} ring_t;
+
+struct aio {
+	bool uring;
+	uint32_t depth;
+	uint32_t inflight;	/* owned by the aio_run() thread */
+	aio_req_t *pending;	/* io_uring: waiting for a free slot */
+	aio_req_t **pending_tail;
+	ring_t ring;
+
+	pthread_mutex_t lock;	/* pool: queue, done and stop */
+	pthread_cond_t work;
+	pthread_cond_t finished;
+	aio_req_t *queue;
+	aio_req_t **queue_tail;
+	aio_req_t *done;
+	bool stop;
+	uint32_t nthreads;
+	pthread_t threads[POOL_THREADS];
+};
+
+static bool ring_setup(ring_t *r, uint32_t depth)
+{
+	struct io_uring_params p;
+	uint8_t *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, depth, &p);
+	if(r->fd < 0)
+		return false;
+
+	r->entries = p.sq_entries;
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = 0;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_ptr == MAP_FAILED)
+		goto FAIL_FD;
+	r->cq_ptr = r->sq_ptr;
+	if(r->cq_len) {
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if(r->cq_ptr == MAP_FAILED)
+			goto FAIL_SQ;
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED)
+		goto FAIL_CQ;
+
+	sq = r->sq_ptr;
+	cq = r->cq_ptr;
+	r->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	r->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	r->sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	r->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	r->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	r->cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	r->unsubmitted = 0;
+	return true;
+
+FAIL_CQ:
+	if(r->cq_len)
+		munmap(r->cq_ptr, r->cq_len);
+FAIL_SQ:
+	munmap(r->sq_ptr, r->sq_len);
+FAIL_FD:
+	close(r->fd);
+	return false;
+}
+
+static void ring_teardown(ring_t *r)
+{
+	munmap(r->sqes, r->sqes_len);
+	if(r->cq_len)
+		munmap(r->cq_ptr, r->cq_len);
+	munmap(r->sq_ptr, r->sq_len);
+	close(r->fd);
+}
+
+static void pread_req(aio_req_t *req)
+{
+	ssize_t len;
+
+	while(req->done < req->size) {
+		len = pread(req->fd, req->buf + req->done, req->size - req->done,
+				(off_t)(req->offset + req->done));
+		req->calls++;
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0) {
+			req->error = len < 0 ? -errno : -EIO;
+			return;
+		}
+		req->done += len;
+	}
+}
+
+static void * pool_worker(void *arg)
+{
+	aio_t *a = arg;
+	aio_req_t *req;
+
+	pthread_mutex_lock(&a->lock);
+	for(;;) {
+		while(!a->queue && !a->stop)
+			pthread_cond_wait(&a->work, &a->lock);
+		if(!a->queue)
+			break;
+		req = a->queue;
+		a->queue = req->next;
+		if(!a->queue)
+			a->queue_tail = &a->queue;
+		pthread_mutex_unlock(&a->lock);
+
+		pread_req(req);
+
+		pthread_mutex_lock(&a->lock);
+		req->next = a->done;
+		a->done = req;
+		pthread_cond_signal(&a->finished);
+	}
+	pthread_mutex_unlock(&a->lock);
+	return NULL;
+}
+
+aio_t * aio_create(uint32_t depth, bool try_uring)
+{
+	aio_t *a;
+	uint32_t i, n;
+
+	a = calloc(1, sizeof(aio_t));
+	if(!a)
+		return NULL;
+	a->depth = depth ? depth : 1;
+	a->pending_tail = &a->pending;
+	a->queue_tail = &a->queue;
+
+	if(try_uring && ring_setup(&a->ring, a->depth)) {
+		a->uring = true;
+		return a;
+	}
+
+	pthread_mutex_init(&a->lock, NULL);
+	pthread_cond_init(&a->work, NULL);
+	pthread_cond_init(&a->finished, NULL);
+	n = a->depth < POOL_THREADS ? a->depth : POOL_THREADS;
+	for(i=0; i<n; i++) {
+		if(pthread_create(&a->threads[a->nthreads], NULL, pool_worker, a))
+			break;	/* aio_run() reads itself if none started */
+		a->nthreads++;
+	}
+	return a;
+}
+
+void aio_destroy(aio_t *a)
+{
+	uint32_t i;
+
+	if(!a)
+		return;
+	if(a->uring) {
+		ring_teardown(&a->ring);
+	} else {
+		pthread_mutex_lock(&a->lock);
+		a->stop = true;
+		pthread_cond_broadcast(&a->work);
+		pthread_mutex_unlock(&a->lock);
+		for(i=0; i<a->nthreads; i++)
+			pthread_join(a->threads[i], NULL);
+		pthread_cond_destroy(&a->finished);
+		pthread_cond_destroy(&a->work);
+		pthread_mutex_destroy(&a->lock);
+	}
+	free(a);
+}
+
+const char * aio_backend(const aio_t *a)
+{
+	return a->uring ? "io_uring" : "pread";
+}
+
+bool aio_read(aio_t *a, int32_t fd, uint64_t offset, void *buf, size_t size,
+		aio_done_t done, void *arg)
+{
+	aio_req_t *req;
+
+	req = calloc(1, sizeof(aio_req_t));
+	if(!req)
+		return false;
+	req->fd = fd;
+	req->offset = offset;
+	req->buf = buf;
+	req->size = size;
+	req->cb = done;
+	req->arg = arg;
+
+	a->inflight++;
+	if(a->uring) {
+		*a->pending_tail = req;
+		a->pending_tail = &req->next;
+	} else {
+		pthread_mutex_lock(&a->lock);
+		*a->queue_tail = req;
+		a->queue_tail = &req->next;
+		pthread_cond_signal(&a->work);
+		pthread_mutex_unlock(&a->lock);
+	}
+	return true;
+}
+
+static void complete(aio_t *a, aio_req_t *req)
+{
+	a->inflight--;
+	stats_add(STAT_BYTES_READ, req->done);
+	stats_add(STAT_SYSCALLS, req->calls);
+	req->cb(req->arg, req->buf, req->error ? req->error : (int64_t)req->done);
+	free(req);
+}
+
+/* Moves pending reads into free SQ slots, returns how many to submit */
+static uint32_t ring_fill(aio_t *a)
+{
+	ring_t *r = &a->ring;
+	struct io_uring_sqe *sqe;
+	aio_req_t *req;
+	uint32_t tail, head, idx;
+
+	tail = *r->sq_tail;
+	head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	while(a->pending && tail - head < r->entries) {
+		req = a->pending;
+		a->pending = req->next;
+		if(!a->pending)
+			a->pending_tail = &a->pending;
+
+		/* READV rather than READ works on every io_uring kernel */
+		req->iov.iov_base = req->buf + req->done;
+		req->iov.iov_len = req->size - req->done;
+		idx = tail & *r->sq_mask;
+		sqe = &r->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = req->fd;
+		sqe->off = req->offset + req->done;
+		sqe->addr = (uintptr_t)&req->iov;
+		sqe->len = 1;
+		sqe->user_data = (uintptr_t)req;
+		r->sq_array[idx] = idx;
+		tail++;
+		r->unsubmitted++;
+	}
+	__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+	return r->unsubmitted;
+}
+
+static void ring_reap(aio_t *a)
+{
+	ring_t *r = &a->ring;
+	struct io_uring_cqe *cqe;
+	aio_req_t *req, *ready = NULL;
+	uint32_t head, tail;
+	int32_t res;
+
+	/* Free the CQ first, callbacks may queue more reads */
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for(; head != tail; head++) {
+		cqe = &r->cqes[head & *r->cq_mask];
+		req = (aio_req_t *)(uintptr_t)cqe->user_data;
+		res = cqe->res;
+		if(res == -EINTR || res == -EAGAIN) {
+			res = 0;
+		} else if(res < 0) {
+			req->error = res;
+		} else if(res == 0) {
+			req->error = -EIO;	/* past the end of the file */
+		} else {
+			req->done += res;
+		}
+		if(!req->error && req->done < req->size) {
+			/* Short read: the rest goes round again */
+			req->next = a->pending;
+			a->pending = req;
+			if(!req->next)
+				a->pending_tail = &req->next;
+			continue;
+		}
+		req->next = ready;
+		ready = req;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+	while(ready) {
+		req = ready;
+		ready = req->next;
+		complete(a, req);
+	}
+}
+
+static void run_uring(aio_t *a)
+{
+	ring_t *r = &a->ring;
+	aio_req_t *req;
+	uint32_t submit;
+	int ret;
+
+	while(a->inflight) {
+		submit = ring_fill(a);
+		ret = syscall(__NR_io_uring_enter, r->fd, submit, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		stats_add(STAT_SYSCALLS, 1);
+		if(ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			/* The ring is unusable: fail what never got to it */
+			while(a->pending) {
+				req = a->pending;
+				a->pending = req->next;
+				req->error = -errno;
+				complete(a, req);
+			}
+			a->pending_tail = &a->pending;
+			return;
+		}
+		if(ret > 0)
+			r->unsubmitted -= (uint32_t)ret < submit ? (uint32_t)ret : submit;
+		ring_reap(a);
+	}
+}
+
+static void run_pool(aio_t *a)
+{
+	aio_req_t *req, *list;
+
+	while(a->inflight) {
+		pthread_mutex_lock(&a->lock);
+		if(!a->nthreads) {
+			/* No workers: read here, in queue order */
+			while(a->queue) {
+				req = a->queue;
+				a->queue = req->next;
+				pread_req(req);
+				req->next = a->done;
+				a->done = req;
+			}
+			a->queue_tail = &a->queue;
+		}
+		while(!a->done)
+			pthread_cond_wait(&a->finished, &a->lock);
+		list = a->done;
+		a->done = NULL;
+		pthread_mutex_unlock(&a->lock);
+
+		while(list) {
+			req = list;
+			list = req->next;
+			complete(a, req);
+		}
+	}
+}
+
+void aio_run(aio_t *a)
+{
+	if(a->uring)
+		run_uring(a);
+	else
+		run_pool(a);
+}
@@ -0,0 +1,36 @@
+#ifndef _ELF_AIO_H
+#define _ELF_AIO_H
+
+#include "elf-parser.h"
+
+/* Asynchronous positional reads.
+ *
+ * Reads are queued with aio_read() and completed by aio_run(), which
+ * keeps up to depth of them in flight and returns once every read,
+ * including those queued by callbacks, has finished.  A read completes
+ * only when the whole range is in or it failed; short reads are
+ * resubmitted for the rest.  Callbacks always run on the thread that
+ * called aio_run(), one at a time, so parsing stages chained through
+ * them need no locking; aio_read() may only be called from that thread.
+ *
+ * The backend is io_uring, set up through the raw system calls.  Where
+ * the kernel has no io_uring, or it is blocked, a pool of threads doing
+ * blocking pread() takes its place.
+ */
+
+#define AIO_DEPTH	64
+
+typedef struct aio aio_t;
+
+/* result is the number of bytes read, size on success, or -errno */
+typedef void (*aio_done_t)(void *arg, void *buf, int64_t result);
+
+aio_t * aio_create(uint32_t depth, bool try_uring);
+void aio_destroy(aio_t *a);
+const char * aio_backend(const aio_t *a);
+
+bool aio_read(aio_t *a, int32_t fd, uint64_t offset, void *buf, size_t size,
+		aio_done_t done, void *arg);
+void aio_run(aio_t *a);
+
+#endif /* _ELF_AIO_H */
@@ -0,0 +1,149 @@
+#include "elf-arena.h"
+
+#define ARENA_ALIGN	16
+#define ARENA_CHUNK_MIN	4096
+
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	_Alignas(ARENA_ALIGN) uint8_t data[];
+} arena_chunk_t;
+
+struct arena {
+	arena_chunk_t *head;	/* newest chunk, allocations bump here */
+	size_t chunk_size;
+	uint64_t total;		/* bytes held in all chunks */
+};
+
+static __thread arena_t *current;
+
+static arena_chunk_t * chunk_new(size_t size)
+{
+	arena_chunk_t *c = malloc(sizeof(arena_chunk_t) + size);
+
+	if(!c)
+		return NULL;
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+arena_t * arena_create(size_t chunk_size)
+{
+	arena_t *a = calloc(1, sizeof(arena_t));
+
+	if(!a)
+		return NULL;
+	a->chunk_size = ALIGN_UP(chunk_size < ARENA_CHUNK_MIN ? ARENA_CHUNK_MIN : chunk_size,
+			ARENA_ALIGN);
+	return a;
+}
+
+void arena_destroy(arena_t *a)
+{
+	arena_chunk_t *c, *next;
+
+	if(!a)
+		return;
+	if(current == a)
+		current = NULL;
+
+	for(c=a->head; c; c=next) {
+		next = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+/* Drop everything but one regular chunk, ready for the next file */
+void arena_reset(arena_t *a)
+{
+	arena_chunk_t *c, *next, *keep = NULL;
+
+	for(c=a->head; c; c=next) {
+		next = c->next;
+		if(!keep && c->size == a->chunk_size) {
+			keep = c;
+			continue;
+		}
+		free(c);
+	}
+
+	a->head = keep;
+	a->total = 0;
+	if(keep) {
+		keep->next = NULL;
+		keep->used = 0;
+		a->total = keep->size;
+	}
+}
+
+void * arena_alloc(arena_t *a, size_t size)
+{
+	arena_chunk_t *c;
+
+	size = ALIGN_UP(size ? size : 1, ARENA_ALIGN);
+	c = a->head;
+	if(c && c->size - c->used >= size) {
+		c->used += size;
+		return c->data + c->used - size;
+	}
+
+	/* Big buffers (.text, symbol tables) get a chunk of their own behind
+	 * the head so the space left in the current chunk is not wasted.
+	 */
+	if(size > a->chunk_size / 4) {
+		c = chunk_new(size);
+		if(!c)
+			return NULL;
+		c->used = size;
+		a->total += size;
+		if(a->head) {
+			c->next = a->head->next;
+			a->head->next = c;
+		} else {
+			a->head = c;
+		}
+		return c->data;
+	}
+
+	c = chunk_new(a->chunk_size);
+	if(!c)
+		return NULL;
+	c->used = size;
+	c->next = a->head;
+	a->head = c;
+	a->total += a->chunk_size;
+	return c->data;
+}
+
+uint64_t arena_size(const arena_t *a)
+{
+	return a->total;
+}
+
+void arena_use(arena_t *a)
+{
+	current = a;
+}
+
+arena_t * arena_current(void)
+{
+	return current;
+}
+
+void * section_alloc(size_t size)
+{
+	return current ? arena_alloc(current, size) : malloc(size);
+}
+
+/* Arena buffers live until the arena does */
+void section_free(void *p)
+{
+	if(!current)
+		free(p);
+}
@@ -0,0 +1,34 @@
+#ifndef _ELF_ARENA_H
+#define _ELF_ARENA_H
+
+#include "elf-parser.h"
+
+/* Bump allocator for the buffers read out of one ELF file.
+ *
+ * Memory comes from a list of chunks; an allocation is a pointer bump
+ * in the newest chunk and individual buffers are never freed.  The
+ * whole arena goes away at once, normally from elf_close(), so batch
+ * runs over many files stay bounded by the largest single file.
+ *
+ * Like the cache, the arena used by read_section*() is selected with a
+ * switch: arena_use() makes it current, arena_use(NULL) goes back to
+ * plain malloc/free.  The switch is per thread so that threads loading
+ * different files do not share one; an arena itself is not thread safe.
+ */
+
+typedef struct arena arena_t;
+
+arena_t * arena_create(size_t chunk_size);
+void arena_destroy(arena_t *a);
+void arena_reset(arena_t *a);
+void * arena_alloc(arena_t *a, size_t size);
+uint64_t arena_size(const arena_t *a);
+
+void arena_use(arena_t *a);
+arena_t * arena_current(void);
+
+/* Section buffers: from the current arena if there is one */
+void * section_alloc(size_t size);
+void section_free(void *p);
+
+#endif /* _ELF_ARENA_H */
@@ -0,0 +1,252 @@
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "elf-cache.h"
+#include "elf-stats.h"
+#include "elf-hash.h"
+
+/* Written in front of every entry.  The build-id survives relinks that
+ * keep the note and edits of a binary, so an entry is only trusted
+ * while the file it was made from has the same size and the same
+ * section header table.  Both come from the contents, a copy of the
+ * binary under another path still matches.
+ */
+typedef struct {
+	uint64_t size;
+	uint64_t shdr_hash;	/* XXH64 of the table as stored in the file */
+} cache_stamp_t;
+
+static char cache_dir[PATH_MAX];	/* <root>/<build-id>, empty if closed */
+static cache_stamp_t cache_stamp;
+
+static bool cache_root(char *path, size_t len)
+{
+	const char *env;
+	int n;
+
+	if((env = getenv("ELF_CACHE_DIR")) && *env)
+		n = snprintf(path, len, "%s", env);
+	else if((env = getenv("XDG_CACHE_HOME")) && *env)
+		n = snprintf(path, len, "%s/linux-recompiler", env);
+	else if((env = getenv("HOME")) && *env)
+		n = snprintf(path, len, "%s/.cache/linux-recompiler", env);
+	else
+		return false;
+
+	return n > 0 && (size_t)n < len;
+}
+
+/* mkdir -p */
+static bool make_dirs(char *path)
+{
+	char *p;
+
+	for(p = path + 1; *p; p++) {
+		if(*p != '/')
+			continue;
+		*p = '\0';
+		if(mkdir(path, 0755) && errno != EEXIST) {
+			*p = '/';
+			return false;
+		}
+		*p = '/';
+	}
+
+	return !mkdir(path, 0755) || errno == EEXIST;
+}
+
+static bool cache_path(char *path, size_t len, const char *kind)
+{
+	int n = snprintf(path, len, "%s/%s", cache_dir, kind);
+	return n > 0 && (size_t)n < len;
+}
+
+/* Only tables are worth keeping; .text and friends are cheaper to read
+ * straight from the binary than from a second copy on disk.
+ */
+static bool is_cacheable_type(uint32_t type)
+{
+	return type == SHT_SYMTAB
+		|| type == SHT_DYNSYM
+		|| type == SHT_STRTAB;
+}
+
+bool cache_open(const build_id_t *bid, int32_t fd, uint64_t shoff, uint64_t shsize)
+{
+	char root[PATH_MAX];
+	struct stat st;
+	char *shdrs;
+	bool ok;
+	int n;
+
+	cache_dir[0] = '\0';
+	if(!bid->len || fstat(fd, &st) || !cache_root(root, sizeof(root)))
+		return false;
+	if(shoff > (uint64_t)st.st_size || shsize > (uint64_t)st.st_size - shoff)
+		return false;
+
+	shdrs = malloc(shsize ? shsize : 1);
+	if(!shdrs)
+		return false;
+	stats_alloc(shsize);
+	ok = read_full(fd, shoff, shdrs, shsize);
+	memset(&cache_stamp, 0, sizeof(cache_stamp));
+	cache_stamp.size = st.st_size;
+	cache_stamp.shdr_hash = hash_xxh64(shdrs, shsize, 0);
+	free(shdrs);
+	if(!ok)
+		return false;
+
+	n = snprintf(cache_dir, sizeof(cache_dir), "%s/%s", root, bid->hex);
+	if(n <= 0 || (size_t)n >= sizeof(cache_dir) || !make_dirs(cache_dir)) {
+		cache_dir[0] = '\0';
+		return false;
+	}
+
+	debug("cache = %s\n", cache_dir);
+	return true;
+}
+
+void cache_close(void)
+{
+	cache_dir[0] = '\0';
+}
+
+bool cache_active(void)
+{
+	return cache_dir[0] != '\0';
+}
+
+/* Entries made from another revision of the file are misses */
+static bool stamp_matches(int32_t fd)
+{
+	cache_stamp_t stamp;
+
+	return read_full(fd, 0, &stamp, sizeof(stamp))
+		&& !memcmp(&stamp, &cache_stamp, sizeof(stamp));
+}
+
+void * cache_load(const char *kind, size_t *size)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	char* buff;
+	size_t len;
+	int32_t fd;
+
+	if(!cache_active() || !cache_path(path, sizeof(path), kind))
+		return NULL;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+
+	buff = NULL;
+	len = 0;
+	if(!fstat(fd, &st) && (uint64_t)st.st_size > sizeof(cache_stamp_t)
+			&& stamp_matches(fd)) {
+		len = st.st_size - sizeof(cache_stamp_t);
+		buff = malloc(len);
+		stats_alloc(len);
+		if(buff && !read_full(fd, sizeof(cache_stamp_t), buff, len)) {
+			free(buff);
+			buff = NULL;
+		}
+	}
+	close(fd);
+
+	if(buff)
+		*size = len;
+	return buff;
+}
+
+bool cache_load_into(const char *kind, void *buf, size_t size)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int32_t fd;
+	bool ok;
+
+	if(!cache_active() || !cache_path(path, sizeof(path), kind))
+		return false;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return false;
+
+	/* A size mismatch means a different layout wrote this entry */
+	ok = !fstat(fd, &st) && (uint64_t)st.st_size == sizeof(cache_stamp_t) + size
+		&& stamp_matches(fd) && read_full(fd, sizeof(cache_stamp_t), buf, size);
+	close(fd);
+	return ok;
+}
+
+bool cache_store(const char *kind, const void *buf, size_t size)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	int32_t fd;
+	bool ok;
+
+	if(!cache_active() || !cache_path(path, sizeof(path), kind))
+		return false;
+
+	/* Write to a private name and rename so that concurrent readers
+	 * never observe a half written entry.
+	 */
+	if(snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp))
+		return false;
+
+	if((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0)
+		return false;
+
+	ok = write(fd, &cache_stamp, sizeof(cache_stamp)) == (ssize_t)sizeof(cache_stamp)
+		&& write(fd, buf, size) == (ssize_t)size;
+	ok = !close(fd) && ok;
+	ok = ok && !rename(tmp, path);
+	if(!ok)
+		unlink(tmp);
+
+	return ok;
+}
+
+bool cache_load_section64(Elf64_Shdr sh, char *buf)
+{
+	char kind[64];
+
+	if(!cache_active() || !is_cacheable_type(sh.sh_type))
+		return false;
+
+	snprintf(kind, sizeof(kind), "sec-%lx-%lx", sh.sh_offset, sh.sh_size);
+	return cache_load_into(kind, buf, sh.sh_size);
+}
+
+void cache_store_section64(Elf64_Shdr sh, const char *buf)
+{
+	char kind[64];
+
+	if(!cache_active() || !is_cacheable_type(sh.sh_type))
+		return;
+
+	snprintf(kind, sizeof(kind), "sec-%lx-%lx", sh.sh_offset, sh.sh_size);
+	cache_store(kind, buf, sh.sh_size);
+}
+
+bool cache_load_section(Elf32_Shdr sh, char *buf)
+{
+	char kind[64];
+
+	if(!cache_active() || !is_cacheable_type(sh.sh_type))
+		return false;
+
+	snprintf(kind, sizeof(kind), "sec-%x-%x", sh.sh_offset, sh.sh_size);
+	return cache_load_into(kind, buf, sh.sh_size);
+}
+
+void cache_store_section(Elf32_Shdr sh, const char *buf)
+{
+	char kind[64];
+
+	if(!cache_active() || !is_cacheable_type(sh.sh_type))
+		return;
+
+	snprintf(kind, sizeof(kind), "sec-%x-%x", sh.sh_offset, sh.sh_size);
+	cache_store(kind, buf, sh.sh_size);
+}
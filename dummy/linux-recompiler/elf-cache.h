@@ -0,0 +1,37 @@
+#ifndef _ELF_CACHE_H
+#define _ELF_CACHE_H
+
+#include "elf-parser.h"
+#include "elf-note.h"
+
+/* Analysis result cache keyed by GNU build-id.
+ *
+ * The symbol and string tables of a binary and the address index built
+ * from them are stored under <cache root>/<build-id>/<kind>.  Because
+ * the key comes from the note segment and not from the path, a binary
+ * that shows up again under a different name is answered without
+ * reading those sections.  Each entry also records the size of the file
+ * and a hash of its section header table, which cache_open() reads from
+ * shoff; an entry is ignored once either differs, so a binary rebuilt or
+ * rewritten without a new build-id is read again.  An edit that keeps
+ * the size and every section header (a string patched in place) is not
+ * seen; run without -c after one.
+ *
+ * The cache root is $ELF_CACHE_DIR, else $XDG_CACHE_HOME/linux-recompiler,
+ * else $HOME/.cache/linux-recompiler.
+ */
+
+bool cache_open(const build_id_t *bid, int32_t fd, uint64_t shoff, uint64_t shsize);
+void cache_close(void);
+bool cache_active(void);
+
+void * cache_load(const char *kind, size_t *size);
+bool cache_load_into(const char *kind, void *buf, size_t size);
+bool cache_store(const char *kind, const void *buf, size_t size);
+
+bool cache_load_section64(Elf64_Shdr sh, char *buf);
+void cache_store_section64(Elf64_Shdr sh, const char *buf);
+bool cache_load_section(Elf32_Shdr sh, char *buf);
+void cache_store_section(Elf32_Shdr sh, const char *buf);
+
+#endif /* _ELF_CACHE_H */
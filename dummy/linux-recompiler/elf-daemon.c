@@ -0,0 +1,728 @@
+#define _GNU_SOURCE	/* accept4 */
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "elf-daemon.h"
+#include "elf-note.h"
+#include "elf-swap.h"
+
+#define MAX_THREADS	64
+#define IMAGE_BUCKETS	1024	/* power of two */
+#define IMAGE_CHUNK	(64 << 10)
+#define RECV_TIMEOUT	1	/* seconds a worker waits for the rest of a request */
+#define SYMBOL_NESTING	8
+
+typedef struct image_sym {
+	uint64_t value;
+	uint64_t size;
+	const char *name;
+	uint32_t name_len;
+	uint32_t info;
+	uint32_t shndx;		/* SHN_XINDEX already resolved */
+} image_sym_t;
+
+typedef struct image_sec {
+	const char *name;
+	query_section_t q;
+} image_sec_t;
+
+/* Everything an image points to lives in its own arena */
+typedef struct image {
+	struct image *chain;		/* hash bucket */
+	struct image *prev, *next;	/* LRU, most recent first */
+	char *path;
+	uint64_t hash;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+
+	arena_t *arena;
+	image_sec_t *secs;
+	uint32_t nsecs;
+	image_sym_t *syms;		/* sorted by name */
+	uint32_t nsyms;
+	image_sym_t **by_addr;		/* functions and objects by value */
+	uint32_t naddr;
+	build_id_t bid;
+	bool has_id;
+
+	uint64_t memory;
+	uint32_t refs;
+	bool evicted;
+} image_t;
+
+typedef struct image_cache {
+	pthread_mutex_t lock;
+	image_t *buckets[IMAGE_BUCKETS];
+	image_t *head, *tail;
+	uint64_t total;
+	uint64_t budget;
+} image_cache_t;
+
+typedef struct server {
+	int32_t listen_fd;
+	int32_t epoll_fd;
+	image_cache_t cache;
+} server_t;
+
+static uint64_t path_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	for(; *path; path++)
+		h = (h ^ (uint8_t)*path) * 0x100000001b3ULL;
+	return h;
+}
+
+static int cmp_sym_name(const void *a, const void *b)
+{
+	const image_sym_t *x = a, *y = b;
+
+	return strcmp(x->name, y->name);
+}
+
+static int cmp_sym_addr(const void *a, const void *b)
+{
+	const image_sym_t *x = *(const image_sym_t * const *)a;
+	const image_sym_t *y = *(const image_sym_t * const *)b;
+
+	/* Larger first, so the innermost symbol at an address is met first */
+	if(x->value != y->value)
+		return x->value < y->value ? -1 : 1;
+	return x->size > y->size ? -1 : x->size < y->size;
+}
+
+static void free_image(image_t *img)
+{
+	if(!img)
+		return;
+	arena_destroy(img->arena);
+	free(img->path);
+	free(img);
+}
+
+static bool load_sections(image_t *img, elf_file_t *ef)
+{
+	uint32_t i;
+	const char *name;
+	size_t len;
+
+	img->nsecs = elf_section_count(ef);
+	img->secs = arena_alloc(img->arena, (img->nsecs + 1) * sizeof(image_sec_t));
+	if(!img->secs)
+		return false;
+
+	for(i=0; i<img->nsecs; i++) {
+		image_sec_t *s = &img->secs[i];
+		name = elf_section_name(ef, i);
+		len = name ? strlen(name) : 0;
+		s->name = arena_alloc(img->arena, len + 1);
+		if(!s->name)
+			return false;
+		memcpy((char *)s->name, name ? name : "", len + 1);
+
+		s->q.index = i;
+		if(elf_is64(ef)) {
+			Elf64_Shdr *sh = &elf_shdrs64(ef)[i];
+			s->q.addr = sh->sh_addr;
+			s->q.offset = sh->sh_offset;
+			s->q.size = sh->sh_size;
+			s->q.flags = sh->sh_flags;
+			s->q.type = sh->sh_type;
+		} else {
+			Elf32_Shdr *sh = &elf_shdrs(ef)[i];
+			s->q.addr = sh->sh_addr;
+			s->q.offset = sh->sh_offset;
+			s->q.size = sh->sh_size;
+			s->q.flags = sh->sh_flags;
+			s->q.type = sh->sh_type;
+		}
+	}
+	return true;
+}
+
+/* The SHT_SYMTAB_SHNDX section that belongs to symbol table idx */
+static void shndx_view(elf_file_t *ef, uint32_t idx, elf_view_t *view)
+{
+	uint32_t i, link, type;
+
+	memset(view, 0, sizeof(*view));
+	for(i=0; i<elf_section_count(ef); i++) {
+		type = elf_is64(ef) ? elf_shdrs64(ef)[i].sh_type : elf_shdrs(ef)[i].sh_type;
+		link = elf_is64(ef) ? elf_shdrs64(ef)[i].sh_link : elf_shdrs(ef)[i].sh_link;
+		if(type == SHT_SYMTAB_SHNDX && link == idx) {
+			if(elf_section_view(ef, i, view) != ELF_OK)
+				memset(view, 0, sizeof(*view));
+			return;
+		}
+	}
+}
+
+/* .symtab if there is one, .dynsym otherwise */
+static bool load_symbols(image_t *img, elf_file_t *ef)
+{
+	elf_view_t symtab, strtab, xindex;
+	uint32_t i, idx = 0, link, type, info, shndx;
+	uint64_t count, entsize, name, j;
+	bool swap, found = false, ok = false;
+	uint8_t *raw = NULL;
+
+	for(i=0; i<img->nsecs; i++) {
+		if(img->secs[i].q.type == SHT_SYMTAB) {
+			idx = i;
+			found = true;
+			break;
+		}
+		if(img->secs[i].q.type == SHT_DYNSYM && !found) {
+			idx = i;
+			found = true;
+		}
+	}
+	if(!found)
+		return true;
+
+	memset(&symtab, 0, sizeof(symtab));
+	memset(&strtab, 0, sizeof(strtab));
+	memset(&xindex, 0, sizeof(xindex));
+	link = elf_is64(ef) ? elf_shdrs64(ef)[idx].sh_link : elf_shdrs(ef)[idx].sh_link;
+	if(elf_section_view(ef, idx, &symtab) != ELF_OK)
+		return false;
+	if(!symtab.data || elf_section_view(ef, link, &strtab) != ELF_OK || !strtab.data) {
+		elf_view_release(&symtab);
+		return true;
+	}
+
+	entsize = elf_is64(ef) ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	count = symtab.size / entsize;
+	raw = malloc(count * entsize + 1);
+	img->syms = arena_alloc(img->arena, (count + 1) * sizeof(image_sym_t));
+	if(!raw || !img->syms)
+		goto EXIT;
+
+	/* The mapping is in file byte order */
+	memcpy(raw, symtab.data, count * entsize);
+	swap = elf_swapped(elf_is64(ef) ? elf_ehdr64(ef)->e_ident : elf_ehdr(ef)->e_ident);
+	if(swap && elf_is64(ef))
+		swap_sym_table64((Elf64_Sym *)raw, count);
+	else if(swap)
+		swap_sym_table((Elf32_Sym *)raw, count);
+
+	for(j=0; j<count; j++) {
+		image_sym_t *d = &img->syms[img->nsyms];
+		if(elf_is64(ef)) {
+			Elf64_Sym *sym = (Elf64_Sym *)raw + j;
+			name = sym->st_name;
+			info = sym->st_info;
+			shndx = sym->st_shndx;
+			d->value = sym->st_value;
+			d->size = sym->st_size;
+		} else {
+			Elf32_Sym *sym = (Elf32_Sym *)raw + j;
+			name = sym->st_name;
+			info = sym->st_info;
+			shndx = sym->st_shndx;
+			d->value = sym->st_value;
+			d->size = sym->st_size;
+		}
+		if(shndx == SHN_XINDEX) {
+			if(!xindex.data)
+				shndx_view(ef, idx, &xindex);
+			shndx = xindex.data && j < xindex.size / sizeof(uint32_t)
+				? swap32_if(swap, ((const uint32_t *)xindex.data)[j]) : SHN_UNDEF;
+		}
+
+		type = ELF32_ST_TYPE(info);
+		if(!name || type == STT_SECTION || type == STT_FILE || name >= strtab.size
+				|| !memchr(strtab.data + name, 0, strtab.size - name))
+			continue;
+
+		/* The mapping goes away with the file, keep a copy */
+		d->name_len = strlen((const char *)strtab.data + name);
+		d->name = arena_alloc(img->arena, d->name_len + 1);
+		if(!d->name)
+			goto EXIT;
+		memcpy((char *)d->name, strtab.data + name, d->name_len + 1);
+		d->info = info;
+		d->shndx = shndx;
+		img->nsyms++;
+	}
+	qsort(img->syms, img->nsyms, sizeof(image_sym_t), cmp_sym_name);
+
+	img->by_addr = arena_alloc(img->arena, (img->nsyms + 1) * sizeof(image_sym_t *));
+	if(!img->by_addr)
+		goto EXIT;
+	/* Imports, absolute and common values do not name an address in the image */
+	for(i=0; i<img->nsyms; i++) {
+		type = ELF32_ST_TYPE(img->syms[i].info);
+		if(img->syms[i].shndx == SHN_UNDEF || img->syms[i].shndx == SHN_ABS
+				|| img->syms[i].shndx == SHN_COMMON)
+			continue;
+		if(type == STT_FUNC || type == STT_OBJECT)
+			img->by_addr[img->naddr++] = &img->syms[i];
+	}
+	qsort(img->by_addr, img->naddr, sizeof(image_sym_t *), cmp_sym_addr);
+	ok = true;
+
+EXIT:
+	free(raw);
+	elf_view_release(&xindex);
+	elf_view_release(&strtab);
+	elf_view_release(&symtab);
+	return ok;
+}
+
+static image_t * load_image(const char *path, elf_status_t *status)
+{
+	elf_file_t *ef = NULL;
+	image_t *img;
+	struct stat st;
+
+	img = calloc(1, sizeof(image_t));
+	if(img) {
+		img->path = strdup(path);
+		img->arena = arena_create(IMAGE_CHUNK);
+	}
+	if(!img || !img->path || !img->arena) {
+		free_image(img);
+		*status = ELF_ERR_NOMEM;
+		return NULL;
+	}
+	img->hash = path_hash(path);
+
+	*status = elf_open(path, &ef);
+	if(*status == ELF_OK && fstat(elf_fd(ef), &st) < 0)
+		*status = ELF_ERR_OPEN;
+	if(*status == ELF_OK)
+		*status = elf_read_shdrs(ef);
+	if(*status != ELF_OK)
+		goto FAIL;
+
+	img->dev = st.st_dev;
+	img->ino = st.st_ino;
+	img->size = st.st_size;
+	img->mtime = st.st_mtim;
+
+	/* Scratch reads go to the handle's arena, this thread only */
+	arena_use(elf_arena(ef));
+	if(elf_is64(ef))
+		img->has_id = read_build_id64(elf_fd(ef), *elf_ehdr64(ef), &img->bid);
+	else
+		img->has_id = read_build_id(elf_fd(ef), *elf_ehdr(ef), &img->bid);
+
+	if(!load_sections(img, ef) || !load_symbols(img, ef)) {
+		*status = ELF_ERR_NOMEM;
+		goto FAIL;
+	}
+
+	img->memory = sizeof(image_t) + strlen(path) + arena_size(img->arena);
+	elf_close(ef);
+	return img;
+
+FAIL:
+	elf_close(ef);
+	free_image(img);
+	return NULL;
+}
+
+/* Cache operations, all with cache->lock held */
+
+static void lru_unlink(image_cache_t *c, image_t *img)
+{
+	if(img->prev)
+		img->prev->next = img->next;
+	else
+		c->head = img->next;
+	if(img->next)
+		img->next->prev = img->prev;
+	else
+		c->tail = img->prev;
+	img->prev = img->next = NULL;
+}
+
+static void lru_push(image_cache_t *c, image_t *img)
+{
+	img->prev = NULL;
+	img->next = c->head;
+	if(c->head)
+		c->head->prev = img;
+	c->head = img;
+	if(!c->tail)
+		c->tail = img;
+}
+
+static image_t * cache_find(image_cache_t *c, const char *path, uint64_t hash)
+{
+	image_t *img;
+
+	for(img=c->buckets[hash & (IMAGE_BUCKETS - 1)]; img; img=img->chain) {
+		if(img->hash == hash && !strcmp(img->path, path))
+			return img;
+	}
+	return NULL;
+}
+
+/* Readers still holding it free it in image_put() */
+static void cache_drop(image_cache_t *c, image_t *img)
+{
+	image_t **p = &c->buckets[img->hash & (IMAGE_BUCKETS - 1)];
+
+	while(*p != img)
+		p = &(*p)->chain;
+	*p = img->chain;
+	lru_unlink(c, img);
+	c->total -= img->memory;
+	img->evicted = true;
+	if(!img->refs)
+		free_image(img);
+}
+
+static void cache_insert(image_cache_t *c, image_t *img)
+{
+	image_t **bucket = &c->buckets[img->hash & (IMAGE_BUCKETS - 1)];
+
+	img->chain = *bucket;
+	*bucket = img;
+	lru_push(c, img);
+	c->total += img->memory;
+
+	/* The newest image stays even if it alone is over budget */
+	while(c->total > c->budget && c->tail != img)
+		cache_drop(c, c->tail);
+}
+
+static bool image_current(const image_t *img, const struct stat *st)
+{
+	return img->dev == st->st_dev && img->ino == st->st_ino
+		&& img->size == st->st_size
+		&& img->mtime.tv_sec == st->st_mtim.tv_sec
+		&& img->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static image_t * image_get(image_cache_t *c, const char *path, elf_status_t *status)
+{
+	uint64_t hash = path_hash(path);
+	image_t *img, *loaded;
+	struct stat st;
+
+	if(stat(path, &st) < 0) {
+		*status = ELF_ERR_OPEN;
+		return NULL;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	img = cache_find(c, path, hash);
+	if(img && !image_current(img, &st)) {
+		cache_drop(c, img);
+		img = NULL;
+	}
+	if(img) {
+		lru_unlink(c, img);
+		lru_push(c, img);
+		img->refs++;
+	}
+	pthread_mutex_unlock(&c->lock);
+	if(img) {
+		*status = ELF_OK;
+		return img;
+	}
+
+	/* Parse outside the lock; if another thread got there first use its copy */
+	loaded = load_image(path, status);
+	if(!loaded)
+		return NULL;
+
+	pthread_mutex_lock(&c->lock);
+	img = cache_find(c, path, hash);
+	if(img && image_current(img, &st)) {
+		free_image(loaded);
+	} else {
+		if(img)
+			cache_drop(c, img);
+		img = loaded;
+		cache_insert(c, img);
+	}
+	img->refs++;
+	pthread_mutex_unlock(&c->lock);
+	return img;
+}
+
+static void image_put(image_cache_t *c, image_t *img)
+{
+	pthread_mutex_lock(&c->lock);
+	if(!--img->refs && img->evicted)
+		free_image(img);
+	pthread_mutex_unlock(&c->lock);
+}
+
+/* Innermost function or object covering addr */
+static const image_sym_t * symbol_at(const image_t *img, uint64_t addr)
+{
+	const image_sym_t *s;
+	uint32_t lo = 0, hi = img->naddr, mid, steps;
+
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(img->by_addr[mid]->value <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	/* Symbols nest rarely and shallowly, a few steps back is enough */
+	for(steps=0; lo-- && steps<SYMBOL_NESTING; steps++) {
+		s = img->by_addr[lo];
+		if(addr < s->value + (s->size ? s->size : 1))
+			return s;
+	}
+	return NULL;
+}
+
+static const image_sym_t * symbol_named(const image_t *img, const char *name)
+{
+	uint32_t lo = 0, hi = img->nsyms, mid;
+	int c;
+
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = strcmp(img->syms[mid].name, name);
+		if(!c)
+			return &img->syms[mid];
+		if(c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static bool recv_full(int32_t fd, void *buf, size_t size)
+{
+	size_t done = 0;
+	ssize_t len;
+
+	while(done < size) {
+		len = recv(fd, (char *)buf + done, size - done, MSG_WAITALL);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return false;
+		done += len;
+	}
+	return true;
+}
+
+static bool send_resp(int32_t fd, int32_t status, struct iovec *payload, uint32_t count)
+{
+	struct iovec iov[3];
+	struct msghdr msg;
+	query_resp_t resp;
+	uint32_t i;
+
+	memset(&resp, 0, sizeof(resp));
+	resp.magic = QUERY_MAGIC;
+	resp.status = status;
+	iov[0].iov_base = &resp;
+	iov[0].iov_len = sizeof(resp);
+	for(i=0; status == ELF_OK && i<count; i++) {
+		iov[i + 1] = payload[i];
+		resp.length += payload[i].iov_len;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = status == ELF_OK ? count + 1 : 1;
+	return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)(sizeof(resp) + resp.length);
+}
+
+static bool send_symbol(int32_t fd, const image_sym_t *s)
+{
+	struct iovec iov[2];
+	query_symbol_t q;
+
+	if(!s)
+		return send_resp(fd, ELF_ERR_NOTFOUND, NULL, 0);
+
+	memset(&q, 0, sizeof(q));
+	q.value = s->value;
+	q.size = s->size;
+	q.info = s->info;
+	q.name_len = s->name_len;
+	iov[0].iov_base = &q;
+	iov[0].iov_len = sizeof(q);
+	iov[1].iov_base = (void *)s->name;
+	iov[1].iov_len = s->name_len;
+	return send_resp(fd, ELF_OK, iov, 2);
+}
+
+/* One request; false when the connection should be closed */
+static bool serve_request(server_t *srv, int32_t fd)
+{
+	char path[QUERY_PATH_MAX + 1], name[QUERY_NAME_MAX + 1];
+	const image_sec_t *sec = NULL;
+	struct iovec iov;
+	query_req_t req;
+	elf_status_t status;
+	image_t *img;
+	uint32_t i;
+	bool ok;
+
+	if(!recv_full(fd, &req, sizeof(req)))
+		return false;
+	if(req.magic != QUERY_MAGIC || req.flags || !req.path_len
+			|| req.path_len > QUERY_PATH_MAX || req.name_len > QUERY_NAME_MAX)
+		return false;
+	if(!recv_full(fd, path, req.path_len) || !recv_full(fd, name, req.name_len))
+		return false;
+	path[req.path_len] = '\0';
+	name[req.name_len] = '\0';
+
+	img = image_get(&srv->cache, path, &status);
+	if(!img)
+		return send_resp(fd, status, NULL, 0);
+
+	switch(req.op)
+	{
+		case QUERY_BUILD_ID:
+			iov.iov_base = img->bid.id;
+			iov.iov_len = img->bid.len;
+			ok = send_resp(fd, img->has_id ? ELF_OK : ELF_ERR_NOTFOUND, &iov, 1);
+			break;
+		case QUERY_SECTION:
+			for(i=0; i<img->nsecs && !sec; i++) {
+				if(!strcmp(img->secs[i].name, name))
+					sec = &img->secs[i];
+			}
+			iov.iov_base = sec ? (void *)&sec->q : NULL;
+			iov.iov_len = sizeof(query_section_t);
+			ok = send_resp(fd, sec ? ELF_OK : ELF_ERR_NOTFOUND, &iov, 1);
+			break;
+		case QUERY_SYMBOL_AT:
+			ok = send_symbol(fd, symbol_at(img, req.arg));
+			break;
+		case QUERY_SYMBOL:
+			ok = send_symbol(fd, symbol_named(img, name));
+			break;
+		default:
+			ok = send_resp(fd, ELF_ERR_FORMAT, NULL, 0);
+			break;
+	}
+
+	image_put(&srv->cache, img);
+	return ok;
+}
+
+static void accept_clients(server_t *srv)
+{
+	struct timeval tv = { .tv_sec = RECV_TIMEOUT };
+	struct epoll_event ev;
+	int32_t fd;
+
+	while((fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		/* A client that stops half way through a request loses it */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+		ev.data.fd = fd;
+		if(epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+			close(fd);
+	}
+}
+
+static void * serve_worker(void *arg)
+{
+	server_t *srv = arg;
+	struct epoll_event ev;
+	int32_t n, fd;
+
+	for(;;) {
+		n = epoll_wait(srv->epoll_fd, &ev, 1, -1);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			break;
+
+		fd = ev.data.fd;
+		if(fd == srv->listen_fd) {
+			accept_clients(srv);
+			continue;
+		}
+
+		/* Oneshot: nobody else sees fd until it is re-armed */
+		if((ev.events & EPOLLIN) && serve_request(srv, fd)) {
+			ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+			if(epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+				continue;
+		}
+		epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+	}
+	return NULL;
+}
+
+int daemon_serve(const char *socket_path, uint64_t budget)
+{
+	pthread_t threads[MAX_THREADS];
+	struct sockaddr_un addr;
+	struct epoll_event ev;
+	struct stat st;
+	server_t srv;
+	int32_t i, nthreads;
+
+	memset(&srv, 0, sizeof(srv));
+	pthread_mutex_init(&srv.cache.lock, NULL);
+	srv.cache.budget = budget;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", socket_path);
+		return 1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	/* A socket left behind by an earlier run */
+	if(lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(socket_path);
+
+	srv.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	ev.events = EPOLLIN;
+	ev.data.fd = srv.listen_fd;
+	if(srv.listen_fd < 0 || srv.epoll_fd < 0
+			|| bind(srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(srv.listen_fd, SOMAXCONN) < 0
+			|| epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &ev) < 0) {
+		fprintf(stderr, "Error %d Unable to listen on %s\n", errno, socket_path);
+		if(srv.listen_fd >= 0)
+			close(srv.listen_fd);
+		if(srv.epoll_fd >= 0)
+			close(srv.epoll_fd);
+		return 1;
+	}
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(nthreads < 1)
+		nthreads = 1;
+	if(nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+	fprintf(stderr, "listening on %s, %d threads, %lu MiB budget\n",
+			socket_path, nthreads, budget >> 20);
+
+	for(i=1; i<nthreads; i++) {
+		if(pthread_create(&threads[i], NULL, serve_worker, &srv))
+			threads[i] = 0;	/* fewer workers, same service */
+	}
+	serve_worker(&srv);
+	for(i=1; i<nthreads; i++) {
+		if(threads[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	fprintf(stderr, "Error %d Serving %s stopped\n", errno, socket_path);
+	close(srv.epoll_fd);
+	close(srv.listen_fd);
+	return 1;
+}
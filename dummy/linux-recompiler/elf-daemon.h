@@ -0,0 +1,77 @@
+#ifndef _ELF_DAEMON_H
+#define _ELF_DAEMON_H
+
+#include "elf-file.h"
+
+/* Query server on a Unix stream socket.
+ *
+ * Parsed images (section table, symbols sorted by address and by name,
+ * build-id) stay resident between queries and are dropped least
+ * recently used first once they take more than the memory budget.  An
+ * image is reloaded when the file's inode, size or mtime change.  The
+ * worker threads share one epoll set, so any number of clients can keep
+ * connections open and each request is served by whichever thread is
+ * free.
+ *
+ * Messages are in host byte order.  A request is a query_req_t followed
+ * by path_len bytes of path and name_len bytes of name (neither NUL
+ * terminated); the answer is a query_resp_t followed by length bytes of
+ * payload.  status is ELF_OK or a negative elf_status_t, and there is
+ * no payload unless it is ELF_OK:
+ *
+ *   QUERY_BUILD_ID   -               the raw build-id
+ *   QUERY_SECTION    name            query_section_t
+ *   QUERY_SYMBOL_AT  arg = address   query_symbol_t, then the name
+ *   QUERY_SYMBOL     name            query_symbol_t, then the name
+ *
+ * QUERY_SYMBOL_AT returns the function or object symbol covering the
+ * address.  Paths are taken as given, relative ones resolve against the
+ * daemon's working directory.
+ */
+
+#define QUERY_MAGIC	0x51464c45	/* "ELFQ" */
+#define QUERY_PATH_MAX	4096
+#define QUERY_NAME_MAX	4096
+
+typedef enum query_op {
+	QUERY_BUILD_ID = 1,
+	QUERY_SECTION = 2,
+	QUERY_SYMBOL_AT = 3,
+	QUERY_SYMBOL = 4
+} query_op_t;
+
+typedef struct query_req {
+	uint32_t magic;
+	uint16_t op;
+	uint16_t flags;		/* 0 */
+	uint32_t path_len;
+	uint32_t name_len;
+	uint64_t arg;
+} query_req_t;
+
+typedef struct query_resp {
+	uint32_t magic;
+	int32_t status;
+	uint32_t length;
+	uint32_t reserved;
+} query_resp_t;
+
+typedef struct query_section {
+	uint64_t addr;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t flags;
+	uint32_t index;
+	uint32_t type;
+} query_section_t;
+
+typedef struct query_symbol {
+	uint64_t value;
+	uint64_t size;
+	uint32_t info;		/* st_info */
+	uint32_t name_len;
+} query_symbol_t;
+
+int daemon_serve(const char *socket_path, uint64_t budget);
+
+#endif /* _ELF_DAEMON_H */
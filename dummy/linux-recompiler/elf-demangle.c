@@ -0,0 +1,217 @@
+#include <pthread.h>
+
+#include "elf-demangle.h"
+#include "elf-arena.h"
+#include "elf-stats.h"
+
+#define MAX_THREADS		64
+#define PARALLEL_MIN_NAMES	2048	/* below this a thread costs more than it saves */
+
+/* libstdc++, declared here so that this file stays C */
+char * __cxa_demangle(const char *mangled, char *buf, size_t *len, int *status);
+
+typedef struct demangle_work {
+	const char *str_tbl;
+	const uint32_t *uniq;	/* string table offsets, one per distinct name */
+	uint32_t first, count;
+	uint64_t *result;	/* 1 + offset into text, 0 if it did not demangle */
+	char *text;		/* results of this slice, NUL separated */
+	size_t used, size;
+} demangle_work_t;
+
+static bool enabled;
+
+void demangle_enable(bool on)
+{
+	enabled = on;
+}
+
+bool demangle_enabled(void)
+{
+	return enabled;
+}
+
+/* s and then tail, as one string */
+static bool append(demangle_work_t *w, const char *s, size_t len, const char *tail)
+{
+	size_t tail_len = strlen(tail);
+	char *p;
+
+	len += tail_len;
+	if(w->used + len + 1 > w->size) {
+		size_t size = w->size ? w->size * 2 : 1 << 16;
+		while(size < w->used + len + 1)
+			size *= 2;
+		p = realloc(w->text, size);
+		if(!p)
+			return false;
+		w->text = p;
+		w->size = size;
+	}
+	memcpy(w->text + w->used, s, len - tail_len);
+	memcpy(w->text + w->used + len - tail_len, tail, tail_len + 1);
+	w->used += len + 1;
+	return true;
+}
+
+static void * demangle_worker(void *arg)
+{
+	demangle_work_t *w = arg;
+	char *buf = NULL, *out, *base = NULL, *p;
+	const char *name, *ver;
+	size_t len = 0, base_size = 0;
+	uint32_t i;
+	int status;
+
+	for(i=w->first; i<w->first + w->count; i++) {
+		name = w->str_tbl + w->uniq[i];
+
+		/* Versioned references read name@VER or name@@VER; mangled
+		 * names never hold an '@', so the suffix is cut off for the
+		 * demangler and put back on its result
+		 */
+		ver = strchr(name, '@');
+		if(ver) {
+			if((size_t)(ver - name) + 1 > base_size) {
+				p = realloc(base, ver - name + 1);
+				if(!p)
+					continue;
+				base = p;
+				base_size = ver - name + 1;
+			}
+			memcpy(base, name, ver - name);
+			base[ver - name] = 0;
+			name = base;
+		}
+
+		/* buf is reused, __cxa_demangle grows it as needed */
+		out = __cxa_demangle(name, buf, &len, &status);
+		if(!out)
+			continue;
+		buf = out;
+		w->result[i] = w->used + 1;
+		if(!append(w, out, strlen(out), ver ? ver : ""))
+			w->result[i] = 0;
+	}
+	free(base);
+	free(buf);
+	return NULL;
+}
+
+static inline uint32_t offset_hash(uint32_t off)
+{
+	return off * 0x9e3779b1u;
+}
+
+char * demangle_table(const char *str_tbl, uint64_t str_size,
+		const uint32_t *names, uint32_t count, const char **out)
+{
+	demangle_work_t work[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	uint32_t *slot_off = NULL, *slot_id = NULL, *uniq = NULL, *ids = NULL;
+	uint64_t *result = NULL;
+	uint32_t i, k, nuniq = 0, mask, nthreads = 1, per;
+	size_t total = 0;
+	char *text = NULL;
+
+	memset(out, 0, count * sizeof(*out));
+	if(!str_tbl || !count)
+		return NULL;
+
+	/* Open addressing on the string table offset: the offset is the
+	 * interned id, same offset same name
+	 */
+	for(mask=1; mask < count * 2; mask <<= 1)
+		;
+	slot_off = malloc(mask * sizeof(uint32_t));
+	slot_id = malloc(mask * sizeof(uint32_t));
+	uniq = malloc(count * sizeof(uint32_t));
+	ids = malloc(count * sizeof(uint32_t));
+	if(!slot_off || !slot_id || !uniq || !ids)
+		goto EXIT;
+	memset(slot_off, 0xff, mask * sizeof(uint32_t));
+	mask--;
+
+	for(i=0; i<count; i++) {
+		uint32_t off = names[i];
+		ids[i] = UINT32_MAX;
+		if(off + 2ULL >= str_size || str_tbl[off] != '_' || str_tbl[off + 1] != 'Z'
+				|| !memchr(str_tbl + off, 0, str_size - off))
+			continue;
+		for(k=offset_hash(off) & mask; slot_off[k] != UINT32_MAX && slot_off[k] != off;
+				k=(k + 1) & mask)
+			;
+		if(slot_off[k] == UINT32_MAX) {
+			slot_off[k] = off;
+			slot_id[k] = nuniq;
+			uniq[nuniq++] = off;
+		}
+		ids[i] = slot_id[k];
+	}
+	if(!nuniq)
+		goto EXIT;
+
+	result = calloc(nuniq, sizeof(uint64_t));
+	if(!result)
+		goto EXIT;
+
+	if(nuniq >= PARALLEL_MIN_NAMES) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(nthreads < 1)
+			nthreads = 1;
+		if(nthreads > MAX_THREADS)
+			nthreads = MAX_THREADS;
+	}
+
+	per = (nuniq + nthreads - 1) / nthreads;
+	memset(work, 0, sizeof(work));
+	for(i=0; i<nthreads; i++) {
+		work[i].str_tbl = str_tbl;
+		work[i].uniq = uniq;
+		work[i].result = result;
+		work[i].first = i * per < nuniq ? i * per : nuniq;
+		work[i].count = nuniq - work[i].first < per ? nuniq - work[i].first : per;
+	}
+	for(i=1; i<nthreads; i++) {
+		if(pthread_create(&threads[i], NULL, demangle_worker, &work[i])) {
+			threads[i] = 0;
+			demangle_worker(&work[i]);	/* do its share here */
+		}
+	}
+	demangle_worker(&work[0]);
+	for(i=1; i<nthreads; i++) {
+		if(threads[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	/* One block from the file's arena for all of them */
+	for(i=0; i<nthreads; i++)
+		total += work[i].used;
+	text = section_alloc(total + 1);
+	stats_alloc(total + 1);
+	if(text) {
+		total = 0;
+		for(i=0; i<nthreads; i++) {
+			memcpy(text + total, work[i].text, work[i].used);
+			for(k=work[i].first; k<work[i].first + work[i].count; k++) {
+				if(result[k])
+					result[k] += total;
+			}
+			total += work[i].used;
+		}
+		for(i=0; i<count; i++) {
+			if(ids[i] != UINT32_MAX && result[ids[i]])
+				out[i] = text + result[ids[i]] - 1;
+		}
+	}
+	for(i=0; i<nthreads; i++)
+		free(work[i].text);
+
+EXIT:
+	free(result);
+	free(ids);
+	free(uniq);
+	free(slot_id);
+	free(slot_off);
+	return text;
+}
@@ -0,0 +1,27 @@
+#ifndef _ELF_DEMANGLE_H
+#define _ELF_DEMANGLE_H
+
+#include "elf-parser.h"
+
+/* C++ names for the symbol dumps (-C).
+ *
+ * The demangler is the one in the C++ runtime (__cxa_demangle), so the
+ * program links with -lstdc++.  A table is demangled in one go before
+ * it is printed: names are interned by their string table offset, each
+ * distinct _Z name is demangled once, the work is split across threads
+ * for large tables, and the results end up in one buffer taken from the
+ * current arena.  With demangling off the dumps never get here.
+ */
+
+void demangle_enable(bool on);
+bool demangle_enabled(void);
+
+/* out[i] is the demangled form of the name at str_tbl + names[i], NULL
+ * when it is not a C++ name.  A name@VER or name@@VER suffix is kept on
+ * the demangled form.  Returns the buffer the strings live in,
+ * for section_free(), or NULL if there was nothing to demangle.
+ */
+char * demangle_table(const char *str_tbl, uint64_t str_size,
+		const uint32_t *names, uint32_t count, const char **out);
+
+#endif /* _ELF_DEMANGLE_H */
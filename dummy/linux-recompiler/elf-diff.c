@@ -0,0 +1,577 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "elf-diff.h"
+#include "elf-swap.h"
+#include "elf-stats.h"
+
+/* Content-defined chunking: a cut is placed where the gear hash of the
+ * last 64 bytes has its low bits clear, so boundaries follow the data
+ * and re-synchronise right after an insertion or deletion.
+ */
+#define CDC_MIN		(2 << 10)
+#define CDC_MAX		(64 << 10)
+#define CDC_MASK	((1 << 13) - 1)	/* 8 KiB chunks on average */
+#define CDC_THRESHOLD	(64 << 10)	/* below this the first difference is enough */
+#define MAX_RANGES	16		/* changed ranges listed per section */
+
+typedef struct diff_sec {
+	const char *name;
+	uint64_t addr;
+	uint64_t size;
+	uint64_t flags;
+	uint32_t type;
+	int32_t match;		/* index in the other file, -1 if none */
+} diff_sec_t;
+
+typedef struct diff_sym {
+	const char *name;
+	uint64_t value;
+	uint64_t size;
+} diff_sym_t;
+
+typedef struct side {
+	const char *path;
+	elf_file_t *ef;
+	diff_sec_t *secs;
+	uint32_t nsecs;
+	diff_sym_t *syms;
+	uint64_t nsyms;
+	elf_view_t symtab;
+	elf_view_t strtab;
+} side_t;
+
+typedef struct chunk {
+	uint64_t offset;
+	uint64_t length;
+	uint64_t hash;
+} chunk_t;
+
+typedef struct diff_count {
+	uint64_t sec_added, sec_removed, sec_changed;
+	uint64_t sym_added, sym_removed, sym_resized, sym_moved;
+} diff_count_t;
+
+static uint64_t gear[256];
+
+static void gear_init(void)
+{
+	uint64_t x = 0x9e3779b97f4a7c15;
+	uint32_t i;
+
+	/* splitmix64, any fixed table works as long as both sides agree */
+	for(i=0; i<256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		gear[i] = z ^ (z >> 31);
+	}
+}
+
+/* Offset of the first differing byte, n if the ranges are equal */
+static uint64_t first_difference(const uint8_t *a, const uint8_t *b, uint64_t n)
+{
+	uint64_t i = 0;
+
+#ifdef __SSE2__
+	/* 64 bytes per round while they match, then narrow down */
+	for(; i + 64 <= n; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+				_mm_loadu_si128((const __m128i *)(b + i)));
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+				_mm_loadu_si128((const __m128i *)(b + i + 16)));
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+				_mm_loadu_si128((const __m128i *)(b + i + 32)));
+		__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+				_mm_loadu_si128((const __m128i *)(b + i + 48)));
+		__m128i all = _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+		if(_mm_movemask_epi8(all) != 0xffff)
+			break;
+	}
+	for(; i + 16 <= n; i += 16) {
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *)(a + i)),
+				_mm_loadu_si128((const __m128i *)(b + i))));
+		if(mask != 0xffff)
+			return i + __builtin_ctz(~mask);
+	}
+#endif
+	for(; i<n; i++) {
+		if(a[i] != b[i])
+			return i;
+	}
+	return n;
+}
+
+static uint64_t cdc_cut(const uint8_t *p, uint64_t n)
+{
+	uint64_t h = 0, i, end;
+
+	if(n <= CDC_MIN)
+		return n;
+
+	end = n < CDC_MAX ? n : CDC_MAX;
+	for(i=CDC_MIN; i<end; i++) {
+		h = (h << 1) + gear[p[i]];
+		if(!(h & CDC_MASK))
+			return i + 1;
+	}
+	return end;
+}
+
+static uint64_t chunk_hash(const uint8_t *p, uint64_t n)
+{
+	uint64_t h = n * 0x9e3779b97f4a7c15, w;
+	uint64_t i;
+
+	for(i=0; i + 8 <= n; i += 8) {
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccd;
+		h ^= h >> 32;
+	}
+	for(; i<n; i++)
+		h = (h ^ p[i]) * 0x100000001b3;
+	return h ? h : 1;	/* 0 marks an empty slot */
+}
+
+static chunk_t * chunk_data(arena_t *arena, const uint8_t *p, uint64_t n, uint64_t *count)
+{
+	chunk_t *c = arena_alloc(arena, (n / CDC_MIN + 1) * sizeof(chunk_t));
+	uint64_t off = 0, len;
+
+	*count = 0;
+	if(!c)
+		return NULL;
+
+	while(off < n) {
+		len = cdc_cut(p + off, n - off);
+		c[*count].offset = off;
+		c[*count].length = len;
+		c[*count].hash = chunk_hash(p + off, len);
+		(*count)++;
+		off += len;
+	}
+	return c;
+}
+
+/* Lists the ranges of the new section that are not made of chunks
+ * found anywhere in the old one.
+ */
+static void report_chunks(arena_t *arena,
+		const uint8_t *a, uint64_t na,
+		const uint8_t *b, uint64_t nb)
+{
+	chunk_t *ca, *cb;
+	uint64_t *set, mask, h, i, k, count_a, count_b;
+	uint64_t changed = 0, changed_bytes = 0, ranges = 0, start = 0, end = 0;
+	bool open = false;
+
+	ca = chunk_data(arena, a, na, &count_a);
+	cb = chunk_data(arena, b, nb, &count_b);
+	for(mask=1; mask < count_a * 2; mask <<= 1)
+		;
+	set = arena_alloc(arena, mask * sizeof(uint64_t));
+	if(!ca || !cb || !set)
+		return;
+	memset(set, 0, mask * sizeof(uint64_t));
+	mask--;
+
+	for(i=0; i<count_a; i++) {
+		for(k=ca[i].hash & mask; set[k] && set[k] != ca[i].hash; k=(k+1) & mask)
+			;
+		set[k] = ca[i].hash;
+	}
+
+	for(i=0; i<=count_b; i++) {
+		bool found = true;
+		if(i < count_b) {
+			h = cb[i].hash;
+			for(k=h & mask; set[k] && set[k] != h; k=(k+1) & mask)
+				;
+			found = set[k] == h;
+		}
+
+		if(!found) {
+			changed++;
+			changed_bytes += cb[i].length;
+			if(!open)
+				start = cb[i].offset;
+			end = cb[i].offset + cb[i].length;
+			open = true;
+		} else if(open) {
+			if(ranges < MAX_RANGES)
+				printf("      new 0x%08lx-0x%08lx changed\n", start, end);
+			ranges++;
+			open = false;
+		}
+	}
+
+	if(ranges > MAX_RANGES)
+		printf("      ... %lu more ranges\n", ranges - MAX_RANGES);
+	printf("      %lu of %lu chunks changed, 0x%lx bytes\n",
+			changed, count_b, changed_bytes);
+}
+
+static bool load_sections(side_t *s)
+{
+	elf_file_t *ef = s->ef;
+	uint32_t i;
+	const char *name;
+
+	s->nsecs = elf_section_count(ef);
+	s->secs = arena_alloc(elf_arena(ef), (s->nsecs + 1) * sizeof(diff_sec_t));
+	if(!s->secs)
+		return false;
+
+	for(i=0; i<s->nsecs; i++) {
+		diff_sec_t *d = &s->secs[i];
+		name = elf_section_name(ef, i);
+		d->name = name ? name : "";
+		d->match = -1;
+		if(elf_is64(ef)) {
+			Elf64_Shdr *sh = &elf_shdrs64(ef)[i];
+			d->addr = sh->sh_addr;
+			d->size = sh->sh_size;
+			d->flags = sh->sh_flags;
+			d->type = sh->sh_type;
+		} else {
+			Elf32_Shdr *sh = &elf_shdrs(ef)[i];
+			d->addr = sh->sh_addr;
+			d->size = sh->sh_size;
+			d->flags = sh->sh_flags;
+			d->type = sh->sh_type;
+		}
+	}
+	return true;
+}
+
+static int cmp_sym(const void *a, const void *b)
+{
+	const diff_sym_t *x = a, *y = b;
+	int c = strcmp(x->name, y->name);
+
+	if(c)
+		return c;
+	return x->value < y->value ? -1 : x->value > y->value;
+}
+
+/* .symtab if there is one, .dynsym otherwise; sorted by name */
+static bool load_symbols(side_t *s)
+{
+	elf_file_t *ef = s->ef;
+	uint32_t i, idx = 0, link = 0, type, info;
+	uint64_t count, entsize, name, j;
+	bool swap, found = false;
+	uint8_t *raw;
+
+	for(i=0; i<s->nsecs; i++) {
+		if(s->secs[i].type == SHT_SYMTAB) {
+			idx = i;
+			found = true;
+			break;
+		}
+		if(s->secs[i].type == SHT_DYNSYM && !found) {
+			idx = i;
+			found = true;
+		}
+	}
+	if(!found)
+		return true;
+
+	/* Without names there is nothing to pair symbols by */
+	link = elf_is64(ef) ? elf_shdrs64(ef)[idx].sh_link : elf_shdrs(ef)[idx].sh_link;
+	if(elf_section_view(ef, idx, &s->symtab) != ELF_OK)
+		return false;
+	if(!s->symtab.data || elf_section_view(ef, link, &s->strtab) != ELF_OK
+			|| !s->strtab.data)
+		return true;
+
+	entsize = elf_is64(ef) ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	count = s->symtab.size / entsize;
+	raw = arena_alloc(elf_arena(ef), count * entsize + 1);
+	s->syms = arena_alloc(elf_arena(ef), (count + 1) * sizeof(diff_sym_t));
+	if(!raw || !s->syms)
+		return false;
+
+	/* The mapping is in file byte order */
+	memcpy(raw, s->symtab.data, count * entsize);
+	swap = elf_swapped(elf_is64(ef) ? elf_ehdr64(ef)->e_ident : elf_ehdr(ef)->e_ident);
+	if(swap && elf_is64(ef))
+		swap_sym_table64((Elf64_Sym *)raw, count);
+	else if(swap)
+		swap_sym_table((Elf32_Sym *)raw, count);
+
+	for(j=0; j<count; j++) {
+		diff_sym_t *d = &s->syms[s->nsyms];
+		if(elf_is64(ef)) {
+			Elf64_Sym *sym = (Elf64_Sym *)raw + j;
+			name = sym->st_name;
+			info = sym->st_info;
+			d->value = sym->st_value;
+			d->size = sym->st_size;
+		} else {
+			Elf32_Sym *sym = (Elf32_Sym *)raw + j;
+			name = sym->st_name;
+			info = sym->st_info;
+			d->value = sym->st_value;
+			d->size = sym->st_size;
+		}
+
+		/* Section and file symbols only restate the section table */
+		type = ELF32_ST_TYPE(info);
+		if(!name || type == STT_SECTION || type == STT_FILE || name >= s->strtab.size
+				|| !memchr(s->strtab.data + name, 0, s->strtab.size - name))
+			continue;
+		d->name = (const char *)s->strtab.data + name;
+		s->nsyms++;
+	}
+
+	qsort(s->syms, s->nsyms, sizeof(diff_sym_t), cmp_sym);
+	stats_add(STAT_SYMBOLS, s->nsyms);
+	return true;
+}
+
+static int cmp_sec(const void *a, const void *b)
+{
+	const diff_sec_t *x = *(const diff_sec_t * const *)a, *y = *(const diff_sec_t * const *)b;
+	int c = strcmp(x->name, y->name);
+
+	return c ? c : (x < y ? -1 : x > y);
+}
+
+/* Same-named sections (.text of -ffunction-sections objects, groups)
+ * pair up in table order.
+ */
+static bool match_sections(side_t *a, side_t *b)
+{
+	diff_sec_t **sa, **sb;
+	uint32_t i = 0, j = 0;
+	int c;
+
+	sa = arena_alloc(elf_arena(a->ef), (a->nsecs + 1) * sizeof(diff_sec_t *));
+	sb = arena_alloc(elf_arena(b->ef), (b->nsecs + 1) * sizeof(diff_sec_t *));
+	if(!sa || !sb)
+		return false;
+	for(i=0; i<a->nsecs; i++)
+		sa[i] = &a->secs[i];
+	for(i=0; i<b->nsecs; i++)
+		sb[i] = &b->secs[i];
+	qsort(sa, a->nsecs, sizeof(*sa), cmp_sec);
+	qsort(sb, b->nsecs, sizeof(*sb), cmp_sec);
+
+	i = 0;
+	while(i < a->nsecs && j < b->nsecs) {
+		c = strcmp(sa[i]->name, sb[j]->name);
+		if(c < 0) {
+			i++;
+		} else if(c > 0) {
+			j++;
+		} else {
+			sa[i]->match = sb[j] - b->secs;
+			sb[j]->match = sa[i] - a->secs;
+			i++;
+			j++;
+		}
+	}
+	return true;
+}
+
+static bool compare_section(side_t *a, side_t *b, uint32_t ia, diff_count_t *count)
+{
+	diff_sec_t *x = &a->secs[ia], *y = &b->secs[x->match];
+	elf_view_t va, vb;
+	uint64_t off = 0;
+	bool differs = false, chunked = false;
+
+	memset(&va, 0, sizeof(va));
+	memset(&vb, 0, sizeof(vb));
+	if(x->type != SHT_NOBITS && y->type != SHT_NOBITS) {
+		if(elf_section_view(a->ef, ia, &va) != ELF_OK
+				|| elf_section_view(b->ef, x->match, &vb) != ELF_OK) {
+			printf("  ! %s: cannot read contents\n", x->name);
+			elf_view_release(&va);
+			return false;
+		}
+		if(va.size == vb.size) {
+			off = va.size ? first_difference(va.data, vb.data, va.size) : 0;
+			differs = off < va.size;
+		} else {
+			off = first_difference(va.data, vb.data, va.size < vb.size ? va.size : vb.size);
+			differs = true;
+		}
+		chunked = differs && va.size >= CDC_THRESHOLD && vb.size >= CDC_THRESHOLD;
+	}
+
+	if(!differs && x->type == y->type && x->flags == y->flags
+			&& x->size == y->size && x->addr == y->addr)
+		goto EXIT;
+
+	count->sec_changed++;
+	printf("  ~ %s", x->name);
+	if(x->type != y->type)
+		printf(" type 0x%x -> 0x%x", x->type, y->type);
+	if(x->flags != y->flags)
+		printf(" flags 0x%lx -> 0x%lx", x->flags, y->flags);
+	if(x->size != y->size)
+		printf(" size 0x%lx -> 0x%lx", x->size, y->size);
+	if(x->addr != y->addr)
+		printf(" addr 0x%lx -> 0x%lx", x->addr, y->addr);
+	if(differs)
+		printf(" contents differ from 0x%lx", off);
+	printf("\n");
+
+	if(chunked)
+		report_chunks(elf_arena(b->ef), va.data, va.size, vb.data, vb.size);
+
+EXIT:
+	elf_view_release(&va);
+	elf_view_release(&vb);
+	return true;
+}
+
+static void diff_sections(side_t *a, side_t *b, diff_count_t *count)
+{
+	uint32_t i;
+
+	printf("[sections]\n");
+	for(i=0; i<a->nsecs; i++) {
+		if(a->secs[i].match < 0) {
+			printf("  - %s size 0x%lx\n", a->secs[i].name, a->secs[i].size);
+			count->sec_removed++;
+		} else {
+			compare_section(a, b, i, count);
+		}
+	}
+	for(i=0; i<b->nsecs; i++) {
+		if(b->secs[i].match < 0) {
+			printf("  + %s size 0x%lx\n", b->secs[i].name, b->secs[i].size);
+			count->sec_added++;
+		}
+	}
+	stats_add(STAT_SECTIONS, a->nsecs + b->nsecs);
+}
+
+static void diff_symbols(side_t *a, side_t *b, diff_count_t *count)
+{
+	uint64_t i = 0, j = 0, ri, rj, k;
+	diff_sym_t *x, *y;
+	int c;
+
+	printf("[symbols]\n");
+	while(i < a->nsyms || j < b->nsyms) {
+		if(i == a->nsyms)
+			c = 1;
+		else if(j == b->nsyms)
+			c = -1;
+		else
+			c = strcmp(a->syms[i].name, b->syms[j].name);
+
+		if(c < 0) {
+			printf("  - %s\n", a->syms[i++].name);
+			count->sym_removed++;
+			continue;
+		}
+		if(c > 0) {
+			printf("  + %s 0x%08lx size %lu\n", b->syms[j].name,
+					b->syms[j].value, b->syms[j].size);
+			j++;
+			count->sym_added++;
+			continue;
+		}
+
+		/* Runs of the same name pair up in address order */
+		for(ri=i+1; ri<a->nsyms && !strcmp(a->syms[ri].name, a->syms[i].name); ri++)
+			;
+		for(rj=j+1; rj<b->nsyms && !strcmp(b->syms[rj].name, b->syms[j].name); rj++)
+			;
+		for(k=0; i+k<ri && j+k<rj; k++) {
+			x = &a->syms[i+k];
+			y = &b->syms[j+k];
+			if(x->size != y->size) {
+				printf("  ~ %s size %lu -> %lu", x->name, x->size, y->size);
+				if(x->value != y->value)
+					printf(" at 0x%08lx -> 0x%08lx", x->value, y->value);
+				printf("\n");
+				count->sym_resized++;
+			} else if(x->value != y->value) {
+				printf("  > %s 0x%08lx -> 0x%08lx\n", x->name, x->value, y->value);
+				count->sym_moved++;
+			}
+		}
+		for(; i+k<ri; k++) {
+			printf("  - %s\n", a->syms[i+k].name);
+			count->sym_removed++;
+		}
+		for(k=rj-j>ri-i ? ri-i : rj-j; j+k<rj; k++) {
+			printf("  + %s 0x%08lx size %lu\n", b->syms[j+k].name,
+					b->syms[j+k].value, b->syms[j+k].size);
+			count->sym_added++;
+		}
+		i = ri;
+		j = rj;
+	}
+}
+
+static bool open_side(side_t *s, const char *path)
+{
+	elf_status_t status;
+
+	s->path = path;
+	status = elf_open(path, &s->ef);
+	if(status == ELF_OK)
+		status = elf_read_shdrs(s->ef);
+	if(status != ELF_OK) {
+		printf("%s: %s\n", path, elf_strerror(status));
+		return false;
+	}
+	if(!load_sections(s)) {
+		printf("%s: %s\n", path, elf_strerror(ELF_ERR_NOMEM));
+		return false;
+	}
+	if(!load_symbols(s)) {
+		printf("%s: cannot read symbols\n", path);
+		return false;
+	}
+	return true;
+}
+
+static void close_side(side_t *s)
+{
+	elf_view_release(&s->symtab);
+	elf_view_release(&s->strtab);
+	elf_close(s->ef);
+}
+
+int elf_diff(const char *old_path, const char *new_path)
+{
+	side_t a, b;
+	diff_count_t count;
+	int ret = 2;
+
+	gear_init();
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	memset(&count, 0, sizeof(count));
+	if(!open_side(&a, old_path) || !open_side(&b, new_path))
+		goto EXIT;
+	if(!match_sections(&a, &b)) {
+		printf("%s\n", elf_strerror(ELF_ERR_NOMEM));
+		goto EXIT;
+	}
+
+	printf("--- %s\n+++ %s\n", old_path, new_path);
+	diff_sections(&a, &b, &count);
+	diff_symbols(&a, &b, &count);
+
+	printf("sections: %lu added, %lu removed, %lu changed\n",
+			count.sec_added, count.sec_removed, count.sec_changed);
+	printf("symbols: %lu added, %lu removed, %lu resized, %lu moved\n",
+			count.sym_added, count.sym_removed, count.sym_resized, count.sym_moved);
+	ret = memcmp(&count, &(diff_count_t){ 0 }, sizeof(count)) ? 1 : 0;
+
+EXIT:
+	close_side(&a);
+	close_side(&b);
+	return ret;
+}
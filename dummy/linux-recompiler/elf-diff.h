@@ -0,0 +1,26 @@
+#ifndef _ELF_DIFF_H
+#define _ELF_DIFF_H
+
+#include "elf-file.h"
+
+/* Structural diff of two ELF files.
+ *
+ * Sections are paired by name and symbols by name (same-named locals
+ * in address order).  Section bodies are compared in place through
+ * read-only mappings; when a large section differs it is cut into
+ * content-defined chunks so that an insertion shows up as one changed
+ * range instead of everything behind it.  The report is printed while
+ * it is produced:
+ *
+ *   - name           only in the old file
+ *   + name           only in the new file
+ *   ~ name ...       size, type, flags or contents changed
+ *   > name ...       symbol moved to another address
+ *
+ * Returns 0 when nothing changed, 1 when something did and 2 when one
+ * of the files could not be read, like diff(1).
+ */
+
+int elf_diff(const char *old_path, const char *new_path);
+
+#endif /* _ELF_DIFF_H */
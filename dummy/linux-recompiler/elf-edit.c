@@ -0,0 +1,457 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elf-edit.h"
+#include "elf-arena.h"
+#include "elf-stats.h"
+
+#define EDIT_NODE_CHUNK	(64 << 10)
+#define EDIT_ADD_CHUNK	(1 << 20)	/* add buffer grows by this much */
+
+typedef struct piece {
+	struct piece *left;
+	struct piece *right;
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t origin;	/* EDIT_ADDED or the offset in the file */
+	uint64_t total;		/* bytes in this subtree */
+	uint32_t prio;		/* heap order, a parent is never below its children */
+} piece_t;
+
+typedef struct version {
+	piece_t *root;
+	edit_change_t change;	/* how it came from the one before */
+} version_t;
+
+struct edit_buf {
+	int32_t fd;
+	bool owns_fd;
+	uint64_t file_size;
+	void *map;		/* the original, whole */
+	arena_t *nodes;		/* every version's nodes */
+	arena_t *added;		/* the add buffer */
+	uint8_t *add_tail;	/* free space left in its newest chunk */
+	size_t add_left;
+	version_t *versions;	/* [0] is the file as opened */
+	edit_change_t *changes;	/* versions[i + 1].change, for edit_history() */
+	uint32_t count;		/* versions kept, redo included */
+	uint32_t current;
+	uint32_t size;
+	uint32_t seed;
+};
+
+static inline uint64_t total(const piece_t *p)
+{
+	return p ? p->total : 0;
+}
+
+static uint32_t next_prio(edit_buf_t *eb)
+{
+	/* xorshift32, random enough to keep the treap balanced */
+	eb->seed ^= eb->seed << 13;
+	eb->seed ^= eb->seed >> 17;
+	eb->seed ^= eb->seed << 5;
+	return eb->seed;
+}
+
+static piece_t * node_new(edit_buf_t *eb, const piece_t *from)
+{
+	piece_t *p = arena_alloc(eb->nodes, sizeof(piece_t));
+
+	if(p && from)
+		*p = *from;
+	return p;
+}
+
+static inline piece_t * fix(piece_t *p)
+{
+	p->total = total(p->left) + p->size + total(p->right);
+	return p;
+}
+
+static piece_t * merge(edit_buf_t *eb, piece_t *a, piece_t *b)
+{
+	piece_t *n, *m;
+
+	if(!a || !b)
+		return a ? a : b;
+
+	if(a->prio >= b->prio) {
+		if(!(m = merge(eb, a->right, b)) || !(n = node_new(eb, a)))
+			return NULL;
+		n->right = m;
+	} else {
+		if(!(m = merge(eb, a, b->left)) || !(n = node_new(eb, b)))
+			return NULL;
+		n->left = m;
+	}
+	return fix(n);
+}
+
+/* Copies of the nodes on the path; a piece straddling pos is cut in two */
+static bool split(edit_buf_t *eb, const piece_t *t, uint64_t pos, piece_t **l, piece_t **r)
+{
+	uint64_t left = total(t ? t->left : NULL);
+	piece_t *n, *m;
+
+	if(!t) {
+		*l = *r = NULL;
+		return true;
+	}
+
+	if(pos <= left) {
+		if(!split(eb, t->left, pos, l, &m) || !(n = node_new(eb, t)))
+			return false;
+		n->left = m;
+		*r = fix(n);
+	} else if(pos >= left + t->size) {
+		if(!split(eb, t->right, pos - left - t->size, &m, r) || !(n = node_new(eb, t)))
+			return false;
+		n->right = m;
+		*l = fix(n);
+	} else {
+		/* The right part gets a priority of its own, or the fragments
+		 * of a much edited piece would all tie and line up in a chain
+		 */
+		pos -= left;
+		if(!(n = node_new(eb, t)) || !(m = node_new(eb, t)))
+			return false;
+		n->size = pos;
+		n->right = NULL;
+		m->data += pos;
+		m->size -= pos;
+		if(m->origin != EDIT_ADDED)
+			m->origin += pos;
+		m->left = m->right = NULL;
+		m->prio = next_prio(eb);
+		*l = fix(n);
+		*r = merge(eb, fix(m), t->right);
+		if(!*r)
+			return false;
+	}
+	return true;
+}
+
+static bool add_version(edit_buf_t *eb, piece_t *root, edit_op_t op, uint64_t offset,
+		uint64_t size)
+{
+	version_t *v;
+	edit_change_t *c;
+	uint32_t n = eb->size ? eb->size * 2 : 64;
+	uint32_t count = eb->current + 1;
+
+	/* A failed edit leaves the redo history as it was */
+	if(count == eb->size) {
+		v = realloc(eb->versions, n * sizeof(version_t));
+		if(!v)
+			return false;
+		eb->versions = v;
+		c = realloc(eb->changes, n * sizeof(edit_change_t));
+		if(!c)
+			return false;
+		eb->changes = c;
+		eb->size = n;
+	}
+
+	/* A new edit ends whatever could have been redone */
+	eb->count = count;
+	v = &eb->versions[eb->count];
+	v->root = root;
+	v->change.op = op;
+	v->change.offset = offset;
+	v->change.size = size;
+	eb->changes[eb->count - 1] = v->change;
+	eb->current = eb->count++;
+	return true;
+}
+
+/* Bytes go to the end of the add buffer, consecutive inserts stay
+ * consecutive there
+ */
+static piece_t * added_piece(edit_buf_t *eb, const void *data, uint64_t size)
+{
+	piece_t *p;
+	uint8_t *to;
+
+	if(size > SIZE_MAX)
+		return NULL;
+	if(size <= eb->add_left) {
+		to = eb->add_tail;
+		eb->add_tail += size;
+		eb->add_left -= size;
+	} else if(size > EDIT_ADD_CHUNK / 4) {
+		to = arena_alloc(eb->added, size);
+	} else {
+		to = arena_alloc(eb->added, EDIT_ADD_CHUNK);
+		if(to) {
+			eb->add_tail = to + size;
+			eb->add_left = EDIT_ADD_CHUNK - size;
+		}
+	}
+	if(!to || !(p = node_new(eb, NULL)))
+		return NULL;
+
+	memcpy(to, data, size);
+	p->left = p->right = NULL;
+	p->data = to;
+	p->size = size;
+	p->origin = EDIT_ADDED;
+	p->prio = next_prio(eb);
+	return fix(p);
+}
+
+elf_status_t edit_open(const char *path, edit_buf_t **eb)
+{
+	elf_status_t status;
+	int32_t fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return ELF_ERR_OPEN;
+
+	status = edit_open_fd(fd, eb);
+	if(status != ELF_OK) {
+		close(fd);
+		return status;
+	}
+
+	(*eb)->owns_fd = true;
+	return ELF_OK;
+}
+
+/* The caller keeps ownership of fd, which must stay open and unchanged
+ * while the buffer is
+ */
+elf_status_t edit_open_fd(int32_t fd, edit_buf_t **eb)
+{
+	struct stat st;
+	edit_buf_t *b;
+	piece_t *p = NULL;
+
+	*eb = NULL;
+	if(fstat(fd, &st) < 0)
+		return ELF_ERR_OPEN;
+
+	b = calloc(1, sizeof(edit_buf_t));
+	if(!b)
+		return ELF_ERR_NOMEM;
+	b->fd = fd;
+	b->file_size = st.st_size;
+	b->seed = 0x9e3779b9;
+	b->nodes = arena_create(EDIT_NODE_CHUNK);
+	b->added = arena_create(EDIT_ADD_CHUNK);
+	b->size = 64;
+	b->versions = malloc(b->size * sizeof(version_t));
+	b->changes = malloc(b->size * sizeof(edit_change_t));
+	if(!b->nodes || !b->added || !b->versions || !b->changes)
+		goto nomem;
+
+	if(b->file_size) {
+		b->map = mmap(NULL, b->file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		stats_add(STAT_SYSCALLS, 1);
+		if(b->map == MAP_FAILED) {
+			b->map = NULL;
+			edit_close(b);
+			return ELF_ERR_IO;
+		}
+		p = node_new(b, NULL);
+		if(!p)
+			goto nomem;
+		p->left = p->right = NULL;
+		p->data = b->map;
+		p->size = b->file_size;
+		p->origin = 0;
+		p->prio = next_prio(b);
+		fix(p);
+	}
+	b->versions[0].root = p;
+	b->count = 1;
+	*eb = b;
+	return ELF_OK;
+
+nomem:
+	edit_close(b);
+	return ELF_ERR_NOMEM;
+}
+
+void edit_close(edit_buf_t *eb)
+{
+	if(!eb)
+		return;
+
+	if(eb->map)
+		munmap(eb->map, eb->file_size);
+	arena_destroy(eb->nodes);
+	arena_destroy(eb->added);
+	free(eb->versions);
+	free(eb->changes);
+	if(eb->owns_fd)
+		close(eb->fd);
+	free(eb);
+}
+
+int32_t edit_fd(const edit_buf_t *eb)
+{
+	return eb->fd;
+}
+
+uint64_t edit_size(const edit_buf_t *eb)
+{
+	return total(eb->versions[eb->current].root);
+}
+
+uint64_t edit_original_size(const edit_buf_t *eb)
+{
+	return eb->file_size;
+}
+
+elf_status_t edit_insert(edit_buf_t *eb, uint64_t offset, const void *data, uint64_t size)
+{
+	piece_t *root = eb->versions[eb->current].root, *l, *r, *p;
+
+	if(offset > total(root))
+		return ELF_ERR_OFFSET;
+	if(!size)
+		return ELF_OK;
+
+	if(!(p = added_piece(eb, data, size)) || !split(eb, root, offset, &l, &r))
+		return ELF_ERR_NOMEM;
+	/* Empty halves merge to NULL, which is not a failure */
+	if(l && !(p = merge(eb, l, p)))
+		return ELF_ERR_NOMEM;
+	if(r && !(p = merge(eb, p, r)))
+		return ELF_ERR_NOMEM;
+	return add_version(eb, p, EDIT_INSERT, offset, size) ? ELF_OK : ELF_ERR_NOMEM;
+}
+
+elf_status_t edit_delete(edit_buf_t *eb, uint64_t offset, uint64_t size)
+{
+	piece_t *root = eb->versions[eb->current].root, *l, *m, *r, *p;
+
+	if(offset > total(root) || size > total(root) - offset)
+		return ELF_ERR_OFFSET;
+	if(!size)
+		return ELF_OK;
+
+	if(!split(eb, root, offset, &l, &m) || !split(eb, m, size, &m, &r))
+		return ELF_ERR_NOMEM;
+	p = merge(eb, l, r);
+	if(!p && (l || r))
+		return ELF_ERR_NOMEM;
+	return add_version(eb, p, EDIT_DELETE, offset, size) ? ELF_OK : ELF_ERR_NOMEM;
+}
+
+elf_status_t edit_patch(edit_buf_t *eb, uint64_t offset, const void *data, uint64_t size)
+{
+	piece_t *root = eb->versions[eb->current].root, *l, *m, *r, *p;
+
+	if(offset > total(root) || size > total(root) - offset)
+		return ELF_ERR_OFFSET;
+	if(!size)
+		return ELF_OK;
+
+	if(!(p = added_piece(eb, data, size))
+			|| !split(eb, root, offset, &l, &m) || !split(eb, m, size, &m, &r))
+		return ELF_ERR_NOMEM;
+	if(l && !(p = merge(eb, l, p)))
+		return ELF_ERR_NOMEM;
+	if(r && !(p = merge(eb, p, r)))
+		return ELF_ERR_NOMEM;
+	return add_version(eb, p, EDIT_PATCH, offset, size) ? ELF_OK : ELF_ERR_NOMEM;
+}
+
+bool edit_undo(edit_buf_t *eb)
+{
+	if(!eb->current)
+		return false;
+	eb->current--;
+	return true;
+}
+
+bool edit_redo(edit_buf_t *eb)
+{
+	if(eb->current + 1 >= eb->count)
+		return false;
+	eb->current++;
+	return true;
+}
+
+const edit_change_t * edit_history(const edit_buf_t *eb, uint32_t *applied, uint32_t *undone)
+{
+	*applied = eb->current;
+	*undone = eb->count - 1 - eb->current;
+	return eb->changes;
+}
+
+uint64_t edit_span(const edit_buf_t *eb, uint64_t offset, const uint8_t **data)
+{
+	const piece_t *p = eb->versions[eb->current].root;
+	uint64_t left;
+
+	*data = NULL;
+	while(p) {
+		left = total(p->left);
+		if(offset < left) {
+			p = p->left;
+		} else if(offset - left < p->size) {
+			offset -= left;
+			*data = p->data + offset;
+			return p->size - offset;
+		} else {
+			offset -= left + p->size;
+			p = p->right;
+		}
+	}
+	return 0;
+}
+
+elf_status_t edit_read(const edit_buf_t *eb, uint64_t offset, void *buf, uint64_t size)
+{
+	const uint8_t *data;
+	uint8_t *to = buf;
+	uint64_t n;
+
+	if(offset > edit_size(eb) || size > edit_size(eb) - offset)
+		return ELF_ERR_OFFSET;
+
+	while(size) {
+		n = edit_span(eb, offset, &data);
+		if(n > size)
+			n = size;
+		memcpy(to, data, n);
+		to += n;
+		offset += n;
+		size -= n;
+	}
+	return ELF_OK;
+}
+
+/* In order, with an explicit stack: a degenerate treap is still only
+ * unlikely
+ */
+bool edit_walk(const edit_buf_t *eb, edit_walk_t fn, void *ctx)
+{
+	const piece_t *stack[128], *p = eb->versions[eb->current].root;
+	edit_piece_t piece;
+	uint64_t offset = 0;
+	uint32_t depth = 0;
+
+	while(p || depth) {
+		if(p && depth < 128) {
+			stack[depth++] = p;
+			p = p->left;
+			continue;
+		}
+		if(p)
+			return false;	/* deeper than any balanced treap gets */
+		p = stack[--depth];
+		piece.data = p->data;
+		piece.size = p->size;
+		piece.origin = p->origin;
+		if(!fn(ctx, offset, &piece))
+			return false;
+		offset += p->size;
+		p = p->right;
+	}
+	return true;
+}
@@ -0,0 +1,86 @@
+#ifndef _ELF_EDIT_H
+#define _ELF_EDIT_H
+
+#include "elf-parser.h"
+#include "elf-file.h"
+
+/* Editing buffer over a file, as a piece table.
+ *
+ * The original file is mapped read-only and never written; bytes that
+ * are inserted or patched in go to an append-only add buffer.  The
+ * edited contents are the concatenation of pieces, each a run of either
+ * one.  Pieces are the nodes of a treap ordered by position, every node
+ * knowing the length of its subtree, so finding, splitting and joining
+ * at an offset are O(log n) in the number of pieces and not in the size
+ * of the file.
+ *
+ * The treap is never modified in place: an edit copies the O(log n)
+ * nodes on its path and yields a new root that shares everything else
+ * with the old one.  Every version is kept, which makes undo and redo
+ * a matter of picking a root, and a failed edit leaves the current
+ * version as it was.  An edit made after an undo drops the versions
+ * that could have been redone; their nodes stay allocated, as all of
+ * them do, until edit_close().
+ *
+ * Reads of unmodified ranges point into the original mapping, nothing
+ * is copied.  A buffer is not thread-safe.
+ */
+
+typedef struct edit_buf edit_buf_t;
+
+typedef enum edit_op {
+	EDIT_INSERT,
+	EDIT_DELETE,
+	EDIT_PATCH,		/* overwrite in place, the size stays */
+} edit_op_t;
+
+typedef struct edit_change {
+	edit_op_t op;
+	uint64_t offset;
+	uint64_t size;
+} edit_change_t;
+
+#define EDIT_ADDED	UINT64_MAX	/* origin of bytes from the add buffer */
+
+typedef struct edit_piece {
+	const uint8_t *data;
+	uint64_t size;
+	uint64_t origin;	/* offset in the original file, or EDIT_ADDED */
+} edit_piece_t;
+
+/* Return false to stop the walk */
+typedef bool (*edit_walk_t)(void *ctx, uint64_t offset, const edit_piece_t *piece);
+
+elf_status_t edit_open(const char *path, edit_buf_t **eb);
+elf_status_t edit_open_fd(int32_t fd, edit_buf_t **eb);
+void edit_close(edit_buf_t *eb);
+
+int32_t edit_fd(const edit_buf_t *eb);
+uint64_t edit_size(const edit_buf_t *eb);
+uint64_t edit_original_size(const edit_buf_t *eb);
+
+/* ELF_ERR_OFFSET for offsets past the end; patches may not extend the
+ * contents, inserts may append
+ */
+elf_status_t edit_insert(edit_buf_t *eb, uint64_t offset, const void *data, uint64_t size);
+elf_status_t edit_delete(edit_buf_t *eb, uint64_t offset, uint64_t size);
+elf_status_t edit_patch(edit_buf_t *eb, uint64_t offset, const void *data, uint64_t size);
+
+bool edit_undo(edit_buf_t *eb);
+bool edit_redo(edit_buf_t *eb);
+
+/* Changes in the current version, oldest first; *undone more can be
+ * redone after them
+ */
+const edit_change_t * edit_history(const edit_buf_t *eb, uint32_t *applied, uint32_t *undone);
+
+/* The contiguous bytes at offset, up to the end of their piece; 0 at
+ * the end of the contents.  Nothing is copied.
+ */
+uint64_t edit_span(const edit_buf_t *eb, uint64_t offset, const uint8_t **data);
+elf_status_t edit_read(const edit_buf_t *eb, uint64_t offset, void *buf, uint64_t size);
+
+/* Every piece of the current version in order */
+bool edit_walk(const edit_buf_t *eb, edit_walk_t fn, void *ctx);
+
+#endif /* _ELF_EDIT_H */
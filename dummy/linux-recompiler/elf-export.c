@@ -0,0 +1,770 @@
+#include <stddef.h>
+
+#include "elf-export.h"
+#include "elf-swap.h"
+#include "elf-arena.h"
+#include "elf-stats.h"
+#include "elf-filter.h"
+#include "elf-demangle.h"
+#include "elf-pipeline.h"
+#include "elf-cache.h"
+
+#define OUT_SIZE	(1 << 16)
+#define JSON_LIT(o, s)	pipeline_write(o, s, sizeof(s) - 1)
+
+/* One row of either table, the same for ELF32 and ELF64 */
+typedef struct export_sec {
+	uint64_t flags;
+	uint64_t addr;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t align;
+	uint32_t name;
+	uint32_t type;
+} export_sec_t;
+
+typedef struct export_sym {
+	uint64_t value;
+	uint64_t size;
+	uint32_t name;
+	uint32_t shndx;
+	uint32_t index;		/* in the symbol table, rows may be filtered */
+	uint8_t bind;
+	uint8_t type;
+} export_sym_t;
+
+typedef struct json_sections {
+	const export_sec_t *sec;
+	const char *str_tbl;
+	uint64_t str_size;
+} json_sections_t;
+
+typedef struct json_symbols {
+	const void *sym_tbl;		/* NULL: streamed through the pipeline */
+	const char *str_tbl;
+	uint64_t str_size;
+	const Elf32_Word *shndx_tbl;
+	uint32_t shndx_count;
+	uint32_t symbol_table;
+	const sym_filter_t *filter;
+	const uint32_t *names;		/* with -C: string offsets, UINT32_MAX if filtered */
+	const char **demangled;
+	bool swapped;
+} json_symbols_t;
+
+static char out_buf[OUT_SIZE];
+static size_t out_len;
+static const char *export_path;
+static bool col_started;
+
+static void out_flush(void)
+{
+	if(out_len)
+		fwrite(out_buf, 1, out_len, stdout);
+	out_len = 0;
+}
+
+static void out_write(const void *p, size_t n)
+{
+	if(out_len + n > OUT_SIZE) {
+		out_flush();
+		if(n > OUT_SIZE) {
+			fwrite(p, 1, n, stdout);
+			return;
+		}
+	}
+	memcpy(out_buf + out_len, p, n);
+	out_len += n;
+}
+
+static void json_u64(pipeline_out_t *o, uint64_t v)
+{
+	char tmp[20];
+	uint32_t i = sizeof(tmp);
+
+	do {
+		tmp[--i] = '0' + v % 10;
+		v /= 10;
+	} while(v);
+	pipeline_write(o, tmp + i, sizeof(tmp) - i);
+}
+
+/* Plain runs are copied in one go, only quotes, backslashes and control
+ * characters are escaped.  Bytes >= 0x80 pass through untouched.
+ */
+static void json_str(pipeline_out_t *o, const char *s, size_t n)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	size_t i, run = 0;
+	char esc[6];
+
+	pipeline_write(o, "\"", 1);
+	for(i=0; i<n; i++) {
+		unsigned char c = s[i];
+		if(c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		pipeline_write(o, s + run, i - run);
+		run = i + 1;
+		if(c == '"' || c == '\\') {
+			esc[0] = '\\';
+			esc[1] = c;
+			pipeline_write(o, esc, 2);
+		} else {
+			memcpy(esc, "\\u00", 4);
+			esc[4] = hexdigits[c >> 4];
+			esc[5] = hexdigits[c & 0xf];
+			pipeline_write(o, esc, 6);
+		}
+	}
+	pipeline_write(o, s + run, n - run);
+	pipeline_write(o, "\"", 1);
+}
+
+static void out_pad(uint64_t size)
+{
+	static const char zero[8];
+
+	if(size & 7)
+		out_write(zero, 8 - (size & 7));
+}
+
+/* Names must be terminated inside their string table, or are cut */
+static const char * name_at(const char *tbl, uint64_t tbl_size, uint32_t off, size_t *len)
+{
+	const char *end;
+
+	if(!tbl || off >= tbl_size) {
+		*len = 0;
+		return "";
+	}
+	end = memchr(tbl + off, 0, tbl_size - off);
+	*len = end ? (size_t)(end - (tbl + off)) : tbl_size - off;
+	return tbl + off;
+}
+
+/* Field filters first, the name only for what is left.  A name that is
+ * not terminated inside its table never matches.
+ */
+static bool export_keeps(const sym_filter_t *f, uint8_t info, uint8_t other,
+		uint32_t shndx, uint64_t value, uint64_t size,
+		const char *str_tbl, uint64_t str_size, uint32_t st_name)
+{
+	const char *name;
+	size_t len;
+
+	if(!f)
+		return true;
+	if(!filter_fields(f, info, other, shndx, value, size))
+		return false;
+	if(f->match == MATCH_ANY)
+		return true;
+	name = name_at(str_tbl, str_size, st_name, &len);
+	return !(str_tbl && (uint64_t)st_name + len >= str_size) && filter_name(f, name);
+}
+
+static void json_begin(pipeline_out_t *o, const char *kind)
+{
+	if(export_path) {
+		JSON_LIT(o, "{\"file\":");
+		json_str(o, export_path, strlen(export_path));
+		JSON_LIT(o, ",\"kind\":\"");
+	} else {
+		JSON_LIT(o, "{\"kind\":\"");
+	}
+	pipeline_write(o, kind, strlen(kind));
+	JSON_LIT(o, "\"");
+}
+
+/* Rows are formatted on the pipeline's decoders and written in order by
+ * the caller
+ */
+static void decode_json_sections(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const json_sections_t *js = ctx;
+	const export_sec_t *sec;
+	const char *name;
+	size_t len;
+	uint64_t i;
+
+	for(i=first; i<first + count; i++) {
+		sec = &js->sec[i];
+		json_begin(out, "section");
+		JSON_LIT(out, ",\"index\":");
+		json_u64(out, i);
+		JSON_LIT(out, ",\"name\":");
+		name = name_at(js->str_tbl, js->str_size, sec->name, &len);
+		json_str(out, name, len);
+		JSON_LIT(out, ",\"type\":");
+		json_u64(out, sec->type);
+		JSON_LIT(out, ",\"flags\":");
+		json_u64(out, sec->flags);
+		JSON_LIT(out, ",\"addr\":");
+		json_u64(out, sec->addr);
+		JSON_LIT(out, ",\"offset\":");
+		json_u64(out, sec->offset);
+		JSON_LIT(out, ",\"size\":");
+		json_u64(out, sec->size);
+		JSON_LIT(out, ",\"align\":");
+		json_u64(out, sec->align);
+		JSON_LIT(out, "}\n");
+	}
+}
+
+static void json_symbol(pipeline_out_t *o, const json_symbols_t *js, uint64_t index,
+		uint32_t st_name, uint64_t value, uint64_t size, uint8_t info,
+		uint32_t shndx)
+{
+	const char *name;
+	size_t len;
+
+	json_begin(o, "symbol");
+	JSON_LIT(o, ",\"table\":");
+	json_u64(o, js->symbol_table);
+	JSON_LIT(o, ",\"index\":");
+	json_u64(o, index);
+	JSON_LIT(o, ",\"name\":");
+	name = name_at(js->str_tbl, js->str_size, st_name, &len);
+	json_str(o, name, len);
+	if(js->names && js->demangled[index]) {
+		JSON_LIT(o, ",\"demangled\":");
+		json_str(o, js->demangled[index], strlen(js->demangled[index]));
+	}
+	JSON_LIT(o, ",\"value\":");
+	json_u64(o, value);
+	JSON_LIT(o, ",\"size\":");
+	json_u64(o, size);
+	JSON_LIT(o, ",\"bind\":");
+	json_u64(o, ELF32_ST_BIND(info));
+	JSON_LIT(o, ",\"type\":");
+	json_u64(o, ELF32_ST_TYPE(info));
+	JSON_LIT(o, ",\"shndx\":");
+	json_u64(o, shndx);
+	JSON_LIT(o, "}\n");
+}
+
+static inline uint32_t export_shndx(const json_symbols_t *js, uint16_t st_shndx, uint64_t i)
+{
+	if(st_shndx == SHN_XINDEX && i < js->shndx_count)
+		return js->shndx_tbl[i];
+	return st_shndx;
+}
+
+static void decode_json_symbols64(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const json_symbols_t *js = ctx;
+	Elf64_Sym *sym = raw ? raw : (Elf64_Sym *)js->sym_tbl + first;
+	uint32_t i, shndx;
+	uint64_t k;
+
+	/* Streamed chunks come straight from the file */
+	if(raw && js->swapped)
+		swap_sym_table64(sym, count);
+
+	for(i=0; i<count; i++) {
+		k = first + i;
+		shndx = export_shndx(js, sym[i].st_shndx, k);
+		if(js->names ? js->names[k] == UINT32_MAX
+				: !export_keeps(js->filter, sym[i].st_info, sym[i].st_other, shndx,
+					sym[i].st_value, sym[i].st_size,
+					js->str_tbl, js->str_size, sym[i].st_name))
+			continue;
+		json_symbol(out, js, k, sym[i].st_name, sym[i].st_value, sym[i].st_size,
+				sym[i].st_info, shndx);
+	}
+}
+
+static void decode_json_symbols(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const json_symbols_t *js = ctx;
+	Elf32_Sym *sym = raw ? raw : (Elf32_Sym *)js->sym_tbl + first;
+	uint32_t i, shndx;
+	uint64_t k;
+
+	/* Streamed chunks come straight from the file */
+	if(raw && js->swapped)
+		swap_sym_table(sym, count);
+
+	for(i=0; i<count; i++) {
+		k = first + i;
+		shndx = export_shndx(js, sym[i].st_shndx, k);
+		if(js->names ? js->names[k] == UINT32_MAX
+				: !export_keeps(js->filter, sym[i].st_info, sym[i].st_other, shndx,
+					sym[i].st_value, sym[i].st_size,
+					js->str_tbl, js->str_size, sym[i].st_name))
+			continue;
+		json_symbol(out, js, k, sym[i].st_name, sym[i].st_value, sym[i].st_size,
+				sym[i].st_info, shndx);
+	}
+}
+
+static void col_begin(col_kind_t kind, uint32_t section, uint64_t rows, uint64_t blob_size)
+{
+	col_block_t blk;
+
+	if(!col_started) {
+		col_header_t hdr;
+		memcpy(hdr.magic, COL_MAGIC, sizeof(hdr.magic));
+		hdr.version = COL_VERSION;
+		hdr.byte_order = COL_BYTE_ORDER;
+		out_write(&hdr, sizeof(hdr));
+		col_started = true;
+	}
+
+	blk.kind = kind;
+	blk.section = section;
+	blk.rows = rows;
+	blk.blob_size = blob_size;
+	out_write(&blk, sizeof(blk));
+}
+
+/* Gather one field of every row into a contiguous column */
+static void col_column(const void *rows, size_t stride, size_t offset, size_t width, uint64_t n)
+{
+	const uint8_t *p = (const uint8_t *)rows + offset;
+	uint64_t i;
+
+	for(i=0; i<n; i++, p+=stride) {
+		if(out_len + width > OUT_SIZE)
+			out_flush();
+		memcpy(out_buf + out_len, p, width);
+		out_len += width;
+	}
+	out_pad(n * width);
+}
+
+static void col_blob(const void *blob, uint64_t size)
+{
+	if(blob)
+		out_write(blob, size);
+	out_pad(size);
+}
+
+#define COLUMN(rows, type, field, n) \
+	col_column(rows, sizeof(type), offsetof(type, field), sizeof(((type *)0)->field), n)
+
+bool parse_export_format(const char *name, export_format_t *fmt)
+{
+	if(!strcmp(name, "text"))
+		*fmt = FORMAT_TEXT;
+	else if(!strcmp(name, "jsonl"))
+		*fmt = FORMAT_JSONL;
+	else if(!strcmp(name, "columnar"))
+		*fmt = FORMAT_COLUMNAR;
+	else
+		return false;
+	return true;
+}
+
+/* Rows written from here on belong to path */
+void export_file(export_format_t fmt, const char *path)
+{
+	export_path = path;
+	if(fmt == FORMAT_COLUMNAR) {
+		col_begin(COL_FILE, 0, 0, strlen(path));
+		col_blob(path, strlen(path));
+		out_flush();
+	}
+}
+
+static void write_sections(export_format_t fmt,
+		uint32_t shstrndx,
+		const export_sec_t *sec,
+		uint32_t count,
+		const char *str_tbl,
+		uint64_t str_size)
+{
+	json_sections_t js;
+	pipeline_job_t job;
+
+	if(fmt == FORMAT_COLUMNAR) {
+		col_begin(COL_SECTIONS, shstrndx, count, str_tbl ? str_size : 0);
+		COLUMN(sec, export_sec_t, name, count);
+		COLUMN(sec, export_sec_t, type, count);
+		COLUMN(sec, export_sec_t, flags, count);
+		COLUMN(sec, export_sec_t, addr, count);
+		COLUMN(sec, export_sec_t, offset, count);
+		COLUMN(sec, export_sec_t, size, count);
+		COLUMN(sec, export_sec_t, align, count);
+		col_blob(str_tbl, str_tbl ? str_size : 0);
+		out_flush();
+	} else {
+		js.sec = sec;
+		js.str_tbl = str_tbl;
+		js.str_size = str_size;
+		memset(&job, 0, sizeof(job));
+		job.count = count;
+		job.fd = -1;
+		job.decode = decode_json_sections;
+		job.ctx = &js;
+		pipeline_run(&job);
+	}
+
+	stats_add(STAT_SECTIONS, count);
+}
+
+/* Every row has to be known before the first column is written, so the
+ * columnar form is gathered in the caller
+ */
+static void write_symbol_columns(uint32_t symbol_table,
+		const export_sym_t *sym,
+		uint32_t count,
+		const char *str_tbl,
+		uint64_t str_size)
+{
+	col_begin(COL_SYMBOLS, symbol_table, count, str_tbl ? str_size : 0);
+	COLUMN(sym, export_sym_t, name, count);
+	COLUMN(sym, export_sym_t, shndx, count);
+	COLUMN(sym, export_sym_t, value, count);
+	COLUMN(sym, export_sym_t, size, count);
+	COLUMN(sym, export_sym_t, bind, count);
+	COLUMN(sym, export_sym_t, type, count);
+	col_blob(str_tbl, str_tbl ? str_size : 0);
+	out_flush();
+	stats_add(STAT_SYMBOLS, count);
+}
+
+void export_sections64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[], export_format_t fmt)
+{
+	uint32_t i, shnum, shstrndx;
+	export_sec_t *rows;
+	char* sh_str = NULL;
+
+	shnum = section_count64(eh, sh_table);
+	shstrndx = section_strndx64(eh, sh_table);
+	if(shstrndx < shnum)
+		sh_str = read_section64(fd, sh_table[shstrndx]);
+
+	rows = section_alloc(shnum * sizeof(export_sec_t));
+	if(rows) {
+		for(i=0; i<shnum; i++) {
+			rows[i].flags = sh_table[i].sh_flags;
+			rows[i].addr = sh_table[i].sh_addr;
+			rows[i].offset = sh_table[i].sh_offset;
+			rows[i].size = sh_table[i].sh_size;
+			rows[i].align = sh_table[i].sh_addralign;
+			rows[i].name = sh_table[i].sh_name;
+			rows[i].type = sh_table[i].sh_type;
+		}
+		write_sections(fmt, shstrndx, rows, shnum,
+				sh_str, sh_str ? sh_table[shstrndx].sh_size : 0);
+	}
+
+	section_free(rows);
+	section_free(sh_str);
+}
+
+static void export_symbol_table64(int32_t fd,
+		Elf64_Ehdr eh,
+		Elf64_Shdr sh_table[],
+		uint32_t symbol_table,
+		export_format_t fmt)
+{
+	Elf64_Sym* sym_tbl = NULL;	/* NULL: streamed through the pipeline */
+	Elf32_Word* shndx_tbl = NULL;
+	char* str_tbl = NULL;
+	export_sym_t *rows;
+	const sym_filter_t *filter;
+	uint32_t *names = NULL;		/* with -C: string offsets, UINT32_MAX if filtered */
+	const char **demangled = NULL;
+	char *demangled_text = NULL;
+	uint32_t i, shnum, link, shndx, shndx_count = 0, symbol_count, count = 0;
+	uint64_t str_size = 0;
+	json_symbols_t js;
+	pipeline_job_t job;
+
+	/* Columns need every row up front and -C the whole table at once;
+	 * a cached table or one that runs past the end of the file is read
+	 * like every other.  JSONL rows are otherwise streamed.
+	 */
+	if(fmt == FORMAT_COLUMNAR || demangle_enabled() || cache_active() || !in_file(fd,
+				sh_table[symbol_table].sh_offset, sh_table[symbol_table].sh_size)) {
+		sym_tbl = (Elf64_Sym*)read_section64(fd, sh_table[symbol_table]);
+		if(!sym_tbl)
+			return;
+	}
+	symbol_count = sh_table[symbol_table].sh_size / sizeof(Elf64_Sym);
+
+	shnum = section_count64(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_SYMTAB_SHNDX
+				&& sh_table[i].sh_link == symbol_table) {
+			shndx_tbl = (Elf32_Word*)read_section64(fd, sh_table[i]);
+			shndx_count = shndx_tbl ? sh_table[i].sh_size / sizeof(Elf32_Word) : 0;
+			break;
+		}
+	}
+
+	link = sh_table[symbol_table].sh_link;
+	if(link < shnum)
+		str_tbl = read_section64(fd, sh_table[link]);
+	if(str_tbl)
+		str_size = sh_table[link].sh_size;
+
+	if(elf_swapped(eh.e_ident)) {
+		if(sym_tbl)
+			swap_sym_table64(sym_tbl, symbol_count);
+		if(shndx_tbl)
+			swap_words(shndx_tbl, shndx_count);
+	}
+
+	memset(&js, 0, sizeof(js));
+	js.sym_tbl = sym_tbl;
+	js.str_tbl = str_tbl;
+	js.str_size = str_size;
+	js.shndx_tbl = shndx_tbl;
+	js.shndx_count = shndx_count;
+	js.symbol_table = symbol_table;
+	js.filter = filter = filter_current();
+	js.swapped = elf_swapped(eh.e_ident);
+
+	if(fmt == FORMAT_COLUMNAR) {
+		rows = section_alloc(symbol_count * sizeof(export_sym_t));
+		if(rows) {
+			for(i=0; i<symbol_count; i++) {
+				export_sym_t *row = &rows[count];
+				row->shndx = export_shndx(&js, sym_tbl[i].st_shndx, i);
+				if(!export_keeps(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+							row->shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+							str_tbl, str_size, sym_tbl[i].st_name))
+					continue;
+
+				row->value = sym_tbl[i].st_value;
+				row->size = sym_tbl[i].st_size;
+				row->name = sym_tbl[i].st_name;
+				row->index = i;
+				row->bind = ELF32_ST_BIND(sym_tbl[i].st_info);
+				row->type = ELF32_ST_TYPE(sym_tbl[i].st_info);
+				count++;
+			}
+			write_symbol_columns(symbol_table, rows, count, str_tbl, str_size);
+		}
+		section_free(rows);
+		goto EXIT;
+	}
+
+	/* -C adds a "demangled" key to the C++ names; the whole table is
+	 * demangled before the rows go out, only the names that pass the
+	 * filter
+	 */
+	if(demangle_enabled() && symbol_count) {
+		names = section_alloc(symbol_count * sizeof(uint32_t));
+		demangled = section_alloc(symbol_count * sizeof(char *));
+		if(names && demangled) {
+			for(i=0; i<symbol_count; i++) {
+				shndx = export_shndx(&js, sym_tbl[i].st_shndx, i);
+				names[i] = export_keeps(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+						shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+						str_tbl, str_size, sym_tbl[i].st_name)
+					? sym_tbl[i].st_name : UINT32_MAX;
+			}
+			demangled_text = demangle_table(str_tbl, str_size, names, symbol_count, demangled);
+			js.names = names;
+			js.demangled = demangled;
+		}
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.count = symbol_count;
+	job.fd = sym_tbl ? -1 : fd;
+	job.offset = sh_table[symbol_table].sh_offset;
+	job.item_size = sizeof(Elf64_Sym);
+	job.decode = decode_json_symbols64;
+	job.ctx = &js;
+	pipeline_run(&job);
+	stats_add(STAT_SYMBOLS, symbol_count);
+
+EXIT:
+	section_free(demangled_text);
+	section_free(demangled);
+	section_free(names);
+	section_free(str_tbl);
+	section_free(shndx_tbl);
+	section_free(sym_tbl);
+}
+
+void export_symbols64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[], export_format_t fmt)
+{
+	uint32_t i, shnum;
+
+	shnum = section_count64(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if((sh_table[i].sh_type == SHT_SYMTAB)
+				|| (sh_table[i].sh_type == SHT_DYNSYM))
+			export_symbol_table64(fd, eh, sh_table, i, fmt);
+	}
+}
+
+void export_sections(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[], export_format_t fmt)
+{
+	uint32_t i, shnum, shstrndx;
+	export_sec_t *rows;
+	char* sh_str = NULL;
+
+	shnum = section_count(eh, sh_table);
+	shstrndx = section_strndx(eh, sh_table);
+	if(shstrndx < shnum)
+		sh_str = read_section(fd, sh_table[shstrndx]);
+
+	rows = section_alloc(shnum * sizeof(export_sec_t));
+	if(rows) {
+		for(i=0; i<shnum; i++) {
+			rows[i].flags = sh_table[i].sh_flags;
+			rows[i].addr = sh_table[i].sh_addr;
+			rows[i].offset = sh_table[i].sh_offset;
+			rows[i].size = sh_table[i].sh_size;
+			rows[i].align = sh_table[i].sh_addralign;
+			rows[i].name = sh_table[i].sh_name;
+			rows[i].type = sh_table[i].sh_type;
+		}
+		write_sections(fmt, shstrndx, rows, shnum,
+				sh_str, sh_str ? sh_table[shstrndx].sh_size : 0);
+	}
+
+	section_free(rows);
+	section_free(sh_str);
+}
+
+static void export_symbol_table(int32_t fd,
+		Elf32_Ehdr eh,
+		Elf32_Shdr sh_table[],
+		uint32_t symbol_table,
+		export_format_t fmt)
+{
+	Elf32_Sym* sym_tbl = NULL;	/* NULL: streamed through the pipeline */
+	Elf32_Word* shndx_tbl = NULL;
+	char* str_tbl = NULL;
+	export_sym_t *rows;
+	const sym_filter_t *filter;
+	uint32_t *names = NULL;		/* with -C: string offsets, UINT32_MAX if filtered */
+	const char **demangled = NULL;
+	char *demangled_text = NULL;
+	uint32_t i, shnum, link, shndx, shndx_count = 0, symbol_count, count = 0;
+	uint64_t str_size = 0;
+	json_symbols_t js;
+	pipeline_job_t job;
+
+	/* Columns need every row up front and -C the whole table at once;
+	 * a cached table or one that runs past the end of the file is read
+	 * like every other.  JSONL rows are otherwise streamed.
+	 */
+	if(fmt == FORMAT_COLUMNAR || demangle_enabled() || cache_active() || !in_file(fd,
+				sh_table[symbol_table].sh_offset, sh_table[symbol_table].sh_size)) {
+		sym_tbl = (Elf32_Sym*)read_section(fd, sh_table[symbol_table]);
+		if(!sym_tbl)
+			return;
+	}
+	symbol_count = sh_table[symbol_table].sh_size / sizeof(Elf32_Sym);
+
+	shnum = section_count(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_SYMTAB_SHNDX
+				&& sh_table[i].sh_link == symbol_table) {
+			shndx_tbl = (Elf32_Word*)read_section(fd, sh_table[i]);
+			shndx_count = shndx_tbl ? sh_table[i].sh_size / sizeof(Elf32_Word) : 0;
+			break;
+		}
+	}
+
+	link = sh_table[symbol_table].sh_link;
+	if(link < shnum)
+		str_tbl = read_section(fd, sh_table[link]);
+	if(str_tbl)
+		str_size = sh_table[link].sh_size;
+
+	if(elf_swapped(eh.e_ident)) {
+		if(sym_tbl)
+			swap_sym_table(sym_tbl, symbol_count);
+		if(shndx_tbl)
+			swap_words(shndx_tbl, shndx_count);
+	}
+
+	memset(&js, 0, sizeof(js));
+	js.sym_tbl = sym_tbl;
+	js.str_tbl = str_tbl;
+	js.str_size = str_size;
+	js.shndx_tbl = shndx_tbl;
+	js.shndx_count = shndx_count;
+	js.symbol_table = symbol_table;
+	js.filter = filter = filter_current();
+	js.swapped = elf_swapped(eh.e_ident);
+
+	if(fmt == FORMAT_COLUMNAR) {
+		rows = section_alloc(symbol_count * sizeof(export_sym_t));
+		if(rows) {
+			for(i=0; i<symbol_count; i++) {
+				export_sym_t *row = &rows[count];
+				row->shndx = export_shndx(&js, sym_tbl[i].st_shndx, i);
+				if(!export_keeps(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+							row->shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+							str_tbl, str_size, sym_tbl[i].st_name))
+					continue;
+
+				row->value = sym_tbl[i].st_value;
+				row->size = sym_tbl[i].st_size;
+				row->name = sym_tbl[i].st_name;
+				row->index = i;
+				row->bind = ELF32_ST_BIND(sym_tbl[i].st_info);
+				row->type = ELF32_ST_TYPE(sym_tbl[i].st_info);
+				count++;
+			}
+			write_symbol_columns(symbol_table, rows, count, str_tbl, str_size);
+		}
+		section_free(rows);
+		goto EXIT;
+	}
+
+	/* -C adds a "demangled" key to the C++ names; the whole table is
+	 * demangled before the rows go out, only the names that pass the
+	 * filter
+	 */
+	if(demangle_enabled() && symbol_count) {
+		names = section_alloc(symbol_count * sizeof(uint32_t));
+		demangled = section_alloc(symbol_count * sizeof(char *));
+		if(names && demangled) {
+			for(i=0; i<symbol_count; i++) {
+				shndx = export_shndx(&js, sym_tbl[i].st_shndx, i);
+				names[i] = export_keeps(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+						shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+						str_tbl, str_size, sym_tbl[i].st_name)
+					? sym_tbl[i].st_name : UINT32_MAX;
+			}
+			demangled_text = demangle_table(str_tbl, str_size, names, symbol_count, demangled);
+			js.names = names;
+			js.demangled = demangled;
+		}
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.count = symbol_count;
+	job.fd = sym_tbl ? -1 : fd;
+	job.offset = sh_table[symbol_table].sh_offset;
+	job.item_size = sizeof(Elf32_Sym);
+	job.decode = decode_json_symbols;
+	job.ctx = &js;
+	pipeline_run(&job);
+	stats_add(STAT_SYMBOLS, symbol_count);
+
+EXIT:
+	section_free(demangled_text);
+	section_free(demangled);
+	section_free(names);
+	section_free(str_tbl);
+	section_free(shndx_tbl);
+	section_free(sym_tbl);
+}
+
+void export_symbols(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[], export_format_t fmt)
+{
+	uint32_t i, shnum;
+
+	shnum = section_count(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if((sh_table[i].sh_type == SHT_SYMTAB)
+				|| (sh_table[i].sh_type == SHT_DYNSYM))
+			export_symbol_table(fd, eh, sh_table, i, fmt);
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef _ELF_EXPORT_H
+#define _ELF_EXPORT_H
+
+#include "elf-parser.h"
+
+/* Machine readable section and symbol dumps.
+ *
+ * Rows are written straight from the decoded tables to stdout, no text
+ * is formatted and parsed back on the way.  JSONL rows go through the
+ * read/decode/write pipeline like the text dumps; the columnar form
+ * needs every row before its first column and is gathered in one go.
+ *
+ * FORMAT_JSONL writes one JSON object per line:
+ *   {"file":..,"kind":"section","index":..,"name":..,"type":..,"flags":..,
+ *    "addr":..,"offset":..,"size":..,"align":..}
+ *   {"file":..,"kind":"symbol","table":..,"index":..,"name":..,"value":..,
+ *    "size":..,"bind":..,"type":..,"shndx":..}
+ *
+ * FORMAT_COLUMNAR writes a col_header_t followed by blocks.  Every block
+ * is a col_block_t, its columns one after the other and then the string
+ * blob; each column and the blob are padded to 8 bytes.  Name columns
+ * are offsets into the blob of their block, which is the ELF string
+ * table unchanged.  Integers are in the byte order of the writer, see
+ * col_header_t.byte_order.
+ *
+ *   COL_FILE     no columns, blob is the path of the file that follows
+ *   COL_SECTIONS u32 name, u32 type, u64 flags, u64 addr, u64 offset,
+ *                u64 size, u64 align
+ *   COL_SYMBOLS  u32 name, u32 shndx, u64 value, u64 size, u8 bind, u8 type
+ */
+
+typedef enum export_format {
+	FORMAT_TEXT,
+	FORMAT_JSONL,
+	FORMAT_COLUMNAR
+} export_format_t;
+
+#define COL_MAGIC	"ECOL"
+#define COL_VERSION	1
+#define COL_BYTE_ORDER	0x0102
+
+typedef enum col_kind {
+	COL_FILE,
+	COL_SECTIONS,
+	COL_SYMBOLS
+} col_kind_t;
+
+typedef struct col_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t byte_order;	/* COL_BYTE_ORDER as written */
+} col_header_t;
+
+typedef struct col_block {
+	uint32_t kind;		/* col_kind_t */
+	uint32_t section;	/* symbol table or section name table index */
+	uint64_t rows;
+	uint64_t blob_size;	/* unpadded */
+} col_block_t;
+
+bool parse_export_format(const char *name, export_format_t *fmt);
+void export_file(export_format_t fmt, const char *path);
+
+void export_sections64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[], export_format_t fmt);
+void export_symbols64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[], export_format_t fmt);
+void export_sections(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[], export_format_t fmt);
+void export_symbols(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[], export_format_t fmt);
+
+#endif /* _ELF_EXPORT_H */
@@ -0,0 +1,342 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elf-file.h"
+#include "elf-stats.h"
+#include "elf-advise.h"
+
+struct elf_file {
+	int32_t fd;
+	bool owns_fd;
+	bool is64;
+	uint64_t file_size;
+	Elf64_Ehdr eh64;
+	Elf32_Ehdr eh32;
+	Elf64_Shdr *sh64;
+	Elf32_Shdr *sh32;
+	uint32_t shnum;
+	bool shdrs_loaded;
+	arena_t *arena;		/* shdr table and section buffers */
+	elf_view_t shstr;	/* section names, mapped on first use */
+};
+
+typedef struct shdr_info {
+	uint64_t offset;
+	uint64_t size;
+	uint32_t type;
+	uint32_t name;
+} shdr_info_t;
+
+/* Symbol and string tables of small binaries fit in the first chunk */
+#define ELF_ARENA_CHUNK	(64 << 10)
+
+static long page_size;
+
+static bool fits(uint64_t offset, uint64_t size, uint64_t limit)
+{
+	return offset <= limit && size <= limit - offset;
+}
+
+static void get_shdr(const elf_file_t *ef, uint32_t idx, shdr_info_t *info)
+{
+	if(ef->is64) {
+		info->offset = ef->sh64[idx].sh_offset;
+		info->size = ef->sh64[idx].sh_size;
+		info->type = ef->sh64[idx].sh_type;
+		info->name = ef->sh64[idx].sh_name;
+	} else {
+		info->offset = ef->sh32[idx].sh_offset;
+		info->size = ef->sh32[idx].sh_size;
+		info->type = ef->sh32[idx].sh_type;
+		info->name = ef->sh32[idx].sh_name;
+	}
+}
+
+elf_status_t elf_open(const char *path, elf_file_t **ef)
+{
+	elf_status_t status;
+	int32_t fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return ELF_ERR_OPEN;
+
+	status = elf_open_fd(fd, ef);
+	if(status != ELF_OK) {
+		close(fd);
+		return status;
+	}
+
+	(*ef)->owns_fd = true;
+	return ELF_OK;
+}
+
+/* The caller keeps ownership of fd */
+elf_status_t elf_open_fd(int32_t fd, elf_file_t **ef)
+{
+	unsigned char ident[EI_NIDENT];
+	elf_file_t *f;
+	struct stat st;
+	bool ok;
+
+	*ef = NULL;
+	if(fstat(fd, &st) < 0)
+		return ELF_ERR_OPEN;
+
+	if(!read_full(fd, 0, ident, EI_NIDENT))
+		return (uint64_t)st.st_size < EI_NIDENT ? ELF_ERR_FORMAT : ELF_ERR_IO;
+	if(memcmp(ident, "\177ELF", 4)
+			|| (ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64))
+		return ELF_ERR_FORMAT;
+
+	f = calloc(1, sizeof(elf_file_t));
+	if(!f)
+		return ELF_ERR_NOMEM;
+	f->arena = arena_create(ELF_ARENA_CHUNK);
+	if(!f->arena) {
+		free(f);
+		return ELF_ERR_NOMEM;
+	}
+	f->fd = fd;
+	f->file_size = st.st_size;
+	f->is64 = ident[EI_CLASS] == ELFCLASS64;
+	advise_open(fd);
+
+	if(f->is64)
+		ok = f->file_size >= sizeof(Elf64_Ehdr) && read_elf_header64(fd, &f->eh64);
+	else
+		ok = f->file_size >= sizeof(Elf32_Ehdr) && read_elf_header(fd, &f->eh32);
+	if(!ok) {
+		arena_destroy(f->arena);
+		free(f);
+		return ELF_ERR_FORMAT;
+	}
+
+	*ef = f;
+	return ELF_OK;
+}
+
+void elf_close(elf_file_t *ef)
+{
+	if(!ef)
+		return;
+
+	elf_view_release(&ef->shstr);
+	arena_destroy(ef->arena);
+	if(ef->owns_fd)
+		close(ef->fd);
+	free(ef);
+}
+
+const char * elf_strerror(elf_status_t status)
+{
+	switch(status)
+	{
+		case ELF_OK:		return "success";
+		case ELF_ERR_OPEN:	return "cannot open file";
+		case ELF_ERR_IO:	return "read error";
+		case ELF_ERR_NOMEM:	return "out of memory";
+		case ELF_ERR_FORMAT:	return "malformed ELF file";
+		case ELF_ERR_RANGE:	return "section index out of range";
+		case ELF_ERR_NOTFOUND:	return "section not found";
+		case ELF_ERR_OFFSET:	return "offset out of range";
+		case ELF_ERR_MOVED:	return "edits move data, save to another file";
+	}
+	return "unknown error";
+}
+
+int32_t elf_fd(const elf_file_t *ef)
+{
+	return ef->fd;
+}
+
+uint64_t elf_file_size(const elf_file_t *ef)
+{
+	return ef->file_size;
+}
+
+bool elf_is64(const elf_file_t *ef)
+{
+	return ef->is64;
+}
+
+const Elf64_Ehdr * elf_ehdr64(const elf_file_t *ef)
+{
+	return ef->is64 ? &ef->eh64 : NULL;
+}
+
+const Elf32_Ehdr * elf_ehdr(const elf_file_t *ef)
+{
+	return ef->is64 ? NULL : &ef->eh32;
+}
+
+arena_t * elf_arena(const elf_file_t *ef)
+{
+	return ef->arena;
+}
+
+elf_status_t elf_read_shdrs(elf_file_t *ef)
+{
+	uint64_t shoff, entsize;
+	uint32_t shnum;
+
+	if(ef->shdrs_loaded)
+		return ELF_OK;
+
+	if(ef->is64) {
+		shoff = ef->eh64.e_shoff;
+		entsize = ef->eh64.e_shentsize;
+	} else {
+		shoff = ef->eh32.e_shoff;
+		entsize = ef->eh32.e_shentsize;
+	}
+
+	/* Section 0 has to be readable before the extended count is known */
+	if(shoff && !fits(shoff, entsize, ef->file_size))
+		return ELF_ERR_FORMAT;
+	shnum = ef->is64 ? read_section_count64(ef->fd, ef->eh64)
+		: read_section_count(ef->fd, ef->eh32);
+	if(shoff && !fits(shoff, (uint64_t)shnum * entsize, ef->file_size))
+		return ELF_ERR_FORMAT;
+
+	if(shnum > 0) {
+		if(ef->is64) {
+			ef->sh64 = arena_alloc(ef->arena, shnum * sizeof(Elf64_Shdr));
+			stats_alloc(shnum * sizeof(Elf64_Shdr));
+			if(!ef->sh64)
+				return ELF_ERR_NOMEM;
+			if(!read_section_header_table64(ef->fd, ef->eh64, ef->sh64)) {
+				ef->sh64 = NULL;
+				return ELF_ERR_IO;
+			}
+		} else {
+			ef->sh32 = arena_alloc(ef->arena, shnum * sizeof(Elf32_Shdr));
+			stats_alloc(shnum * sizeof(Elf32_Shdr));
+			if(!ef->sh32)
+				return ELF_ERR_NOMEM;
+			if(!read_section_header_table(ef->fd, ef->eh32, ef->sh32)) {
+				ef->sh32 = NULL;
+				return ELF_ERR_IO;
+			}
+		}
+	}
+
+	ef->shnum = shnum;
+	ef->shdrs_loaded = true;
+	return ELF_OK;
+}
+
+uint32_t elf_section_count(const elf_file_t *ef)
+{
+	return ef->shnum;
+}
+
+Elf64_Shdr * elf_shdrs64(const elf_file_t *ef)
+{
+	return ef->sh64;
+}
+
+Elf32_Shdr * elf_shdrs(const elf_file_t *ef)
+{
+	return ef->sh32;
+}
+
+static elf_status_t map_range(elf_file_t *ef, uint64_t offset, uint64_t size,
+		advise_access_t access, elf_view_t *view)
+{
+	uint64_t start;
+
+	if(!page_size)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	start = offset & ~((uint64_t)page_size - 1);
+	view->length = size + (offset - start);
+	view->base = mmap(NULL, view->length, PROT_READ, MAP_PRIVATE, ef->fd, (off_t)start);
+	stats_add(STAT_SYSCALLS, 1);
+	if(view->base == MAP_FAILED) {
+		memset(view, 0, sizeof(*view));
+		return ELF_ERR_IO;
+	}
+
+	view->data = (const uint8_t *)view->base + (offset - start);
+	view->size = size;
+	advise_map(view->base, view->length, access);
+	return ELF_OK;
+}
+
+elf_status_t elf_section_view(elf_file_t *ef, uint32_t idx, elf_view_t *view)
+{
+	shdr_info_t sh;
+
+	memset(view, 0, sizeof(*view));
+	if(!ef->shdrs_loaded || idx >= ef->shnum)
+		return ELF_ERR_RANGE;
+
+	get_shdr(ef, idx, &sh);
+	if(sh.type == SHT_NOBITS || sh.size == 0)
+		return ELF_OK;
+	if(!fits(sh.offset, sh.size, ef->file_size))
+		return ELF_ERR_FORMAT;
+
+	return map_range(ef, sh.offset, sh.size, ACCESS_TABLE, view);
+}
+
+/* The whole file, for walks over many sections and segments */
+elf_status_t elf_file_view(elf_file_t *ef, elf_view_t *view)
+{
+	memset(view, 0, sizeof(*view));
+	if(ef->file_size == 0)
+		return ELF_OK;
+
+	return map_range(ef, 0, ef->file_size, ACCESS_STREAM, view);
+}
+
+void elf_view_release(elf_view_t *view)
+{
+	if(view->base)
+		munmap(view->base, view->length);
+	memset(view, 0, sizeof(*view));
+}
+
+const char * elf_section_name(elf_file_t *ef, uint32_t idx)
+{
+	shdr_info_t sh;
+	uint32_t shstrndx;
+
+	if(!ef->shdrs_loaded || idx >= ef->shnum)
+		return NULL;
+
+	if(!ef->shstr.data) {
+		shstrndx = ef->is64 ? section_strndx64(ef->eh64, ef->sh64)
+			: section_strndx(ef->eh32, ef->sh32);
+		if(elf_section_view(ef, shstrndx, &ef->shstr) != ELF_OK || !ef->shstr.data)
+			return NULL;
+	}
+
+	/* Names must be terminated inside the string table */
+	get_shdr(ef, idx, &sh);
+	if(sh.name >= ef->shstr.size
+			|| !memchr(ef->shstr.data + sh.name, 0, ef->shstr.size - sh.name))
+		return NULL;
+
+	return (const char *)ef->shstr.data + sh.name;
+}
+
+elf_status_t elf_find_section(elf_file_t *ef, const char *name, uint32_t *idx)
+{
+	const char *s;
+	uint32_t i;
+
+	if(!ef->shdrs_loaded)
+		return ELF_ERR_RANGE;
+
+	for(i=0; i<ef->shnum; i++) {
+		s = elf_section_name(ef, i);
+		if(s && !strcmp(s, name)) {
+			*idx = i;
+			return ELF_OK;
+		}
+	}
+
+	return ELF_ERR_NOTFOUND;
+}
@@ -0,0 +1,52 @@
+#ifndef _ELF_FILE_H
+#define _ELF_FILE_H
+
+#include "elf-parser.h"
+#include "elf-arena.h"
+
+/* Embeddable reader API.
+ *
+ * Nothing here prints, asserts or exits: every call reports failure
+ * through its return value, so the parser can be linked into a
+ * long-running service and built with -DNDEBUG.  Headers are converted
+ * to host byte order on load; section contents are handed out as
+ * read-only mappings in the file's own byte order.
+ *
+ * Buffers read on behalf of a handle, the section header table
+ * included, come from an arena owned by it and are released together
+ * by elf_close().  A handle is not thread-safe, open one per thread.
+ */
+
+typedef struct elf_file elf_file_t;
+
+typedef struct elf_view {
+	const uint8_t *data;	/* NULL for empty and SHT_NOBITS sections */
+	uint64_t size;
+	void *base;		/* page aligned mapping, private */
+	size_t length;
+} elf_view_t;
+
+elf_status_t elf_open(const char *path, elf_file_t **ef);
+elf_status_t elf_open_fd(int32_t fd, elf_file_t **ef);
+void elf_close(elf_file_t *ef);
+const char * elf_strerror(elf_status_t status);
+
+int32_t elf_fd(const elf_file_t *ef);
+uint64_t elf_file_size(const elf_file_t *ef);
+bool elf_is64(const elf_file_t *ef);
+const Elf64_Ehdr * elf_ehdr64(const elf_file_t *ef);
+const Elf32_Ehdr * elf_ehdr(const elf_file_t *ef);
+arena_t * elf_arena(const elf_file_t *ef);
+
+elf_status_t elf_read_shdrs(elf_file_t *ef);
+uint32_t elf_section_count(const elf_file_t *ef);
+Elf64_Shdr * elf_shdrs64(const elf_file_t *ef);
+Elf32_Shdr * elf_shdrs(const elf_file_t *ef);
+const char * elf_section_name(elf_file_t *ef, uint32_t idx);
+elf_status_t elf_find_section(elf_file_t *ef, const char *name, uint32_t *idx);
+
+elf_status_t elf_section_view(elf_file_t *ef, uint32_t idx, elf_view_t *view);
+elf_status_t elf_file_view(elf_file_t *ef, elf_view_t *view);
+void elf_view_release(elf_view_t *view);
+
+#endif /* _ELF_FILE_H */
@@ -0,0 +1,301 @@
+#include <fnmatch.h>
+
+#include "elf-filter.h"
+
+typedef struct filter_name_tbl {
+	const char *name;
+	uint32_t value;
+} filter_name_tbl_t;
+
+static const filter_name_tbl_t binds[] = {
+	{ "local", STB_LOCAL }, { "global", STB_GLOBAL }, { "weak", STB_WEAK },
+	{ "unique", STB_GNU_UNIQUE }, { NULL, 0 }
+};
+
+static const filter_name_tbl_t types[] = {
+	{ "notype", STT_NOTYPE }, { "object", STT_OBJECT }, { "func", STT_FUNC },
+	{ "section", STT_SECTION }, { "file", STT_FILE }, { "common", STT_COMMON },
+	{ "tls", STT_TLS }, { "ifunc", STT_GNU_IFUNC }, { NULL, 0 }
+};
+
+static const filter_name_tbl_t visibilities[] = {
+	{ "default", STV_DEFAULT }, { "internal", STV_INTERNAL },
+	{ "hidden", STV_HIDDEN }, { "protected", STV_PROTECTED }, { NULL, 0 }
+};
+
+static const filter_name_tbl_t shndxs[] = {
+	{ "undef", SHN_UNDEF }, { "abs", SHN_ABS }, { "common", SHN_COMMON },
+	{ NULL, 0 }
+};
+
+static const sym_filter_t *current;
+
+static bool parse_number(const char *s, const char *end, uint64_t *v)
+{
+	char *stop;
+
+	if(s == end)
+		return false;
+	errno = 0;
+	*v = strtoull(s, &stop, 0);
+	return !errno && stop == end;
+}
+
+/* "lo..hi", "lo..", "..hi" or a single value */
+static bool parse_range(const char *s, uint64_t *lo, uint64_t *hi)
+{
+	const char *dots = strstr(s, "..");
+	const char *end = s + strlen(s);
+
+	if(!dots)
+		return parse_number(s, end, lo) && (*hi = *lo, true);
+
+	*lo = 0;
+	*hi = UINT64_MAX;
+	if(dots != s && !parse_number(s, dots, lo))
+		return false;
+	if(dots + 2 != end && !parse_number(dots + 2, end, hi))
+		return false;
+	return *lo <= *hi;
+}
+
+/* Alternatives separated by '|', looked up by name */
+static bool parse_mask(char *s, const filter_name_tbl_t *tbl, uint32_t *mask)
+{
+	char *alt, *save = NULL;
+	uint32_t i;
+
+	for(alt=strtok_r(s, "|", &save); alt; alt=strtok_r(NULL, "|", &save)) {
+		for(i=0; tbl[i].name && strcmp(tbl[i].name, alt); i++)
+			;
+		if(!tbl[i].name)
+			return false;
+		*mask |= 1u << tbl[i].value;
+	}
+	return *mask != 0;
+}
+
+/* Bytes at the start of a regex that every match begins with */
+static size_t regex_prefix(const char *re)
+{
+	size_t n = 0;
+
+	/* An alternation may start some other way */
+	if(re[0] != '^' || strchr(re, '|'))
+		return 0;
+	while((re[n + 1] >= 'a' && re[n + 1] <= 'z') || (re[n + 1] >= 'A' && re[n + 1] <= 'Z')
+			|| (re[n + 1] >= '0' && re[n + 1] <= '9') || re[n + 1] == '_')
+		n++;
+	/* A quantifier makes the last literal optional */
+	if(n && re[n + 1] && strchr("*?+{", re[n + 1]))
+		n--;
+	return n;
+}
+
+static bool compile_glob(sym_filter_t *f)
+{
+	char *p = f->pattern, *star;
+
+	f->prefix = f->pattern;
+	f->prefix_len = strcspn(f->pattern, "*?[\\");
+	if(f->pattern[strcspn(f->pattern, "[\\")]) {
+		f->match = MATCH_FNMATCH;
+		return true;
+	}
+
+	f->match = MATCH_GLOB;
+	f->anchor_start = *p != '*';
+	f->anchor_end = !*p || p[strlen(p) - 1] != '*';
+	for(;;) {
+		star = strchr(p, '*');
+		if(!star || star != p) {
+			if(f->npieces == FILTER_MAX_PIECES)
+				return false;
+			f->pieces[f->npieces].text = p;
+			f->pieces[f->npieces++].len = star ? (size_t)(star - p) : strlen(p);
+		}
+		if(!star)
+			break;
+		p = star + 1;
+	}
+	return true;
+}
+
+static bool set_name(sym_filter_t *f, name_match_t kind, const char *value)
+{
+	if(f->match != MATCH_ANY)
+		return false;	/* one name term per filter */
+	f->pattern = strdup(value);
+	if(!f->pattern)
+		return false;
+
+	if(kind == MATCH_REGEX) {
+		if(regcomp(&f->regex, value, REG_EXTENDED | REG_NOSUB))
+			return false;
+		f->match = MATCH_REGEX;
+		f->prefix = f->pattern + 1;
+		f->prefix_len = regex_prefix(f->pattern);
+		return true;
+	}
+	return compile_glob(f);
+}
+
+bool filter_parse(const char *expr, sym_filter_t *f)
+{
+	char *copy, *term, *value, *save = NULL;
+	bool ok = true;
+	uint64_t v;
+	uint32_t mask;
+
+	memset(f, 0, sizeof(*f));
+	f->value_max = f->size_max = UINT64_MAX;
+
+	copy = strdup(expr);
+	if(!copy)
+		return false;
+
+	for(term=strtok_r(copy, ",", &save); term && ok; term=strtok_r(NULL, ",", &save)) {
+		value = strchr(term, '=');
+		if(!value) {
+			ok = false;
+			break;
+		}
+		*value++ = '\0';
+
+		if(!strcmp(term, "bind")) {
+			ok = parse_mask(value, binds, &f->binds);
+		} else if(!strcmp(term, "type")) {
+			ok = parse_mask(value, types, &f->types);
+		} else if(!strcmp(term, "vis")) {
+			ok = parse_mask(value, visibilities, &f->visibilities);
+		} else if(!strcmp(term, "shndx")) {
+			mask = 0;
+			f->by_shndx = true;
+			if(parse_number(value, value + strlen(value), &v) && v <= UINT32_MAX)
+				f->shndx = v;
+			else if(parse_mask(value, shndxs, &mask) && !(mask & (mask - 1)))
+				f->shndx = __builtin_ctz(mask);
+			else
+				ok = false;
+		} else if(!strcmp(term, "value")) {
+			ok = parse_range(value, &f->value_min, &f->value_max);
+		} else if(!strcmp(term, "size")) {
+			ok = parse_range(value, &f->size_min, &f->size_max);
+		} else if(!strcmp(term, "name")) {
+			ok = set_name(f, MATCH_GLOB, value);
+		} else if(!strcmp(term, "prefix")) {
+			/* A prefix is the glob "text*" with the star implied */
+			size_t len = strlen(value);
+			char *glob = malloc(len + 2);
+			ok = glob && strcspn(value, "*?[\\") == len;
+			if(ok) {
+				memcpy(glob, value, len);
+				strcpy(glob + len, "*");
+				ok = set_name(f, MATCH_GLOB, glob);
+			}
+			free(glob);
+		} else if(!strcmp(term, "regex")) {
+			ok = set_name(f, MATCH_REGEX, value);
+		} else {
+			ok = false;
+		}
+	}
+
+	free(copy);
+	if(!ok)
+		filter_free(f);
+	return ok;
+}
+
+void filter_free(sym_filter_t *f)
+{
+	if(f->match == MATCH_REGEX)
+		regfree(&f->regex);
+	free(f->pattern);
+	if(current == f)
+		current = NULL;
+	memset(f, 0, sizeof(*f));
+}
+
+void filter_use(const sym_filter_t *f)
+{
+	current = f;
+}
+
+const sym_filter_t * filter_current(void)
+{
+	return current;
+}
+
+/* memcmp with '?' in the pattern matching any byte */
+static bool piece_at(const char *s, const char *piece, size_t len)
+{
+	size_t i;
+
+	for(i=0; i<len; i++) {
+		if(!s[i] || (piece[i] != '?' && piece[i] != s[i]))
+			return false;
+	}
+	return true;
+}
+
+/* Pieces in order, each at its leftmost position: no backtracking needed */
+static bool glob_match(const sym_filter_t *f, const char *name)
+{
+	size_t len = strlen(name), pos = 0, i;
+	uint32_t k, last = f->npieces - 1;
+
+	if(!f->npieces)
+		return !f->anchor_start || !len;
+
+	for(k=0; k<f->npieces; k++) {
+		const char *text = f->pieces[k].text;
+		size_t plen = f->pieces[k].len;
+
+		if(k == 0 && f->anchor_start) {
+			if(!piece_at(name, text, plen))
+				return false;
+			pos = plen;
+			if(k == last && f->anchor_end)
+				return pos == len;
+			continue;
+		}
+		if(k == last && f->anchor_end) {
+			/* The tail piece has to end exactly at the end */
+			return len >= plen && len - plen >= pos && piece_at(name + len - plen, text, plen);
+		}
+
+		for(i=pos; i + plen <= len; i++) {
+			if(piece_at(name + i, text, plen))
+				break;
+		}
+		if(i + plen > len)
+			return false;
+		pos = i + plen;
+	}
+	return true;
+}
+
+bool filter_name(const sym_filter_t *f, const char *name)
+{
+	/* NULL: the name runs off its string table, only a filter without
+	 * a name pattern lets the symbol through
+	 */
+	if(!name)
+		return f->match == MATCH_ANY && !f->prefix_len;
+
+	if(f->prefix_len && strncmp(name, f->prefix, f->prefix_len))
+		return false;
+
+	switch(f->match)
+	{
+		case MATCH_GLOB:
+			return glob_match(f, name);
+		case MATCH_FNMATCH:
+			return !fnmatch(f->pattern, name, 0);
+		case MATCH_REGEX:
+			return !regexec(&f->regex, name, 0, NULL, 0);
+		default:
+			return true;
+	}
+}
@@ -0,0 +1,92 @@
+#ifndef _ELF_FILTER_H
+#define _ELF_FILTER_H
+
+#include <regex.h>
+
+#include "elf-parser.h"
+
+/* Symbol filters applied while a table is decoded.
+ *
+ * An expression is a comma separated list of terms, all of which must
+ * hold:
+ *
+ *   bind=global|weak|local       type=func|object|notype|tls|...
+ *   vis=default|hidden|...       shndx=N|undef|abs|common
+ *   value=lo..hi  size=lo..hi    either end may be left out, a single
+ *                                number matches exactly
+ *   name=glob     prefix=text    regex=ERE
+ *
+ * The dumps test the numeric fields first and look at the name only
+ * for symbols that pass them.  Names are matched by a pattern compiled
+ * once: a glob is split at its stars into pieces, a regex goes through
+ * regcomp(), and every kind first rejects names that lack the literal
+ * prefix the pattern starts with.
+ *
+ * Like the arena, the filter used by the dumps is selected with a
+ * switch, filter_use(NULL) turns filtering off.
+ */
+
+#define FILTER_MAX_PIECES	16
+
+typedef enum name_match {
+	MATCH_ANY,
+	MATCH_GLOB,
+	MATCH_FNMATCH,	/* globs with classes or escapes */
+	MATCH_REGEX
+} name_match_t;
+
+typedef struct sym_filter {
+	uint32_t binds;		/* 1 << STB_*, 0 for any */
+	uint32_t types;		/* 1 << STT_* */
+	uint32_t visibilities;	/* 1 << STV_* */
+	bool by_shndx;
+	uint32_t shndx;
+	uint64_t value_min, value_max;
+	uint64_t size_min, size_max;
+
+	name_match_t match;
+	char *pattern;
+	const char *prefix;	/* every match starts with these bytes */
+	size_t prefix_len;
+	uint32_t npieces;	/* MATCH_GLOB: the text between stars */
+	struct {
+		const char *text;
+		size_t len;
+	} pieces[FILTER_MAX_PIECES];
+	bool anchor_start, anchor_end;
+	regex_t regex;
+} sym_filter_t;
+
+bool filter_parse(const char *expr, sym_filter_t *f);
+void filter_free(sym_filter_t *f);
+
+void filter_use(const sym_filter_t *f);
+const sym_filter_t * filter_current(void);
+
+bool filter_name(const sym_filter_t *f, const char *name);
+
+/* The cheap part, run before the name is looked at */
+static inline bool filter_fields(const sym_filter_t *f, uint8_t info,
+		uint8_t other, uint32_t shndx, uint64_t value, uint64_t size)
+{
+	if(f->binds && !(f->binds & (1u << ELF32_ST_BIND(info))))
+		return false;
+	if(f->types && !(f->types & (1u << ELF32_ST_TYPE(info))))
+		return false;
+	if(f->visibilities && !(f->visibilities & (1u << ELF_ST_VISIBILITY(other))))
+		return false;
+	if(f->by_shndx && shndx != f->shndx)
+		return false;
+	return value >= f->value_min && value <= f->value_max
+		&& size >= f->size_min && size <= f->size_max;
+}
+
+/* Both parts; no filter keeps everything */
+static inline bool filter_symbol(const sym_filter_t *f, uint8_t info, uint8_t other,
+		uint32_t shndx, uint64_t value, uint64_t size, const char *name)
+{
+	return !f || (filter_fields(f, info, other, shndx, value, size)
+			&& filter_name(f, name));
+}
+
+#endif /* _ELF_FILTER_H */
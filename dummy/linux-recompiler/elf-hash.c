@@ -0,0 +1,502 @@
+#include <pthread.h>
+
+#include "elf-hash.h"
+#include "elf-parser.h"
+#include "elf-stats.h"
+
+#define MAX_THREADS		64
+#define PARALLEL_MIN_BYTES	(4 << 20)	/* not worth a thread below this */
+
+#define PRIME64_1	0x9e3779b185ebca87ULL
+#define PRIME64_2	0xc2b2ae3d27d4eb4fULL
+#define PRIME64_3	0x165667b19e3779f9ULL
+#define PRIME64_4	0x85ebca77c2b2ae63ULL
+#define PRIME64_5	0x27d4eb2f165667c5ULL
+
+typedef enum item_kind {
+	ITEM_FILE,
+	ITEM_SECTION,
+	ITEM_SEGMENT
+} item_kind_t;
+
+typedef struct item {
+	item_kind_t kind;
+	uint32_t idx;
+	const char *name;
+	uint64_t offset;
+	uint64_t size;
+	const uint8_t *data;	/* NULL without file contents */
+	uint64_t first_leaf;
+	uint64_t leaves;
+	uint64_t fast;
+	uint8_t sha[32];
+	int64_t dup;
+} item_t;
+
+/* A leaf of one item, or (leaf == -1) its whole SHA-256 */
+typedef struct hash_job {
+	item_t *item;
+	int64_t leaf;
+} hash_job_t;
+
+typedef struct hash_work {
+	hash_job_t *jobs;
+	uint64_t count;
+	uint64_t next;		/* claimed atomically */
+	uint64_t *digests;	/* one per leaf, all items */
+} hash_work_t;
+
+static inline uint64_t rotl64(uint64_t x, uint32_t r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64_le(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint32_t read32_le(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t hash_xxh64(const void *data, uint64_t len, uint64_t seed)
+{
+	const uint8_t *p = data;
+	const uint8_t *end = p + len;
+	uint64_t h;
+
+	if(len >= 32) {
+		uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+		uint64_t v2 = seed + PRIME64_2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, read64_le(p));
+			v2 = xxh64_round(v2, read64_le(p + 8));
+			v3 = xxh64_round(v3, read64_le(p + 16));
+			v4 = xxh64_round(v4, read64_le(p + 24));
+			p += 32;
+		} while(p + 32 <= end);
+
+		h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+		h = xxh64_merge(h, v1);
+		h = xxh64_merge(h, v2);
+		h = xxh64_merge(h, v3);
+		h = xxh64_merge(h, v4);
+	} else {
+		h = seed + PRIME64_5;
+	}
+
+	h += len;
+	for(; p + 8 <= end; p += 8) {
+		h ^= xxh64_round(0, read64_le(p));
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+	}
+	if(p + 4 <= end) {
+		h ^= read32_le(p) * PRIME64_1;
+		h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	for(; p<end; p++) {
+		h ^= *p * PRIME64_5;
+		h = rotl64(h, 11) * PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t st[8], const uint8_t *p)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	uint32_t i;
+
+	for(i=0; i<16; i++)
+		w[i] = (uint32_t)p[4*i] << 24 | (uint32_t)p[4*i+1] << 16
+			| (uint32_t)p[4*i+2] << 8 | p[4*i+3];
+	for(; i<64; i++) {
+		uint32_t s0 = ROR32(w[i-15], 7) ^ ROR32(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = ROR32(w[i-2], 17) ^ ROR32(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	a = st[0]; b = st[1]; c = st[2]; d = st[3];
+	e = st[4]; f = st[5]; g = st[6]; h = st[7];
+	for(i=0; i<64; i++) {
+		t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25))
+			+ ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22))
+			+ ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+	st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+static void sha256(const uint8_t *p, uint64_t len, uint8_t out[32])
+{
+	uint32_t st[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	uint8_t tail[128];
+	uint64_t i, rest, bits = len * 8;
+	uint32_t k;
+
+	for(i=0; i + 64 <= len; i += 64)
+		sha256_block(st, p + i);
+
+	/* Padding: 0x80, zeros, then the bit length big-endian */
+	rest = len - i;
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, p + i, rest);
+	tail[rest] = 0x80;
+	rest = rest < 56 ? 64 : 128;
+	for(k=0; k<8; k++)
+		tail[rest - 1 - k] = bits >> (8 * k);
+	sha256_block(st, tail);
+	if(rest == 128)
+		sha256_block(st, tail + 64);
+
+	for(k=0; k<8; k++) {
+		out[4*k] = st[k] >> 24;
+		out[4*k+1] = st[k] >> 16;
+		out[4*k+2] = st[k] >> 8;
+		out[4*k+3] = st[k];
+	}
+}
+
+static void * hash_worker(void *arg)
+{
+	hash_work_t *work = arg;
+	hash_job_t *job;
+	item_t *it;
+	uint64_t i, off, len;
+
+	while((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->count) {
+		job = &work->jobs[i];
+		it = job->item;
+		if(job->leaf < 0) {
+			sha256(it->data, it->size, it->sha);
+			continue;
+		}
+		off = (uint64_t)job->leaf * HASH_LEAF;
+		len = it->size - off < HASH_LEAF ? it->size - off : HASH_LEAF;
+		work->digests[it->first_leaf + job->leaf] = hash_xxh64(it->data + off, len, 0);
+	}
+	return NULL;
+}
+
+static void hash_items(item_t *items, uint32_t n, bool with_sha, arena_t *arena)
+{
+	pthread_t threads[MAX_THREADS];
+	hash_work_t work;
+	uint64_t leaves = 0, bytes = 0, i, j;
+	uint32_t k, nthreads = 1;
+
+	for(k=0; k<n; k++) {
+		items[k].first_leaf = leaves;
+		items[k].leaves = items[k].data ? (items[k].size + HASH_LEAF - 1) / HASH_LEAF : 0;
+		leaves += items[k].leaves;
+		bytes += items[k].data ? items[k].size : 0;
+	}
+
+	memset(&work, 0, sizeof(work));
+	work.digests = arena_alloc(arena, (leaves + 1) * sizeof(uint64_t));
+	work.jobs = arena_alloc(arena, (leaves + n + 1) * sizeof(hash_job_t));
+	if(!work.digests || !work.jobs)
+		return;
+
+	/* SHA-256 jobs are the long ones, hand them out first */
+	for(k=0; with_sha && k<n; k++) {
+		if(items[k].data) {
+			work.jobs[work.count].item = &items[k];
+			work.jobs[work.count++].leaf = -1;
+		}
+	}
+	for(k=0; k<n; k++) {
+		for(i=0; i<items[k].leaves; i++) {
+			work.jobs[work.count].item = &items[k];
+			work.jobs[work.count++].leaf = i;
+		}
+	}
+
+	if(bytes >= PARALLEL_MIN_BYTES) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(nthreads < 1)
+			nthreads = 1;
+		if(nthreads > MAX_THREADS)
+			nthreads = MAX_THREADS;
+	}
+
+	for(k=1; k<nthreads; k++) {
+		if(pthread_create(&threads[k], NULL, hash_worker, &work))
+			threads[k] = 0;	/* the others pick up its share */
+	}
+	hash_worker(&work);
+	for(k=1; k<nthreads; k++) {
+		if(threads[k])
+			pthread_join(threads[k], NULL);
+	}
+
+	/* Fold the leaves into one digest per item */
+	for(k=0; k<n; k++) {
+		item_t *it = &items[k];
+		if(it->leaves == 1) {
+			it->fast = work.digests[it->first_leaf];
+		} else if(it->leaves > 1) {
+			uint8_t *buf = arena_alloc(arena, it->leaves * 8);
+			if(!buf)
+				continue;
+			for(i=0; i<it->leaves; i++) {
+				uint64_t d = work.digests[it->first_leaf + i];
+				for(j=0; j<8; j++)
+					buf[i * 8 + j] = d >> (8 * j);
+			}
+			it->fast = hash_xxh64(buf, it->leaves * 8, it->size);
+		}
+	}
+}
+
+static int cmp_content(const void *a, const void *b)
+{
+	const item_t *x = *(const item_t * const *)a, *y = *(const item_t * const *)b;
+
+	if(x->kind != y->kind)
+		return x->kind < y->kind ? -1 : 1;
+	if(x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+	if(x->fast != y->fast)
+		return x->fast < y->fast ? -1 : 1;
+	return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+/* Same kind, size and fast hash; with SHA-256 on it has to agree too */
+static void find_duplicates(item_t *items, uint32_t n, bool with_sha, arena_t *arena)
+{
+	item_t **order = arena_alloc(arena, (n + 1) * sizeof(item_t *));
+	uint32_t i, first = 0;
+
+	if(!order)
+		return;
+	for(i=0; i<n; i++)
+		order[i] = &items[i];
+	qsort(order, n, sizeof(item_t *), cmp_content);
+
+	for(i=0; i<n; i++) {
+		item_t *it = order[i], *f = order[first];
+		if(i && it->data && f->data && it->kind == f->kind && it->size == f->size
+				&& it->fast == f->fast
+				&& (!with_sha || !memcmp(it->sha, f->sha, sizeof(it->sha))))
+			it->dup = f->idx;
+		else
+			first = i;
+	}
+}
+
+static void print_item(const item_t *it, bool with_sha)
+{
+	static const char * const kinds[] = { "file", "section", "segment" };
+	uint32_t i;
+
+	if(it->kind == ITEM_FILE)
+		printf("%s\t-\t%s\t0x%lx\t0x%lx", kinds[it->kind], it->name, it->offset, it->size);
+	else
+		printf("%s\t%u\t%s\t0x%lx\t0x%lx", kinds[it->kind], it->idx,
+				it->name, it->offset, it->size);
+
+	if(it->data)
+		printf("\t%016lx", it->fast);
+	else
+		printf("\t-");
+	if(with_sha) {
+		printf("\t");
+		for(i=0; it->data && i<sizeof(it->sha); i++)
+			printf("%02x", it->sha[i]);
+		if(!it->data)
+			printf("-");
+	}
+
+	if(it->dup >= 0)
+		printf("\t%ld\n", it->dup);
+	else
+		printf("\t-\n");
+}
+
+/* Sections and PT_LOAD segments of ef, pointing into the mapped file */
+static item_t * collect_items(elf_file_t *ef, const elf_view_t *file,
+		const char *path, uint32_t *count)
+{
+	arena_t *arena = elf_arena(ef);
+	uint64_t size = elf_file_size(ef), offset, length;
+	uint32_t shnum = elf_section_count(ef), phnum = 0, i, n = 0, type;
+	Elf64_Phdr *ph64 = NULL;
+	Elf32_Phdr *ph32 = NULL;
+	item_t *items, *it;
+	const char *name;
+
+	if(elf_is64(ef)) {
+		const Elf64_Ehdr *eh = elf_ehdr64(ef);
+		if(eh->e_phnum && eh->e_phentsize == sizeof(Elf64_Phdr)
+				&& eh->e_phoff <= size && eh->e_phnum * sizeof(Elf64_Phdr) <= size - eh->e_phoff) {
+			ph64 = arena_alloc(arena, eh->e_phnum * sizeof(Elf64_Phdr));
+			if(ph64 && read_program_header_table64(elf_fd(ef), *eh, ph64))
+				phnum = eh->e_phnum;
+		}
+	} else {
+		const Elf32_Ehdr *eh = elf_ehdr(ef);
+		if(eh->e_phnum && eh->e_phentsize == sizeof(Elf32_Phdr)
+				&& eh->e_phoff <= size && eh->e_phnum * sizeof(Elf32_Phdr) <= size - eh->e_phoff) {
+			ph32 = arena_alloc(arena, eh->e_phnum * sizeof(Elf32_Phdr));
+			if(ph32 && read_program_header_table(elf_fd(ef), *eh, ph32))
+				phnum = eh->e_phnum;
+		}
+	}
+
+	items = arena_alloc(arena, (1 + shnum + phnum) * sizeof(item_t));
+	if(!items)
+		return NULL;
+	memset(items, 0, (1 + shnum + phnum) * sizeof(item_t));
+
+	items[n].kind = ITEM_FILE;
+	items[n].name = path;
+	items[n].size = size;
+	items[n].data = file->data;
+	items[n++].dup = -1;
+
+	for(i=0; i<shnum; i++) {
+		it = &items[n++];
+		if(elf_is64(ef)) {
+			offset = elf_shdrs64(ef)[i].sh_offset;
+			length = elf_shdrs64(ef)[i].sh_size;
+			type = elf_shdrs64(ef)[i].sh_type;
+		} else {
+			offset = elf_shdrs(ef)[i].sh_offset;
+			length = elf_shdrs(ef)[i].sh_size;
+			type = elf_shdrs(ef)[i].sh_type;
+		}
+		name = elf_section_name(ef, i);
+		it->kind = ITEM_SECTION;
+		it->idx = i;
+		it->name = name && *name ? name : "-";
+		it->offset = offset;
+		it->size = length;
+		it->dup = -1;
+		if(type != SHT_NOBITS && length && offset <= size && length <= size - offset)
+			it->data = file->data + offset;
+	}
+
+	for(i=0; i<phnum; i++) {
+		if(ph64) {
+			type = ph64[i].p_type;
+			offset = ph64[i].p_offset;
+			length = ph64[i].p_filesz;
+		} else {
+			type = ph32[i].p_type;
+			offset = ph32[i].p_offset;
+			length = ph32[i].p_filesz;
+		}
+		if(type != PT_LOAD)
+			continue;
+
+		it = &items[n++];
+		it->kind = ITEM_SEGMENT;
+		it->idx = i;
+		it->name = "PT_LOAD";
+		it->offset = offset;
+		it->size = length;
+		it->dup = -1;
+		if(length && offset <= size && length <= size - offset)
+			it->data = file->data + offset;
+	}
+
+	*count = n;
+	return items;
+}
+
+bool hash_manifest(const char *path, bool with_sha)
+{
+	elf_file_t *ef = NULL;
+	elf_view_t file;
+	elf_status_t status;
+	item_t *items;
+	uint32_t i, n;
+
+	status = elf_open(path, &ef);
+	if(status == ELF_OK)
+		status = elf_read_shdrs(ef);
+	if(status == ELF_OK)
+		status = elf_file_view(ef, &file);
+	if(status != ELF_OK) {
+		fprintf(stderr, "%s: %s\n", path, elf_strerror(status));
+		elf_close(ef);
+		return false;
+	}
+
+	items = collect_items(ef, &file, path, &n);
+	if(!items) {
+		fprintf(stderr, "%s: %s\n", path, elf_strerror(ELF_ERR_NOMEM));
+		elf_view_release(&file);
+		elf_close(ef);
+		return false;
+	}
+
+	/* Every byte passes through the mapping once per digest kind */
+	stats_add(STAT_BYTES_READ, elf_file_size(ef));
+	hash_items(items, n, with_sha, elf_arena(ef));
+	find_duplicates(items, n, with_sha, elf_arena(ef));
+
+	printf("# manifest 1 xxh64-tree%s\n", with_sha ? " sha256" : "");
+	for(i=0; i<n; i++)
+		print_item(&items[i], with_sha);
+
+	elf_view_release(&file);
+	elf_close(ef);
+	return true;
+}
@@ -0,0 +1,33 @@
+#ifndef _ELF_HASH_H
+#define _ELF_HASH_H
+
+#include "elf-file.h"
+
+/* Content fingerprints for every section and PT_LOAD segment.
+ *
+ * The file is mapped once and hashed in place.  The fast hash is an
+ * XXH64 tree: contents are cut into HASH_LEAF sized leaves hashed in
+ * parallel, and when there is more than one leaf the root is the XXH64
+ * of the little-endian leaf digests seeded with the total size.  A
+ * single leaf is plain XXH64 with seed 0, so small sections can be
+ * checked with any xxhash tool.  SHA-256 is optional and, being
+ * sequential, runs in parallel across sections instead.
+ *
+ * The manifest is one tab separated line per item:
+ *
+ *   # manifest 1 xxh64-tree [sha256]
+ *   file     -    path     size    fast [sha256]  -
+ *   section  idx  name     offset  size  fast [sha256]  dup
+ *   segment  idx  PT_LOAD  offset  size  fast [sha256]  dup
+ *
+ * dup is the index of the first earlier section (segment) with the same
+ * contents, "-" if there is none.  Items without file contents show "-"
+ * for their hashes.
+ */
+
+#define HASH_LEAF	(1 << 20)
+
+bool hash_manifest(const char *path, bool sha256);
+uint64_t hash_xxh64(const void *data, uint64_t len, uint64_t seed);
+
+#endif /* _ELF_HASH_H */
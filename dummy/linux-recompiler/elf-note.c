@@ -0,0 +1,188 @@
+#include "elf-note.h"
+#include "elf-swap.h"
+#include "elf-arena.h"
+
+/* Note segments are a few hundred bytes, anything bigger is not worth
+ * reading just to find a build-id.
+ */
+#define NOTE_MAX_SIZE	(1 << 20)
+
+#define NOTE_ALIGN(x, a)	(((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+static char * read_range(int32_t fd, uint64_t offset, uint64_t size)
+{
+	char* buff;
+
+	if(size == 0)
+		return NULL;
+
+	buff = section_alloc(size);
+	if(!buff)
+		return NULL;
+
+	if(!read_full(fd, offset, buff, size)) {
+		section_free(buff);
+		return NULL;
+	}
+
+	return buff;
+}
+
+static bool read_note_build_id(int32_t fd,
+		uint64_t offset,
+		uint64_t size,
+		uint64_t align,
+		bool swap,
+		build_id_t *bid)
+{
+	bool found;
+	char* notes;
+
+	if(size > NOTE_MAX_SIZE)
+		return false;
+
+	notes = read_range(fd, offset, size);
+	if(!notes)
+		return false;
+
+	/* SHT_NOTE/PT_NOTE entries are 4-byte aligned unless the
+	 * container itself asks for 8 (e.g. .note.gnu.property)
+	 */
+	found = find_build_id(notes, size, align == 8 ? 8 : 4, swap, bid);
+	section_free(notes);
+	return found;
+}
+
+bool find_build_id(const char *notes, size_t size, size_t align, bool swap, build_id_t *bid)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	size_t off = 0;
+	uint32_t i;
+
+	/* Elf32_Nhdr and Elf64_Nhdr have the same layout */
+	while(off + sizeof(Elf64_Nhdr) <= size) {
+		const Elf64_Nhdr *nh = (const Elf64_Nhdr *)(notes + off);
+		size_t namesz = swap32_if(swap, (uint32_t)nh->n_namesz);
+		size_t descsz = swap32_if(swap, (uint32_t)nh->n_descsz);
+		size_t name = off + sizeof(Elf64_Nhdr);
+		size_t desc = name + NOTE_ALIGN(namesz, align);
+
+		if(desc < name || desc + descsz < desc || desc + descsz > size)
+			break;
+
+		if(swap32_if(swap, (uint32_t)nh->n_type) == NT_GNU_BUILD_ID
+				&& namesz == 4
+				&& !memcmp(notes + name, "GNU", 4)
+				&& descsz > 0 && descsz <= BUILD_ID_MAX) {
+			memcpy(bid->id, notes + desc, descsz);
+			bid->len = descsz;
+			for(i=0; i<bid->len; i++) {
+				bid->hex[i*2] = hexdigits[bid->id[i] >> 4];
+				bid->hex[i*2+1] = hexdigits[bid->id[i] & 0xf];
+			}
+			bid->hex[bid->len*2] = '\0';
+			return true;
+		}
+
+		off = desc + NOTE_ALIGN(descsz, align);
+	}
+
+	return false;
+}
+
+bool read_build_id64(int32_t fd, Elf64_Ehdr eh, build_id_t *bid)
+{
+	uint32_t i, shnum;
+	bool found = false;
+
+	/* The program header table sits right behind the ELF header and
+	 * PT_NOTE is tiny, so this costs a page or two of I/O regardless
+	 * of the file size.
+	 */
+	if(eh.e_phnum > 0 && eh.e_phentsize == sizeof(Elf64_Phdr)) {
+		Elf64_Phdr* ph_tbl = malloc(eh.e_phnum * sizeof(Elf64_Phdr));
+		if(!ph_tbl)
+			return false;
+
+		if(!read_program_header_table64(fd, eh, ph_tbl)) {
+			free(ph_tbl);
+			return false;
+		}
+		for(i=0; i<eh.e_phnum && !found; i++) {
+			if(ph_tbl[i].p_type == PT_NOTE)
+				found = read_note_build_id(fd, ph_tbl[i].p_offset,
+						ph_tbl[i].p_filesz, ph_tbl[i].p_align,
+						elf_swapped(eh.e_ident), bid);
+		}
+		free(ph_tbl);
+		if(found)
+			return true;
+	}
+
+	/* Relocatable objects have no program headers, fall back to SHT_NOTE */
+	shnum = read_section_count64(fd, eh);
+	if(shnum > 0 && eh.e_shentsize == sizeof(Elf64_Shdr)) {
+		Elf64_Shdr* sh_tbl = (Elf64_Shdr*)read_range(fd, eh.e_shoff,
+				shnum * sizeof(Elf64_Shdr));
+		if(!sh_tbl)
+			return false;
+		if(elf_swapped(eh.e_ident))
+			swap_shdr_table64(sh_tbl, shnum);
+
+		for(i=0; i<shnum && !found; i++) {
+			if(sh_tbl[i].sh_type == SHT_NOTE)
+				found = read_note_build_id(fd, sh_tbl[i].sh_offset,
+						sh_tbl[i].sh_size, sh_tbl[i].sh_addralign,
+						elf_swapped(eh.e_ident), bid);
+		}
+		section_free(sh_tbl);
+	}
+
+	return found;
+}
+
+bool read_build_id(int32_t fd, Elf32_Ehdr eh, build_id_t *bid)
+{
+	uint32_t i, shnum;
+	bool found = false;
+
+	if(eh.e_phnum > 0 && eh.e_phentsize == sizeof(Elf32_Phdr)) {
+		Elf32_Phdr* ph_tbl = malloc(eh.e_phnum * sizeof(Elf32_Phdr));
+		if(!ph_tbl)
+			return false;
+
+		if(!read_program_header_table(fd, eh, ph_tbl)) {
+			free(ph_tbl);
+			return false;
+		}
+		for(i=0; i<eh.e_phnum && !found; i++) {
+			if(ph_tbl[i].p_type == PT_NOTE)
+				found = read_note_build_id(fd, ph_tbl[i].p_offset,
+						ph_tbl[i].p_filesz, ph_tbl[i].p_align,
+						elf_swapped(eh.e_ident), bid);
+		}
+		free(ph_tbl);
+		if(found)
+			return true;
+	}
+
+	shnum = read_section_count(fd, eh);
+	if(shnum > 0 && eh.e_shentsize == sizeof(Elf32_Shdr)) {
+		Elf32_Shdr* sh_tbl = (Elf32_Shdr*)read_range(fd, eh.e_shoff,
+				shnum * sizeof(Elf32_Shdr));
+		if(!sh_tbl)
+			return false;
+		if(elf_swapped(eh.e_ident))
+			swap_shdr_table(sh_tbl, shnum);
+
+		for(i=0; i<shnum && !found; i++) {
+			if(sh_tbl[i].sh_type == SHT_NOTE)
+				found = read_note_build_id(fd, sh_tbl[i].sh_offset,
+						sh_tbl[i].sh_size, sh_tbl[i].sh_addralign,
+						elf_swapped(eh.e_ident), bid);
+		}
+		section_free(sh_tbl);
+	}
+
+	return found;
+}
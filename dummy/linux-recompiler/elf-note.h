@@ -0,0 +1,19 @@
+#ifndef _ELF_NOTE_H
+#define _ELF_NOTE_H
+
+#include "elf-parser.h"
+
+/* GNU build-ids are 20 bytes (sha1) in practice, --build-id=0x... may be longer */
+#define BUILD_ID_MAX	64
+
+typedef struct build_id {
+	uint8_t id[BUILD_ID_MAX];
+	uint32_t len;
+	char hex[BUILD_ID_MAX * 2 + 1];	/* lower-case hex, used as cache key */
+} build_id_t;
+
+bool find_build_id(const char *notes, size_t size, size_t align, bool swap, build_id_t *bid);
+bool read_build_id64(int32_t fd, Elf64_Ehdr eh, build_id_t *bid);
+bool read_build_id(int32_t fd, Elf32_Ehdr eh, build_id_t *bid);
+
+#endif /* _ELF_NOTE_H */
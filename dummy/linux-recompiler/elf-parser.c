@@ -1,10 +1,51 @@
+#include <sys/stat.h>
+
 #include "elf-parser.h"
+#include "elf-cache.h"
+#include "elf-swap.h"
+#include "elf-stats.h"
+#include "elf-arena.h"
+#include "elf-filter.h"
+#include "elf-demangle.h"
+#include "elf-advise.h"
+#include "elf-pipeline.h"
+
+bool read_full(int32_t fd, uint64_t offset, void *buf, size_t size)
+{
+	char* p = buf;
+	ssize_t len;
+	uint64_t start;
+
+	/* pread() leaves the file offset alone so one fd can be shared
+	 * between threads; it may also return short, hence the loop.
+	 */
+	while(size > 0) {
+		start = stats_clock();
+		len = pread(fd, p, size, (off_t)offset);
+		stats_elapsed(STAT_IO_NS, start);
+		stats_add(STAT_SYSCALLS, 1);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return false;
+		stats_add(STAT_BYTES_READ, len);
+		p += len;
+		offset += len;
+		size -= len;
+	}
 
-void read_elf_header64(int32_t fd, Elf64_Ehdr *elf_header)
+	return true;
+}
+
+bool read_elf_header64(int32_t fd, Elf64_Ehdr *elf_header)
 {
-	assert(elf_header != NULL);
-	assert(lseek(fd, (off_t)0, SEEK_SET) == (off_t)0);
-	assert(read(fd, (void *)elf_header, sizeof(Elf64_Ehdr)) == sizeof(Elf64_Ehdr));
+	if(!read_full(fd, 0, elf_header, sizeof(Elf64_Ehdr)))
+		return false;
+
+	/* Everything past e_ident is stored in the file's byte order */
+	if(elf_swapped(elf_header->e_ident))
+		swap_ehdr64(elf_header);
+	return true;
 }
 
 
@@ -250,42 +291,185 @@ void print_elf_header64(Elf64_Ehdr elf_header)
 
 }
 
-void read_section_header_table64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+uint32_t read_section_count64(int32_t fd, Elf64_Ehdr eh)
+{
+	Elf64_Shdr sh;
+
+	/* Extended numbering: with SHN_LORESERVE or more sections e_shnum
+	 * is 0 and the real count is held in sh_size of section 0.
+	 */
+	if(eh.e_shnum != 0 || eh.e_shoff == 0)
+		return eh.e_shnum;
+
+	/* An unreadable table has no sections as far as callers care */
+	if(!read_full(fd, eh.e_shoff, &sh, sizeof(Elf64_Shdr)))
+		return 0;
+	if(elf_swapped(eh.e_ident))
+		swap_shdr_table64(&sh, 1);
+
+	return (uint32_t)sh.sh_size;
+}
+
+uint32_t section_count64(Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+{
+	if(eh.e_shnum != 0 || eh.e_shoff == 0)
+		return eh.e_shnum;
+
+	return (uint32_t)sh_table[0].sh_size;
+}
+
+uint32_t section_strndx64(Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+{
+	/* e_shstrndx does not fit either, sh_link of section 0 holds it */
+	if(eh.e_shstrndx == SHN_XINDEX)
+		return sh_table[0].sh_link;
+
+	return eh.e_shstrndx;
+}
+
+bool read_section_header_table64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
 {
-	uint32_t i;
+	uint32_t i, shnum;
+	size_t entsize, size;
+	char* buf;
+	advice_t advice;
+	bool ok;
 
-	assert(lseek(fd, (off_t)eh.e_shoff, SEEK_SET) == (off_t)eh.e_shoff);
+	shnum = read_section_count64(fd, eh);
 
-	for(i=0; i<eh.e_shnum; i++) {
-		assert(read(fd, (void *)&sh_table[i], eh.e_shentsize)
-				== eh.e_shentsize);
+	/* One read for the whole table; objects built with
+	 * -ffunction-sections easily have 100k+ entries.
+	 */
+	entsize = eh.e_shentsize;
+	size = (size_t)shnum * entsize;
+	advise_begin(&advice, fd, eh.e_shoff, size, ACCESS_TABLE);
+	if(entsize == sizeof(Elf64_Shdr)) {
+		ok = read_full(fd, eh.e_shoff, sh_table, size);
+		advise_end(&advice);
+		if(!ok)
+			return false;
+	} else {
+		/* Foreign entry size, re-stride into our layout */
+		buf = calloc(1, size);
+		if(!buf) {
+			advise_end(&advice);
+			return false;
+		}
+		stats_alloc(size);
+		ok = read_full(fd, eh.e_shoff, buf, size);
+		advise_end(&advice);
+		if(!ok) {
+			free(buf);
+			return false;
+		}
+		for(i=0; i<shnum; i++) {
+			memset(&sh_table[i], 0, sizeof(Elf64_Shdr));
+			memcpy(&sh_table[i], buf + i * entsize,
+					entsize < sizeof(Elf64_Shdr) ? entsize : sizeof(Elf64_Shdr));
+		}
+		free(buf);
 	}
 
+	if(elf_swapped(eh.e_ident))
+		swap_shdr_table64(sh_table, shnum);
+
+	stats_add(STAT_SECTIONS, shnum);
+	return true;
+}
+
+bool read_program_header_table64(int32_t fd, Elf64_Ehdr eh, Elf64_Phdr ph_table[])
+{
+	if(!read_full(fd, eh.e_phoff, ph_table, eh.e_phnum * sizeof(Elf64_Phdr)))
+		return false;
+
+	if(elf_swapped(eh.e_ident))
+		swap_phdr_table64(ph_table, eh.e_phnum);
+	return true;
 }
 
+/* The buffer comes from the current arena, if any; release it with
+ * section_free()
+ */
 char * read_section64(int32_t fd, Elf64_Shdr sh)
 {
-	char* buff = malloc(sh.sh_size);
+	char* buff = section_alloc(sh.sh_size);
+	advice_t advice;
+	stats_alloc(sh.sh_size);
 	if(!buff) {
 		printf("%s:Failed to allocate %ldbytes\n",
 				__func__, sh.sh_size);
+		return NULL;
 	}
 
-	assert(buff != NULL);
-	assert(lseek(fd, (off_t)sh.sh_offset, SEEK_SET) == (off_t)sh.sh_offset);
-	assert(read(fd, (void *)buff, sh.sh_size) == sh.sh_size);
+	/* Binaries already seen under another path are answered from cache */
+	if(cache_load_section64(sh, buff))
+		return buff;
+
+	advise_begin(&advice, fd, sh.sh_offset, sh.sh_size, ACCESS_TABLE);
+	if(!read_full(fd, sh.sh_offset, buff, sh.sh_size)) {
+		advise_end(&advice);
+		printf("%s:Failed to read %ldbytes at 0x%08lx\n",
+				__func__, sh.sh_size, (uint64_t)sh.sh_offset);
+		section_free(buff);
+		return NULL;
+	}
+	advise_end(&advice);
 
+	cache_store_section64(sh, buff);
 	return buff;
 }
 
-void print_section_headers64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+const char * table_string(const char *tbl, uint64_t size, uint64_t off)
+{
+	if(off >= size || !memchr(tbl + off, 0, size - off))
+		return NULL;
+	return tbl + off;
+}
+
+/* Names that run off their string table print as empty */
+static inline const char * printable(const char *name)
 {
-	uint32_t i;
+	return name ? name : "";
+}
+
+typedef struct section_dump64 {
+	const Elf64_Shdr *sh_table;
+	const char *sh_str;
+	uint64_t sh_str_size;
+} section_dump64_t;
+
+static void decode_section_headers64(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const section_dump64_t *dump = ctx;
+	const Elf64_Shdr *sh;
+	uint64_t i;
+
+	for(i=first; i<first + count; i++) {
+		sh = &dump->sh_table[i];
+		pipeline_printf(out, " %03u 0x%08lx 0x%08lx 0x%08lx %4ld 0x%08lx 0x%08x %s\t\n",
+				(uint32_t)i, sh->sh_offset, sh->sh_addr, sh->sh_size,
+				sh->sh_addralign, sh->sh_flags, sh->sh_type,
+				printable(table_string(dump->sh_str, dump->sh_str_size, sh->sh_name)));
+	}
+}
+
+elf_status_t print_section_headers64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+{
+	uint32_t shnum, shstrndx;
 	char* sh_str;	/* section-header string-table is also a section. */
+	section_dump64_t dump;
+	pipeline_job_t job;
 
 	/* Read section-header string-table */
-	debug("eh.e_shstrndx = 0x%x\n", eh.e_shstrndx);
-	sh_str = read_section64(fd, sh_table[eh.e_shstrndx]);
+	shstrndx = section_strndx64(eh, sh_table);
+	debug("eh.e_shstrndx = 0x%x\n", shstrndx);
+	shnum = section_count64(eh, sh_table);
+	if(shstrndx >= shnum)
+		return ELF_ERR_RANGE;
+	sh_str = read_section64(fd, sh_table[shstrndx]);
+	if(!sh_str)
+		return ELF_ERR_IO;
 
 	printf("========================================");
 	printf("========================================\n");
@@ -294,33 +478,141 @@ void print_section_headers64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
 	printf("========================================");
 	printf("========================================\n");
 
-	for(i=0; i<eh.e_shnum; i++) {
-		printf(" %03d ", i);
-		printf("0x%08lx ", sh_table[i].sh_offset);
-		printf("0x%08lx ", sh_table[i].sh_addr);
-		printf("0x%08lx ", sh_table[i].sh_size);
-		printf("%4ld ", sh_table[i].sh_addralign);
-		printf("0x%08lx ", sh_table[i].sh_flags);
-		printf("0x%08x ", sh_table[i].sh_type);
-		printf("%s\t", (sh_str + sh_table[i].sh_name));
-		printf("\n");
-	}
+	dump.sh_table = sh_table;
+	dump.sh_str = sh_str;
+	dump.sh_str_size = sh_table[shstrndx].sh_size;
+	memset(&job, 0, sizeof(job));
+	job.count = shnum;
+	job.fd = -1;
+	job.decode = decode_section_headers64;
+	job.ctx = &dump;
+	pipeline_run(&job);
 	printf("========================================");
 	printf("========================================\n");
 	printf("\n");	/* end of section header table */
+	stats_add(STAT_SECTIONS, shnum);
+
+	section_free(sh_str);
+	return ELF_OK;
 }
 
-void print_symbol_table64(int32_t fd,
+bool in_file(int32_t fd, uint64_t offset, uint64_t size)
+{
+	struct stat st;
+
+	if(fstat(fd, &st))
+		return false;
+	return offset <= (uint64_t)st.st_size && size <= (uint64_t)st.st_size - offset;
+}
+
+/* SHN_XINDEX symbols keep their section index in SHT_SYMTAB_SHNDX; a
+ * table shorter than the symbol table leaves the rest undefined
+ */
+static inline uint32_t symbol_shndx(uint32_t st_shndx, const Elf32_Word *shndx_tbl,
+		uint32_t shndx_count, uint32_t i)
+{
+	if(st_shndx != SHN_XINDEX)
+		return st_shndx;
+	return shndx_tbl && i < shndx_count ? shndx_tbl[i] : SHN_UNDEF;
+}
+
+static void print_symbol(pipeline_out_t *out, uint64_t value, uint8_t info, uint32_t shndx,
+		const char *name, const char *demangled)
+{
+	if(demangled)
+		pipeline_printf(out, "0x%08lx 0x%02x 0x%02x %5u %s\t%s\n", value,
+				ELF32_ST_BIND(info), ELF32_ST_TYPE(info), shndx, name, demangled);
+	else
+		pipeline_printf(out, "0x%08lx 0x%02x 0x%02x %5u %s\n", value,
+				ELF32_ST_BIND(info), ELF32_ST_TYPE(info), shndx, name);
+}
+
+/* What the decoders of one symbol table share, for both classes */
+typedef struct symbol_dump {
+	const void *sym_tbl;		/* NULL when the symbols are streamed */
+	const char *str_tbl;
+	uint64_t str_size;
+	const Elf32_Word *shndx_tbl;
+	uint32_t shndx_count;
+	const sym_filter_t *filter;
+	const uint32_t *names;		/* with -C: string offsets, UINT32_MAX if filtered */
+	const char **demangled;
+	bool swapped;
+} symbol_dump_t;
+
+static void decode_symbols64(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const symbol_dump_t *dump = ctx;
+	Elf64_Sym *sym = raw ? raw : (Elf64_Sym *)dump->sym_tbl + first;
+	const char *name;
+	uint32_t i, k, shndx;
+
+	/* Streamed chunks come straight from the file */
+	if(raw && dump->swapped)
+		swap_sym_table64(sym, count);
+
+	/* Numbers first, the name only for what is left */
+	for(i=0; i<count; i++) {
+		k = first + i;
+		shndx = symbol_shndx(sym[i].st_shndx, dump->shndx_tbl, dump->shndx_count, k);
+		name = table_string(dump->str_tbl, dump->str_size, sym[i].st_name);
+		if(dump->names ? dump->names[k] == UINT32_MAX
+				: !filter_symbol(dump->filter, sym[i].st_info, sym[i].st_other,
+					shndx, sym[i].st_value, sym[i].st_size, name))
+			continue;
+		print_symbol(out, sym[i].st_value, sym[i].st_info, shndx, printable(name),
+				dump->names ? dump->demangled[k] : NULL);
+	}
+}
+
+elf_status_t print_symbol_table64(int32_t fd,
 		Elf64_Ehdr eh,
 		Elf64_Shdr sh_table[],
 		uint32_t symbol_table)
 {
 
 	char *str_tbl;
-	Elf64_Sym* sym_tbl;
-	uint32_t i, symbol_count;
+	Elf64_Sym* sym_tbl = NULL;	/* NULL: streamed through the pipeline */
+	const sym_filter_t *filter;
+	uint32_t *names = NULL;		/* with -C: string offsets, UINT32_MAX if filtered */
+	const char **demangled = NULL;
+	char *demangled_text = NULL;
+	Elf32_Word* shndx_tbl = NULL;	/* SHT_SYMTAB_SHNDX, if any */
+	uint32_t i, shnum, shndx, shndx_count = 0, symbol_count;
+	elf_status_t status;
+	symbol_dump_t dump;
+	pipeline_job_t job;
+
+	/* The table is read whole only to be demangled in one go, to go
+	 * through the cache, or to fail the way every other read does when
+	 * it runs past the end of the file; otherwise it is streamed while
+	 * it is printed
+	 */
+	if(demangle_enabled() || cache_active() || !in_file(fd,
+				sh_table[symbol_table].sh_offset, sh_table[symbol_table].sh_size)) {
+		/* The string table comes next, let it load while the symbols do */
+		if(sh_table[symbol_table].sh_link < section_count64(eh, sh_table))
+			advise_prefetch(fd, sh_table[sh_table[symbol_table].sh_link].sh_offset,
+					sh_table[sh_table[symbol_table].sh_link].sh_size);
+
+		sym_tbl = (Elf64_Sym*)read_section64(fd, sh_table[symbol_table]);
+		if(!sym_tbl)
+			return ELF_ERR_IO;
+	}
 
-	sym_tbl = (Elf64_Sym*)read_section64(fd, sh_table[symbol_table]);
+	/* Symbols in sections past SHN_LORESERVE carry SHN_XINDEX and the
+	 * real index sits in the SHT_SYMTAB_SHNDX section linked to us.
+	 */
+	shnum = section_count64(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_SYMTAB_SHNDX
+				&& sh_table[i].sh_link == symbol_table) {
+			shndx_tbl = (Elf32_Word*)read_section64(fd, sh_table[i]);
+			shndx_count = sh_table[i].sh_size / sizeof(Elf32_Word);
+			break;
+		}
+	}
 
 	/* Read linked string-table
 	 * Section containing the string table having names of
@@ -328,38 +620,110 @@ void print_symbol_table64(int32_t fd,
 	 */
 	uint32_t str_tbl_ndx = sh_table[symbol_table].sh_link;
 	debug("str_table_ndx = 0x%x\n", str_tbl_ndx);
-	str_tbl = read_section64(fd, sh_table[str_tbl_ndx]);
+	str_tbl = str_tbl_ndx < shnum ? read_section64(fd, sh_table[str_tbl_ndx]) : NULL;
+	if(!str_tbl) {
+		section_free(shndx_tbl);
+		section_free(sym_tbl);
+		return str_tbl_ndx < shnum ? ELF_ERR_IO : ELF_ERR_RANGE;
+	}
 
 	symbol_count = (sh_table[symbol_table].sh_size/sizeof(Elf64_Sym));
 	printf("%d symbols\n", symbol_count);
+	stats_add(STAT_SYMBOLS, symbol_count);
+
+	/* Section contents are cached raw, convert our private copy */
+	if(elf_swapped(eh.e_ident)) {
+		if(sym_tbl)
+			swap_sym_table64(sym_tbl, symbol_count);
+		if(shndx_tbl)
+			swap_words(shndx_tbl, shndx_count);
+	}
+
+	filter = filter_current();
 
-	for(i=0; i< symbol_count; i++) {
-		printf("0x%08lx ", sym_tbl[i].st_value);
-		printf("0x%02x ", ELF32_ST_BIND(sym_tbl[i].st_info));
-		printf("0x%02x ", ELF32_ST_TYPE(sym_tbl[i].st_info));
-		printf("%s\n", (str_tbl + sym_tbl[i].st_name));
+	/* Opt-in column: the whole table is demangled before printing, only
+	 * the names that pass the filter
+	 */
+	if(demangle_enabled()) {
+		names = section_alloc(symbol_count * sizeof(uint32_t));
+		demangled = section_alloc(symbol_count * sizeof(char *));
+		if(names && demangled) {
+			for(i=0; i< symbol_count; i++) {
+				shndx = symbol_shndx(sym_tbl[i].st_shndx, shndx_tbl, shndx_count, i);
+				names[i] = filter_symbol(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+						shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+						table_string(str_tbl, sh_table[str_tbl_ndx].sh_size, sym_tbl[i].st_name))
+					? sym_tbl[i].st_name : UINT32_MAX;
+			}
+			demangled_text = demangle_table(str_tbl, sh_table[str_tbl_ndx].sh_size,
+					names, symbol_count, demangled);
+		} else {
+			section_free(names);
+			names = NULL;
+		}
 	}
+
+	memset(&dump, 0, sizeof(dump));
+	dump.sym_tbl = sym_tbl;
+	dump.str_tbl = str_tbl;
+	dump.str_size = sh_table[str_tbl_ndx].sh_size;
+	dump.shndx_tbl = shndx_tbl;
+	dump.shndx_count = shndx_count;
+	dump.filter = filter;
+	dump.names = names;
+	dump.demangled = demangled;
+	dump.swapped = elf_swapped(eh.e_ident);
+
+	memset(&job, 0, sizeof(job));
+	job.count = symbol_count;
+	job.fd = sym_tbl ? -1 : fd;
+	job.offset = sh_table[symbol_table].sh_offset;
+	job.item_size = sizeof(Elf64_Sym);
+	job.decode = decode_symbols64;
+	job.ctx = &dump;
+	status = pipeline_run(&job) ? ELF_OK : ELF_ERR_IO;
+	if(status != ELF_OK)
+		printf("%s:Failed to read %ldbytes at 0x%08lx\n", __func__,
+				sh_table[symbol_table].sh_size, (uint64_t)sh_table[symbol_table].sh_offset);
+
+	section_free(demangled_text);
+	section_free(demangled);
+	section_free(names);
+	section_free(shndx_tbl);
+	section_free(str_tbl);
+	section_free(sym_tbl);
+	return status;
 }
 
-void print_symbols64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+elf_status_t print_symbols64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
 {
-	uint32_t i;
+	elf_status_t status, first = ELF_OK;
+	uint32_t i, shnum;
 
-	for(i=0; i<eh.e_shnum; i++) {
+	/* A broken table does not hide the ones after it */
+	shnum = section_count64(eh, sh_table);
+	for(i=0; i<shnum; i++) {
 		if ((sh_table[i].sh_type==SHT_SYMTAB)
 				|| (sh_table[i].sh_type==SHT_DYNSYM)) {
 			printf("\n[Section %03d]", i);
-			print_symbol_table64(fd, eh, sh_table, i);
+			status = print_symbol_table64(fd, eh, sh_table, i);
+			if(first == ELF_OK)
+				first = status;
 		}
 	}
+	return first;
 }
 
-void save_text_section64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+elf_status_t save_text_section64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
 {
-	uint32_t i;
-	int32_t fd2;	/* to write text.S in current directory */
+	uint32_t i, shnum, shstrndx;
+	elf_status_t status = ELF_OK;
+	const char *name;
+	int32_t fd2 = -1;	/* to write text.S in current directory */
 	char* sh_str;	/* section-header string-table is also a section. */
-	char* buf;	/* buffer to hold contents of the .text section */
+	char* buf = NULL;	/* buffer to hold contents of the .text section */
+	advice_t advice;
+	bool ok;
 
 	/*   */
 	char *pwd = getcwd(NULL, (size_t)NULL);
@@ -369,11 +733,23 @@ void save_text_section64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
 	printf("%s\n", pwd);
 
 	/* Read section-header string-table */
-	debug("eh.e_shstrndx = 0x%x\n", eh.e_shstrndx);
-	sh_str = read_section64(fd, sh_table[eh.e_shstrndx]);
+	shstrndx = section_strndx64(eh, sh_table);
+	debug("eh.e_shstrndx = 0x%x\n", shstrndx);
+	shnum = section_count64(eh, sh_table);
+	sh_str = NULL;
+	if(shstrndx >= shnum) {
+		status = ELF_ERR_RANGE;
+		goto EXIT;
+	}
+	sh_str = read_section64(fd, sh_table[shstrndx]);
+	if(!sh_str) {
+		status = ELF_ERR_IO;
+		goto EXIT;
+	}
 
-	for(i=0; i<eh.e_shnum; i++) {
-		if(!strcmp(".text", (sh_str + sh_table[i].sh_name))) {
+	for(i=0; i<shnum; i++) {
+		name = table_string(sh_str, sh_table[shstrndx].sh_size, sh_table[i].sh_name);
+		if(name && !strcmp(".text", name)) {
 			printf("Found section\t\".text\"\n");
 			printf("at offset\t0x%08lx\n", sh_table[i].sh_offset);
 			printf("of size\t\t0x%08lx\n", sh_table[i].sh_size);
@@ -382,28 +758,56 @@ void save_text_section64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
 		}
 	}
 
-	assert(lseek(fd, sh_table[i].sh_offset, SEEK_SET)==sh_table[i].sh_offset);
-	buf = malloc(sh_table[i].sh_size);
+	if(i == shnum) {
+		printf("No .text section\n");
+		goto EXIT;
+	}
+
+	buf = section_alloc(sh_table[i].sh_size);
+	stats_alloc(sh_table[i].sh_size);
 	if(!buf) {
 		printf("Failed to allocate %ldbytes!!\n", sh_table[i].sh_size);
+		status = ELF_ERR_NOMEM;
+		goto EXIT;
+	}
+	advise_begin(&advice, fd, sh_table[i].sh_offset, sh_table[i].sh_size, ACCESS_STREAM);
+	ok = read_full(fd, sh_table[i].sh_offset, buf, sh_table[i].sh_size);
+	advise_end(&advice);
+	if(!ok) {
+		printf("Failed to read .text\n");
+		status = ELF_ERR_IO;
 		goto EXIT;
 	}
-	assert(read(fd, buf, sh_table[i].sh_size)==sh_table[i].sh_size);
 	fd2 = open(pwd, O_RDWR|O_SYNC|O_CREAT, 0644);
-	write(fd2, buf, sh_table[i].sh_size);
+	if(fd2 < 0) {
+		printf("Error %d Unable to open %s\n", errno, pwd);
+		status = ELF_ERR_OPEN;
+		goto EXIT;
+	}
+	if(write(fd2, buf, sh_table[i].sh_size) != (ssize_t)sh_table[i].sh_size) {
+		printf("Error %d writing %s\n", errno, pwd);
+		status = ELF_ERR_IO;
+	}
 	fsync(fd2);
 
 EXIT:
-	close(fd2);
+	if(fd2 >= 0)
+		close(fd2);
+	section_free(buf);
+	section_free(sh_str);
 	free(pwd);
-
+	return status;
 }
 
-void read_elf_header(int32_t fd, Elf32_Ehdr *elf_header)
+bool read_elf_header(int32_t fd, Elf32_Ehdr *elf_header)
 {
-	assert(elf_header != NULL);
-	assert(lseek(fd, (off_t)0, SEEK_SET) == (off_t)0);
-	assert(read(fd, (void *)elf_header, sizeof(Elf32_Ehdr)) == sizeof(Elf32_Ehdr));
+	if(!read_full(fd, 0, elf_header, sizeof(Elf32_Ehdr)))
+		return false;
+
+	/* Everything past e_ident is stored in the file's byte order */
+	if(elf_swapped(elf_header->e_ident))
+		swap_ehdr(elf_header);
+	return true;
 }
 
 
@@ -647,42 +1051,172 @@ void print_elf_header(Elf32_Ehdr elf_header)
 
 }
 
-void read_section_header_table(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+uint32_t read_section_count(int32_t fd, Elf32_Ehdr eh)
 {
-	uint32_t i;
+	Elf32_Shdr sh;
+
+	/* Extended numbering: with SHN_LORESERVE or more sections e_shnum
+	 * is 0 and the real count is held in sh_size of section 0.
+	 */
+	if(eh.e_shnum != 0 || eh.e_shoff == 0)
+		return eh.e_shnum;
 
-	assert(lseek(fd, (off_t)eh.e_shoff, SEEK_SET) == (off_t)eh.e_shoff);
+	/* An unreadable table has no sections as far as callers care */
+	if(!read_full(fd, eh.e_shoff, &sh, sizeof(Elf32_Shdr)))
+		return 0;
+	if(elf_swapped(eh.e_ident))
+		swap_shdr_table(&sh, 1);
 
-	for(i=0; i<eh.e_shnum; i++) {
-		assert(read(fd, (void *)&sh_table[i], eh.e_shentsize)
-				== eh.e_shentsize);
+	return (uint32_t)sh.sh_size;
+}
+
+uint32_t section_count(Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+{
+	if(eh.e_shnum != 0 || eh.e_shoff == 0)
+		return eh.e_shnum;
+
+	return (uint32_t)sh_table[0].sh_size;
+}
+
+uint32_t section_strndx(Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+{
+	/* e_shstrndx does not fit either, sh_link of section 0 holds it */
+	if(eh.e_shstrndx == SHN_XINDEX)
+		return sh_table[0].sh_link;
+
+	return eh.e_shstrndx;
+}
+
+bool read_section_header_table(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+{
+	uint32_t i, shnum;
+	size_t entsize, size;
+	char* buf;
+	advice_t advice;
+	bool ok;
+
+	shnum = read_section_count(fd, eh);
+
+	/* One read for the whole table; objects built with
+	 * -ffunction-sections easily have 100k+ entries.
+	 */
+	entsize = eh.e_shentsize;
+	size = (size_t)shnum * entsize;
+	advise_begin(&advice, fd, eh.e_shoff, size, ACCESS_TABLE);
+	if(entsize == sizeof(Elf32_Shdr)) {
+		ok = read_full(fd, eh.e_shoff, sh_table, size);
+		advise_end(&advice);
+		if(!ok)
+			return false;
+	} else {
+		/* Foreign entry size, re-stride into our layout */
+		buf = calloc(1, size);
+		if(!buf) {
+			advise_end(&advice);
+			return false;
+		}
+		stats_alloc(size);
+		ok = read_full(fd, eh.e_shoff, buf, size);
+		advise_end(&advice);
+		if(!ok) {
+			free(buf);
+			return false;
+		}
+		for(i=0; i<shnum; i++) {
+			memset(&sh_table[i], 0, sizeof(Elf32_Shdr));
+			memcpy(&sh_table[i], buf + i * entsize,
+					entsize < sizeof(Elf32_Shdr) ? entsize : sizeof(Elf32_Shdr));
+		}
+		free(buf);
 	}
 
+	if(elf_swapped(eh.e_ident))
+		swap_shdr_table(sh_table, shnum);
+
+	stats_add(STAT_SECTIONS, shnum);
+	return true;
+}
+
+bool read_program_header_table(int32_t fd, Elf32_Ehdr eh, Elf32_Phdr ph_table[])
+{
+	if(!read_full(fd, eh.e_phoff, ph_table, eh.e_phnum * sizeof(Elf32_Phdr)))
+		return false;
+
+	if(elf_swapped(eh.e_ident))
+		swap_phdr_table(ph_table, eh.e_phnum);
+	return true;
 }
 
+/* The buffer comes from the current arena, if any; release it with
+ * section_free()
+ */
 char * read_section(int32_t fd, Elf32_Shdr sh)
 {
-	char* buff = malloc(sh.sh_size);
+	char* buff = section_alloc(sh.sh_size);
+	advice_t advice;
+	stats_alloc(sh.sh_size);
 	if(!buff) {
 		printf("%s:Failed to allocate %dbytes\n",
 				__func__, sh.sh_size);
+		return NULL;
 	}
 
-	assert(buff != NULL);
-	assert(lseek(fd, (off_t)sh.sh_offset, SEEK_SET) == (off_t)sh.sh_offset);
-	assert(read(fd, (void *)buff, sh.sh_size) == sh.sh_size);
+	/* Binaries already seen under another path are answered from cache */
+	if(cache_load_section(sh, buff))
+		return buff;
+
+	advise_begin(&advice, fd, sh.sh_offset, sh.sh_size, ACCESS_TABLE);
+	if(!read_full(fd, sh.sh_offset, buff, sh.sh_size)) {
+		advise_end(&advice);
+		printf("%s:Failed to read %dbytes at 0x%08lx\n",
+				__func__, sh.sh_size, (uint64_t)sh.sh_offset);
+		section_free(buff);
+		return NULL;
+	}
+	advise_end(&advice);
 
+	cache_store_section(sh, buff);
 	return buff;
 }
 
-void print_section_headers(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+typedef struct section_dump {
+	const Elf32_Shdr *sh_table;
+	const char *sh_str;
+	uint64_t sh_str_size;
+} section_dump_t;
+
+static void decode_section_headers(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const section_dump_t *dump = ctx;
+	const Elf32_Shdr *sh;
+	uint64_t i;
+
+	for(i=first; i<first + count; i++) {
+		sh = &dump->sh_table[i];
+		pipeline_printf(out, " %03u 0x%08x 0x%08x 0x%08x %4d 0x%08x 0x%08x %s\t\n",
+				(uint32_t)i, sh->sh_offset, sh->sh_addr, sh->sh_size,
+				sh->sh_addralign, sh->sh_flags, sh->sh_type,
+				printable(table_string(dump->sh_str, dump->sh_str_size, sh->sh_name)));
+	}
+}
+
+elf_status_t print_section_headers(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
 {
-	uint32_t i;
+	uint32_t shnum, shstrndx;
 	char* sh_str;	/* section-header string-table is also a section. */
+	section_dump_t dump;
+	pipeline_job_t job;
 
 	/* Read section-header string-table */
-	debug("eh.e_shstrndx = 0x%x\n", eh.e_shstrndx);
-	sh_str = read_section(fd, sh_table[eh.e_shstrndx]);
+	shstrndx = section_strndx(eh, sh_table);
+	debug("eh.e_shstrndx = 0x%x\n", shstrndx);
+	shnum = section_count(eh, sh_table);
+	if(shstrndx >= shnum)
+		return ELF_ERR_RANGE;
+	sh_str = read_section(fd, sh_table[shstrndx]);
+	if(!sh_str)
+		return ELF_ERR_IO;
 
 	printf("========================================");
 	printf("========================================\n");
@@ -691,33 +1225,97 @@ void print_section_headers(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
 	printf("========================================");
 	printf("========================================\n");
 
-	for(i=0; i<eh.e_shnum; i++) {
-		printf(" %03d ", i);
-		printf("0x%08x ", sh_table[i].sh_offset);
-		printf("0x%08x ", sh_table[i].sh_addr);
-		printf("0x%08x ", sh_table[i].sh_size);
-		printf("%4d ", sh_table[i].sh_addralign);
-		printf("0x%08x ", sh_table[i].sh_flags);
-		printf("0x%08x ", sh_table[i].sh_type);
-		printf("%s\t", (sh_str + sh_table[i].sh_name));
-		printf("\n");
-	}
+	dump.sh_table = sh_table;
+	dump.sh_str = sh_str;
+	dump.sh_str_size = sh_table[shstrndx].sh_size;
+	memset(&job, 0, sizeof(job));
+	job.count = shnum;
+	job.fd = -1;
+	job.decode = decode_section_headers;
+	job.ctx = &dump;
+	pipeline_run(&job);
 	printf("========================================");
 	printf("========================================\n");
 	printf("\n");	/* end of section header table */
+	stats_add(STAT_SECTIONS, shnum);
+
+	section_free(sh_str);
+	return ELF_OK;
 }
 
-void print_symbol_table(int32_t fd,
+static void decode_symbols(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const symbol_dump_t *dump = ctx;
+	Elf32_Sym *sym = raw ? raw : (Elf32_Sym *)dump->sym_tbl + first;
+	const char *name;
+	uint32_t i, k, shndx;
+
+	/* Streamed chunks come straight from the file */
+	if(raw && dump->swapped)
+		swap_sym_table(sym, count);
+
+	/* Numbers first, the name only for what is left */
+	for(i=0; i<count; i++) {
+		k = first + i;
+		shndx = symbol_shndx(sym[i].st_shndx, dump->shndx_tbl, dump->shndx_count, k);
+		name = table_string(dump->str_tbl, dump->str_size, sym[i].st_name);
+		if(dump->names ? dump->names[k] == UINT32_MAX
+				: !filter_symbol(dump->filter, sym[i].st_info, sym[i].st_other,
+					shndx, sym[i].st_value, sym[i].st_size, name))
+			continue;
+		print_symbol(out, sym[i].st_value, sym[i].st_info, shndx, printable(name),
+				dump->names ? dump->demangled[k] : NULL);
+	}
+}
+
+elf_status_t print_symbol_table(int32_t fd,
 		Elf32_Ehdr eh,
 		Elf32_Shdr sh_table[],
 		uint32_t symbol_table)
 {
 
 	char *str_tbl;
-	Elf32_Sym* sym_tbl;
-	uint32_t i, symbol_count;
+	Elf32_Sym* sym_tbl = NULL;	/* NULL: streamed through the pipeline */
+	const sym_filter_t *filter;
+	uint32_t *names = NULL;		/* with -C: string offsets, UINT32_MAX if filtered */
+	const char **demangled = NULL;
+	char *demangled_text = NULL;
+	Elf32_Word* shndx_tbl = NULL;	/* SHT_SYMTAB_SHNDX, if any */
+	uint32_t i, shnum, shndx, shndx_count = 0, symbol_count;
+	elf_status_t status;
+	symbol_dump_t dump;
+	pipeline_job_t job;
+
+	/* The table is read whole only to be demangled in one go, to go
+	 * through the cache, or to fail the way every other read does when
+	 * it runs past the end of the file; otherwise it is streamed while
+	 * it is printed
+	 */
+	if(demangle_enabled() || cache_active() || !in_file(fd,
+				sh_table[symbol_table].sh_offset, sh_table[symbol_table].sh_size)) {
+		/* The string table comes next, let it load while the symbols do */
+		if(sh_table[symbol_table].sh_link < section_count(eh, sh_table))
+			advise_prefetch(fd, sh_table[sh_table[symbol_table].sh_link].sh_offset,
+					sh_table[sh_table[symbol_table].sh_link].sh_size);
+
+		sym_tbl = (Elf32_Sym*)read_section(fd, sh_table[symbol_table]);
+		if(!sym_tbl)
+			return ELF_ERR_IO;
+	}
 
-	sym_tbl = (Elf32_Sym*)read_section(fd, sh_table[symbol_table]);
+	/* Symbols in sections past SHN_LORESERVE carry SHN_XINDEX and the
+	 * real index sits in the SHT_SYMTAB_SHNDX section linked to us.
+	 */
+	shnum = section_count(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_SYMTAB_SHNDX
+				&& sh_table[i].sh_link == symbol_table) {
+			shndx_tbl = (Elf32_Word*)read_section(fd, sh_table[i]);
+			shndx_count = sh_table[i].sh_size / sizeof(Elf32_Word);
+			break;
+		}
+	}
 
 	/* Read linked string-table
 	 * Section containing the string table having names of
@@ -725,38 +1323,110 @@ void print_symbol_table(int32_t fd,
 	 */
 	uint32_t str_tbl_ndx = sh_table[symbol_table].sh_link;
 	debug("str_table_ndx = 0x%x\n", str_tbl_ndx);
-	str_tbl = read_section(fd, sh_table[str_tbl_ndx]);
+	str_tbl = str_tbl_ndx < shnum ? read_section(fd, sh_table[str_tbl_ndx]) : NULL;
+	if(!str_tbl) {
+		section_free(shndx_tbl);
+		section_free(sym_tbl);
+		return str_tbl_ndx < shnum ? ELF_ERR_IO : ELF_ERR_RANGE;
+	}
 
 	symbol_count = (sh_table[symbol_table].sh_size/sizeof(Elf32_Sym));
 	printf("%d symbols\n", symbol_count);
+	stats_add(STAT_SYMBOLS, symbol_count);
+
+	/* Section contents are cached raw, convert our private copy */
+	if(elf_swapped(eh.e_ident)) {
+		if(sym_tbl)
+			swap_sym_table(sym_tbl, symbol_count);
+		if(shndx_tbl)
+			swap_words(shndx_tbl, shndx_count);
+	}
+
+	filter = filter_current();
 
-	for(i=0; i< symbol_count; i++) {
-		printf("0x%08x ", sym_tbl[i].st_value);
-		printf("0x%02x ", ELF32_ST_BIND(sym_tbl[i].st_info));
-		printf("0x%02x ", ELF32_ST_TYPE(sym_tbl[i].st_info));
-		printf("%s\n", (str_tbl + sym_tbl[i].st_name));
+	/* Opt-in column: the whole table is demangled before printing, only
+	 * the names that pass the filter
+	 */
+	if(demangle_enabled()) {
+		names = section_alloc(symbol_count * sizeof(uint32_t));
+		demangled = section_alloc(symbol_count * sizeof(char *));
+		if(names && demangled) {
+			for(i=0; i< symbol_count; i++) {
+				shndx = symbol_shndx(sym_tbl[i].st_shndx, shndx_tbl, shndx_count, i);
+				names[i] = filter_symbol(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+						shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+						table_string(str_tbl, sh_table[str_tbl_ndx].sh_size, sym_tbl[i].st_name))
+					? sym_tbl[i].st_name : UINT32_MAX;
+			}
+			demangled_text = demangle_table(str_tbl, sh_table[str_tbl_ndx].sh_size,
+					names, symbol_count, demangled);
+		} else {
+			section_free(names);
+			names = NULL;
+		}
 	}
+
+	memset(&dump, 0, sizeof(dump));
+	dump.sym_tbl = sym_tbl;
+	dump.str_tbl = str_tbl;
+	dump.str_size = sh_table[str_tbl_ndx].sh_size;
+	dump.shndx_tbl = shndx_tbl;
+	dump.shndx_count = shndx_count;
+	dump.filter = filter;
+	dump.names = names;
+	dump.demangled = demangled;
+	dump.swapped = elf_swapped(eh.e_ident);
+
+	memset(&job, 0, sizeof(job));
+	job.count = symbol_count;
+	job.fd = sym_tbl ? -1 : fd;
+	job.offset = sh_table[symbol_table].sh_offset;
+	job.item_size = sizeof(Elf32_Sym);
+	job.decode = decode_symbols;
+	job.ctx = &dump;
+	status = pipeline_run(&job) ? ELF_OK : ELF_ERR_IO;
+	if(status != ELF_OK)
+		printf("%s:Failed to read %dbytes at 0x%08lx\n", __func__,
+				sh_table[symbol_table].sh_size, (uint64_t)sh_table[symbol_table].sh_offset);
+
+	section_free(demangled_text);
+	section_free(demangled);
+	section_free(names);
+	section_free(shndx_tbl);
+	section_free(str_tbl);
+	section_free(sym_tbl);
+	return status;
 }
 
-void print_symbols(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+elf_status_t print_symbols(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
 {
-	uint32_t i;
+	elf_status_t status, first = ELF_OK;
+	uint32_t i, shnum;
 
-	for(i=0; i<eh.e_shnum; i++) {
+	/* A broken table does not hide the ones after it */
+	shnum = section_count(eh, sh_table);
+	for(i=0; i<shnum; i++) {
 		if ((sh_table[i].sh_type==SHT_SYMTAB)
 				|| (sh_table[i].sh_type==SHT_DYNSYM)) {
 			printf("\n[Section %03d]", i);
-			print_symbol_table(fd, eh, sh_table, i);
+			status = print_symbol_table(fd, eh, sh_table, i);
+			if(first == ELF_OK)
+				first = status;
 		}
 	}
+	return first;
 }
 
-void save_text_section(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+elf_status_t save_text_section(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
 {
-	uint32_t i;
-	int32_t fd2;	/* to write text.S in current directory */
+	uint32_t i, shnum, shstrndx;
+	elf_status_t status = ELF_OK;
+	const char *name;
+	int32_t fd2 = -1;	/* to write text.S in current directory */
 	char* sh_str;	/* section-header string-table is also a section. */
-	char* buf;	/* buffer to hold contents of the .text section */
+	char* buf = NULL;	/* buffer to hold contents of the .text section */
+	advice_t advice;
+	bool ok;
 
 	/*   */
 	char *pwd = getcwd(NULL, (size_t)NULL);
@@ -766,11 +1436,23 @@ void save_text_section(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
 	printf("%s\n", pwd);
 
 	/* Read section-header string-table */
-	debug("eh.e_shstrndx = 0x%x\n", eh.e_shstrndx);
-	sh_str = read_section(fd, sh_table[eh.e_shstrndx]);
+	shstrndx = section_strndx(eh, sh_table);
+	debug("eh.e_shstrndx = 0x%x\n", shstrndx);
+	shnum = section_count(eh, sh_table);
+	sh_str = NULL;
+	if(shstrndx >= shnum) {
+		status = ELF_ERR_RANGE;
+		goto EXIT;
+	}
+	sh_str = read_section(fd, sh_table[shstrndx]);
+	if(!sh_str) {
+		status = ELF_ERR_IO;
+		goto EXIT;
+	}
 
-	for(i=0; i<eh.e_shnum; i++) {
-		if(!strcmp(".text", (sh_str + sh_table[i].sh_name))) {
+	for(i=0; i<shnum; i++) {
+		name = table_string(sh_str, sh_table[shstrndx].sh_size, sh_table[i].sh_name);
+		if(name && !strcmp(".text", name)) {
 			printf("Found section\t\".text\"\n");
 			printf("at offset\t0x%08x\n", sh_table[i].sh_offset);
 			printf("of size\t\t0x%08x\n", sh_table[i].sh_size);
@@ -779,21 +1461,45 @@ void save_text_section(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
 		}
 	}
 
-	assert(lseek(fd, sh_table[i].sh_offset, SEEK_SET)==sh_table[i].sh_offset);
-	buf = malloc(sh_table[i].sh_size);
+	if(i == shnum) {
+		printf("No .text section\n");
+		goto EXIT;
+	}
+
+	buf = section_alloc(sh_table[i].sh_size);
+	stats_alloc(sh_table[i].sh_size);
 	if(!buf) {
 		printf("Failed to allocate %dbytes!!\n", sh_table[i].sh_size);
+		status = ELF_ERR_NOMEM;
+		goto EXIT;
+	}
+	advise_begin(&advice, fd, sh_table[i].sh_offset, sh_table[i].sh_size, ACCESS_STREAM);
+	ok = read_full(fd, sh_table[i].sh_offset, buf, sh_table[i].sh_size);
+	advise_end(&advice);
+	if(!ok) {
+		printf("Failed to read .text\n");
+		status = ELF_ERR_IO;
 		goto EXIT;
 	}
-	assert(read(fd, buf, sh_table[i].sh_size)==sh_table[i].sh_size);
 	fd2 = open(pwd, O_RDWR|O_SYNC|O_CREAT, 0644);
-	write(fd2, buf, sh_table[i].sh_size);
+	if(fd2 < 0) {
+		printf("Error %d Unable to open %s\n", errno, pwd);
+		status = ELF_ERR_OPEN;
+		goto EXIT;
+	}
+	if(write(fd2, buf, sh_table[i].sh_size) != (ssize_t)sh_table[i].sh_size) {
+		printf("Error %d writing %s\n", errno, pwd);
+		status = ELF_ERR_IO;
+	}
 	fsync(fd2);
 
 EXIT:
-	close(fd2);
+	if(fd2 >= 0)
+		close(fd2);
+	section_free(buf);
+	section_free(sh_str);
 	free(pwd);
-
+	return status;
 }
 
 bool is64Bit(Elf32_Ehdr eh) {
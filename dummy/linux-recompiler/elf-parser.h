@@ -1,3 +1,6 @@
+#ifndef _ELF_PARSER_H
+#define _ELF_PARSER_H
+
 #include <stdio.h>
 #include <assert.h>
 #include <fcntl.h>
@@ -6,32 +9,51 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <unistd.h>
 
 #include "elf.h"
+#include "elf-status.h"
 
+#ifdef NDEBUG
+#define DEBUG 0
+#else
 #define DEBUG 1
+#endif
 
 #define debug(...) \
             do { if (DEBUG) printf("<debug>:"__VA_ARGS__); } while (0)
 
+bool read_full(int32_t fd, uint64_t offset, void *buf, size_t size);
+bool in_file(int32_t fd, uint64_t offset, uint64_t size);
 void disassemble(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr* sh_tbl);
 void disassemble64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr* sh_tbl);
-void read_elf_header64(int32_t fd, Elf64_Ehdr *elf_header);
+bool read_elf_header64(int32_t fd, Elf64_Ehdr *elf_header);
 bool is_ELF64(Elf64_Ehdr eh);
 void print_elf_header64(Elf64_Ehdr elf_header);
-void read_section_header_table64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+uint32_t read_section_count64(int32_t fd, Elf64_Ehdr eh);
+uint32_t section_count64(Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+uint32_t section_strndx64(Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+bool read_section_header_table64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+bool read_program_header_table64(int32_t fd, Elf64_Ehdr eh, Elf64_Phdr ph_table[]);
 char * read_section64(int32_t fd, Elf64_Shdr sh);
-void print_section_headers64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
-void print_symbol_table64(int32_t fd,Elf64_Ehdr eh,Elf64_Shdr sh_table[],uint32_t symbol_table);
-void print_symbols64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
-void save_text_section64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
-void read_elf_header(int32_t fd, Elf32_Ehdr *elf_header);
+elf_status_t print_section_headers64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+elf_status_t print_symbol_table64(int32_t fd,Elf64_Ehdr eh,Elf64_Shdr sh_table[],uint32_t symbol_table);
+elf_status_t print_symbols64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+elf_status_t save_text_section64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+bool read_elf_header(int32_t fd, Elf32_Ehdr *elf_header);
 bool is_ELF(Elf32_Ehdr eh);
 void print_elf_header(Elf32_Ehdr elf_header);
-void read_section_header_table(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+uint32_t read_section_count(int32_t fd, Elf32_Ehdr eh);
+uint32_t section_count(Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+uint32_t section_strndx(Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+bool read_section_header_table(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+bool read_program_header_table(int32_t fd, Elf32_Ehdr eh, Elf32_Phdr ph_table[]);
 char * read_section(int32_t fd, Elf32_Shdr sh);
-void print_section_headers(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
-void print_symbol_table(int32_t fd,Elf32_Ehdr eh,Elf32_Shdr sh_table[],uint32_t symbol_table);
-void print_symbols(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
-void save_text_section(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+elf_status_t print_section_headers(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+elf_status_t print_symbol_table(int32_t fd,Elf32_Ehdr eh,Elf32_Shdr sh_table[],uint32_t symbol_table);
+elf_status_t print_symbols(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+elf_status_t save_text_section(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
 bool is64Bit(Elf32_Ehdr eh);
+const char * table_string(const char *tbl, uint64_t size, uint64_t off);
+
+#endif /* _ELF_PARSER_H */
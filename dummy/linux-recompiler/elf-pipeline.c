@@ -0,0 +1,307 @@
+#include <pthread.h>
+#include <stdarg.h>
+
+#include "elf-pipeline.h"
+#include "elf-advise.h"
+#include "elf-stats.h"
+
+typedef enum slot_state {
+	SLOT_FREE,		/* written out, or never used */
+	SLOT_READ,		/* raw bytes are in */
+	SLOT_BUSY,		/* a decoder has it */
+	SLOT_DONE,		/* text is ready, or failed */
+} slot_state_t;
+
+typedef struct slot {
+	slot_state_t state;
+	bool failed;
+	void *raw;
+	pipeline_out_t out;
+} slot_t;
+
+typedef struct pipeline {
+	const pipeline_job_t *job;
+	uint32_t chunk;
+	uint64_t chunks;
+	slot_t slots[PIPELINE_SLOTS];
+	uint32_t nslots;
+	uint64_t next_decode;	/* first chunk no decoder has taken */
+	bool started;		/* the threads are up, output may have begun */
+	bool stop;		/* the writer is done, or gave up */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;	/* any slot changed state */
+} pipeline_t;
+
+/* Room for n more bytes and a NUL */
+static bool out_reserve(pipeline_out_t *out, size_t n)
+{
+	size_t size;
+	char *p;
+
+	if(out->used + n < out->size)
+		return true;
+	size = out->size ? out->size * 2 : 1 << 16;
+	while(size < out->used + n + 1)
+		size *= 2;
+	p = realloc(out->text, size);
+	if(!p) {
+		out->failed = true;
+		return false;
+	}
+	out->text = p;
+	out->size = size;
+	return true;
+}
+
+void pipeline_write(pipeline_out_t *out, const void *p, size_t n)
+{
+	if(out->failed || !out_reserve(out, n))
+		return;
+	memcpy(out->text + out->used, p, n);
+	out->used += n;
+}
+
+void pipeline_printf(pipeline_out_t *out, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if(out->failed)
+		return;
+	va_start(ap, fmt);
+	len = vsnprintf(out->text + out->used, out->size - out->used, fmt, ap);
+	va_end(ap);
+	if(len < 0) {
+		out->failed = true;
+		return;
+	}
+	if((size_t)len >= out->size - out->used) {
+		if(!out_reserve(out, len))
+			return;
+		va_start(ap, fmt);
+		vsnprintf(out->text + out->used, out->size - out->used, fmt, ap);
+		va_end(ap);
+	}
+	out->used += len;
+}
+
+static inline uint32_t chunk_items(const pipeline_t *p, uint64_t c)
+{
+	uint64_t left = p->job->count - c * p->chunk;
+
+	return left < p->chunk ? left : p->chunk;
+}
+
+static bool read_chunk(const pipeline_t *p, uint64_t c, void *raw)
+{
+	const pipeline_job_t *job = p->job;
+
+	return read_full(job->fd, job->offset + c * p->chunk * job->item_size,
+			raw, (size_t)chunk_items(p, c) * job->item_size);
+}
+
+static void decode_chunk(const pipeline_t *p, uint64_t c, slot_t *s)
+{
+	s->out.used = 0;
+	p->job->decode(p->job->ctx, c * p->chunk, chunk_items(p, c), s->raw, &s->out);
+	s->failed = s->out.failed;
+}
+
+static bool write_chunk(slot_t *s)
+{
+	if(s->failed)
+		return false;
+	if(s->out.used)
+		fwrite(s->out.text, 1, s->out.used, stdout);
+	return true;
+}
+
+/* The slot of chunk c is free once chunk c - nslots has been written */
+static void * reader(void *arg)
+{
+	pipeline_t *p = arg;
+	slot_t *s;
+	uint64_t c;
+	bool ok = true;
+
+	for(c=0; c<p->chunks && ok; c++) {
+		s = &p->slots[c % p->nslots];
+		pthread_mutex_lock(&p->lock);
+		while(!p->stop && s->state != SLOT_FREE)
+			pthread_cond_wait(&p->changed, &p->lock);
+		if(p->stop) {
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		pthread_mutex_unlock(&p->lock);
+
+		ok = read_chunk(p, c, s->raw);
+
+		pthread_mutex_lock(&p->lock);
+		s->failed = !ok;
+		s->state = ok ? SLOT_READ : SLOT_DONE;
+		pthread_cond_broadcast(&p->changed);
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
+
+/* Chunks are taken in order, so a slow one holds up the writer but
+ * never the other decoders
+ */
+static void * decoder(void *arg)
+{
+	pipeline_t *p = arg;
+	slot_state_t ready = p->job->fd < 0 ? SLOT_FREE : SLOT_READ;
+	slot_t *s;
+	uint64_t c;
+
+	pthread_mutex_lock(&p->lock);
+	for(;;) {
+		while(!p->stop && p->next_decode < p->chunks
+				&& p->slots[p->next_decode % p->nslots].state != ready)
+			pthread_cond_wait(&p->changed, &p->lock);
+		if(p->stop || p->next_decode >= p->chunks)
+			break;
+		c = p->next_decode++;
+		s = &p->slots[c % p->nslots];
+		s->state = SLOT_BUSY;
+		pthread_mutex_unlock(&p->lock);
+
+		decode_chunk(p, c, s);
+
+		pthread_mutex_lock(&p->lock);
+		s->state = SLOT_DONE;
+		pthread_cond_broadcast(&p->changed);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+/* One chunk after the other, for small tables and as the fallback */
+static bool run_inline(pipeline_t *p)
+{
+	slot_t *s = &p->slots[0];
+	uint64_t c;
+	bool ok = true;
+
+	for(c=0; c<p->chunks && ok; c++) {
+		if(s->raw && !read_chunk(p, c, s->raw))
+			return false;
+		decode_chunk(p, c, s);
+		ok = write_chunk(s);
+	}
+	return ok;
+}
+
+static bool run_threads(pipeline_t *p, uint32_t ndecoders)
+{
+	pthread_t threads[PIPELINE_WORKERS + 1];
+	uint32_t i, nthreads = 0;
+	slot_t *s;
+	uint64_t c;
+	bool ok = true;
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->changed, NULL);
+
+	if(p->job->fd >= 0) {
+		if(pthread_create(&threads[nthreads], NULL, reader, p) == 0)
+			nthreads++;
+		else
+			ok = false;
+	}
+	for(i=0; i<ndecoders && ok; i++) {
+		if(pthread_create(&threads[nthreads], NULL, decoder, p) == 0)
+			nthreads++;
+		else if(i == 0)
+			ok = false;
+	}
+
+	/* The writer: chunks go out in order, each slot freed behind it */
+	p->started = ok;
+	for(c=0; c<p->chunks && ok; c++) {
+		s = &p->slots[c % p->nslots];
+		pthread_mutex_lock(&p->lock);
+		while(s->state != SLOT_DONE)
+			pthread_cond_wait(&p->changed, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+
+		ok = write_chunk(s);
+
+		pthread_mutex_lock(&p->lock);
+		s->state = SLOT_FREE;
+		pthread_cond_broadcast(&p->changed);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->stop = true;
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->lock);
+	for(i=0; i<nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&p->changed);
+	pthread_mutex_destroy(&p->lock);
+	return ok;
+}
+
+bool pipeline_run(const pipeline_job_t *job)
+{
+	pipeline_t p;
+	advice_t advice;
+	uint32_t i, ndecoders = 1;
+	size_t raw_size = 0;
+	bool ok = true;
+	long n;
+
+	if(!job->count)
+		return true;
+	memset(&p, 0, sizeof(p));
+	p.job = job;
+	p.chunk = job->chunk ? job->chunk : PIPELINE_CHUNK;
+	p.chunks = (job->count + p.chunk - 1) / p.chunk;
+
+	/* A chunk of work per decoder at least, or threads cost more than
+	 * they save
+	 */
+	if(p.chunks > 1) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		ndecoders = n < 1 ? 1 : n > PIPELINE_WORKERS ? PIPELINE_WORKERS : n;
+		if(ndecoders > p.chunks)
+			ndecoders = p.chunks;
+	}
+	p.nslots = p.chunks > 1 ? 2 * ndecoders + 2 : 1;
+	if(p.nslots > p.chunks)
+		p.nslots = p.chunks;
+
+	if(job->fd >= 0)
+		raw_size = (size_t)p.chunk * job->item_size;
+	for(i=0; i<p.nslots && raw_size; i++) {
+		p.slots[i].raw = malloc(raw_size);
+		if(!p.slots[i].raw) {
+			ok = false;
+			break;
+		}
+	}
+	stats_alloc(p.nslots * raw_size);
+
+	if(ok) {
+		if(job->fd >= 0)
+			advise_begin(&advice, job->fd, job->offset, job->count * job->item_size,
+					ACCESS_STREAM);
+		if(p.chunks == 1)
+			ok = run_inline(&p);
+		else if(!run_threads(&p, ndecoders))
+			ok = p.started ? false : run_inline(&p);	/* nothing written yet */
+		if(job->fd >= 0)
+			advise_end(&advice);
+	}
+
+	for(i=0; i<p.nslots; i++) {
+		free(p.slots[i].raw);
+		free(p.slots[i].out.text);
+	}
+	return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef _ELF_PIPELINE_H
+#define _ELF_PIPELINE_H
+
+#include "elf-parser.h"
+
+/* Read, decode and format stages for the table dumps.
+ *
+ * A table is cut into chunks of items.  A reader thread pulls the raw
+ * bytes of each chunk out of the file, decoder threads turn chunks into
+ * text, and the calling thread writes that text to stdout in table
+ * order.  The stages hand chunks over through a fixed ring of slots: the
+ * reader waits for a free slot and only the writer frees them, so no
+ * more than PIPELINE_SLOTS chunks exist at once, raw or formatted,
+ * however large the table is and however slow stdout is.
+ *
+ * Tables that are already in memory have no reader, fd is -1 and the
+ * decoder indexes its own copy.  Tables of one chunk are done in the
+ * caller without any threads.
+ */
+
+#define PIPELINE_CHUNK		4096	/* items */
+#define PIPELINE_WORKERS	16	/* decoders */
+#define PIPELINE_SLOTS		(2 * PIPELINE_WORKERS + 2)
+
+typedef struct pipeline_out {
+	char *text;
+	size_t used;
+	size_t size;
+	bool failed;		/* out of memory, the dump stops */
+} pipeline_out_t;
+
+/* Formats items first .. first + count - 1.  raw holds their bytes as
+ * read from the file, NULL when the job has no fd; the decoder may
+ * modify it, swap it in place for instance.  Runs on any thread.
+ */
+typedef void (*pipeline_decode_t)(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out);
+
+typedef struct pipeline_job {
+	uint64_t count;		/* items */
+	uint32_t chunk;		/* items per chunk, 0 for PIPELINE_CHUNK */
+	int32_t fd;		/* -1: nothing to read */
+	uint64_t offset;	/* of item 0 in the file */
+	size_t item_size;	/* bytes per item in the file */
+	pipeline_decode_t decode;
+	void *ctx;
+} pipeline_job_t;
+
+/* False if a read or an allocation failed; what came before that chunk
+ * has been written
+ */
+bool pipeline_run(const pipeline_job_t *job);
+
+void pipeline_printf(pipeline_out_t *out, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void pipeline_write(pipeline_out_t *out, const void *p, size_t n);
+
+#endif /* _ELF_PIPELINE_H */
@@ -0,0 +1,910 @@
+#define _GNU_SOURCE
+#include <sys/stat.h>
+
+#include "elf-rewrite.h"
+#include "elf-stats.h"
+#include "elf-swap.h"
+
+#define MIN_PAGE	4096
+
+/* Section contents that are laid out anew on save */
+typedef struct moved {
+	uint8_t *data;		/* NULL: the contents stay where they are */
+	uint64_t size;
+} moved_t;
+
+/* Headers are kept widened to the 64-bit layout for both classes */
+struct rewriter {
+	elf_file_t *ef;
+	edit_buf_t *eb;
+	bool is64;
+	bool swapped;
+	Elf64_Ehdr eh;
+	Elf64_Phdr *ph;
+	uint32_t phnum;
+	Elf64_Shdr *sh;
+	moved_t *moved;
+	uint32_t shnum;
+	uint32_t shsize;
+	uint32_t shstrndx;
+	bool layout;		/* sections moved or added, headers are written again */
+	bool new_segment;	/* an added section has to be loaded */
+};
+
+typedef struct out {
+	int32_t in;
+	int32_t fd;
+	bool in_place;
+	elf_status_t status;
+	rewrite_result_t *result;
+} out_t;
+
+static inline uint64_t align_up(uint64_t v, uint64_t a)
+{
+	return a > 1 ? (v + a - 1) / a * a : v;
+}
+
+static void widen_ehdr(const Elf32_Ehdr *e, Elf64_Ehdr *w)
+{
+	memcpy(w->e_ident, e->e_ident, EI_NIDENT);
+	w->e_type = e->e_type;
+	w->e_machine = e->e_machine;
+	w->e_version = e->e_version;
+	w->e_entry = e->e_entry;
+	w->e_phoff = e->e_phoff;
+	w->e_shoff = e->e_shoff;
+	w->e_flags = e->e_flags;
+	w->e_ehsize = e->e_ehsize;
+	w->e_phentsize = e->e_phentsize;
+	w->e_phnum = e->e_phnum;
+	w->e_shentsize = e->e_shentsize;
+	w->e_shnum = e->e_shnum;
+	w->e_shstrndx = e->e_shstrndx;
+}
+
+static void narrow_ehdr(const Elf64_Ehdr *w, Elf32_Ehdr *e)
+{
+	memcpy(e->e_ident, w->e_ident, EI_NIDENT);
+	e->e_type = w->e_type;
+	e->e_machine = w->e_machine;
+	e->e_version = w->e_version;
+	e->e_entry = w->e_entry;
+	e->e_phoff = w->e_phoff;
+	e->e_shoff = w->e_shoff;
+	e->e_flags = w->e_flags;
+	e->e_ehsize = w->e_ehsize;
+	e->e_phentsize = w->e_phentsize;
+	e->e_phnum = w->e_phnum;
+	e->e_shentsize = w->e_shentsize;
+	e->e_shnum = w->e_shnum;
+	e->e_shstrndx = w->e_shstrndx;
+}
+
+static void widen_shdr(const Elf32_Shdr *s, Elf64_Shdr *w)
+{
+	w->sh_name = s->sh_name;
+	w->sh_type = s->sh_type;
+	w->sh_flags = s->sh_flags;
+	w->sh_addr = s->sh_addr;
+	w->sh_offset = s->sh_offset;
+	w->sh_size = s->sh_size;
+	w->sh_link = s->sh_link;
+	w->sh_info = s->sh_info;
+	w->sh_addralign = s->sh_addralign;
+	w->sh_entsize = s->sh_entsize;
+}
+
+static void narrow_shdr(const Elf64_Shdr *w, Elf32_Shdr *s)
+{
+	s->sh_name = w->sh_name;
+	s->sh_type = w->sh_type;
+	s->sh_flags = w->sh_flags;
+	s->sh_addr = w->sh_addr;
+	s->sh_offset = w->sh_offset;
+	s->sh_size = w->sh_size;
+	s->sh_link = w->sh_link;
+	s->sh_info = w->sh_info;
+	s->sh_addralign = w->sh_addralign;
+	s->sh_entsize = w->sh_entsize;
+}
+
+static void widen_phdr(const Elf32_Phdr *p, Elf64_Phdr *w)
+{
+	w->p_type = p->p_type;
+	w->p_flags = p->p_flags;
+	w->p_offset = p->p_offset;
+	w->p_vaddr = p->p_vaddr;
+	w->p_paddr = p->p_paddr;
+	w->p_filesz = p->p_filesz;
+	w->p_memsz = p->p_memsz;
+	w->p_align = p->p_align;
+}
+
+static void narrow_phdr(const Elf64_Phdr *w, Elf32_Phdr *p)
+{
+	p->p_type = w->p_type;
+	p->p_flags = w->p_flags;
+	p->p_offset = w->p_offset;
+	p->p_vaddr = w->p_vaddr;
+	p->p_paddr = w->p_paddr;
+	p->p_filesz = w->p_filesz;
+	p->p_memsz = w->p_memsz;
+	p->p_align = w->p_align;
+}
+
+/* Headers in the file's class and byte order; out holds the size of
+ * count entries
+ */
+static void put_ehdr(const rewriter_t *rw, const Elf64_Ehdr *eh, uint8_t *out)
+{
+	Elf64_Ehdr e64 = *eh;
+	Elf32_Ehdr e32;
+
+	if(rw->is64) {
+		if(rw->swapped)
+			swap_ehdr64(&e64);
+		memcpy(out, &e64, sizeof(e64));
+	} else {
+		narrow_ehdr(eh, &e32);
+		if(rw->swapped)
+			swap_ehdr(&e32);
+		memcpy(out, &e32, sizeof(e32));
+	}
+}
+
+/* The header as it stands in the buffer, patches included, widened and
+ * in host order
+ */
+static elf_status_t get_ehdr(const rewriter_t *rw, Elf64_Ehdr *eh)
+{
+	Elf32_Ehdr e32;
+	elf_status_t status;
+
+	if(rw->is64) {
+		status = edit_read(rw->eb, 0, eh, sizeof(Elf64_Ehdr));
+		if(status == ELF_OK && rw->swapped)
+			swap_ehdr64(eh);
+	} else {
+		status = edit_read(rw->eb, 0, &e32, sizeof(Elf32_Ehdr));
+		if(status == ELF_OK && rw->swapped)
+			swap_ehdr(&e32);
+		if(status == ELF_OK)
+			widen_ehdr(&e32, eh);
+	}
+	return status;
+}
+
+static void put_shdrs(const rewriter_t *rw, const Elf64_Shdr *sh, uint32_t count, uint8_t *out)
+{
+	Elf64_Shdr s64;
+	Elf32_Shdr s32;
+	uint32_t i;
+
+	for(i=0; i<count; i++) {
+		if(rw->is64) {
+			s64 = sh[i];
+			if(rw->swapped)
+				swap_shdr_table64(&s64, 1);
+			memcpy(out + i * sizeof(s64), &s64, sizeof(s64));
+		} else {
+			narrow_shdr(&sh[i], &s32);
+			if(rw->swapped)
+				swap_shdr_table(&s32, 1);
+			memcpy(out + i * sizeof(s32), &s32, sizeof(s32));
+		}
+	}
+}
+
+static void put_phdrs(const rewriter_t *rw, const Elf64_Phdr *ph, uint32_t count, uint8_t *out)
+{
+	Elf64_Phdr p64;
+	Elf32_Phdr p32;
+	uint32_t i;
+
+	for(i=0; i<count; i++) {
+		if(rw->is64) {
+			p64 = ph[i];
+			if(rw->swapped)
+				swap_phdr_table64(&p64, 1);
+			memcpy(out + i * sizeof(p64), &p64, sizeof(p64));
+		} else {
+			narrow_phdr(&ph[i], &p32);
+			if(rw->swapped)
+				swap_phdr_table(&p32, 1);
+			memcpy(out + i * sizeof(p32), &p32, sizeof(p32));
+		}
+	}
+}
+
+static elf_status_t load_headers(rewriter_t *rw)
+{
+	elf_file_t *ef = rw->ef;
+	Elf32_Phdr *ph32;
+	uint64_t entsize;
+	uint32_t i;
+
+	rw->is64 = elf_is64(ef);
+	if(rw->is64)
+		rw->eh = *elf_ehdr64(ef);
+	else
+		widen_ehdr(elf_ehdr(ef), &rw->eh);
+	rw->swapped = elf_swapped(rw->eh.e_ident);
+
+	rw->shnum = elf_section_count(ef);
+	rw->shsize = rw->shnum + 8;
+	rw->sh = calloc(rw->shsize, sizeof(Elf64_Shdr));
+	rw->moved = calloc(rw->shsize, sizeof(moved_t));
+	if(!rw->sh || !rw->moved)
+		return ELF_ERR_NOMEM;
+	for(i=0; i<rw->shnum; i++) {
+		if(rw->is64)
+			rw->sh[i] = elf_shdrs64(ef)[i];
+		else
+			widen_shdr(&elf_shdrs(ef)[i], &rw->sh[i]);
+	}
+	rw->shstrndx = rw->eh.e_shstrndx == SHN_XINDEX && rw->shnum ? rw->sh[0].sh_link
+		: rw->eh.e_shstrndx;
+	if(rw->shstrndx >= rw->shnum)
+		rw->shstrndx = 0;
+
+	rw->phnum = rw->eh.e_phnum;
+	if(!rw->phnum)
+		return ELF_OK;
+	entsize = rw->is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	if(rw->eh.e_phoff > elf_file_size(ef)
+			|| (elf_file_size(ef) - rw->eh.e_phoff) / entsize < rw->phnum)
+		return ELF_ERR_FORMAT;
+	rw->ph = calloc(rw->phnum + 1, sizeof(Elf64_Phdr));
+	if(!rw->ph)
+		return ELF_ERR_NOMEM;
+	if(rw->is64)
+		return read_program_header_table64(elf_fd(ef), *elf_ehdr64(ef), rw->ph)
+			? ELF_OK : ELF_ERR_IO;
+
+	ph32 = malloc(rw->phnum * sizeof(Elf32_Phdr));
+	if(!ph32)
+		return ELF_ERR_NOMEM;
+	if(!read_program_header_table(elf_fd(ef), *elf_ehdr(ef), ph32)) {
+		free(ph32);
+		return ELF_ERR_IO;
+	}
+	for(i=0; i<rw->phnum; i++)
+		widen_phdr(&ph32[i], &rw->ph[i]);
+	free(ph32);
+	return ELF_OK;
+}
+
+elf_status_t rewrite_open(const char *path, rewriter_t **rw)
+{
+	rewriter_t *r;
+	elf_status_t status;
+
+	*rw = NULL;
+	r = calloc(1, sizeof(rewriter_t));
+	if(!r)
+		return ELF_ERR_NOMEM;
+
+	status = elf_open(path, &r->ef);
+	if(status == ELF_OK)
+		status = elf_read_shdrs(r->ef);
+	if(status == ELF_OK)
+		status = load_headers(r);
+	if(status == ELF_OK)
+		status = edit_open_fd(elf_fd(r->ef), &r->eb);
+	if(status != ELF_OK) {
+		rewrite_close(r);
+		return status;
+	}
+
+	*rw = r;
+	return ELF_OK;
+}
+
+void rewrite_close(rewriter_t *rw)
+{
+	uint32_t i;
+
+	if(!rw)
+		return;
+
+	/* The buffer maps the file through the handle's fd */
+	edit_close(rw->eb);
+	elf_close(rw->ef);
+	for(i=0; rw->moved && i<rw->shnum; i++)
+		free(rw->moved[i].data);
+	free(rw->moved);
+	free(rw->sh);
+	free(rw->ph);
+	free(rw);
+}
+
+elf_file_t * rewrite_file(rewriter_t *rw)
+{
+	return rw->ef;
+}
+
+edit_buf_t * rewrite_buffer(rewriter_t *rw)
+{
+	return rw->eb;
+}
+
+elf_status_t rewrite_patch(rewriter_t *rw, uint64_t offset, const void *data, uint64_t size)
+{
+	return edit_patch(rw->eb, offset, data, size);
+}
+
+static elf_status_t set_moved(rewriter_t *rw, uint32_t idx, const void *data, uint64_t size)
+{
+	uint8_t *copy = malloc(size ? size : 1);
+
+	if(!copy)
+		return ELF_ERR_NOMEM;
+	memcpy(copy, data, size);
+	free(rw->moved[idx].data);
+	rw->moved[idx].data = copy;
+	rw->moved[idx].size = size;
+	rw->layout = true;
+	return ELF_OK;
+}
+
+elf_status_t rewrite_set_section(rewriter_t *rw, uint32_t idx, const void *data, uint64_t size)
+{
+	Elf64_Shdr *sh = &rw->sh[idx];
+	elf_status_t status;
+
+	if(!idx || idx >= rw->shnum || sh->sh_type == SHT_NOBITS)
+		return ELF_ERR_RANGE;
+
+	/* Added, or already moved: it is laid out on save anyway */
+	if(rw->moved[idx].data)
+		return set_moved(rw, idx, data, size);
+
+	if(size <= sh->sh_size) {
+		status = edit_patch(rw->eb, sh->sh_offset, data, size);
+		if(status == ELF_OK && size < sh->sh_size) {
+			sh->sh_size = size;
+			rw->layout = true;
+		}
+		return status;
+	}
+	if(sh->sh_flags & SHF_ALLOC)
+		return ELF_ERR_RANGE;
+	return set_moved(rw, idx, data, size);
+}
+
+/* The name goes at the end of the section name table, which moves */
+static elf_status_t add_name(rewriter_t *rw, const char *name, uint32_t *offset)
+{
+	const Elf64_Shdr *sh = &rw->sh[rw->shstrndx];
+	moved_t *m = &rw->moved[rw->shstrndx];
+	size_t len = strlen(name) + 1;
+	uint64_t size = m->data ? m->size : sh->sh_size;
+	uint8_t *names;
+	elf_status_t status;
+
+	if(!rw->shstrndx || sh->sh_type != SHT_STRTAB || size + len > UINT32_MAX)
+		return ELF_ERR_FORMAT;
+	names = malloc(size + len);
+	if(!names)
+		return ELF_ERR_NOMEM;
+	if(m->data)
+		memcpy(names, m->data, size);
+	else if((status = edit_read(rw->eb, sh->sh_offset, names, size)) != ELF_OK) {
+		free(names);
+		return status;
+	}
+	memcpy(names + size, name, len);
+
+	free(m->data);
+	m->data = names;
+	m->size = size + len;
+	*offset = size;
+	rw->layout = true;
+	return ELF_OK;
+}
+
+elf_status_t rewrite_add_section(rewriter_t *rw, const char *name, uint32_t type,
+		uint64_t flags, uint64_t align, const void *data, uint64_t size, uint32_t *idx)
+{
+	Elf64_Shdr *sh;
+	moved_t *m;
+	uint32_t n;
+	elf_status_t status;
+
+	if(type == SHT_NULL || type == SHT_NOBITS || !rw->shnum)
+		return ELF_ERR_RANGE;
+	if((flags & SHF_ALLOC) && (!rw->phnum || rw->phnum + 1 >= 0xffff
+			|| (rw->eh.e_type != ET_EXEC && rw->eh.e_type != ET_DYN)))
+		return ELF_ERR_RANGE;
+
+	if(rw->shnum == rw->shsize) {
+		n = rw->shsize * 2;
+		sh = realloc(rw->sh, n * sizeof(Elf64_Shdr));
+		if(!sh)
+			return ELF_ERR_NOMEM;
+		rw->sh = sh;
+		m = realloc(rw->moved, n * sizeof(moved_t));
+		if(!m)
+			return ELF_ERR_NOMEM;
+		rw->moved = m;
+		rw->shsize = n;
+	}
+
+	sh = &rw->sh[rw->shnum];
+	memset(sh, 0, sizeof(*sh));
+	memset(&rw->moved[rw->shnum], 0, sizeof(moved_t));
+	status = add_name(rw, name, &sh->sh_name);
+	if(status == ELF_OK)
+		status = set_moved(rw, rw->shnum, data, size);
+	if(status != ELF_OK)
+		return status;
+	sh->sh_type = type;
+	sh->sh_flags = flags;
+	sh->sh_addralign = align ? align : 1;
+	sh->sh_size = size;
+	if(flags & SHF_ALLOC)
+		rw->new_segment = true;
+	if(idx)
+		*idx = rw->shnum;
+	rw->shnum++;
+	return ELF_OK;
+}
+
+/* Zero fill up to the alignment, then data; edits are counted so the
+ * save can take them back
+ */
+static elf_status_t append(rewriter_t *rw, uint32_t *edits, uint64_t align,
+		const void *data, uint64_t size, uint64_t *offset)
+{
+	uint64_t end = edit_size(rw->eb), pad = align_up(end, align) - end;
+	elf_status_t status;
+	uint8_t *zeros;
+
+	if(pad) {
+		zeros = calloc(1, pad);
+		if(!zeros)
+			return ELF_ERR_NOMEM;
+		status = edit_insert(rw->eb, end, zeros, pad);
+		free(zeros);
+		if(status != ELF_OK)
+			return status;
+		(*edits)++;
+	}
+	*offset = end + pad;
+	if(!size)
+		return ELF_OK;
+	status = edit_insert(rw->eb, *offset, data, size);
+	if(status == ELF_OK)
+		(*edits)++;
+	return status;
+}
+
+/* Loaded sections that were added, after a new program header table,
+ * make up one new PT_LOAD placed above every other segment
+ */
+static elf_status_t add_segment(rewriter_t *rw, Elf64_Ehdr *eh, Elf64_Phdr *ph,
+		Elf64_Shdr *sh, uint32_t *edits)
+{
+	uint64_t p_align = MIN_PAGE, top = 0, entsize, table, off, vaddr, start;
+	uint32_t i, last = 0, phnum = rw->phnum + 1, flags = PF_R;
+	elf_status_t status;
+	uint8_t *bytes;
+
+	for(i=0; i<rw->phnum; i++) {
+		if(ph[i].p_type != PT_LOAD)
+			continue;
+		if(ph[i].p_align > p_align)
+			p_align = ph[i].p_align;
+		if(ph[i].p_vaddr + ph[i].p_memsz > top)
+			top = ph[i].p_vaddr + ph[i].p_memsz;
+		last = i + 1;
+	}
+
+	/* Room for the table first, filled in when the segment is known */
+	entsize = rw->is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+	table = phnum * entsize;
+	bytes = calloc(1, table);
+	if(!bytes)
+		return ELF_ERR_NOMEM;
+	status = append(rw, edits, rw->is64 ? 8 : 4, bytes, table, &start);
+	if(status != ELF_OK) {
+		free(bytes);
+		return status;
+	}
+	/* offset and address agree modulo the alignment, no padding needed */
+	vaddr = align_up(top, p_align) + start % p_align;
+
+	for(i=1; i<rw->shnum && status == ELF_OK; i++) {
+		if(!rw->moved[i].data || !(sh[i].sh_flags & SHF_ALLOC))
+			continue;
+		status = append(rw, edits, sh[i].sh_addralign, rw->moved[i].data,
+				rw->moved[i].size, &off);
+		sh[i].sh_offset = off;
+		sh[i].sh_addr = vaddr + (off - start);
+		sh[i].sh_size = rw->moved[i].size;
+		if(sh[i].sh_flags & SHF_WRITE)
+			flags |= PF_W;
+		if(sh[i].sh_flags & SHF_EXECINSTR)
+			flags |= PF_X;
+	}
+	if(status != ELF_OK) {
+		free(bytes);
+		return status;
+	}
+
+	/* PT_LOAD entries stay sorted by address */
+	memmove(&ph[last + 1], &ph[last], (rw->phnum - last) * sizeof(Elf64_Phdr));
+	memset(&ph[last], 0, sizeof(Elf64_Phdr));
+	ph[last].p_type = PT_LOAD;
+	ph[last].p_flags = flags;
+	ph[last].p_offset = start;
+	ph[last].p_vaddr = ph[last].p_paddr = vaddr;
+	ph[last].p_filesz = ph[last].p_memsz = edit_size(rw->eb) - start;
+	ph[last].p_align = p_align;
+	for(i=0; i<phnum; i++) {
+		if(ph[i].p_type != PT_PHDR)
+			continue;
+		ph[i].p_offset = start;
+		ph[i].p_vaddr = ph[i].p_paddr = vaddr;
+		ph[i].p_filesz = ph[i].p_memsz = table;
+	}
+	eh->e_phoff = start;
+	eh->e_phnum = phnum;
+	eh->e_phentsize = entsize;
+
+	put_phdrs(rw, ph, phnum, bytes);
+	status = edit_patch(rw->eb, start, bytes, table);
+	if(status == ELF_OK)
+		(*edits)++;
+	free(bytes);
+	return status;
+}
+
+/* Appends what moved and the headers, on copies of the tables so the
+ * rewriter can go on editing after the save
+ */
+static elf_status_t relayout(rewriter_t *rw, uint32_t *edits)
+{
+	Elf64_Ehdr eh;
+	Elf64_Phdr *ph = NULL;
+	Elf64_Shdr *sh;
+	uint64_t entsize = rw->is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr), off;
+	uint8_t bytes[sizeof(Elf64_Ehdr)], *table = NULL;
+	elf_status_t status = ELF_ERR_NOMEM;
+	uint32_t i;
+
+	/* Only the table fields are rewritten, patches to the rest stay */
+	if((status = get_ehdr(rw, &eh)) != ELF_OK)
+		return status;
+
+	status = ELF_ERR_NOMEM;
+	sh = malloc(rw->shnum * sizeof(Elf64_Shdr));
+	if(rw->new_segment)
+		ph = malloc((rw->phnum + 1) * sizeof(Elf64_Phdr));
+	table = malloc(rw->shnum * entsize);
+	if(!sh || !table || (rw->new_segment && !ph))
+		goto out;
+	memcpy(sh, rw->sh, rw->shnum * sizeof(Elf64_Shdr));
+	if(ph)
+		memcpy(ph, rw->ph, rw->phnum * sizeof(Elf64_Phdr));
+
+	status = ELF_OK;
+	for(i=1; i<rw->shnum && status == ELF_OK; i++) {
+		if(!rw->moved[i].data || (sh[i].sh_flags & SHF_ALLOC))
+			continue;
+		status = append(rw, edits, sh[i].sh_addralign, rw->moved[i].data,
+				rw->moved[i].size, &off);
+		sh[i].sh_offset = off;
+		sh[i].sh_size = rw->moved[i].size;
+	}
+	if(status == ELF_OK && rw->new_segment)
+		status = add_segment(rw, &eh, ph, sh, edits);
+	if(status != ELF_OK)
+		goto out;
+
+	/* Counts that do not fit the header go to section 0 */
+	eh.e_shnum = rw->shnum < SHN_LORESERVE ? rw->shnum : 0;
+	eh.e_shstrndx = rw->shstrndx < SHN_LORESERVE ? rw->shstrndx : SHN_XINDEX;
+	sh[0].sh_size = rw->shnum < SHN_LORESERVE ? 0 : rw->shnum;
+	sh[0].sh_link = rw->shstrndx < SHN_LORESERVE ? 0 : rw->shstrndx;
+	eh.e_shentsize = entsize;
+	put_shdrs(rw, sh, rw->shnum, table);
+	status = append(rw, edits, rw->is64 ? 8 : 4, table, rw->shnum * entsize, &off);
+	if(status != ELF_OK)
+		goto out;
+	eh.e_shoff = off;
+
+	put_ehdr(rw, &eh, bytes);
+	status = edit_patch(rw->eb, 0, bytes, rw->is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr));
+	if(status == ELF_OK)
+		(*edits)++;
+
+out:
+	free(table);
+	free(ph);
+	free(sh);
+	return status;
+}
+
+static bool write_full(int32_t fd, uint64_t offset, const uint8_t *data, uint64_t size)
+{
+	ssize_t n;
+
+	while(size) {
+		n = pwrite(fd, data, size, offset);
+		stats_add(STAT_SYSCALLS, 1);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		data += n;
+		offset += n;
+		size -= n;
+	}
+	return true;
+}
+
+/* False when the kernel cannot copy between these two files at all */
+static bool copy_range(int32_t in, uint64_t from, int32_t out, uint64_t to, uint64_t size)
+{
+	loff_t off_in = from, off_out = to;
+	ssize_t n;
+
+	while(size) {
+		n = copy_file_range(in, &off_in, out, &off_out, size, 0);
+		stats_add(STAT_SYSCALLS, 1);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		size -= n;
+	}
+	return true;
+}
+
+/* Patches and appends never move what was there; anything else cannot
+ * be saved in place, and that has to be known before the first write
+ */
+static bool stays_put(void *ctx, uint64_t offset, const edit_piece_t *piece)
+{
+	out_t *o = ctx;
+
+	if(piece->origin != EDIT_ADDED && piece->origin != offset) {
+		o->status = ELF_ERR_MOVED;
+		return false;
+	}
+	return true;
+}
+
+static bool out_piece(void *ctx, uint64_t offset, const edit_piece_t *piece)
+{
+	out_t *o = ctx;
+
+	if(piece->origin != EDIT_ADDED) {
+		if(o->in_place) {
+			o->result->kept += piece->size;
+			return true;
+		}
+		if(copy_range(o->in, piece->origin, o->fd, offset, piece->size)) {
+			o->result->copied += piece->size;
+			return true;
+		}
+		/* No copy between these filesystems, write it from the mapping */
+	}
+
+	if(!write_full(o->fd, offset, piece->data, piece->size)) {
+		o->status = ELF_ERR_IO;
+		return false;
+	}
+	o->result->written += piece->size;
+	stats_add(STAT_OUTPUT_BYTES, piece->size);
+	return true;
+}
+
+elf_status_t rewrite_save(rewriter_t *rw, const char *path, rewrite_result_t *result)
+{
+	struct stat in, st;
+	out_t o;
+	uint32_t edits = 0;
+	elf_status_t status = ELF_OK;
+
+	memset(result, 0, sizeof(*result));
+	memset(&o, 0, sizeof(o));
+	o.in = elf_fd(rw->ef);
+	o.result = result;
+	if(fstat(o.in, &in) < 0)
+		return ELF_ERR_OPEN;
+
+	/* Truncating the input would lose the bytes still to be copied */
+	o.in_place = stat(path, &st) == 0 && st.st_dev == in.st_dev && st.st_ino == in.st_ino;
+	o.fd = open(path, o.in_place ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, in.st_mode & 07777);
+	if(o.fd < 0)
+		return ELF_ERR_OPEN;
+
+	if(rw->layout)
+		status = relayout(rw, &edits);
+	if(status == ELF_OK && o.in_place && !edit_walk(rw->eb, stays_put, &o))
+		status = o.status != ELF_OK ? o.status : ELF_ERR_NOMEM;
+	if(status == ELF_OK) {
+		result->size = edit_size(rw->eb);
+		if(!edit_walk(rw->eb, out_piece, &o))
+			status = o.status != ELF_OK ? o.status : ELF_ERR_NOMEM;
+		else if(ftruncate(o.fd, result->size) < 0)
+			status = ELF_ERR_IO;
+	}
+	if(close(o.fd) < 0 && status == ELF_OK)
+		status = ELF_ERR_IO;
+
+	/* Back to the edits as they were before the save */
+	while(edits--)
+		edit_undo(rw->eb);
+	return status;
+}
+
+typedef struct cli_edit {
+	const char *text;
+	uint8_t *data;		/* patch bytes, or NULL for a section */
+	uint64_t size;
+	uint64_t offset;
+} cli_edit_t;
+
+static cli_edit_t *cli_edits;
+static uint32_t cli_count;
+
+static bool add_cli_edit(const cli_edit_t *e)
+{
+	cli_edit_t *grown = realloc(cli_edits, (cli_count + 1) * sizeof(cli_edit_t));
+
+	if(!grown)
+		return false;
+	cli_edits = grown;
+	cli_edits[cli_count++] = *e;
+	return true;
+}
+
+static int hex_digit(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool rewrite_add_patch(const char *text)
+{
+	cli_edit_t e;
+	const char *s;
+	char *end;
+	int hi, lo;
+
+	memset(&e, 0, sizeof(e));
+	e.text = text;
+	e.offset = strtoull(text, &end, 0);
+	if(end == text || *end != ':')
+		return false;
+	e.data = malloc(strlen(end) / 2 + 1);
+	if(!e.data)
+		return false;
+	for(s=end+1; *s; ) {
+		if(*s == ' ') {
+			s++;
+			continue;
+		}
+		hi = hex_digit(s[0]);
+		lo = hi < 0 ? -1 : hex_digit(s[1]);
+		if(lo < 0)
+			break;
+		e.data[e.size++] = hi << 4 | lo;
+		s += 2;
+	}
+	if(*s || !e.size || !add_cli_edit(&e)) {
+		free(e.data);
+		return false;
+	}
+	return true;
+}
+
+bool rewrite_add_section_file(const char *text)
+{
+	cli_edit_t e;
+	const char *eq = strchr(text, '=');
+
+	if(!eq || eq == text || !eq[1])
+		return false;
+	memset(&e, 0, sizeof(e));
+	e.text = text;
+	return add_cli_edit(&e);
+}
+
+static uint8_t * read_whole(const char *path, uint64_t *size)
+{
+	struct stat st;
+	uint8_t *data = NULL;
+	int32_t fd = open(path, O_RDONLY);
+
+	if(fd < 0)
+		return NULL;
+	if(fstat(fd, &st) == 0 && (data = malloc(st.st_size ? st.st_size : 1))) {
+		*size = st.st_size;
+		if(!read_full(fd, 0, data, st.st_size)) {
+			free(data);
+			data = NULL;
+		}
+	}
+	close(fd);
+	return data;
+}
+
+/* "name[,awx]=path" */
+static elf_status_t add_file_section(rewriter_t *rw, const char *text)
+{
+	const char *eq = strchr(text, '='), *comma = memchr(text, ',', eq - text), *f;
+	size_t len = (comma ? comma : eq) - text;
+	uint64_t flags = 0, size;
+	uint8_t *data;
+	char *name;
+	elf_status_t status;
+
+	for(f=comma ? comma+1 : eq; f<eq; f++) {
+		switch(*f)
+		{
+			case 'a': flags |= SHF_ALLOC; break;
+			case 'w': flags |= SHF_WRITE | SHF_ALLOC; break;
+			case 'x': flags |= SHF_EXECINSTR | SHF_ALLOC; break;
+			default: return ELF_ERR_FORMAT;
+		}
+	}
+	name = strndup(text, len);
+	if(!name)
+		return ELF_ERR_NOMEM;
+	data = read_whole(eq + 1, &size);
+	if(!data) {
+		free(name);
+		return ELF_ERR_OPEN;
+	}
+	status = rewrite_add_section(rw, name, SHT_PROGBITS, flags,
+			(flags & SHF_EXECINSTR) ? 16 : 8, data, size, NULL);
+	free(data);
+	free(name);
+	return status;
+}
+
+bool rewrite_run(const char *in, const char *out)
+{
+	rewriter_t *rw;
+	rewrite_result_t result;
+	elf_status_t status;
+	uint32_t i;
+
+	status = rewrite_open(in, &rw);
+	if(status != ELF_OK) {
+		fprintf(stderr, "%s: %s\n", in, elf_strerror(status));
+		return false;
+	}
+
+	for(i=0; i<cli_count; i++) {
+		if(cli_edits[i].data)
+			status = rewrite_patch(rw, cli_edits[i].offset, cli_edits[i].data,
+					cli_edits[i].size);
+		else
+			status = add_file_section(rw, cli_edits[i].text);
+		if(status != ELF_OK) {
+			fprintf(stderr, "%s: %s\n", cli_edits[i].text, elf_strerror(status));
+			rewrite_close(rw);
+			return false;
+		}
+	}
+
+	status = rewrite_save(rw, out, &result);
+	rewrite_close(rw);
+	if(status != ELF_OK) {
+		fprintf(stderr, "%s: %s\n", out, elf_strerror(status));
+		return false;
+	}
+	printf("wrote %s: %lu bytes, %lu copied, %lu written, %lu kept\n",
+			out, result.size, result.copied, result.written, result.kept);
+	return true;
+}
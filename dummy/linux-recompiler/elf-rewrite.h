@@ -0,0 +1,75 @@
+#ifndef _ELF_REWRITE_H
+#define _ELF_REWRITE_H
+
+#include "elf-parser.h"
+#include "elf-file.h"
+#include "elf-edit.h"
+
+/* Writes an edited ELF file back out.
+ *
+ * Edits go to an editing buffer over the input (elf-edit).  Byte
+ * patches and section contents that do not grow stay where they are.
+ * Sections that grow and added ones are laid out after the end of the
+ * input.  The section header table is then written again after them
+ * and e_shoff, e_shnum and the section offsets are fixed up to match.
+ * A section that has to be loaded gets a new PT_LOAD of its own at the
+ * end, together with a larger copy of the program header table, and
+ * PT_PHDR is pointed at that copy.  Loaded sections cannot grow, because
+ * code refers to them by address.  The old header tables stay in the
+ * file, unreferenced.
+ *
+ * Only the pieces of the buffer are written.  Ranges that come straight
+ * from the input are copied from file to file with copy_file_range(),
+ * which lets the filesystem share the blocks instead where it can.  New
+ * bytes are written with pwrite().  Saving over the input itself writes
+ * the new bytes only and leaves the rest of the file as it is.
+ *
+ * Headers are read from the input and converted to host order on open,
+ * and converted back when written.  Both classes and both byte orders
+ * are handled.
+ */
+
+typedef struct rewriter rewriter_t;
+
+typedef struct rewrite_result {
+	uint64_t size;		/* of the output */
+	uint64_t copied;	/* by copy_file_range */
+	uint64_t written;	/* by pwrite */
+	uint64_t kept;		/* in place, untouched */
+} rewrite_result_t;
+
+elf_status_t rewrite_open(const char *path, rewriter_t **rw);
+void rewrite_close(rewriter_t *rw);
+
+elf_file_t * rewrite_file(rewriter_t *rw);
+edit_buf_t * rewrite_buffer(rewriter_t *rw);
+
+/* Overwrites bytes at a file offset; ELF_ERR_OFFSET if they run past
+ * the end.  Header bytes are written over when a save has to lay the
+ * file out again.
+ */
+elf_status_t rewrite_patch(rewriter_t *rw, uint64_t offset, const void *data, uint64_t size);
+
+/* New contents for a section; ELF_ERR_RANGE if a loaded one would grow */
+elf_status_t rewrite_set_section(rewriter_t *rw, uint32_t idx, const void *data, uint64_t size);
+
+/* Appends a section of type SHT_PROGBITS or SHT_NOTE and so on; its
+ * address is chosen on save when flags has SHF_ALLOC
+ */
+elf_status_t rewrite_add_section(rewriter_t *rw, const char *name, uint32_t type,
+		uint64_t flags, uint64_t align, const void *data, uint64_t size, uint32_t *idx);
+
+/* path may name the input, which is then updated in place; if the
+ * edits move any of its bytes that fails with ELF_ERR_MOVED before
+ * anything is written
+ */
+elf_status_t rewrite_save(rewriter_t *rw, const char *path, rewrite_result_t *result);
+
+/* Command line edits, applied in order by rewrite_run(): "offset:hex"
+ * patches bytes, "name[,awx]=path" adds a section holding a file
+ */
+bool rewrite_add_patch(const char *text);
+bool rewrite_add_section_file(const char *text);
+bool rewrite_run(const char *in, const char *out);
+
+#endif /* _ELF_REWRITE_H */
@@ -0,0 +1,340 @@
+#include <sys/stat.h>
+
+#include "elf-scan.h"
+#include "elf-swap.h"
+
+typedef struct scan scan_t;
+
+typedef struct scan_file {
+	scan_t *scan;
+	const char *path;
+	int32_t fd;
+	uint64_t file_size;
+	bool is64;
+	bool swapped;
+	union {
+		Elf64_Ehdr eh64;
+		Elf32_Ehdr eh32;
+		Elf64_Shdr sh64;	/* section 0, extended numbering */
+		Elf32_Shdr sh32;
+	} hdr;
+	uint16_t machine;
+	uint64_t shoff;
+	uint32_t shnum;
+	void *shdrs;
+	uint32_t symbols;
+	uint32_t functions;
+	uint32_t pending;	/* reads in flight */
+	const char *error;
+	int err;		/* errno behind error, 0 if none */
+	bool done;
+} scan_file_t;
+
+struct scan {
+	aio_t *aio;
+	scan_file_t *files;
+	uint32_t count;
+	uint32_t next;		/* first file not opened yet */
+	uint32_t open;
+	uint32_t printed;
+	bool starting;		/* in start_files(), settle() must not recurse */
+	bool ok;
+};
+
+static void start_files(scan_t *s);
+
+static bool fits(uint64_t offset, uint64_t size, uint64_t limit)
+{
+	return offset <= limit && size <= limit - offset;
+}
+
+static void print_file(scan_t *s, const scan_file_t *f)
+{
+	if(f->error) {
+		s->ok = false;
+		if(f->err)
+			printf("%s\terror: %s: %s\n", f->path, f->error, strerror(f->err));
+		else
+			printf("%s\terror: %s\n", f->path, f->error);
+		return;
+	}
+	printf("%s\t%s\t%u\t%u\t%u\t%u\n", f->path, f->is64 ? "elf64" : "elf32",
+			f->machine, f->shnum, f->symbols, f->functions);
+}
+
+static void fail(scan_file_t *f, const char *error, int64_t result)
+{
+	if(f->error)
+		return;
+	f->error = error;
+	f->err = result < 0 ? (int)-result : 0;
+}
+
+/* Called whenever a read of f completes; the last one closes it and
+ * lets the next file in
+ */
+static void settle(scan_file_t *f)
+{
+	scan_t *s = f->scan;
+
+	if(f->pending)
+		return;
+	if(f->fd >= 0)
+		close(f->fd);
+	f->fd = -1;
+	free(f->shdrs);
+	f->shdrs = NULL;
+	f->done = true;
+	s->open--;
+
+	/* Output stays in argument order */
+	while(s->printed < s->count && s->files[s->printed].done)
+		print_file(s, &s->files[s->printed++]);
+	start_files(s);
+}
+
+static bool queue(scan_file_t *f, uint64_t offset, void *buf, size_t size, aio_done_t done)
+{
+	if(!aio_read(f->scan->aio, f->fd, offset, buf, size, done, f)) {
+		fail(f, "out of memory", 0);
+		return false;
+	}
+	f->pending++;
+	return true;
+}
+
+static void on_symtab(void *arg, void *buf, int64_t result)
+{
+	scan_file_t *f = arg;
+	uint32_t i, n;
+	uint16_t shndx;
+
+	f->pending--;
+	if(result < 0) {
+		fail(f, "symbol table", result);
+	} else if(f->is64) {
+		Elf64_Sym *sym = buf;
+		n = result / sizeof(Elf64_Sym);
+		for(i=0; i<n; i++) {
+			shndx = f->swapped ? __builtin_bswap16(sym[i].st_shndx) : sym[i].st_shndx;
+			if(ELF32_ST_TYPE(sym[i].st_info) == STT_FUNC && shndx != SHN_UNDEF)
+				f->functions++;
+		}
+	} else {
+		Elf32_Sym *sym = buf;
+		n = result / sizeof(Elf32_Sym);
+		for(i=0; i<n; i++) {
+			shndx = f->swapped ? __builtin_bswap16(sym[i].st_shndx) : sym[i].st_shndx;
+			if(ELF32_ST_TYPE(sym[i].st_info) == STT_FUNC && shndx != SHN_UNDEF)
+				f->functions++;
+		}
+	}
+	free(buf);
+	settle(f);
+}
+
+/* Every symbol table of the file goes out at once */
+static void on_shdrs(void *arg, void *buf, int64_t result)
+{
+	scan_file_t *f = arg;
+	uint64_t offset, size, entsize;
+	uint32_t i, type;
+	void *tbl;
+
+	f->pending--;
+	if(result < 0) {
+		fail(f, "section headers", result);
+		settle(f);
+		return;
+	}
+	if(f->swapped) {
+		if(f->is64)
+			swap_shdr_table64(buf, f->shnum);
+		else
+			swap_shdr_table(buf, f->shnum);
+	}
+
+	entsize = f->is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+	for(i=0; i<f->shnum && !f->error; i++) {
+		if(f->is64) {
+			type = ((Elf64_Shdr *)buf)[i].sh_type;
+			offset = ((Elf64_Shdr *)buf)[i].sh_offset;
+			size = ((Elf64_Shdr *)buf)[i].sh_size;
+		} else {
+			type = ((Elf32_Shdr *)buf)[i].sh_type;
+			offset = ((Elf32_Shdr *)buf)[i].sh_offset;
+			size = ((Elf32_Shdr *)buf)[i].sh_size;
+		}
+		if(type != SHT_SYMTAB && type != SHT_DYNSYM)
+			continue;
+		size -= size % entsize;
+		if(!fits(offset, size, f->file_size)) {
+			fail(f, "symbol table past end of file", 0);
+			break;
+		}
+		f->symbols += size / entsize;
+		if(!size)
+			continue;
+		tbl = malloc(size);
+		if(!tbl) {
+			fail(f, "out of memory", 0);
+			break;
+		}
+		if(!queue(f, offset, tbl, size, on_symtab))
+			free(tbl);
+	}
+	settle(f);
+}
+
+static void read_shdrs(scan_file_t *f)
+{
+	uint64_t size = (uint64_t)f->shnum
+		* (f->is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr));
+
+	if(!fits(f->shoff, size, f->file_size)) {
+		fail(f, "section headers past end of file", 0);
+		return;
+	}
+	f->shdrs = malloc(size);
+	if(!f->shdrs) {
+		fail(f, "out of memory", 0);
+		return;
+	}
+	queue(f, f->shoff, f->shdrs, size, on_shdrs);
+}
+
+/* e_shnum was 0: the count is the size of section 0 */
+static void on_shdr0(void *arg, void *buf, int64_t result)
+{
+	scan_file_t *f = arg;
+	uint64_t count;
+
+	f->pending--;
+	if(result < 0) {
+		fail(f, "section headers", result);
+	} else {
+		if(f->is64) {
+			count = f->swapped ? __builtin_bswap64(f->hdr.sh64.sh_size) : f->hdr.sh64.sh_size;
+		} else {
+			count = swap32_if(f->swapped, f->hdr.sh32.sh_size);
+		}
+		if(count > UINT32_MAX)
+			fail(f, "section count out of range", 0);
+		f->shnum = count;
+		if(!f->error && f->shnum)
+			read_shdrs(f);
+	}
+	settle(f);
+}
+
+static void on_ehdr(void *arg, void *buf, int64_t result)
+{
+	scan_file_t *f = arg;
+	uint16_t shentsize;
+
+	f->pending--;
+	if(result < 0) {
+		fail(f, "ELF header", result);
+		settle(f);
+		return;
+	}
+	if(strncmp((char *)f->hdr.eh64.e_ident, "\177ELF", 4)) {
+		fail(f, "not an ELF file", 0);
+		settle(f);
+		return;
+	}
+	f->is64 = f->hdr.eh64.e_ident[EI_CLASS] == ELFCLASS64;
+	f->swapped = elf_swapped(f->hdr.eh64.e_ident);
+	if((uint64_t)result < (f->is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr))) {
+		fail(f, "truncated ELF header", 0);
+		settle(f);
+		return;
+	}
+
+	if(f->is64) {
+		if(f->swapped)
+			swap_ehdr64(&f->hdr.eh64);
+		f->machine = f->hdr.eh64.e_machine;
+		f->shoff = f->hdr.eh64.e_shoff;
+		f->shnum = f->hdr.eh64.e_shnum;
+		shentsize = f->hdr.eh64.e_shentsize;
+	} else {
+		if(f->swapped)
+			swap_ehdr(&f->hdr.eh32);
+		f->machine = f->hdr.eh32.e_machine;
+		f->shoff = f->hdr.eh32.e_shoff;
+		f->shnum = f->hdr.eh32.e_shnum;
+		shentsize = f->hdr.eh32.e_shentsize;
+	}
+
+	if(!f->shoff) {
+		f->shnum = 0;
+	} else if(shentsize != (f->is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr))) {
+		fail(f, "unexpected e_shentsize", 0);
+	} else if(!f->shnum) {
+		/* The header is done with, section 0 goes in its place */
+		if(!fits(f->shoff, shentsize, f->file_size))
+			fail(f, "section headers past end of file", 0);
+		else
+			queue(f, f->shoff, &f->hdr, shentsize, on_shdr0);
+	} else {
+		read_shdrs(f);
+	}
+	settle(f);
+}
+
+static void start_files(scan_t *s)
+{
+	scan_file_t *f;
+	struct stat st;
+
+	if(s->starting)
+		return;
+	s->starting = true;
+	while(s->open < SCAN_FILES && s->next < s->count) {
+		f = &s->files[s->next++];
+		s->open++;
+		f->fd = open(f->path, O_RDONLY);
+		if(f->fd < 0 || fstat(f->fd, &st)) {
+			fail(f, "open", -errno);
+		} else if((uint64_t)st.st_size < EI_NIDENT) {
+			fail(f, "not an ELF file", 0);
+		} else {
+			f->file_size = st.st_size;
+			queue(f, 0, &f->hdr, f->file_size < sizeof(Elf64_Ehdr)
+					? f->file_size : sizeof(Elf64_Ehdr), on_ehdr);
+		}
+		settle(f);
+	}
+	s->starting = false;
+}
+
+bool scan_files(char *paths[], uint32_t count)
+{
+	scan_t s;
+	uint32_t i;
+
+	memset(&s, 0, sizeof(s));
+	s.ok = true;
+	s.count = count;
+	s.files = calloc(count, sizeof(scan_file_t));
+	s.aio = aio_create(AIO_DEPTH, true);
+	if(!s.files || !s.aio) {
+		free(s.files);
+		aio_destroy(s.aio);
+		return false;
+	}
+	debug("scan: %s backend\n", aio_backend(s.aio));
+	for(i=0; i<count; i++) {
+		s.files[i].scan = &s;
+		s.files[i].path = paths[i];
+		s.files[i].fd = -1;
+	}
+
+	start_files(&s);
+	aio_run(s.aio);
+
+	aio_destroy(s.aio);
+	free(s.files);
+	return s.ok;
+}
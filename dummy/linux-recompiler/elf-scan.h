@@ -0,0 +1,24 @@
+#ifndef _ELF_SCAN_H
+#define _ELF_SCAN_H
+
+#include "elf-aio.h"
+
+/* Inventory of many files at once (-I).
+ *
+ * Each file is a chain of reads driven by completions: the ELF header,
+ * then the section header table, then every symbol table in parallel.
+ * Up to SCAN_FILES files are open at a time and a new one starts as
+ * soon as one is done, so the reads of many files overlap.  Lines come
+ * out in argument order:
+ *
+ *   path  class  machine  sections  symbols  functions
+ *
+ * functions counts the defined STT_FUNC symbols.  A file that cannot be
+ * read shows the reason instead.
+ */
+
+#define SCAN_FILES	64
+
+bool scan_files(char *paths[], uint32_t count);
+
+#endif /* _ELF_SCAN_H */
@@ -0,0 +1,495 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "elf-search.h"
+#include "elf-stats.h"
+#include "elf-symview.h"
+
+#define NO_STATE	UINT32_MAX
+
+typedef struct pattern {
+	const char *text;
+	uint8_t *value;		/* already masked */
+	uint8_t *mask;
+	uint32_t len;
+	uint32_t lit;		/* longest run of whole bytes */
+	uint32_t lit_len;
+} pattern_t;
+
+/* Aho-Corasick over the runs, as a full transition table */
+typedef struct automaton {
+	uint32_t *next;		/* [state * 256 + byte] */
+	uint32_t *fail;
+	uint32_t *first;	/* first pattern whose run ends in the state */
+	uint32_t *dict;		/* closest suffix state with patterns, or NO_STATE */
+	uint32_t *chain;	/* [pattern] next pattern ending in the same state */
+	uint32_t states;
+} automaton_t;
+
+typedef struct region {
+	char name[32];		/* for segments */
+	const char *label;
+	uint32_t shndx;		/* SHN_UNDEF for segments */
+	uint64_t offset;
+	uint64_t size;
+	uint64_t addr;
+} region_t;
+
+typedef struct hit {
+	uint64_t offset;	/* into the region */
+	uint32_t pattern;
+} hit_t;
+
+typedef struct hits {
+	hit_t *hits;
+	uint64_t count;
+	uint64_t size;
+	bool failed;
+} hits_t;
+
+static pattern_t *patterns;
+static uint32_t npatterns;
+static automaton_t ac;
+static bool ac_built;
+
+static int hex_digit(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Two digits, either may be '?' when wild is set */
+static bool parse_byte(const char **s, bool wild, uint8_t *value, uint8_t *mask)
+{
+	int i, d;
+
+	*value = 0;
+	*mask = 0;
+	for(i=0; i<2; i++) {
+		while(**s == ' ')
+			(*s)++;
+		if(wild && **s == '?') {
+			d = 0;
+		} else {
+			d = hex_digit(**s);
+			if(d < 0)
+				return false;
+			*mask |= 0xf << (4 - 4 * i);
+		}
+		*value |= d << (4 - 4 * i);
+		(*s)++;
+	}
+	return true;
+}
+
+bool search_add(const char *text)
+{
+	pattern_t p, *grown;
+	const char *s;
+	uint8_t value, mask, full;
+	uint32_t i, run = 0;
+	size_t n = strlen(text);
+
+	memset(&p, 0, sizeof(p));
+	p.text = text;
+	p.value = malloc(n / 2 + 1);
+	p.mask = malloc(n / 2 + 1);
+	if(!p.value || !p.mask)
+		goto FAIL;
+
+	for(s=text; ; ) {
+		while(*s == ' ')
+			s++;
+		if(!*s)
+			break;
+		if(!parse_byte(&s, true, &value, &mask))
+			goto FAIL;
+		if(*s == '/') {
+			s++;
+			if(mask != 0xff || !parse_byte(&s, false, &mask, &full))
+				goto FAIL;
+		}
+		p.value[p.len] = value & mask;
+		p.mask[p.len] = mask;
+		p.len++;
+	}
+
+	for(i=0; i<p.len; i++) {
+		run = p.mask[i] == 0xff ? run + 1 : 0;
+		if(run > p.lit_len) {
+			p.lit_len = run;
+			p.lit = i + 1 - run;
+		}
+	}
+	if(!p.lit_len)
+		goto FAIL;
+
+	grown = realloc(patterns, (npatterns + 1) * sizeof(pattern_t));
+	if(!grown)
+		goto FAIL;
+	patterns = grown;
+	patterns[npatterns++] = p;
+	ac_built = false;
+	return true;
+
+FAIL:
+	free(p.value);
+	free(p.mask);
+	return false;
+}
+
+uint32_t search_count(void)
+{
+	return npatterns;
+}
+
+static void ac_free(void)
+{
+	free(ac.next);
+	free(ac.fail);
+	free(ac.first);
+	free(ac.dict);
+	free(ac.chain);
+	memset(&ac, 0, sizeof(ac));
+	ac_built = false;
+}
+
+/* Trie of the runs, then breadth first: fail links, the missing
+ * transitions filled in from them, and dictionary links
+ */
+static bool ac_build(void)
+{
+	uint32_t i, j, c, s, t, f, max = 1, head, tail, *queue;
+
+	ac_free();
+	for(i=0; i<npatterns; i++)
+		max += patterns[i].lit_len;
+	ac.next = malloc((size_t)max * 256 * sizeof(uint32_t));
+	ac.fail = calloc(max, sizeof(uint32_t));
+	ac.first = malloc(max * sizeof(uint32_t));
+	ac.dict = malloc(max * sizeof(uint32_t));
+	ac.chain = malloc(npatterns * sizeof(uint32_t));
+	queue = malloc(max * sizeof(uint32_t));
+	if(!ac.next || !ac.fail || !ac.first || !ac.dict || !ac.chain || !queue) {
+		free(queue);
+		ac_free();
+		return false;
+	}
+	stats_alloc((size_t)max * 256 * sizeof(uint32_t));
+	memset(ac.next, 0xff, (size_t)max * 256 * sizeof(uint32_t));
+	memset(ac.first, 0xff, max * sizeof(uint32_t));
+	ac.states = 1;
+
+	for(i=0; i<npatterns; i++) {
+		s = 0;
+		for(j=0; j<patterns[i].lit_len; j++) {
+			c = patterns[i].value[patterns[i].lit + j];
+			if(ac.next[s * 256 + c] == NO_STATE)
+				ac.next[s * 256 + c] = ac.states++;
+			s = ac.next[s * 256 + c];
+		}
+		ac.chain[i] = ac.first[s];
+		ac.first[s] = i;
+	}
+
+	head = tail = 0;
+	ac.dict[0] = NO_STATE;
+	for(c=0; c<256; c++) {
+		t = ac.next[c];
+		if(t == NO_STATE) {
+			ac.next[c] = 0;
+		} else {
+			ac.fail[t] = 0;
+			ac.dict[t] = NO_STATE;
+			queue[tail++] = t;
+		}
+	}
+	while(head < tail) {
+		s = queue[head++];
+		for(c=0; c<256; c++) {
+			t = ac.next[s * 256 + c];
+			f = ac.next[ac.fail[s] * 256 + c];
+			if(t == NO_STATE) {
+				ac.next[s * 256 + c] = f;
+				continue;
+			}
+			ac.fail[t] = f;
+			ac.dict[t] = ac.first[f] != NO_STATE ? f : ac.dict[f];
+			queue[tail++] = t;
+		}
+	}
+
+	free(queue);
+	ac_built = true;
+	return true;
+}
+
+static void add_hit(hits_t *h, uint64_t offset, uint32_t pattern)
+{
+	hit_t *grown;
+	uint64_t size;
+
+	if(h->count == h->size) {
+		size = h->size ? h->size * 2 : 64;
+		grown = realloc(h->hits, size * sizeof(hit_t));
+		if(!grown) {
+			h->failed = true;
+			return;
+		}
+		h->hits = grown;
+		h->size = size;
+	}
+	h->hits[h->count].offset = offset;
+	h->hits[h->count].pattern = pattern;
+	h->count++;
+}
+
+static inline bool verify(const pattern_t *p, const uint8_t *at)
+{
+	uint32_t i;
+
+	for(i=0; i<p->len; i++) {
+		if((at[i] & p->mask[i]) != p->value[i])
+			return false;
+	}
+	return true;
+}
+
+/* Candidates are the positions where the first and the last byte of the
+ * run both match, tested 16 at a time
+ */
+static void search_one(const pattern_t *p, const uint8_t *data, uint64_t size, hits_t *h)
+{
+	uint32_t a = p->lit, b = p->lit + p->lit_len - 1;
+	uint8_t ca = p->value[a], cb = p->value[b];
+	uint64_t i = 0, end;
+
+	if(size < p->len)
+		return;
+	end = size - p->len + 1;	/* positions */
+
+#ifdef __SSE2__
+	{
+		__m128i va = _mm_set1_epi8((char)ca), vb = _mm_set1_epi8((char)cb);
+		uint32_t mask, k;
+
+		for(; i + 16 <= end; i += 16) {
+			mask = _mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + a)), va),
+					_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i + b)), vb)));
+			while(mask) {
+				k = __builtin_ctz(mask);
+				mask &= mask - 1;
+				if(verify(p, data + i + k))
+					add_hit(h, i + k, p - patterns);
+			}
+		}
+	}
+#endif
+	for(; i<end; i++) {
+		if(data[i + a] == ca && data[i + b] == cb && verify(p, data + i))
+			add_hit(h, i, p - patterns);
+	}
+}
+
+static void search_set(const uint8_t *data, uint64_t size, hits_t *h)
+{
+	const pattern_t *p;
+	uint64_t i, start;
+	uint32_t s = 0, d, k;
+
+	for(i=0; i<size; i++) {
+		s = ac.next[s * 256 + data[i]];
+		for(d = ac.first[s] != NO_STATE ? s : ac.dict[s]; d != NO_STATE; d = ac.dict[d]) {
+			for(k=ac.first[d]; k != NO_STATE; k=ac.chain[k]) {
+				p = &patterns[k];
+				/* i is the last byte of the run */
+				if(i + 1 < (uint64_t)p->lit + p->lit_len)
+					continue;
+				start = i + 1 - p->lit - p->lit_len;
+				if(start + p->len <= size && verify(p, data + start))
+					add_hit(h, start, k);
+			}
+		}
+	}
+}
+
+static int hit_cmp(const void *a, const void *b)
+{
+	const hit_t *x = a, *y = b;
+
+	if(x->offset != y->offset)
+		return x->offset < y->offset ? -1 : 1;
+	return x->pattern < y->pattern ? -1 : x->pattern > y->pattern;
+}
+
+static void print_hits(const region_t *r, hits_t *h, const symview_t *view)
+{
+	const symview_entry_t *e;
+	uint64_t i, addr, key;
+
+	/* The automaton finds hits by where their run ends */
+	if(npatterns > 1)
+		qsort(h->hits, h->count, sizeof(hit_t), hit_cmp);
+
+	for(i=0; i<h->count; i++) {
+		addr = r->addr + h->hits[i].offset;
+		key = view && view->by_section ? h->hits[i].offset : addr;
+		e = view ? symbol_view_find(view, r->shndx, key) : NULL;
+		printf("%s\t0x%08lx\t0x%08lx\t", r->label, r->offset + h->hits[i].offset, addr);
+		if(e)
+			printf("%s+0x%lx", symbol_view_name(view, e), key - e->value);
+		else
+			printf("-");
+		printf("\t%s\n", patterns[h->hits[i].pattern].text);
+	}
+}
+
+static uint32_t get_regions(elf_file_t *ef, uint32_t flags, region_t **out)
+{
+	region_t *r = NULL;
+	uint32_t i, n = 0, count;
+	Elf64_Phdr *ph64 = NULL;
+	Elf32_Phdr *ph32 = NULL;
+	uint64_t size = elf_file_size(ef);
+
+	if(flags & SEARCH_SEGMENTS) {
+		count = elf_is64(ef) ? elf_ehdr64(ef)->e_phnum : elf_ehdr(ef)->e_phnum;
+		if(!count || (elf_is64(ef) ? !elf_ehdr64(ef)->e_phoff : !elf_ehdr(ef)->e_phoff))
+			return 0;
+		if(elf_is64(ef))
+			ph64 = malloc(count * sizeof(Elf64_Phdr));
+		else
+			ph32 = malloc(count * sizeof(Elf32_Phdr));
+		r = calloc(count, sizeof(region_t));
+		if(!r || !(elf_is64(ef)
+				? ph64 && read_program_header_table64(elf_fd(ef), *elf_ehdr64(ef), ph64)
+				: ph32 && read_program_header_table(elf_fd(ef), *elf_ehdr(ef), ph32)))
+			count = 0;
+		for(i=0; i<count; i++) {
+			if(elf_is64(ef)) {
+				if(ph64[i].p_type != PT_LOAD)
+					continue;
+				r[n].offset = ph64[i].p_offset;
+				r[n].size = ph64[i].p_filesz;
+				r[n].addr = ph64[i].p_vaddr;
+			} else {
+				if(ph32[i].p_type != PT_LOAD)
+					continue;
+				r[n].offset = ph32[i].p_offset;
+				r[n].size = ph32[i].p_filesz;
+				r[n].addr = ph32[i].p_vaddr;
+			}
+			if(!r[n].size || r[n].offset > size || r[n].size > size - r[n].offset)
+				continue;
+			snprintf(r[n].name, sizeof(r[n].name), "LOAD[%u]", i);
+			r[n].label = r[n].name;
+			r[n].shndx = SHN_UNDEF;
+			n++;
+		}
+		free(ph64);
+		free(ph32);
+	} else {
+		count = elf_section_count(ef);
+		r = calloc(count ? count : 1, sizeof(region_t));
+		for(i=1; r && i<count; i++) {
+			if(elf_is64(ef)) {
+				if(elf_shdrs64(ef)[i].sh_type == SHT_NOBITS)
+					continue;
+				r[n].offset = elf_shdrs64(ef)[i].sh_offset;
+				r[n].size = elf_shdrs64(ef)[i].sh_size;
+				r[n].addr = elf_shdrs64(ef)[i].sh_addr;
+			} else {
+				if(elf_shdrs(ef)[i].sh_type == SHT_NOBITS)
+					continue;
+				r[n].offset = elf_shdrs(ef)[i].sh_offset;
+				r[n].size = elf_shdrs(ef)[i].sh_size;
+				r[n].addr = elf_shdrs(ef)[i].sh_addr;
+			}
+			if(!r[n].size || r[n].offset > size || r[n].size > size - r[n].offset)
+				continue;
+			r[n].label = elf_section_name(ef, i);
+			if(!r[n].label)
+				r[n].label = "?";
+			r[n].shndx = i;
+			n++;
+		}
+	}
+	*out = r;
+	return n;
+}
+
+/* .symtab if there is one, the dynamic symbols otherwise */
+static bool load_symbols(elf_file_t *ef, symview_t *view)
+{
+	uint32_t i, type, found = 0, count = elf_section_count(ef);
+
+	for(i=1; i<count; i++) {
+		type = elf_is64(ef) ? elf_shdrs64(ef)[i].sh_type : elf_shdrs(ef)[i].sh_type;
+		if(type == SHT_SYMTAB) {
+			found = i;
+			break;
+		}
+		if(type == SHT_DYNSYM && !found)
+			found = i;
+	}
+	if(!found)
+		return false;
+	if(elf_is64(ef))
+		return symbol_view64(elf_fd(ef), *elf_ehdr64(ef), elf_shdrs64(ef), found, view);
+	return symbol_view(elf_fd(ef), *elf_ehdr(ef), elf_shdrs(ef), found, view);
+}
+
+bool search_file(elf_file_t *ef, uint32_t flags)
+{
+	elf_view_t file;
+	region_t *regions = NULL;
+	symview_t view;
+	hits_t h;
+	uint32_t i, n;
+	bool have_view = false;
+
+	if(!npatterns)
+		return true;
+	if(npatterns > 1 && !ac_built && !ac_build())
+		return false;
+	if(elf_file_view(ef, &file) != ELF_OK)
+		return false;
+
+	memset(&h, 0, sizeof(h));
+	memset(&view, 0, sizeof(view));
+	n = get_regions(ef, flags, &regions);
+	for(i=0; i<n && !h.failed; i++) {
+		h.count = 0;
+		if(npatterns == 1) {
+			search_one(&patterns[0], file.data + regions[i].offset, regions[i].size, &h);
+		} else {
+			search_set(file.data + regions[i].offset, regions[i].size, &h);
+		}
+		stats_add(STAT_SECTIONS, 1);
+		if(!h.count)
+			continue;
+
+		/* Symbols only once there is something to name */
+		if(!have_view) {
+			have_view = true;
+			if(!load_symbols(ef, &view))
+				memset(&view, 0, sizeof(view));
+		}
+		print_hits(&regions[i], &h, view.count ? &view : NULL);
+	}
+	if(h.failed)
+		printf("search: out of memory\n");
+
+	symbol_view_free(&view);
+	free(h.hits);
+	free(regions);
+	elf_view_release(&file);
+	return !h.failed;
+}
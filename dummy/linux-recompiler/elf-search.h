@@ -0,0 +1,35 @@
+#ifndef _ELF_SEARCH_H
+#define _ELF_SEARCH_H
+
+#include "elf-parser.h"
+#include "elf-file.h"
+
+/* Byte signature search (-x).
+ *
+ * A pattern is hex bytes, spaces optional: "??" matches any byte, a '?'
+ * in place of one digit matches any nibble ("4?"), and a mask may follow
+ * a byte after a slash ("88/f8" matches 0x88 to 0x8f).  Every pattern
+ * needs at least one whole byte.
+ *
+ * Each pattern is anchored on its longest run of whole bytes.  A lone
+ * pattern is found with an SSE2 filter on the first and last byte of
+ * that run, 16 positions per compare; a set goes through one
+ * Aho-Corasick automaton built from the runs of all of them.  Either
+ * way every candidate is checked against the full masked pattern, and
+ * overlapping hits are all reported.
+ *
+ * Sections with contents are searched, or the PT_LOAD segments with
+ * SEARCH_SEGMENTS.  A hit is printed with its section or segment, file
+ * offset, virtual address, the symbol containing it and the pattern.
+ * Like the symbol filter the pattern set is process wide.
+ */
+
+#define SEARCH_SEGMENTS	0x01
+
+bool search_add(const char *text);
+uint32_t search_count(void);
+
+/* False if the file could not be mapped */
+bool search_file(elf_file_t *ef, uint32_t flags);
+
+#endif /* _ELF_SEARCH_H */
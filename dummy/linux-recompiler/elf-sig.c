@@ -0,0 +1,999 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elf-sig.h"
+#include "elf-stats.h"
+#include "elf-swap.h"
+
+#define MAX_THREADS	64
+#define MATCH_BATCH	64	/* functions a worker claims at once */
+#define SIG_SHOW	4	/* names printed per function */
+#define NONE		UINT32_MAX
+
+#define ARMAG		"!<arch>\n"
+#define SARMAG		8
+#define AR_HDR_SIZE	60
+
+typedef struct sig {
+	uint64_t hash;
+	uint64_t bytes;		/* value[size], then mask[size], in db.bytes */
+	uint32_t size;
+	uint32_t names;		/* first of the chain in db.names */
+	uint32_t node;		/* trie node it hangs off */
+} sig_t;
+
+typedef struct sig_name {
+	uint64_t text;		/* into db.text */
+	uint32_t next;
+	bool global;
+} sig_name_t;
+
+typedef struct edge {
+	uint64_t key;		/* node << 8 | byte, plus one, so 0 is empty */
+	uint32_t child;
+} edge_t;
+
+typedef struct node {
+	uint32_t first;		/* into db.order */
+	uint32_t count;
+} node_t;
+
+typedef struct sig_db {
+	uint16_t machine;
+	uint8_t class;		/* of the first object, 0 before it */
+	sig_t *sigs;
+	uint64_t nsigs, sigs_size;
+	sig_name_t *names;
+	uint64_t nnames, names_size;
+	uint8_t *bytes;
+	uint64_t nbytes, bytes_size;
+	char *text;
+	uint64_t ntext, text_size;
+	uint32_t *index;	/* signatures by hash, open addressing */
+	uint64_t index_size;
+	edge_t *edges;		/* open addressing */
+	uint64_t nedges, edges_size;
+	node_t *nodes;
+	uint64_t nnodes, nodes_size;
+	uint32_t *order;	/* signatures by node, then size */
+	uint64_t functions;	/* function symbols seen */
+	uint64_t skipped;	/* objects for another machine */
+} sig_db_t;
+
+/* A PT_LOAD segment of the file being matched */
+typedef struct load {
+	uint64_t vaddr;
+	uint64_t offset;
+	uint64_t filesz;
+} load_t;
+
+typedef struct match {
+	uint32_t sig;		/* first that matched, NONE if none did */
+	uint32_t count;
+} match_t;
+
+typedef struct target {
+	const uint8_t *data;
+	load_t *loads;
+	uint32_t nloads;
+	const func_range_t *ranges;
+	match_t *matches;
+	uint32_t count;
+	uint32_t next;		/* first function not claimed yet */
+} target_t;
+
+static const char **refs;
+static uint32_t nrefs;
+static sig_db_t db;
+
+bool sig_add_reference(const char *path)
+{
+	const char **r = realloc(refs, (nrefs + 1) * sizeof(char *));
+
+	if(!r)
+		return false;
+	refs = r;
+	refs[nrefs++] = path;
+	return true;
+}
+
+uint32_t sig_reference_count(void)
+{
+	return nrefs;
+}
+
+static bool grow(void **p, uint64_t *size, uint64_t need, size_t elem)
+{
+	uint64_t n = *size ? *size : 1024;
+	void *q;
+
+	if(need <= *size)
+		return true;
+	while(n < need)
+		n *= 2;
+	q = realloc(*p, n * elem);
+	if(!q)
+		return false;
+	*p = q;
+	*size = n;
+	return true;
+}
+
+static uint64_t hash_bytes(const uint8_t *p, uint64_t n)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;	/* FNV-1a */
+
+	while(n--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static inline uint64_t hash_key(uint64_t key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> 17;
+}
+
+/* Bytes of the field a relocation fills in, and how many bytes before
+ * it the linker may rewrite as well when it relaxes the instruction
+ */
+static uint32_t reloc_span(uint16_t machine, uint32_t type, uint32_t *before)
+{
+	*before = 0;
+	if(!type)
+		return 0;	/* R_*_NONE */
+
+	if(machine == EM_X86_64) {
+		switch(type)
+		{
+			case ELF_R_X86_64_64:
+			case ELF_R_X86_64_DTPOFF64:
+			case ELF_R_X86_64_TPOFF64:
+			case ELF_R_X86_64_PC64:
+			case ELF_R_X86_64_GOTOFF64:
+			case ELF_R_X86_64_GOT64:
+			case ELF_R_X86_64_GOTPCREL64:
+			case ELF_R_X86_64_GOTPC64:
+			case ELF_R_X86_64_GOTPLT64:
+			case ELF_R_X86_64_PLTOFF64:
+			case ELF_R_X86_64_SIZE64:
+				return 8;
+			case ELF_R_X86_64_16:
+			case ELF_R_X86_64_PC16:
+				return 2;
+			case ELF_R_X86_64_8:
+			case ELF_R_X86_64_PC8:
+				return 1;
+			case ELF_R_X86_64_GOTPCRELX:	/* mov/call/jmp, opcode and modrm */
+				*before = 2;
+				return 4;
+			case ELF_R_X86_64_REX_GOTPCRELX:
+			case ELF_R_X86_64_GOTTPOFF:	/* IE to LE, the REX prefix too */
+				*before = 3;
+				return 4;
+			case ELF_R_X86_64_TLSGD:	/* the whole 16 byte GD sequence */
+				*before = 4;
+				return 12;
+			case ELF_R_X86_64_TLSLD:	/* lea and the call after it */
+				*before = 3;
+				return 9;
+		}
+	} else if(machine == EM_386) {
+		switch(type)
+		{
+			case ELF_R_386_16:
+			case ELF_R_386_PC16:
+				return 2;
+			case ELF_R_386_8:
+			case ELF_R_386_PC8:
+				return 1;
+			case ELF_R_386_GOT32X:
+			case ELF_R_386_TLS_IE:
+			case ELF_R_386_TLS_GOTIE:
+				*before = 2;
+				return 4;
+			case ELF_R_386_TLS_GD:
+				*before = 3;
+				return 9;
+			case ELF_R_386_TLS_LDM:
+				*before = 2;
+				return 8;
+		}
+	} else if(machine == ELF_EM_AARCH64) {
+		switch(type)
+		{
+			case ELF_R_AARCH64_ABS64:
+			case ELF_R_AARCH64_PREL64:
+				return 8;
+			case ELF_R_AARCH64_ABS16:
+			case ELF_R_AARCH64_PREL16:
+				return 2;
+		}
+	}
+	/* Data words and, on fixed width ISAs, whole instructions */
+	return 4;
+}
+
+static void mask_field(uint8_t *mask, uint64_t size, uint64_t offset,
+		uint32_t width, uint32_t before)
+{
+	uint64_t from, to;
+
+	if(offset >= size || !width)
+		return;
+	from = offset > before ? offset - before : 0;
+	to = width > size - offset ? size : offset + width;
+	memset(mask + from, 0, to - from);
+}
+
+static void mask_relocs64(const uint8_t *data, const Elf64_Shdr *rsh, bool swapped,
+		uint16_t machine, uint8_t *mask, uint64_t size)
+{
+	size_t entsize = rsh->sh_type == SHT_RELA ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+	Elf64_Rela r;
+	uint32_t width, before;
+	uint64_t off;
+
+	for(off=0; off + entsize <= rsh->sh_size; off += entsize) {
+		/* r_offset and r_info lead both layouts */
+		memcpy(&r, data + off, entsize);
+		if(swapped)
+			swap_rel_table64((Elf64_Rel *)&r, 1);
+		width = reloc_span(machine, ELF64_R_TYPE(r.r_info), &before);
+		mask_field(mask, size, r.r_offset, width, before);
+	}
+}
+
+static void mask_relocs(const uint8_t *data, const Elf32_Shdr *rsh, bool swapped,
+		uint16_t machine, uint8_t *mask, uint64_t size)
+{
+	size_t entsize = rsh->sh_type == SHT_RELA ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+	Elf32_Rela r;
+	uint32_t width, before;
+	uint64_t off;
+
+	for(off=0; off + entsize <= rsh->sh_size; off += entsize) {
+		memcpy(&r, data + off, entsize);
+		if(swapped)
+			swap_rel_table((Elf32_Rel *)&r, 1);
+		width = reloc_span(machine, ELF32_R_TYPE(r.r_info), &before);
+		mask_field(mask, size, r.r_offset, width, before);
+	}
+}
+
+static bool add_name(sig_t *s, const char *name, bool global)
+{
+	uint32_t i, last = NONE;
+	size_t len = strlen(name) + 1;
+	sig_name_t *n;
+
+	for(i=s->names; i!=NONE; i=db.names[i].next) {
+		if(!strcmp(db.text + db.names[i].text, name)) {
+			db.names[i].global |= global;
+			return true;
+		}
+		last = i;
+	}
+	if(db.nnames >= NONE
+			|| !grow((void **)&db.names, &db.names_size, db.nnames + 1, sizeof(sig_name_t))
+			|| !grow((void **)&db.text, &db.text_size, db.ntext + len, 1))
+		return false;
+
+	memcpy(db.text + db.ntext, name, len);
+	n = &db.names[db.nnames];
+	n->text = db.ntext;
+	n->next = NONE;
+	n->global = global;
+	if(last == NONE)
+		s->names = db.nnames;
+	else
+		db.names[last].next = db.nnames;
+	db.nnames++;
+	db.ntext += len;
+	return true;
+}
+
+static bool index_grow(void)
+{
+	uint64_t i, j, size = db.index_size ? db.index_size * 2 : 4096;
+	uint32_t *index = malloc(size * sizeof(uint32_t));
+
+	if(!index)
+		return false;
+	memset(index, 0xff, size * sizeof(uint32_t));
+	for(i=0; i<db.nsigs; i++) {
+		for(j=db.sigs[i].hash & (size - 1); index[j] != NONE; j=(j + 1) & (size - 1))
+			;
+		index[j] = i;
+	}
+	free(db.index);
+	db.index = index;
+	db.index_size = size;
+	return true;
+}
+
+/* False only when out of memory */
+static bool add_sig(const uint8_t *code, const uint8_t *mask, uint64_t size,
+		const char *name, bool global)
+{
+	uint64_t i, j, h, fixed = 0;
+	uint8_t *v;
+	sig_t *s;
+
+	db.functions++;
+	for(i=0; i<size; i++)
+		fixed += mask[i] != 0;
+	if(fixed < SIG_MIN_FIXED || size >= NONE)
+		return true;
+
+	if(!grow((void **)&db.bytes, &db.bytes_size, db.nbytes + 2 * size, 1))
+		return false;
+	v = db.bytes + db.nbytes;
+	for(i=0; i<size; i++)
+		v[i] = code[i] & mask[i];
+	memcpy(v + size, mask, size);
+	h = hash_bytes(v, 2 * size) ^ size;
+
+	if(db.nsigs * 2 >= db.index_size && !index_grow())
+		return false;
+	for(j=h & (db.index_size - 1); db.index[j] != NONE; j=(j + 1) & (db.index_size - 1)) {
+		s = &db.sigs[db.index[j]];
+		if(s->hash == h && s->size == size && !memcmp(db.bytes + s->bytes, v, 2 * size))
+			return add_name(s, name, global);	/* an alias or a copy */
+	}
+
+	if(db.nsigs >= NONE
+			|| !grow((void **)&db.sigs, &db.sigs_size, db.nsigs + 1, sizeof(sig_t)))
+		return false;
+	s = &db.sigs[db.nsigs];
+	s->hash = h;
+	s->bytes = db.nbytes;
+	s->size = size;
+	s->names = NONE;
+	s->node = 0;
+	db.index[j] = db.nsigs++;
+	db.nbytes += 2 * size;
+	return add_name(s, name, global);
+}
+
+static bool same_machine(uint16_t machine, uint8_t class)
+{
+	if(!db.class) {
+		db.class = class;
+		db.machine = machine;
+	}
+	if(db.class == class && db.machine == machine)
+		return true;
+	db.skipped++;
+	return false;
+}
+
+static elf_status_t add_object64(const uint8_t *base, uint64_t size)
+{
+	Elf64_Ehdr eh;
+	Elf64_Shdr *sh;
+	Elf64_Sym sym;
+	uint8_t **masks;
+	const char *strtab;
+	uint64_t i, j, count, strsize;
+	uint32_t idx, link, type;
+	elf_status_t status = ELF_OK;
+	bool swapped;
+
+	if(size < sizeof(eh))
+		return ELF_ERR_FORMAT;
+	memcpy(&eh, base, sizeof(eh));
+	swapped = elf_swapped(eh.e_ident);
+	if(swapped)
+		swap_ehdr64(&eh);
+	if(eh.e_type != ET_REL || !eh.e_shnum || eh.e_shentsize != sizeof(Elf64_Shdr)
+			|| eh.e_shoff > size
+			|| (size - eh.e_shoff) / sizeof(Elf64_Shdr) < eh.e_shnum)
+		return ELF_ERR_FORMAT;
+	if(!same_machine(eh.e_machine, ELFCLASS64))
+		return ELF_OK;
+
+	sh = malloc(eh.e_shnum * sizeof(Elf64_Shdr));
+	masks = calloc(eh.e_shnum, sizeof(uint8_t *));
+	if(!sh || !masks) {
+		status = ELF_ERR_NOMEM;
+		goto out;
+	}
+	memcpy(sh, base + eh.e_shoff, eh.e_shnum * sizeof(Elf64_Shdr));
+	if(swapped)
+		swap_shdr_table64(sh, eh.e_shnum);
+	for(i=1; i<eh.e_shnum; i++) {
+		if(sh[i].sh_type != SHT_NOBITS
+				&& (sh[i].sh_offset > size || sh[i].sh_size > size - sh[i].sh_offset)) {
+			status = ELF_ERR_FORMAT;
+			goto out;
+		}
+	}
+
+	/* What the linker will rewrite in the code */
+	for(i=1; i<eh.e_shnum; i++) {
+		if(sh[i].sh_type != SHT_PROGBITS || !(sh[i].sh_flags & SHF_EXECINSTR)
+				|| !sh[i].sh_size)
+			continue;
+		masks[i] = malloc(sh[i].sh_size);
+		if(!masks[i]) {
+			status = ELF_ERR_NOMEM;
+			goto out;
+		}
+		memset(masks[i], 0xff, sh[i].sh_size);
+	}
+	for(i=1; i<eh.e_shnum; i++) {
+		idx = sh[i].sh_info;
+		if((sh[i].sh_type != SHT_REL && sh[i].sh_type != SHT_RELA)
+				|| idx >= eh.e_shnum || !masks[idx])
+			continue;
+		mask_relocs64(base + sh[i].sh_offset, &sh[i], swapped, eh.e_machine,
+				masks[idx], sh[idx].sh_size);
+	}
+
+	for(i=1; i<eh.e_shnum; i++) {
+		link = sh[i].sh_link;
+		if(sh[i].sh_type != SHT_SYMTAB || !link || link >= eh.e_shnum
+				|| sh[link].sh_type != SHT_STRTAB)
+			continue;
+		strtab = (const char *)base + sh[link].sh_offset;
+		strsize = sh[link].sh_size;
+		count = sh[i].sh_size / sizeof(Elf64_Sym);
+		for(j=1; j<count; j++) {
+			memcpy(&sym, base + sh[i].sh_offset + j * sizeof(Elf64_Sym), sizeof(sym));
+			if(swapped)
+				swap_sym_table64(&sym, 1);
+			type = ELF64_ST_TYPE(sym.st_info);
+			idx = sym.st_shndx;
+			if((type != STT_FUNC && type != STT_GNU_IFUNC) || !sym.st_size
+					|| idx >= eh.e_shnum || !masks[idx]
+					|| sym.st_value > sh[idx].sh_size
+					|| sym.st_size > sh[idx].sh_size - sym.st_value
+					|| sym.st_name >= strsize
+					|| !memchr(strtab + sym.st_name, 0, strsize - sym.st_name))
+				continue;
+			if(!add_sig(base + sh[idx].sh_offset + sym.st_value, masks[idx] + sym.st_value,
+					sym.st_size, strtab + sym.st_name,
+					ELF64_ST_BIND(sym.st_info) != STB_LOCAL)) {
+				status = ELF_ERR_NOMEM;
+				goto out;
+			}
+		}
+	}
+
+out:
+	for(i=0; masks && i<eh.e_shnum; i++)
+		free(masks[i]);
+	free(masks);
+	free(sh);
+	return status;
+}
+
+static elf_status_t add_object(const uint8_t *base, uint64_t size)
+{
+	Elf32_Ehdr eh;
+	Elf32_Shdr *sh;
+	Elf32_Sym sym;
+	uint8_t **masks;
+	const char *strtab;
+	uint64_t i, j, count, strsize;
+	uint32_t idx, link, type;
+	elf_status_t status = ELF_OK;
+	bool swapped;
+
+	if(size < sizeof(eh))
+		return ELF_ERR_FORMAT;
+	memcpy(&eh, base, sizeof(eh));
+	swapped = elf_swapped(eh.e_ident);
+	if(swapped)
+		swap_ehdr(&eh);
+	if(eh.e_type != ET_REL || !eh.e_shnum || eh.e_shentsize != sizeof(Elf32_Shdr)
+			|| eh.e_shoff > size
+			|| (size - eh.e_shoff) / sizeof(Elf32_Shdr) < eh.e_shnum)
+		return ELF_ERR_FORMAT;
+	if(!same_machine(eh.e_machine, ELFCLASS32))
+		return ELF_OK;
+
+	sh = malloc(eh.e_shnum * sizeof(Elf32_Shdr));
+	masks = calloc(eh.e_shnum, sizeof(uint8_t *));
+	if(!sh || !masks) {
+		status = ELF_ERR_NOMEM;
+		goto out;
+	}
+	memcpy(sh, base + eh.e_shoff, eh.e_shnum * sizeof(Elf32_Shdr));
+	if(swapped)
+		swap_shdr_table(sh, eh.e_shnum);
+	for(i=1; i<eh.e_shnum; i++) {
+		if(sh[i].sh_type != SHT_NOBITS
+				&& (sh[i].sh_offset > size || sh[i].sh_size > size - sh[i].sh_offset)) {
+			status = ELF_ERR_FORMAT;
+			goto out;
+		}
+	}
+
+	/* What the linker will rewrite in the code */
+	for(i=1; i<eh.e_shnum; i++) {
+		if(sh[i].sh_type != SHT_PROGBITS || !(sh[i].sh_flags & SHF_EXECINSTR)
+				|| !sh[i].sh_size)
+			continue;
+		masks[i] = malloc(sh[i].sh_size);
+		if(!masks[i]) {
+			status = ELF_ERR_NOMEM;
+			goto out;
+		}
+		memset(masks[i], 0xff, sh[i].sh_size);
+	}
+	for(i=1; i<eh.e_shnum; i++) {
+		idx = sh[i].sh_info;
+		if((sh[i].sh_type != SHT_REL && sh[i].sh_type != SHT_RELA)
+				|| idx >= eh.e_shnum || !masks[idx])
+			continue;
+		mask_relocs(base + sh[i].sh_offset, &sh[i], swapped, eh.e_machine,
+				masks[idx], sh[idx].sh_size);
+	}
+
+	for(i=1; i<eh.e_shnum; i++) {
+		link = sh[i].sh_link;
+		if(sh[i].sh_type != SHT_SYMTAB || !link || link >= eh.e_shnum
+				|| sh[link].sh_type != SHT_STRTAB)
+			continue;
+		strtab = (const char *)base + sh[link].sh_offset;
+		strsize = sh[link].sh_size;
+		count = sh[i].sh_size / sizeof(Elf32_Sym);
+		for(j=1; j<count; j++) {
+			memcpy(&sym, base + sh[i].sh_offset + j * sizeof(Elf32_Sym), sizeof(sym));
+			if(swapped)
+				swap_sym_table(&sym, 1);
+			type = ELF32_ST_TYPE(sym.st_info);
+			idx = sym.st_shndx;
+			if((type != STT_FUNC && type != STT_GNU_IFUNC) || !sym.st_size
+					|| idx >= eh.e_shnum || !masks[idx]
+					|| sym.st_value > sh[idx].sh_size
+					|| sym.st_size > sh[idx].sh_size - sym.st_value
+					|| sym.st_name >= strsize
+					|| !memchr(strtab + sym.st_name, 0, strsize - sym.st_name))
+				continue;
+			if(!add_sig(base + sh[idx].sh_offset + sym.st_value, masks[idx] + sym.st_value,
+					sym.st_size, strtab + sym.st_name,
+					ELF32_ST_BIND(sym.st_info) != STB_LOCAL)) {
+				status = ELF_ERR_NOMEM;
+				goto out;
+			}
+		}
+	}
+
+out:
+	for(i=0; masks && i<eh.e_shnum; i++)
+		free(masks[i]);
+	free(masks);
+	free(sh);
+	return status;
+}
+
+static elf_status_t add_member(const uint8_t *base, uint64_t size)
+{
+	if(size < EI_NIDENT || memcmp(base, "\177ELF", 4))
+		return ELF_ERR_FORMAT;
+	if(base[EI_CLASS] == ELFCLASS64)
+		return add_object64(base, size);
+	if(base[EI_CLASS] == ELFCLASS32)
+		return add_object(base, size);
+	return ELF_ERR_FORMAT;
+}
+
+/* Members that are not relocatable objects, the symbol index and the
+ * long name table among them, are skipped
+ */
+static elf_status_t add_archive(const uint8_t *base, uint64_t size)
+{
+	char field[16];
+	const uint8_t *hdr;
+	uint64_t off = SARMAG, data, member, name;
+
+	while(off + AR_HDR_SIZE <= size) {
+		hdr = base + off;
+		if(memcmp(hdr + 58, "`\n", 2))
+			return ELF_ERR_FORMAT;
+		memcpy(field, hdr + 48, 10);
+		field[10] = '\0';
+		member = strtoull(field, NULL, 10);
+		data = off + AR_HDR_SIZE;
+		if(member > size - data)
+			return ELF_ERR_FORMAT;
+		off = data + member + (member & 1);
+
+		/* BSD long names lead the member data */
+		if(!memcmp(hdr, "#1/", 3)) {
+			memcpy(field, hdr + 3, 13);
+			field[13] = '\0';
+			name = strtoull(field, NULL, 10);
+			if(name > member)
+				return ELF_ERR_FORMAT;
+			data += name;
+			member -= name;
+		}
+		if(add_member(base + data, member) == ELF_ERR_NOMEM)
+			return ELF_ERR_NOMEM;
+	}
+	return ELF_OK;
+}
+
+static elf_status_t add_reference(const char *path)
+{
+	struct stat st;
+	elf_status_t status;
+	void *map;
+	int32_t fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return ELF_ERR_OPEN;
+	if(fstat(fd, &st) < 0) {
+		close(fd);
+		return ELF_ERR_OPEN;
+	}
+	if(!S_ISREG(st.st_mode) || st.st_size < SARMAG) {
+		close(fd);
+		return ELF_ERR_FORMAT;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED)
+		return ELF_ERR_NOMEM;
+	stats_add(STAT_SYSCALLS, 1);
+
+	if(!memcmp(map, ARMAG, SARMAG))
+		status = add_archive(map, st.st_size);
+	else
+		status = add_member(map, st.st_size);
+	munmap(map, st.st_size);
+	return status;
+}
+
+static uint32_t trie_child(uint32_t node, uint8_t byte)
+{
+	uint64_t key = ((uint64_t)node << 8 | byte) + 1, mask = db.edges_size - 1, i;
+
+	for(i=hash_key(key) & mask; db.edges[i].key; i=(i + 1) & mask) {
+		if(db.edges[i].key == key)
+			return db.edges[i].child;
+	}
+	return NONE;
+}
+
+static bool edges_grow(void)
+{
+	uint64_t i, j, size = db.edges_size ? db.edges_size * 2 : 4096;
+	edge_t *edges = calloc(size, sizeof(edge_t));
+
+	if(!edges)
+		return false;
+	for(i=0; i<db.edges_size; i++) {
+		if(!db.edges[i].key)
+			continue;
+		for(j=hash_key(db.edges[i].key) & (size - 1); edges[j].key; j=(j + 1) & (size - 1))
+			;
+		edges[j] = db.edges[i];
+	}
+	free(db.edges);
+	db.edges = edges;
+	db.edges_size = size;
+	return true;
+}
+
+static uint32_t trie_add(uint32_t node, uint8_t byte)
+{
+	uint64_t key = ((uint64_t)node << 8 | byte) + 1, i;
+	uint32_t child = trie_child(node, byte);
+
+	if(child != NONE)
+		return child;
+	if(db.nnodes >= NONE
+			|| (db.nedges * 2 >= db.edges_size && !edges_grow())
+			|| !grow((void **)&db.nodes, &db.nodes_size, db.nnodes + 1, sizeof(node_t)))
+		return NONE;
+
+	for(i=hash_key(key) & (db.edges_size - 1); db.edges[i].key; i=(i + 1) & (db.edges_size - 1))
+		;
+	db.edges[i].key = key;
+	db.edges[i].child = db.nnodes;
+	db.nedges++;
+	return db.nnodes++;
+}
+
+static int order_cmp(const void *a, const void *b)
+{
+	const sig_t *x = &db.sigs[*(const uint32_t *)a], *y = &db.sigs[*(const uint32_t *)b];
+
+	if(x->node != y->node)
+		return x->node < y->node ? -1 : 1;
+	if(x->size != y->size)
+		return x->size < y->size ? -1 : 1;
+	return 0;
+}
+
+/* Each signature goes as deep as its leading fixed bytes allow */
+static bool trie_build(void)
+{
+	const uint8_t *v, *m;
+	uint32_t i, j, node;
+
+	if(!edges_grow() || !grow((void **)&db.nodes, &db.nodes_size, 1, sizeof(node_t)))
+		return false;
+	db.nnodes = 1;
+	for(i=0; i<db.nsigs; i++) {
+		v = db.bytes + db.sigs[i].bytes;
+		m = v + db.sigs[i].size;
+		node = 0;
+		for(j=0; j<db.sigs[i].size && j<SIG_PREFIX && m[j]; j++) {
+			node = trie_add(node, v[j]);
+			if(node == NONE)
+				return false;
+		}
+		db.sigs[i].node = node;
+	}
+
+	db.order = malloc((db.nsigs ? db.nsigs : 1) * sizeof(uint32_t));
+	if(!db.order)
+		return false;
+	for(i=0; i<db.nsigs; i++)
+		db.order[i] = i;
+	qsort(db.order, db.nsigs, sizeof(uint32_t), order_cmp);
+
+	memset(db.nodes, 0, db.nnodes * sizeof(node_t));
+	for(i=0; i<db.nsigs; i++) {
+		node = db.sigs[db.order[i]].node;
+		if(!db.nodes[node].count)
+			db.nodes[node].first = i;
+		db.nodes[node].count++;
+	}
+	return true;
+}
+
+bool sig_build(void)
+{
+	elf_status_t status;
+	uint32_t i;
+
+	for(i=0; i<nrefs; i++) {
+		status = add_reference(refs[i]);
+		if(status == ELF_ERR_NOMEM) {
+			fprintf(stderr, "%s: %s\n", refs[i], elf_strerror(status));
+			return false;
+		}
+		if(status == ELF_ERR_OPEN)
+			fprintf(stderr, "%s: %s\n", refs[i], strerror(errno));
+		else if(status != ELF_OK)
+			fprintf(stderr, "%s: not a relocatable object or archive\n", refs[i]);
+	}
+	if(db.skipped)
+		fprintf(stderr, "%lu objects for another machine skipped\n", db.skipped);
+	if(!db.nsigs) {
+		fprintf(stderr, "No function signatures in the references\n");
+		return false;
+	}
+
+	/* Only the trie is needed from here on */
+	free(db.index);
+	db.index = NULL;
+	if(!trie_build()) {
+		fprintf(stderr, "Signatures: %s\n", elf_strerror(ELF_ERR_NOMEM));
+		return false;
+	}
+	return true;
+}
+
+static inline bool verify(const sig_t *s, const uint8_t *code)
+{
+	const uint8_t *value = db.bytes + s->bytes, *mask = value + s->size;
+	uint32_t i;
+
+	for(i=0; i<s->size; i++) {
+		if((code[i] & mask[i]) != value[i])
+			return false;
+	}
+	return true;
+}
+
+/* The signatures of a node are sorted by size, only one size can match */
+static void match_node(uint32_t node, const uint8_t *code, uint32_t size, match_t *m)
+{
+	const node_t *n = &db.nodes[node];
+	uint32_t lo = n->first, hi = n->first + n->count, mid, end = hi;
+
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(db.sigs[db.order[mid]].size < size)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for(; lo<end && db.sigs[db.order[lo]].size == size; lo++) {
+		if(verify(&db.sigs[db.order[lo]], code) && !m->count++)
+			m->sig = db.order[lo];
+	}
+}
+
+static void match_function(const uint8_t *code, uint64_t size, match_t *m)
+{
+	uint32_t i, node = 0;
+
+	m->sig = NONE;
+	m->count = 0;
+	if(!code || !size || size >= NONE)
+		return;
+	match_node(node, code, size, m);
+	for(i=0; i<size && i<SIG_PREFIX; i++) {
+		node = trie_child(node, code[i]);
+		if(node == NONE)
+			break;
+		match_node(node, code, size, m);
+	}
+}
+
+static const uint8_t * function_bytes(const target_t *t, const func_range_t *r)
+{
+	const load_t *l;
+	uint32_t i;
+
+	if(r->end <= r->start)
+		return NULL;
+	for(i=0; i<t->nloads; i++) {
+		l = &t->loads[i];
+		if(r->start >= l->vaddr && r->start - l->vaddr < l->filesz
+				&& r->end - r->start <= l->filesz - (r->start - l->vaddr))
+			return t->data + l->offset + (r->start - l->vaddr);
+	}
+	return NULL;
+}
+
+static void * match_worker(void *arg)
+{
+	target_t *t = arg;
+	uint32_t first, end, i;
+
+	for(;;) {
+		first = __atomic_fetch_add(&t->next, MATCH_BATCH, __ATOMIC_RELAXED);
+		if(first >= t->count)
+			break;
+		end = t->count - first < MATCH_BATCH ? t->count : first + MATCH_BATCH;
+		for(i=first; i<end; i++)
+			match_function(function_bytes(t, &t->ranges[i]),
+					t->ranges[i].end - t->ranges[i].start, &t->matches[i]);
+	}
+	return NULL;
+}
+
+static uint32_t get_loads(elf_file_t *ef, load_t **out)
+{
+	load_t *l;
+	Elf64_Phdr *ph64 = NULL;
+	Elf32_Phdr *ph32 = NULL;
+	uint64_t size = elf_file_size(ef);
+	uint32_t i, n = 0, count;
+
+	*out = NULL;
+	count = elf_is64(ef) ? elf_ehdr64(ef)->e_phnum : elf_ehdr(ef)->e_phnum;
+	if(!count || (elf_is64(ef) ? !elf_ehdr64(ef)->e_phoff : !elf_ehdr(ef)->e_phoff))
+		return 0;
+	if(elf_is64(ef))
+		ph64 = malloc(count * sizeof(Elf64_Phdr));
+	else
+		ph32 = malloc(count * sizeof(Elf32_Phdr));
+	l = calloc(count, sizeof(load_t));
+	if(!l || !(elf_is64(ef)
+			? ph64 && read_program_header_table64(elf_fd(ef), *elf_ehdr64(ef), ph64)
+			: ph32 && read_program_header_table(elf_fd(ef), *elf_ehdr(ef), ph32)))
+		count = 0;
+	for(i=0; i<count; i++) {
+		if(elf_is64(ef)) {
+			if(ph64[i].p_type != PT_LOAD || !(ph64[i].p_flags & PF_X))
+				continue;
+			l[n].vaddr = ph64[i].p_vaddr;
+			l[n].offset = ph64[i].p_offset;
+			l[n].filesz = ph64[i].p_filesz;
+		} else {
+			if(ph32[i].p_type != PT_LOAD || !(ph32[i].p_flags & PF_X))
+				continue;
+			l[n].vaddr = ph32[i].p_vaddr;
+			l[n].offset = ph32[i].p_offset;
+			l[n].filesz = ph32[i].p_filesz;
+		}
+		if(l[n].offset > size || l[n].filesz > size - l[n].offset)
+			continue;
+		n++;
+	}
+	free(ph64);
+	free(ph32);
+	*out = l;
+	return n;
+}
+
+/* Globals first, at most SIG_SHOW of them in all */
+static void print_names(const sig_t *s)
+{
+	uint32_t i, shown = 0, pass;
+
+	for(pass=0; pass<2; pass++) {
+		for(i=s->names; i!=NONE; i=db.names[i].next) {
+			if(db.names[i].global != !pass)
+				continue;
+			if(shown == SIG_SHOW) {
+				printf(",...");
+				return;
+			}
+			printf("%s%s", shown ? "," : "", db.text + db.names[i].text);
+			shown++;
+		}
+	}
+}
+
+bool sig_match(elf_file_t *ef, const func_range_t *ranges, uint32_t count)
+{
+	pthread_t threads[MAX_THREADS];
+	elf_view_t file;
+	target_t t;
+	uint32_t i, nthreads, found = 0, ambiguous = 0;
+	uint16_t machine = elf_is64(ef) ? elf_ehdr64(ef)->e_machine : elf_ehdr(ef)->e_machine;
+	long n;
+
+	if(!db.nsigs)
+		return true;
+	if(machine != db.machine || (elf_is64(ef) ? ELFCLASS64 : ELFCLASS32) != db.class) {
+		printf("Signatures are for machine %u, this file is for %u\n", db.machine, machine);
+		return true;
+	}
+	if(elf_file_view(ef, &file) != ELF_OK)
+		return false;
+
+	memset(&t, 0, sizeof(t));
+	t.data = file.data;
+	t.ranges = ranges;
+	t.count = count;
+	t.nloads = get_loads(ef, &t.loads);
+	t.matches = malloc((count ? count : 1) * sizeof(match_t));
+	if(!t.matches) {
+		printf("signatures: out of memory\n");
+		free(t.loads);
+		elf_view_release(&file);
+		return true;
+	}
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+	if(nthreads > (count + MATCH_BATCH - 1) / MATCH_BATCH)
+		nthreads = (count + MATCH_BATCH - 1) / MATCH_BATCH;
+	for(i=1; i<nthreads; i++) {
+		/* Without the thread the others claim its share */
+		if(pthread_create(&threads[i], NULL, match_worker, &t))
+			threads[i] = 0;
+	}
+	match_worker(&t);
+	for(i=1; i<nthreads; i++) {
+		if(threads[i])
+			pthread_join(threads[i], NULL);
+	}
+
+	for(i=0; i<count; i++) {
+		if(!t.matches[i].count)
+			continue;
+		found++;
+		printf("0x%08lx\t%lu\t", ranges[i].start, ranges[i].end - ranges[i].start);
+		print_names(&db.sigs[t.matches[i].sig]);
+		if(t.matches[i].count > 1) {
+			printf("\t(%u signatures)", t.matches[i].count);
+			ambiguous++;
+		}
+		printf("\n");
+	}
+	printf("%u of %u functions identified, %u ambiguous, %lu signatures\n",
+			found, count, ambiguous, db.nsigs);
+	stats_add(STAT_SYMBOLS, found);
+
+	free(t.matches);
+	free(t.loads);
+	elf_view_release(&file);
+	return true;
+}
@@ -0,0 +1,45 @@
+#ifndef _ELF_SIG_H
+#define _ELF_SIG_H
+
+#include "elf-parser.h"
+#include "elf-file.h"
+#include "eh-frame.h"
+
+/* Library function identification (-g).
+ *
+ * References are relocatable objects or ar archives of them, libc.a for
+ * instance.  Every sized function symbol in an executable section of a
+ * reference becomes a signature: its bytes, with the bytes the linker
+ * will rewrite masked out.  Those are found from the relocations that
+ * apply to the section, widened where the linker may also relax the
+ * instruction around the field (GOTPCRELX, the TLS sequences).
+ * Functions that are byte for byte the same after masking share one
+ * signature carrying all their names, and signatures with fewer than
+ * SIG_MIN_FIXED fixed bytes are dropped, they would match everywhere.
+ *
+ * The signatures hang off a trie over their leading fixed bytes, whose
+ * edges live in one hash table, and each trie node keeps its
+ * signatures sorted by size.  A function of the file, as recovered from
+ * .eh_frame, walks the trie along its own bytes; at every node only the
+ * signatures of exactly its size are compared in full.  Functions are
+ * matched on all CPUs.
+ *
+ * Like the search patterns the reference set is process wide and built
+ * once, before the first file.
+ */
+
+#define SIG_MIN_FIXED	12	/* bytes */
+#define SIG_PREFIX	32	/* trie depth */
+
+bool sig_add_reference(const char *path);
+uint32_t sig_reference_count(void);
+
+/* Loads every reference; false if none gave a signature */
+bool sig_build(void);
+
+/* Prints the identified functions out of count; false if the file could
+ * not be mapped
+ */
+bool sig_match(elf_file_t *ef, const func_range_t *ranges, uint32_t count);
+
+#endif /* _ELF_SIG_H */
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE	/* fopencookie */
+#include <time.h>
+
+#include "elf-stats.h"
+
+bool stats_enabled;
+stat_phase_t stats_phase;
+uint64_t stats[PHASE_MAX][STAT_MAX];
+
+static uint64_t phase_start;
+
+static const char * const phase_names[PHASE_MAX] = {
+	"other", "header", "build_id", "shdrs", "sections",
+	"symbols", "text", "line", "functions", "diff", "hash", "scan",
+	"search", "signatures", "rewrite", "xrefs",
+};
+
+static const char * const counter_names[STAT_MAX] = {
+	"ns", "io_ns", "write_ns", "bytes_read", "syscalls",
+	"allocs", "alloc_bytes", "sections", "symbols", "output_bytes",
+};
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* stdout is replaced by a stream that counts what printf produced and
+ * how long the writes took; formatting time is what is left of a phase
+ * after io_ns and write_ns.
+ */
+static ssize_t count_write(void *cookie, const char *buf, size_t size)
+{
+	uint64_t start = stats_clock();
+	size_t done = 0;
+	ssize_t len;
+
+	(void)cookie;
+	while(done < size) {
+		len = write(1, buf + done, size - done);
+		stats_add(STAT_SYSCALLS, 1);
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			break;
+		done += len;
+	}
+
+	stats_add(STAT_OUTPUT_BYTES, done);
+	stats_elapsed(STAT_WRITE_NS, start);
+	return done ? (ssize_t)done : -1;
+}
+
+void stats_enable(void)
+{
+	static cookie_io_functions_t funcs = { NULL, count_write, NULL, NULL };
+	FILE *out;
+
+	if(stats_enabled)
+		return;
+
+	fflush(stdout);
+	out = fopencookie(NULL, "w", funcs);
+	if(out) {
+		setvbuf(out, NULL, _IOFBF, 1 << 16);
+		stdout = out;
+	}
+	stats_enabled = true;
+}
+
+void stats_begin(stat_phase_t phase)
+{
+	if(!stats_enabled)
+		return;
+
+	fflush(stdout);
+	stats_phase = phase;
+	phase_start = stats_now();
+}
+
+void stats_end(void)
+{
+	if(!stats_enabled)
+		return;
+
+	/* Output still buffered belongs to this phase */
+	fflush(stdout);
+	stats_add(STAT_NS, stats_now() - phase_start);
+	stats_phase = PHASE_OTHER;
+}
+
+void stats_reset(void)
+{
+	memset(stats, 0, sizeof(stats));
+	stats_phase = PHASE_OTHER;
+}
+
+static void print_json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			fprintf(out, "\\%c", *s);
+		else if((unsigned char)*s < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void print_json_counters(FILE *out, const uint64_t counters[])
+{
+	uint32_t i;
+
+	fputc('{', out);
+	for(i=0; i<STAT_MAX; i++)
+		fprintf(out, "%s\"%s\":%lu", i ? "," : "", counter_names[i], counters[i]);
+	fputc('}', out);
+}
+
+/* One line per file, phases that saw no activity are left out */
+void stats_print_json(FILE *out, const char *file)
+{
+	uint64_t total[STAT_MAX];
+	uint32_t i, j;
+	bool first = true;
+
+	fflush(stdout);
+	memset(total, 0, sizeof(total));
+
+	fputs("{\"file\":", out);
+	print_json_string(out, file);
+	fputs(",\"phases\":{", out);
+	for(i=0; i<PHASE_MAX; i++) {
+		bool used = false;
+		for(j=0; j<STAT_MAX; j++) {
+			total[j] += stats[i][j];
+			used |= stats[i][j] != 0;
+		}
+		if(!used)
+			continue;
+
+		fprintf(out, "%s\"%s\":", first ? "" : ",", phase_names[i]);
+		print_json_counters(out, stats[i]);
+		first = false;
+	}
+	fputs("},\"total\":", out);
+	print_json_counters(out, total);
+	fputs("}\n", out);
+	fflush(out);
+}
@@ -0,0 +1,87 @@
+#ifndef _ELF_STATS_H
+#define _ELF_STATS_H
+
+#include "elf-parser.h"
+
+/* Per-phase counters and timers.
+ *
+ * Always compiled in: while disabled every hook is a single predictable
+ * branch on stats_enabled and no clock is read.  Once enabled, the
+ * caller brackets each top-level phase with stats_begin()/stats_end()
+ * and everything counted in between (preads, mmaps, buffer allocations,
+ * sections and symbols handled, bytes written to stdout) is charged to
+ * that phase.  Counters are updated atomically, so worker threads may
+ * count into the current phase too.
+ */
+
+typedef enum stat_phase {
+	PHASE_OTHER,
+	PHASE_HEADER,
+	PHASE_BUILD_ID,
+	PHASE_SHDRS,
+	PHASE_SECTIONS,
+	PHASE_SYMBOLS,
+	PHASE_TEXT,
+	PHASE_LINE,
+	PHASE_FUNCTIONS,
+	PHASE_DIFF,
+	PHASE_HASH,
+	PHASE_SCAN,
+	PHASE_SEARCH,
+	PHASE_SIGS,
+	PHASE_REWRITE,
+	PHASE_XREF,
+	PHASE_MAX
+} stat_phase_t;
+
+typedef enum stat_counter {
+	STAT_NS,		/* wall time of the phase */
+	STAT_IO_NS,		/* part of it spent in pread */
+	STAT_WRITE_NS,		/* part of it spent writing stdout */
+	STAT_BYTES_READ,
+	STAT_SYSCALLS,		/* pread, mmap, write */
+	STAT_ALLOCS,		/* table and section buffers */
+	STAT_ALLOC_BYTES,
+	STAT_SECTIONS,
+	STAT_SYMBOLS,
+	STAT_OUTPUT_BYTES,
+	STAT_MAX
+} stat_counter_t;
+
+extern bool stats_enabled;
+extern stat_phase_t stats_phase;
+extern uint64_t stats[PHASE_MAX][STAT_MAX];
+
+uint64_t stats_now(void);
+
+static inline void stats_add(stat_counter_t counter, uint64_t n)
+{
+	if(stats_enabled)
+		__atomic_fetch_add(&stats[stats_phase][counter], n, __ATOMIC_RELAXED);
+}
+
+/* Start/stop pair for timing a span inside the current phase */
+static inline uint64_t stats_clock(void)
+{
+	return stats_enabled ? stats_now() : 0;
+}
+
+static inline void stats_elapsed(stat_counter_t counter, uint64_t start)
+{
+	if(stats_enabled)
+		stats_add(counter, stats_now() - start);
+}
+
+static inline void stats_alloc(uint64_t size)
+{
+	stats_add(STAT_ALLOCS, 1);
+	stats_add(STAT_ALLOC_BYTES, size);
+}
+
+void stats_enable(void);
+void stats_begin(stat_phase_t phase);
+void stats_end(void);
+void stats_reset(void);
+void stats_print_json(FILE *out, const char *file);
+
+#endif /* _ELF_STATS_H */
@@ -0,0 +1,17 @@
+#ifndef _ELF_STATUS_H
+#define _ELF_STATUS_H
+
+/* Status codes shared by the reader API and the printing paths */
+typedef enum elf_status {
+	ELF_OK = 0,
+	ELF_ERR_OPEN = -1,	/* open(2)/fstat(2) failed, see errno */
+	ELF_ERR_IO = -2,	/* short or failed read */
+	ELF_ERR_NOMEM = -3,
+	ELF_ERR_FORMAT = -4,	/* not ELF, or a table runs past EOF */
+	ELF_ERR_RANGE = -5,	/* section index out of range */
+	ELF_ERR_NOTFOUND = -6,
+	ELF_ERR_OFFSET = -7,	/* file offset past the end of the contents */
+	ELF_ERR_MOVED = -8,	/* edits move bytes, cannot save in place */
+} elf_status_t;
+
+#endif /* _ELF_STATUS_H */
@@ -0,0 +1,197 @@
+#include "elf-swap.h"
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+/* An ELF table entry is described by the width of each of its fields.
+ * Fields are naturally aligned and every entry size is a multiple of
+ * its widest field, so no field ever straddles a 16-byte boundary once
+ * entries are laid out back to back.  That lets a run of entries be
+ * converted 16 bytes at a time with one pshufb per lane, using masks
+ * that repeat every lcm(entry size, 16) bytes.
+ */
+typedef struct swap_layout {
+	const uint8_t *widths;
+	uint32_t nfields;
+	uint32_t size;
+} swap_layout_t;
+
+#define SWAP_LAYOUT(name, type, ...) \
+	static const uint8_t name##_widths[] = { __VA_ARGS__ }; \
+	static const swap_layout_t name = { name##_widths, sizeof(name##_widths), sizeof(type) }
+
+#define IDENT	1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1
+
+SWAP_LAYOUT(ehdr64_layout, Elf64_Ehdr, IDENT, 2,2,4,8,8,8,4,2,2,2,2,2,2);
+SWAP_LAYOUT(shdr64_layout, Elf64_Shdr, 4,4,8,8,8,8,4,4,8,8);
+SWAP_LAYOUT(phdr64_layout, Elf64_Phdr, 4,4,8,8,8,8,8,8);
+SWAP_LAYOUT(sym64_layout, Elf64_Sym, 4,1,1,2,8,8);
+SWAP_LAYOUT(rel64_layout, Elf64_Rel, 8,8);
+SWAP_LAYOUT(rela64_layout, Elf64_Rela, 8,8,8);
+SWAP_LAYOUT(ehdr32_layout, Elf32_Ehdr, IDENT, 2,2,4,4,4,4,4,2,2,2,2,2,2);
+SWAP_LAYOUT(shdr32_layout, Elf32_Shdr, 4,4,4,4,4,4,4,4,4,4);
+SWAP_LAYOUT(phdr32_layout, Elf32_Phdr, 4,4,4,4,4,4,4,4);
+SWAP_LAYOUT(sym32_layout, Elf32_Sym, 4,4,4,1,1,2);
+SWAP_LAYOUT(rel32_layout, Elf32_Rel, 4,4);
+SWAP_LAYOUT(rela32_layout, Elf32_Rela, 4,4,4);
+SWAP_LAYOUT(word_layout, uint32_t, 4);
+
+/* Largest repeat period: Elf32_Ehdr, lcm(52, 16) */
+#define SWAP_PERIOD_MAX	208
+
+static void swap_entry(uint8_t *p, const swap_layout_t *l)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+	uint32_t i;
+
+	for(i=0; i<l->nfields; i++) {
+		switch(l->widths[i])
+		{
+			case 2:
+				memcpy(&v16, p, 2);
+				v16 = __builtin_bswap16(v16);
+				memcpy(p, &v16, 2);
+				break;
+			case 4:
+				memcpy(&v32, p, 4);
+				v32 = __builtin_bswap32(v32);
+				memcpy(p, &v32, 4);
+				break;
+			case 8:
+				memcpy(&v64, p, 8);
+				v64 = __builtin_bswap64(v64);
+				memcpy(p, &v64, 8);
+				break;
+		}
+		p += l->widths[i];
+	}
+}
+
+#ifdef __SSSE3__
+static size_t swap_period(size_t size)
+{
+	size_t a = size, b = 16, t;
+
+	while(b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return size / a * 16;
+}
+
+/* Converts whole periods with pshufb, returns the number of entries done */
+static size_t swap_table_simd(uint8_t *p, size_t count, const swap_layout_t *l)
+{
+	uint8_t mask[SWAP_PERIOD_MAX];
+	__m128i lanes[SWAP_PERIOD_MAX / 16];
+	size_t period, per, n, off, i, j, k;
+	uint32_t f;
+
+	period = swap_period(l->size);
+	per = period / l->size;
+	if(period > SWAP_PERIOD_MAX || count < per)
+		return 0;
+
+	/* Each output byte picks its source within the same 16-byte lane */
+	for(i=0, off=0; i<per; i++) {
+		for(f=0; f<l->nfields; f++) {
+			for(k=0; k<l->widths[f]; k++)
+				mask[off + k] = (uint8_t)((off % 16) + l->widths[f] - 1 - k);
+			off += l->widths[f];
+		}
+	}
+	for(j=0; j<period / 16; j++)
+		lanes[j] = _mm_loadu_si128((const __m128i *)(mask + j * 16));
+
+	n = count / per;
+	for(i=0; i<n; i++, p += period) {
+		for(j=0; j<period / 16; j++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + j * 16));
+			_mm_storeu_si128((__m128i *)(p + j * 16), _mm_shuffle_epi8(v, lanes[j]));
+		}
+	}
+
+	return n * per;
+}
+#endif
+
+static void swap_table(void *base, size_t count, const swap_layout_t *l)
+{
+	uint8_t *p = base;
+	size_t i = 0;
+
+#ifdef __SSSE3__
+	i = swap_table_simd(p, count, l);
+#endif
+	for(; i<count; i++)
+		swap_entry(p + i * l->size, l);
+}
+
+void swap_ehdr64(Elf64_Ehdr *eh)
+{
+	swap_table(eh, 1, &ehdr64_layout);
+}
+
+void swap_shdr_table64(Elf64_Shdr *sh_table, size_t count)
+{
+	swap_table(sh_table, count, &shdr64_layout);
+}
+
+void swap_phdr_table64(Elf64_Phdr *ph_table, size_t count)
+{
+	swap_table(ph_table, count, &phdr64_layout);
+}
+
+void swap_sym_table64(Elf64_Sym *sym_table, size_t count)
+{
+	swap_table(sym_table, count, &sym64_layout);
+}
+
+void swap_rel_table64(Elf64_Rel *rel_table, size_t count)
+{
+	swap_table(rel_table, count, &rel64_layout);
+}
+
+void swap_rela_table64(Elf64_Rela *rela_table, size_t count)
+{
+	swap_table(rela_table, count, &rela64_layout);
+}
+
+void swap_ehdr(Elf32_Ehdr *eh)
+{
+	swap_table(eh, 1, &ehdr32_layout);
+}
+
+void swap_shdr_table(Elf32_Shdr *sh_table, size_t count)
+{
+	swap_table(sh_table, count, &shdr32_layout);
+}
+
+void swap_phdr_table(Elf32_Phdr *ph_table, size_t count)
+{
+	swap_table(ph_table, count, &phdr32_layout);
+}
+
+void swap_sym_table(Elf32_Sym *sym_table, size_t count)
+{
+	swap_table(sym_table, count, &sym32_layout);
+}
+
+void swap_rel_table(Elf32_Rel *rel_table, size_t count)
+{
+	swap_table(rel_table, count, &rel32_layout);
+}
+
+void swap_rela_table(Elf32_Rela *rela_table, size_t count)
+{
+	swap_table(rela_table, count, &rela32_layout);
+}
+
+void swap_words(uint32_t *words, size_t count)
+{
+	swap_table(words, count, &word_layout);
+}
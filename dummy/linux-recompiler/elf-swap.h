@@ -0,0 +1,45 @@
+#ifndef _ELF_SWAP_H
+#define _ELF_SWAP_H
+
+#include "elf-parser.h"
+
+/* Byte order conversion for foreign-endian ELF files.
+ *
+ * Tables are converted in place right after they are read, so the rest
+ * of the parser only ever sees host order.  Files already in host order
+ * (the common case) are left untouched: callers test elf_swapped() and
+ * skip the conversion entirely, no copy is made.
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ELFDATA_HOST	ELFDATA2MSB
+#else
+#define ELFDATA_HOST	ELFDATA2LSB
+#endif
+
+static inline bool elf_swapped(const unsigned char e_ident[])
+{
+	return e_ident[EI_DATA] != ELFDATA_HOST
+		&& (e_ident[EI_DATA] == ELFDATA2LSB || e_ident[EI_DATA] == ELFDATA2MSB);
+}
+
+static inline uint32_t swap32_if(bool swap, uint32_t v)
+{
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+void swap_ehdr64(Elf64_Ehdr *eh);
+void swap_shdr_table64(Elf64_Shdr *sh_table, size_t count);
+void swap_phdr_table64(Elf64_Phdr *ph_table, size_t count);
+void swap_sym_table64(Elf64_Sym *sym_table, size_t count);
+void swap_rel_table64(Elf64_Rel *rel_table, size_t count);
+void swap_rela_table64(Elf64_Rela *rela_table, size_t count);
+void swap_ehdr(Elf32_Ehdr *eh);
+void swap_shdr_table(Elf32_Shdr *sh_table, size_t count);
+void swap_phdr_table(Elf32_Phdr *ph_table, size_t count);
+void swap_sym_table(Elf32_Sym *sym_table, size_t count);
+void swap_rel_table(Elf32_Rel *rel_table, size_t count);
+void swap_rela_table(Elf32_Rela *rela_table, size_t count);
+void swap_words(uint32_t *words, size_t count);
+
+#endif /* _ELF_SWAP_H */
@@ -0,0 +1,628 @@
+#include "elf-symview.h"
+#include "elf-swap.h"
+#include "elf-stats.h"
+#include "elf-arena.h"
+#include "elf-filter.h"
+#include "elf-pipeline.h"
+#include "elf-cache.h"
+
+#define KEY_DIGITS	8	/* bytes of the address */
+#define SEC_DIGITS	4	/* bytes of the section index */
+#define PACKED_BITS	11	/* digit of the packed sort */
+#define PACKED_DIGITS	((64 + PACKED_BITS - 1) / PACKED_BITS)
+
+typedef struct sort_key {
+	uint64_t key;
+	uint32_t sec;
+	uint32_t idx;		/* into the unsorted entries */
+} sort_key_t;
+
+/* LSD radix sort on (address, section index), stable, so equal keys
+ * keep symbol table order.  The section index is the major key when
+ * sec_major is set and the minor one otherwise.  All histograms are
+ * counted in one pass; a digit that is the same for every key would
+ * leave the order as it is and its pass is skipped.
+ */
+static sort_key_t * radix_sort(sort_key_t *keys, sort_key_t *tmp, uint32_t n, bool sec_major)
+{
+	uint32_t counts[KEY_DIGITS + SEC_DIGITS][256];
+	uint32_t i, p, d, sum, c, digit;
+	sort_key_t *src = keys, *dst = tmp, *t;
+
+	/* Digits 0..KEY_DIGITS-1 are the address, the rest the section */
+	memset(counts, 0, sizeof(counts));
+	for(i=0; i<n; i++) {
+		for(d=0; d<KEY_DIGITS; d++)
+			counts[d][(keys[i].key >> (d * 8)) & 0xff]++;
+		for(d=0; d<SEC_DIGITS; d++)
+			counts[KEY_DIGITS + d][(keys[i].sec >> (d * 8)) & 0xff]++;
+	}
+
+	for(p=0; p<KEY_DIGITS + SEC_DIGITS; p++) {
+		/* Minor key first */
+		if(sec_major)
+			d = p;
+		else
+			d = p < SEC_DIGITS ? KEY_DIGITS + p : p - SEC_DIGITS;
+
+		if(d < KEY_DIGITS)
+			digit = (keys[0].key >> (d * 8)) & 0xff;
+		else
+			digit = (keys[0].sec >> ((d - KEY_DIGITS) * 8)) & 0xff;
+		if(counts[d][digit] == n)
+			continue;
+
+		for(sum=0, i=0; i<256; i++) {
+			c = counts[d][i];
+			counts[d][i] = sum;
+			sum += c;
+		}
+		if(d < KEY_DIGITS) {
+			for(i=0; i<n; i++)
+				dst[counts[d][(src[i].key >> (d * 8)) & 0xff]++] = src[i];
+		} else {
+			for(i=0; i<n; i++)
+				dst[counts[d][(src[i].sec >> ((d - KEY_DIGITS) * 8)) & 0xff]++] = src[i];
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	return src;
+}
+
+static inline uint32_t bit_width(uint64_t v)
+{
+	return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+/* The common case: address less the lowest one, section index and
+ * symbol position all fit one 64-bit word, position lowest so that
+ * each word carries its symbol.  Sorting the words with wider digits
+ * moves half the bytes of radix_sort() in fewer passes, and a table
+ * that is already in order costs one scan.  Returns false if the key
+ * does not fit.
+ */
+static bool packed_sort(const symview_entry_t *raw, uint32_t n, bool sec_major,
+		uint32_t *order)
+{
+	uint32_t counts[PACKED_DIGITS][1 << PACKED_BITS];
+	uint64_t vmin = UINT64_MAX, vmax = 0, smax = 0, key, *words, *tmp, *src, *dst, *t;
+	uint32_t vbits, sbits, ibits, bits, i, d, sum, c, shift, mask = (1 << PACKED_BITS) - 1;
+	bool sorted = true;
+
+	for(i=0; i<n; i++) {
+		if(raw[i].value < vmin)
+			vmin = raw[i].value;
+		if(raw[i].value > vmax)
+			vmax = raw[i].value;
+		if(raw[i].shndx > smax)
+			smax = raw[i].shndx;
+	}
+	vbits = bit_width(vmax - vmin);
+	sbits = bit_width(smax);
+	ibits = bit_width(n - 1);
+	bits = vbits + sbits + ibits;
+	if(bits > 64)
+		return false;
+
+	words = malloc(n * sizeof(uint64_t));
+	tmp = malloc(n * sizeof(uint64_t));
+	if(!words || !tmp) {
+		free(words);
+		free(tmp);
+		return false;
+	}
+
+	memset(counts, 0, sizeof(counts));
+	for(i=0; i<n; i++) {
+		if(sec_major)
+			key = ((uint64_t)raw[i].shndx << vbits | (raw[i].value - vmin)) << ibits | i;
+		else
+			key = ((raw[i].value - vmin) << sbits | raw[i].shndx) << ibits | i;
+		words[i] = key;
+		if(i && key < words[i - 1])
+			sorted = false;
+		for(d=0; ibits + d * PACKED_BITS < bits; d++)
+			counts[d][(key >> (ibits + d * PACKED_BITS)) & mask]++;
+	}
+
+	/* The position bits are in order already and a stable pass keeps
+	 * them so, only the key above them is sorted
+	 */
+	src = words;
+	dst = tmp;
+	for(d=0; !sorted && ibits + d * PACKED_BITS < bits; d++) {
+		shift = ibits + d * PACKED_BITS;
+		if(counts[d][(words[0] >> shift) & mask] == n)
+			continue;
+		for(sum=0, i=0; i<=mask; i++) {
+			c = counts[d][i];
+			counts[d][i] = sum;
+			sum += c;
+		}
+		for(i=0; i<n; i++)
+			dst[counts[d][(src[i] >> shift) & mask]++] = src[i];
+		t = src;
+		src = dst;
+		dst = t;
+	}
+
+	for(i=0; i<n; i++)
+		order[i] = ibits ? src[i] & ((1ULL << ibits) - 1) : 0;
+	free(words);
+	free(tmp);
+	return true;
+}
+
+/* raw holds the kept symbols in table order; sec_base and sec_size
+ * give the address range of every section
+ */
+static bool view_build(symview_t *view, const symview_entry_t *raw, uint32_t n,
+		const uint64_t *sec_base, const uint64_t *sec_size, bool by_section)
+{
+	sort_key_t *keys = NULL, *tmp = NULL, *sorted;
+	symview_entry_t *e;
+	uint64_t size, end, limit;
+	uint32_t *order, i, g, k, next;
+
+	view->by_section = by_section;
+	if(!n)
+		return true;
+
+	view->entries = section_alloc(n * sizeof(symview_entry_t));
+	stats_alloc(n * sizeof(symview_entry_t));
+	order = malloc(n * sizeof(uint32_t));
+	if(!view->entries || !order)
+		goto FAIL;
+
+	if(!packed_sort(raw, n, by_section, order)) {
+		keys = malloc(n * sizeof(sort_key_t));
+		tmp = malloc(n * sizeof(sort_key_t));
+		if(!keys || !tmp)
+			goto FAIL;
+		for(i=0; i<n; i++) {
+			keys[i].key = raw[i].value;
+			keys[i].sec = raw[i].shndx;
+			keys[i].idx = i;
+		}
+		sorted = radix_sort(keys, tmp, n, by_section);
+		for(i=0; i<n; i++)
+			order[i] = sorted[i].idx;
+		free(keys);
+		free(tmp);
+	}
+	for(i=0; i<n; i++)
+		view->entries[i] = raw[order[i]];
+	free(order);
+	view->count = n;
+
+	/* Groups of aliases, then one size per group */
+	e = view->entries;
+	for(g=0; g<n; g=next) {
+		size = 0;
+		for(next=g; next<n && e[next].value == e[g].value
+				&& e[next].shndx == e[g].shndx; next++) {
+			e[next].group = g;
+			if(e[next].size > size)
+				size = e[next].size;
+		}
+		view->groups++;
+
+		if(!size) {
+			end = sec_base[e[g].shndx] + sec_size[e[g].shndx];
+			if(e[g].value < sec_base[e[g].shndx] || e[g].value >= end)
+				continue;
+			/* Next higher address: in the same section for
+			 * relocatable files, in any section otherwise
+			 */
+			for(k=next; k<n && !by_section && e[k].value == e[g].value; k++)
+				;
+			limit = end;
+			if(k < n && (!by_section || e[k].shndx == e[g].shndx)
+					&& e[k].value < limit)
+				limit = e[k].value;
+			size = limit - e[g].value;
+			if(!size)
+				continue;
+		}
+		for(i=g; i<next; i++) {
+			if(!e[i].size) {
+				e[i].size = size;
+				e[i].flags |= SYMVIEW_INFERRED;
+			}
+		}
+	}
+	return true;
+
+FAIL:
+	free(keys);
+	free(tmp);
+	free(order);
+	section_free(view->entries);
+	view->entries = NULL;
+	return false;
+}
+
+void symbol_view_free(symview_t *view)
+{
+	section_free(view->entries);
+	section_free(view->str_tbl);
+	memset(view, 0, sizeof(*view));
+}
+
+/* Unfiltered views are cached as built, entries in address order; the
+ * string table behind them comes through the section cache
+ */
+static bool view_load(symview_t *view, uint32_t symbol_table, uint32_t shnum)
+{
+	char kind[32];
+	symview_entry_t *e;
+	size_t size;
+	uint32_t i, n;
+
+	if(!cache_active() || filter_current())
+		return false;
+	snprintf(kind, sizeof(kind), "symview-%u", symbol_table);
+	e = cache_load(kind, &size);
+	if(!e)
+		return false;
+
+	n = size / sizeof(symview_entry_t);
+	if(size % sizeof(symview_entry_t) || size / sizeof(symview_entry_t) != n)
+		n = 0;
+	for(i=0; i<n && e[i].group <= i && e[i].shndx < shnum; i++)
+		;
+	if(!n || i < n) {
+		free(e);
+		return false;
+	}
+
+	view->entries = section_alloc(size);
+	stats_alloc(size);
+	if(view->entries)
+		memcpy(view->entries, e, size);
+	free(e);
+	if(!view->entries)
+		return false;
+	view->count = n;
+	for(i=0; i<n; i++) {
+		if(view->entries[i].group == i)
+			view->groups++;
+	}
+	return true;
+}
+
+static void view_store(const symview_t *view, uint32_t symbol_table)
+{
+	char kind[32];
+
+	if(!cache_active() || filter_current() || !view->count)
+		return;
+	snprintf(kind, sizeof(kind), "symview-%u", symbol_table);
+	cache_store(kind, view->entries, view->count * sizeof(symview_entry_t));
+}
+
+static inline bool view_keeps(uint32_t st_shndx, uint8_t info)
+{
+	if(st_shndx == SHN_UNDEF
+			|| (st_shndx >= SHN_LORESERVE && st_shndx != SHN_XINDEX))
+		return false;
+	switch(ELF32_ST_TYPE(info)) {
+		case STT_SECTION:
+		case STT_FILE:
+		case STT_TLS:	/* offsets in the TLS block, not addresses */
+			return false;
+	}
+	return true;
+}
+
+static inline const char * view_name(const symview_t *view, uint32_t name)
+{
+	return name < view->str_size ? view->str_tbl + name : "";
+}
+
+const char * symbol_view_name(const symview_t *view, const symview_entry_t *e)
+{
+	return view_name(view, e->name);
+}
+
+const symview_entry_t * symbol_view_find(const symview_t *view, uint32_t shndx, uint64_t addr)
+{
+	const symview_entry_t *e = view->entries, *g;
+	uint32_t lo = 0, hi = view->count, mid;
+
+	/* First entry past addr */
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(view->by_section ? e[mid].shndx < shndx
+					|| (e[mid].shndx == shndx && e[mid].value <= addr)
+				: e[mid].value <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* The closest address below; groups at that address in other
+	 * sections are passed over
+	 */
+	for(; lo > 0; lo = g - e) {
+		g = &e[e[lo - 1].group];
+		if(view->by_section && g->shndx != shndx)
+			return NULL;
+		if(shndx == SHN_UNDEF || g->shndx == shndx)
+			return addr - g->value < g->size ? g : NULL;
+		if(g == e || g[-1].value != g->value)
+			return NULL;
+	}
+	return NULL;
+}
+
+bool symbol_view64(int32_t fd,
+		Elf64_Ehdr eh,
+		Elf64_Shdr sh_table[],
+		uint32_t symbol_table,
+		symview_t *view)
+{
+	Elf64_Sym* sym_tbl;
+	Elf32_Word* shndx_tbl = NULL;	/* SHT_SYMTAB_SHNDX, if any */
+	const sym_filter_t *filter;
+	symview_entry_t *raw = NULL;
+	uint64_t *sec_base = NULL, *sec_size;
+	uint32_t i, n = 0, shnum, shndx, shndx_count = 0, symbol_count;
+	bool ok = false;
+
+	memset(view, 0, sizeof(*view));
+	shnum = section_count64(eh, sh_table);
+	if(sh_table[symbol_table].sh_link < shnum) {
+		view->str_tbl = read_section64(fd, sh_table[sh_table[symbol_table].sh_link]);
+		if(view->str_tbl)
+			view->str_size = sh_table[sh_table[symbol_table].sh_link].sh_size;
+	}
+	view->by_section = eh.e_type == ET_REL;
+	if(view_load(view, symbol_table, shnum))
+		return true;
+
+	sym_tbl = (Elf64_Sym*)read_section64(fd, sh_table[symbol_table]);
+	if(!sym_tbl) {
+		symbol_view_free(view);
+		return false;
+	}
+
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_SYMTAB_SHNDX
+				&& sh_table[i].sh_link == symbol_table) {
+			shndx_tbl = (Elf32_Word*)read_section64(fd, sh_table[i]);
+			shndx_count = sh_table[i].sh_size / sizeof(Elf32_Word);
+			break;
+		}
+	}
+
+	symbol_count = (sh_table[symbol_table].sh_size/sizeof(Elf64_Sym));
+	stats_add(STAT_SYMBOLS, symbol_count);
+	if(elf_swapped(eh.e_ident)) {
+		swap_sym_table64(sym_tbl, symbol_count);
+		if(shndx_tbl)
+			swap_words(shndx_tbl, shndx_count);
+	}
+
+	raw = malloc(symbol_count * sizeof(symview_entry_t));
+	sec_base = malloc(shnum * 2 * sizeof(uint64_t));
+	if(!raw || !sec_base)
+		goto EXIT;
+	sec_size = sec_base + shnum;
+	for(i=0; i<shnum; i++) {
+		sec_base[i] = eh.e_type == ET_REL ? 0 : sh_table[i].sh_addr;
+		sec_size[i] = sh_table[i].sh_size;
+	}
+
+	filter = filter_current();
+	for(i=0; i<symbol_count; i++) {
+		if(!view_keeps(sym_tbl[i].st_shndx, sym_tbl[i].st_info))
+			continue;
+		shndx = sym_tbl[i].st_shndx;
+		if(shndx == SHN_XINDEX)
+			shndx = shndx_tbl && i < shndx_count ? shndx_tbl[i] : SHN_UNDEF;
+		if(shndx == SHN_UNDEF || shndx >= shnum)
+			continue;
+		if(filter && !filter_symbol(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+					shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+					view_name(view, sym_tbl[i].st_name)))
+			continue;
+
+		raw[n].value = sym_tbl[i].st_value;
+		raw[n].size = sym_tbl[i].st_size;
+		raw[n].index = i;
+		raw[n].name = sym_tbl[i].st_name;
+		raw[n].shndx = shndx;
+		raw[n].info = sym_tbl[i].st_info;
+		raw[n].flags = 0;
+		n++;
+	}
+	ok = view_build(view, raw, n, sec_base, sec_size, eh.e_type == ET_REL);
+	if(ok)
+		view_store(view, symbol_table);
+
+EXIT:
+	free(sec_base);
+	free(raw);
+	section_free(shndx_tbl);
+	section_free(sym_tbl);
+	if(!ok)
+		symbol_view_free(view);
+	return ok;
+}
+
+bool symbol_view(int32_t fd,
+		Elf32_Ehdr eh,
+		Elf32_Shdr sh_table[],
+		uint32_t symbol_table,
+		symview_t *view)
+{
+	Elf32_Sym* sym_tbl;
+	Elf32_Word* shndx_tbl = NULL;	/* SHT_SYMTAB_SHNDX, if any */
+	const sym_filter_t *filter;
+	symview_entry_t *raw = NULL;
+	uint64_t *sec_base = NULL, *sec_size;
+	uint32_t i, n = 0, shnum, shndx, shndx_count = 0, symbol_count;
+	bool ok = false;
+
+	memset(view, 0, sizeof(*view));
+	shnum = section_count(eh, sh_table);
+	if(sh_table[symbol_table].sh_link < shnum) {
+		view->str_tbl = read_section(fd, sh_table[sh_table[symbol_table].sh_link]);
+		if(view->str_tbl)
+			view->str_size = sh_table[sh_table[symbol_table].sh_link].sh_size;
+	}
+	view->by_section = eh.e_type == ET_REL;
+	if(view_load(view, symbol_table, shnum))
+		return true;
+
+	sym_tbl = (Elf32_Sym*)read_section(fd, sh_table[symbol_table]);
+	if(!sym_tbl) {
+		symbol_view_free(view);
+		return false;
+	}
+
+	for(i=0; i<shnum; i++) {
+		if(sh_table[i].sh_type == SHT_SYMTAB_SHNDX
+				&& sh_table[i].sh_link == symbol_table) {
+			shndx_tbl = (Elf32_Word*)read_section(fd, sh_table[i]);
+			shndx_count = sh_table[i].sh_size / sizeof(Elf32_Word);
+			break;
+		}
+	}
+
+	symbol_count = (sh_table[symbol_table].sh_size/sizeof(Elf32_Sym));
+	stats_add(STAT_SYMBOLS, symbol_count);
+	if(elf_swapped(eh.e_ident)) {
+		swap_sym_table(sym_tbl, symbol_count);
+		if(shndx_tbl)
+			swap_words(shndx_tbl, shndx_count);
+	}
+
+	raw = malloc(symbol_count * sizeof(symview_entry_t));
+	sec_base = malloc(shnum * 2 * sizeof(uint64_t));
+	if(!raw || !sec_base)
+		goto EXIT;
+	sec_size = sec_base + shnum;
+	for(i=0; i<shnum; i++) {
+		sec_base[i] = eh.e_type == ET_REL ? 0 : sh_table[i].sh_addr;
+		sec_size[i] = sh_table[i].sh_size;
+	}
+
+	filter = filter_current();
+	for(i=0; i<symbol_count; i++) {
+		if(!view_keeps(sym_tbl[i].st_shndx, sym_tbl[i].st_info))
+			continue;
+		shndx = sym_tbl[i].st_shndx;
+		if(shndx == SHN_XINDEX)
+			shndx = shndx_tbl && i < shndx_count ? shndx_tbl[i] : SHN_UNDEF;
+		if(shndx == SHN_UNDEF || shndx >= shnum)
+			continue;
+		if(filter && !filter_symbol(filter, sym_tbl[i].st_info, sym_tbl[i].st_other,
+					shndx, sym_tbl[i].st_value, sym_tbl[i].st_size,
+					view_name(view, sym_tbl[i].st_name)))
+			continue;
+
+		raw[n].value = sym_tbl[i].st_value;
+		raw[n].size = sym_tbl[i].st_size;
+		raw[n].index = i;
+		raw[n].name = sym_tbl[i].st_name;
+		raw[n].shndx = shndx;
+		raw[n].info = sym_tbl[i].st_info;
+		raw[n].flags = 0;
+		n++;
+	}
+	ok = view_build(view, raw, n, sec_base, sec_size, eh.e_type == ET_REL);
+	if(ok)
+		view_store(view, symbol_table);
+
+EXIT:
+	free(sec_base);
+	free(raw);
+	section_free(shndx_tbl);
+	section_free(sym_tbl);
+	if(!ok)
+		symbol_view_free(view);
+	return ok;
+}
+
+/* One line per address, aliases after the first name; '*' marks an
+ * inferred size
+ */
+static void decode_view(void *ctx, uint64_t first, uint32_t count,
+		void *raw, pipeline_out_t *out)
+{
+	const symview_t *view = ctx;
+	const symview_entry_t *e;
+	uint64_t i;
+
+	for(i=first; i<first + count; i++) {
+		e = &view->entries[i];
+		if(e->group != i) {
+			pipeline_printf(out, " = %s", view_name(view, e->name));
+			continue;
+		}
+		if(i)
+			pipeline_printf(out, "\n");
+		pipeline_printf(out, "0x%08lx %8lu%c %5u %s", e->value, e->size,
+				e->flags & SYMVIEW_INFERRED ? '*' : ' ',
+				e->shndx, view_name(view, e->name));
+	}
+}
+
+static void print_view(const symview_t *view)
+{
+	pipeline_job_t job;
+
+	printf("%u symbols at %u addresses\n", view->count, view->groups);
+	memset(&job, 0, sizeof(job));
+	job.count = view->count;
+	job.fd = -1;
+	job.decode = decode_view;
+	job.ctx = (void *)view;
+	pipeline_run(&job);
+	if(view->count)
+		printf("\n");
+}
+
+void print_symbol_views64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[])
+{
+	symview_t view;
+	uint32_t i, shnum;
+
+	shnum = section_count64(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if ((sh_table[i].sh_type==SHT_SYMTAB)
+				|| (sh_table[i].sh_type==SHT_DYNSYM)) {
+			printf("\n[Section %03d]", i);
+			if(!symbol_view64(fd, eh, sh_table, i, &view)) {
+				printf("unreadable\n");
+				continue;
+			}
+			print_view(&view);
+			symbol_view_free(&view);
+		}
+	}
+}
+
+void print_symbol_views(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[])
+{
+	symview_t view;
+	uint32_t i, shnum;
+
+	shnum = section_count(eh, sh_table);
+	for(i=0; i<shnum; i++) {
+		if ((sh_table[i].sh_type==SHT_SYMTAB)
+				|| (sh_table[i].sh_type==SHT_DYNSYM)) {
+			printf("\n[Section %03d]", i);
+			if(!symbol_view(fd, eh, sh_table, i, &view)) {
+				printf("unreadable\n");
+				continue;
+			}
+			print_view(&view);
+			symbol_view_free(&view);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef _ELF_SYMVIEW_H
+#define _ELF_SYMVIEW_H
+
+#include "elf-parser.h"
+
+/* Symbol tables in address order.
+ *
+ * Only symbols that name a place in a section are kept: undefined,
+ * absolute, common, section, file and TLS symbols are dropped.  The
+ * (address, section index) keys are sorted with an LSD radix sort, one
+ * byte per pass, skipping the passes where every key has the same
+ * byte, so a table of addresses below 4 GiB in fewer than 256 sections
+ * costs at most five passes.  In relocatable files values are section
+ * offsets and the section index is the major key.
+ *
+ * Symbols at the same address form a group whose first entry, lowest
+ * symbol table index first, stands for it.  A group without any sized
+ * member gets the distance to the next address in its section, or to
+ * the end of the section, as its size; such sizes are flagged.
+ */
+
+#define SYMVIEW_INFERRED	0x01	/* size did not come from st_size */
+
+typedef struct symview_entry {
+	uint64_t value;
+	uint64_t size;
+	uint32_t index;		/* in the symbol table */
+	uint32_t name;		/* string table offset */
+	uint32_t shndx;
+	uint32_t group;		/* entry that starts the group at this address */
+	uint8_t info;
+	uint8_t flags;
+} symview_entry_t;
+
+typedef struct symview {
+	symview_entry_t *entries;
+	uint32_t count;
+	uint32_t groups;	/* distinct addresses */
+	char *str_tbl;
+	uint64_t str_size;
+	bool by_section;	/* relocatable: section major */
+} symview_t;
+
+bool symbol_view64(int32_t fd,
+		Elf64_Ehdr eh,
+		Elf64_Shdr sh_table[],
+		uint32_t symbol_table,
+		symview_t *view);
+bool symbol_view(int32_t fd,
+		Elf32_Ehdr eh,
+		Elf32_Shdr sh_table[],
+		uint32_t symbol_table,
+		symview_t *view);
+void symbol_view_free(symview_t *view);
+
+/* First entry of the group whose range holds addr, NULL if none does.
+ * In relocatable files addr is an offset into section shndx; otherwise
+ * shndx may be SHN_UNDEF for any section.
+ */
+const symview_entry_t * symbol_view_find(const symview_t *view, uint32_t shndx, uint64_t addr);
+const char * symbol_view_name(const symview_t *view, const symview_entry_t *e);
+
+void print_symbol_views64(int32_t fd, Elf64_Ehdr eh, Elf64_Shdr sh_table[]);
+void print_symbol_views(int32_t fd, Elf32_Ehdr eh, Elf32_Shdr sh_table[]);
+
+#endif /* _ELF_SYMVIEW_H */
@@ -0,0 +1,281 @@
+#include <poll.h>
+#include <libgen.h>
+#include <sys/inotify.h>
+
+#include "elf-watch.h"
+#include "elf-hash.h"
+#include "elf-stats.h"
+
+#define WATCH_EVENTS	(IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+#define SETTLE_MS	100	/* a rebuild writes in bursts, wait for quiet */
+
+typedef struct watch_section {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t hash;
+} watch_section_t;
+
+/* Printed form of one symbol table and the contents it came from */
+typedef struct watch_symtab {
+	uint64_t key[3];	/* symbols, strings, extended indexes */
+	char *text;
+	size_t length;
+} watch_symtab_t;
+
+typedef struct watch_state {
+	const char *path;
+	watch_section_t *sections;
+	uint32_t nsections;
+	watch_symtab_t *symtabs;
+	uint32_t nsymtabs;
+	uint32_t updates;
+} watch_state_t;
+
+static uint64_t section_hash(elf_file_t *ef, uint32_t idx)
+{
+	elf_view_t view;
+	uint64_t hash = 0;
+
+	if(elf_section_view(ef, idx, &view) != ELF_OK)
+		return 0;
+	if(view.data)
+		hash = hash_xxh64(view.data, view.size, 0);
+	elf_view_release(&view);
+	return hash;
+}
+
+/* Run print_symbol_table*() with stdout pointed at a memory buffer */
+static bool render_symtab(elf_file_t *ef, uint32_t idx, watch_symtab_t *out)
+{
+	FILE *saved = stdout, *mem;
+
+	out->text = NULL;
+	out->length = 0;
+	mem = open_memstream(&out->text, &out->length);
+	if(!mem)
+		return false;
+
+	fflush(stdout);
+	stdout = mem;
+	if(elf_is64(ef))
+		print_symbol_table64(elf_fd(ef), *elf_ehdr64(ef), elf_shdrs64(ef), idx);
+	else
+		print_symbol_table(elf_fd(ef), *elf_ehdr(ef), elf_shdrs(ef), idx);
+	stdout = saved;
+
+	return fclose(mem) == 0;
+}
+
+static void section_link(elf_file_t *ef, uint32_t idx, uint32_t *type, uint32_t *link)
+{
+	if(elf_is64(ef)) {
+		*type = elf_shdrs64(ef)[idx].sh_type;
+		*link = elf_shdrs64(ef)[idx].sh_link;
+	} else {
+		*type = elf_shdrs(ef)[idx].sh_type;
+		*link = elf_shdrs(ef)[idx].sh_link;
+	}
+}
+
+static bool analyze(watch_state_t *st, bool with_stats)
+{
+	watch_section_t *sections;
+	watch_symtab_t *symtabs, *found;
+	elf_file_t *ef = NULL;
+	elf_status_t status;
+	uint64_t start = stats_now();
+	uint32_t i, j, n, nsym = 0, changed = 0, added = 0, removed = 0, reused = 0;
+	uint32_t type, link;
+
+	stats_begin(PHASE_HEADER);
+	status = elf_open(st->path, &ef);
+	if(status == ELF_OK)
+		status = elf_read_shdrs(ef);
+	stats_end();
+	if(status != ELF_OK) {
+		/* Most likely caught in the middle of a rebuild */
+		fprintf(stderr, "%s: %s\n", st->path, elf_strerror(status));
+		elf_close(ef);
+		return false;
+	}
+	arena_use(elf_arena(ef));
+
+	stats_begin(PHASE_SHDRS);
+	n = elf_section_count(ef);
+	sections = calloc(n + 1, sizeof(watch_section_t));
+	symtabs = calloc(n + 1, sizeof(watch_symtab_t));
+	if(!sections || !symtabs) {
+		fprintf(stderr, "%s: %s\n", st->path, elf_strerror(ELF_ERR_NOMEM));
+		free(sections);
+		free(symtabs);
+		elf_close(ef);
+		return false;
+	}
+	for(i=0; i<n; i++) {
+		if(elf_is64(ef)) {
+			sections[i].offset = elf_shdrs64(ef)[i].sh_offset;
+			sections[i].size = elf_shdrs64(ef)[i].sh_size;
+		} else {
+			sections[i].offset = elf_shdrs(ef)[i].sh_offset;
+			sections[i].size = elf_shdrs(ef)[i].sh_size;
+		}
+		sections[i].hash = section_hash(ef, i);
+		if(i >= st->nsections)
+			added++;
+		else if(memcmp(&sections[i], &st->sections[i], sizeof(watch_section_t)))
+			changed++;
+	}
+	if(st->nsections > n)
+		removed = st->nsections - n;
+	stats_end();
+
+	if(elf_is64(ef)) {
+		if(is_ELF64(*elf_ehdr64(ef)))
+			print_elf_header64(*elf_ehdr64(ef));
+	} else {
+		if(is_ELF(*elf_ehdr(ef)))
+			print_elf_header(*elf_ehdr(ef));
+	}
+
+	stats_begin(PHASE_SECTIONS);
+	if(!n)
+		printf("No section headers\n");
+	else if(elf_is64(ef))
+		print_section_headers64(elf_fd(ef), *elf_ehdr64(ef), elf_shdrs64(ef));
+	else
+		print_section_headers(elf_fd(ef), *elf_ehdr(ef), elf_shdrs(ef));
+	stats_end();
+
+	/* Tables are looked up by contents, not index, so adding a section
+	 * in front of them does not throw them away
+	 */
+	stats_begin(PHASE_SYMBOLS);
+	for(i=0; i<n; i++) {
+		section_link(ef, i, &type, &link);
+		if(type != SHT_SYMTAB && type != SHT_DYNSYM)
+			continue;
+
+		watch_symtab_t *tab = &symtabs[nsym++];
+		tab->key[0] = sections[i].hash;
+		tab->key[1] = link < n ? sections[link].hash : 0;
+		tab->key[2] = 0;
+		for(j=0; j<n; j++) {
+			uint32_t t, l;
+			section_link(ef, j, &t, &l);
+			if(t == SHT_SYMTAB_SHNDX && l == i) {
+				tab->key[2] = sections[j].hash;
+				break;
+			}
+		}
+
+		found = NULL;
+		for(j=0; j<st->nsymtabs && !found; j++) {
+			if(st->symtabs[j].text
+					&& !memcmp(st->symtabs[j].key, tab->key, sizeof(tab->key)))
+				found = &st->symtabs[j];
+		}
+		if(found) {
+			tab->text = found->text;
+			tab->length = found->length;
+			found->text = NULL;
+			reused++;
+		} else if(!render_symtab(ef, i, tab)) {
+			free(tab->text);
+			tab->text = NULL;
+			continue;
+		}
+
+		printf("\n[Section %03d]", i);
+		fwrite(tab->text, 1, tab->length, stdout);
+	}
+	stats_end();
+	fflush(stdout);
+
+	for(j=0; j<st->nsymtabs; j++)
+		free(st->symtabs[j].text);
+	free(st->symtabs);
+	free(st->sections);
+	st->symtabs = symtabs;
+	st->nsymtabs = nsym;
+	st->sections = sections;
+	st->nsections = n;
+
+	/* changed counts the indices both versions have */
+	fprintf(stderr, "%s: update %u, %u of %u sections changed, %u added, %u removed,"
+			" %u of %u symbol tables reused, %lu us\n",
+			st->path, st->updates++, changed, n - added, added, removed, reused, nsym,
+			(stats_now() - start) / 1000);
+	if(with_stats) {
+		stats_print_json(stderr, st->path);
+		stats_reset();
+	}
+
+	elf_close(ef);
+	return true;
+}
+
+/* True once an event for name has arrived and the directory went quiet */
+static bool wait_change(int32_t fd, const char *name)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	bool hit = false;
+	ssize_t len;
+	char *p;
+
+	for(;;) {
+		if(poll(&pfd, 1, hit ? SETTLE_MS : -1) == 0)
+			return true;
+
+		len = read(fd, buf, sizeof(buf));
+		if(len < 0 && errno == EINTR)
+			continue;
+		if(len <= 0)
+			return false;
+
+		for(p=buf; p<buf + len; p+=sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if(ev->len && !strcmp(ev->name, name))
+				hit = true;
+		}
+	}
+}
+
+int watch_file(const char *path, bool with_stats)
+{
+	watch_state_t st;
+	char *dir_copy, *base_copy;
+	int32_t fd;
+	uint32_t j;
+
+	memset(&st, 0, sizeof(st));
+	st.path = path;
+
+	dir_copy = strdup(path);
+	base_copy = strdup(path);
+	fd = inotify_init1(IN_CLOEXEC);
+	if(!dir_copy || !base_copy || fd < 0
+			|| inotify_add_watch(fd, dirname(dir_copy), WATCH_EVENTS) < 0) {
+		fprintf(stderr, "Error %d Unable to watch %s\n", errno, path);
+		free(dir_copy);
+		free(base_copy);
+		if(fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	analyze(&st, with_stats);
+	while(wait_change(fd, basename(base_copy)))
+		analyze(&st, with_stats);
+
+	fprintf(stderr, "Error %d Watching %s stopped\n", errno, path);
+	for(j=0; j<st.nsymtabs; j++)
+		free(st.symtabs[j].text);
+	free(st.symtabs);
+	free(st.sections);
+	free(dir_copy);
+	free(base_copy);
+	close(fd);
+	return 1;
+}
@@ -0,0 +1,21 @@
+#ifndef _ELF_WATCH_H
+#define _ELF_WATCH_H
+
+#include "elf-file.h"
+
+/* Re-dump a file every time it is rewritten.
+ *
+ * The directory is watched with inotify, so both in-place writes and
+ * the rename a linker usually does are seen.  Between updates every
+ * section is remembered by offset, size and XXH64 of its contents, and
+ * each printed symbol table is kept keyed by the hashes of the symbol,
+ * string and SHT_SYMTAB_SHNDX sections it was made from; on a change
+ * only tables whose inputs differ are decoded again.  A summary of what
+ * was reused goes to stderr after each dump.
+ *
+ * Only returns on error.
+ */
+
+int watch_file(const char *path, bool with_stats);
+
+#endif /* _ELF_WATCH_H */
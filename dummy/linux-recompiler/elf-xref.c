@@ -0,0 +1,806 @@
+#include <pthread.h>
+
+#include "elf-xref.h"
+#include "elf-stats.h"
+#include "elf-swap.h"
+#include "x86-decode.h"
+
+#define MAX_THREADS	64
+#define UNIT_BATCH	16	/* code units a worker claims at once */
+#define RUN_START	4096	/* edges */
+
+typedef struct edge {
+	uint64_t key;		/* the side the run is sorted by */
+	uint64_t other;
+	uint32_t kind;
+} edge_t;
+
+/* A worker's buffer, then a sorted run */
+typedef struct run {
+	edge_t *edges;
+	uint64_t count;
+	uint64_t size;
+	bool failed;
+} run_t;
+
+typedef struct load {
+	uint64_t vaddr;
+	uint64_t memsz;
+	uint64_t offset;
+	uint64_t filesz;
+	bool exec;
+} load_t;
+
+/* A stretch of code swept from its first byte */
+typedef struct unit {
+	const uint8_t *data;
+	uint64_t addr;
+	uint64_t size;
+} unit_t;
+
+typedef struct csr {
+	uint64_t *keys;
+	uint64_t *first;	/* [nkeys + 1], into refs */
+	xref_ref_t *refs;
+	uint64_t nkeys;
+} csr_t;
+
+struct xref_index {
+	csr_t to;
+	csr_t from;
+};
+
+typedef struct sweep {
+	elf_file_t *ef;
+	const uint8_t *base;
+	uint64_t size;
+	bool swapped;
+	bool decode;		/* x86 or x86-64 */
+	bool mode64;
+	load_t *loads;
+	uint32_t nloads;
+	unit_t *units;
+	uint64_t nunits;
+	uint64_t next;		/* first unit not claimed yet */
+	run_t from[MAX_THREADS];
+	run_t to[MAX_THREADS];
+} sweep_t;
+
+typedef struct worker {
+	sweep_t *s;
+	uint32_t idx;
+} worker_t;
+
+typedef struct merge_job {
+	run_t *a;
+	run_t *b;
+	run_t out;
+} merge_job_t;
+
+typedef struct csr_job {
+	run_t *run;
+	csr_t *csr;
+	bool ok;
+} csr_job_t;
+
+static const char * const kind_names[XREF_KIND_MAX] = {
+	"call", "jump", "cond", "read", "addr", "pointer",
+};
+
+const char * xref_kind_name(uint32_t kind)
+{
+	return kind < XREF_KIND_MAX ? kind_names[kind] : "?";
+}
+
+static inline bool in_image(const sweep_t *s, uint64_t addr)
+{
+	uint32_t i;
+
+	for(i=0; i<s->nloads; i++) {
+		if(addr - s->loads[i].vaddr < s->loads[i].memsz)
+			return true;
+	}
+	return false;
+}
+
+/* The file bytes at addr, NULL unless n of them are there */
+static const uint8_t * bytes_at(const sweep_t *s, uint64_t addr, uint64_t n)
+{
+	const load_t *l;
+	uint32_t i;
+
+	for(i=0; i<s->nloads; i++) {
+		l = &s->loads[i];
+		if(addr - l->vaddr < l->filesz && n <= l->filesz - (addr - l->vaddr))
+			return s->base + l->offset + (addr - l->vaddr);
+	}
+	return NULL;
+}
+
+static void add_edge(run_t *r, uint64_t from, uint64_t to, uint32_t kind)
+{
+	edge_t *grown;
+	uint64_t n;
+
+	if(r->count == r->size) {
+		n = r->size ? r->size * 2 : RUN_START;
+		grown = realloc(r->edges, n * sizeof(edge_t));
+		if(!grown) {
+			r->failed = true;
+			return;
+		}
+		stats_alloc((n - r->size) * sizeof(edge_t));
+		r->edges = grown;
+		r->size = n;
+	}
+	r->edges[r->count].key = from;
+	r->edges[r->count].other = to;
+	r->edges[r->count].kind = kind;
+	r->count++;
+}
+
+static int compare_edge(const void *a, const void *b)
+{
+	const edge_t *x = a, *y = b;
+
+	if(x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	if(x->other != y->other)
+		return x->other < y->other ? -1 : 1;
+	return x->kind < y->kind ? -1 : x->kind > y->kind;
+}
+
+static void sweep_unit(const sweep_t *s, run_t *r, const unit_t *u)
+{
+	static const uint32_t flow_kind[] = { 0, XREF_CALL, XREF_JUMP, XREF_COND };
+	x86_insn_t insn;
+	uint64_t off = 0;
+
+	while(off < u->size) {
+		/* Not an instruction: try the next byte */
+		if(!x86_decode(u->data + off, u->size - off, u->addr + off, s->mode64, &insn)) {
+			off++;
+			continue;
+		}
+		if(insn.flow != X86_FLOW_NONE && in_image(s, insn.target))
+			add_edge(r, u->addr + off, insn.target, flow_kind[insn.flow]);
+		if(insn.has_mem && in_image(s, insn.mem))
+			add_edge(r, u->addr + off, insn.mem, insn.lea ? XREF_ADDR : XREF_READ);
+		off += insn.length;
+	}
+}
+
+/* The address a dynamic relocation stores, for the pointer types */
+static bool pointer_target(uint16_t machine, uint32_t type, bool defined,
+		uint64_t sym, uint64_t addend, uint64_t *to)
+{
+	switch(machine)
+	{
+		case EM_X86_64:
+			switch(type)
+			{
+				case ELF_R_X86_64_RELATIVE:
+				case ELF_R_X86_64_IRELATIVE:
+					*to = addend;
+					return true;
+				case ELF_R_X86_64_64:
+					*to = sym + addend;
+					return defined;
+				case ELF_R_X86_64_GLOB_DAT:
+				case ELF_R_X86_64_JUMP_SLOT:
+					*to = sym;
+					return defined;
+			}
+			return false;
+		case EM_386:
+			switch(type)
+			{
+				case ELF_R_386_RELATIVE:
+				case ELF_R_386_IRELATIVE:
+					*to = addend;
+					return true;
+				case ELF_R_386_32:
+					*to = (uint32_t)(sym + addend);
+					return defined;
+				case ELF_R_386_GLOB_DAT:
+				case ELF_R_386_JMP_SLOT:
+					*to = sym;
+					return defined;
+			}
+			return false;
+		case ELF_EM_AARCH64:
+			switch(type)
+			{
+				case ELF_R_AARCH64_RELATIVE:
+				case ELF_R_AARCH64_IRELATIVE:
+					*to = addend;
+					return true;
+				case ELF_R_AARCH64_ABS64:
+				case ELF_R_AARCH64_GLOB_DAT:
+				case ELF_R_AARCH64_JUMP_SLOT:
+					*to = sym + addend;
+					return defined;
+			}
+			return false;
+	}
+	return false;
+}
+
+static bool symbol_value64(const sweep_t *s, const Elf64_Shdr *symtab, uint64_t idx,
+		uint64_t *value)
+{
+	Elf64_Sym sym;
+
+	if(!idx || symtab->sh_type == SHT_NOBITS || symtab->sh_offset > s->size
+			|| symtab->sh_size > s->size - symtab->sh_offset
+			|| idx >= symtab->sh_size / sizeof(Elf64_Sym))
+		return false;
+	memcpy(&sym, s->base + symtab->sh_offset + idx * sizeof(sym), sizeof(sym));
+	if(s->swapped)
+		swap_sym_table64(&sym, 1);
+	*value = sym.st_value;
+	return sym.st_shndx != SHN_UNDEF && sym.st_value;
+}
+
+static bool symbol_value(const sweep_t *s, const Elf32_Shdr *symtab, uint64_t idx,
+		uint64_t *value)
+{
+	Elf32_Sym sym;
+
+	if(!idx || symtab->sh_type == SHT_NOBITS || symtab->sh_offset > s->size
+			|| symtab->sh_size > s->size - symtab->sh_offset
+			|| idx >= symtab->sh_size / sizeof(Elf32_Sym))
+		return false;
+	memcpy(&sym, s->base + symtab->sh_offset + idx * sizeof(sym), sizeof(sym));
+	if(s->swapped)
+		swap_sym_table(&sym, 1);
+	*value = sym.st_value;
+	return sym.st_shndx != SHN_UNDEF && sym.st_value;
+}
+
+static void scan_relocs64(const sweep_t *s, run_t *r)
+{
+	const Elf64_Shdr *sh = elf_shdrs64(s->ef), *symtab;
+	uint32_t i, shnum = elf_section_count(s->ef), type;
+	uint16_t machine = elf_ehdr64(s->ef)->e_machine;
+	uint64_t j, count, ent, sym, to, addend;
+	const uint8_t *p;
+	Elf64_Rela rela;
+	bool defined;
+
+	for(i=1; i<shnum; i++) {
+		if((sh[i].sh_type != SHT_RELA && sh[i].sh_type != SHT_REL)
+				|| sh[i].sh_offset > s->size || sh[i].sh_size > s->size - sh[i].sh_offset)
+			continue;
+		ent = sh[i].sh_type == SHT_RELA ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+		count = sh[i].sh_size / ent;
+		symtab = sh[i].sh_link && sh[i].sh_link < shnum ? &sh[sh[i].sh_link] : NULL;
+		stats_add(STAT_SECTIONS, 1);
+		for(j=0; j<count; j++) {
+			memset(&rela, 0, sizeof(rela));
+			memcpy(&rela, s->base + sh[i].sh_offset + j * ent, ent);
+			if(s->swapped)
+				swap_rela_table64(&rela, 1);
+			if(!in_image(s, rela.r_offset))
+				continue;
+			type = ELF64_R_TYPE(rela.r_info);
+			addend = rela.r_addend;
+			/* REL keeps the addend in place */
+			if(sh[i].sh_type == SHT_REL) {
+				p = bytes_at(s, rela.r_offset, 8);
+				if(!p)
+					continue;
+				memcpy(&addend, p, 8);
+				if(s->swapped)
+					addend = __builtin_bswap64(addend);
+			}
+			sym = 0;
+			defined = symtab && symbol_value64(s, symtab, ELF64_R_SYM(rela.r_info), &sym);
+			if(pointer_target(machine, type, defined, sym, addend, &to) && in_image(s, to))
+				add_edge(r, rela.r_offset, to, XREF_POINTER);
+		}
+	}
+}
+
+static void scan_relocs(const sweep_t *s, run_t *r)
+{
+	const Elf32_Shdr *sh = elf_shdrs(s->ef), *symtab;
+	uint32_t i, shnum = elf_section_count(s->ef), type, word;
+	uint16_t machine = elf_ehdr(s->ef)->e_machine;
+	uint64_t j, count, ent, sym, to, addend;
+	const uint8_t *p;
+	Elf32_Rela rela;
+	bool defined;
+
+	for(i=1; i<shnum; i++) {
+		if((sh[i].sh_type != SHT_RELA && sh[i].sh_type != SHT_REL)
+				|| sh[i].sh_offset > s->size || sh[i].sh_size > s->size - sh[i].sh_offset)
+			continue;
+		ent = sh[i].sh_type == SHT_RELA ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+		count = sh[i].sh_size / ent;
+		symtab = sh[i].sh_link && sh[i].sh_link < shnum ? &sh[sh[i].sh_link] : NULL;
+		stats_add(STAT_SECTIONS, 1);
+		for(j=0; j<count; j++) {
+			memset(&rela, 0, sizeof(rela));
+			memcpy(&rela, s->base + sh[i].sh_offset + j * ent, ent);
+			if(s->swapped)
+				swap_rela_table(&rela, 1);
+			if(!in_image(s, rela.r_offset))
+				continue;
+			type = ELF32_R_TYPE(rela.r_info);
+			addend = (uint32_t)rela.r_addend;
+			if(sh[i].sh_type == SHT_REL) {
+				p = bytes_at(s, rela.r_offset, 4);
+				if(!p)
+					continue;
+				memcpy(&word, p, 4);
+				addend = swap32_if(s->swapped, word);
+			}
+			sym = 0;
+			defined = symtab && symbol_value(s, symtab, ELF32_R_SYM(rela.r_info), &sym);
+			if(pointer_target(machine, type, defined, sym, addend, &to) && in_image(s, to))
+				add_edge(r, rela.r_offset, to, XREF_POINTER);
+		}
+	}
+}
+
+static uint32_t get_loads64(sweep_t *s)
+{
+	const Elf64_Ehdr *eh = elf_ehdr64(s->ef);
+	Elf64_Phdr *ph;
+	uint32_t i, n = 0;
+
+	if(!eh->e_phnum || eh->e_phentsize != sizeof(Elf64_Phdr) || eh->e_phoff > s->size
+			|| (s->size - eh->e_phoff) / sizeof(Elf64_Phdr) < eh->e_phnum)
+		return 0;
+	ph = malloc(eh->e_phnum * sizeof(Elf64_Phdr));
+	s->loads = calloc(eh->e_phnum, sizeof(load_t));
+	if(!ph || !s->loads || !read_program_header_table64(elf_fd(s->ef), *eh, ph)) {
+		free(ph);
+		return 0;
+	}
+	for(i=0; i<eh->e_phnum; i++) {
+		if(ph[i].p_type != PT_LOAD || !ph[i].p_memsz || ph[i].p_offset > s->size
+				|| ph[i].p_filesz > s->size - ph[i].p_offset)
+			continue;
+		s->loads[n].vaddr = ph[i].p_vaddr;
+		s->loads[n].memsz = ph[i].p_memsz;
+		s->loads[n].offset = ph[i].p_offset;
+		s->loads[n].filesz = ph[i].p_filesz < ph[i].p_memsz ? ph[i].p_filesz : ph[i].p_memsz;
+		s->loads[n].exec = (ph[i].p_flags & PF_X) != 0;
+		n++;
+	}
+	free(ph);
+	return n;
+}
+
+static uint32_t get_loads(sweep_t *s)
+{
+	const Elf32_Ehdr *eh = elf_ehdr(s->ef);
+	Elf32_Phdr *ph;
+	uint32_t i, n = 0;
+
+	if(!eh->e_phnum || eh->e_phentsize != sizeof(Elf32_Phdr) || eh->e_phoff > s->size
+			|| (s->size - eh->e_phoff) / sizeof(Elf32_Phdr) < eh->e_phnum)
+		return 0;
+	ph = malloc(eh->e_phnum * sizeof(Elf32_Phdr));
+	s->loads = calloc(eh->e_phnum, sizeof(load_t));
+	if(!ph || !s->loads || !read_program_header_table(elf_fd(s->ef), *eh, ph)) {
+		free(ph);
+		return 0;
+	}
+	for(i=0; i<eh->e_phnum; i++) {
+		if(ph[i].p_type != PT_LOAD || !ph[i].p_memsz || ph[i].p_offset > s->size
+				|| ph[i].p_filesz > s->size - ph[i].p_offset)
+			continue;
+		s->loads[n].vaddr = ph[i].p_vaddr;
+		s->loads[n].memsz = ph[i].p_memsz;
+		s->loads[n].offset = ph[i].p_offset;
+		s->loads[n].filesz = ph[i].p_filesz < ph[i].p_memsz ? ph[i].p_filesz : ph[i].p_memsz;
+		s->loads[n].exec = (ph[i].p_flags & PF_X) != 0;
+		n++;
+	}
+	free(ph);
+	return n;
+}
+
+/* Cuts [addr, addr + size) at the function starts inside it */
+static void add_region(sweep_t *s, const uint8_t *data, uint64_t addr, uint64_t size,
+		const func_range_t *ranges, uint32_t count)
+{
+	uint64_t lo = 0, hi = count, mid, end = addr + size, cut;
+	unit_t *u;
+
+	/* First function starting after addr */
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(ranges[mid].start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for(; ; lo++) {
+		cut = lo < count && ranges[lo].start < end ? ranges[lo].start : end;
+		if(cut == addr)
+			continue;
+		u = &s->units[s->nunits++];
+		u->data = data;
+		u->addr = addr;
+		u->size = cut - addr;
+		data += cut - addr;
+		addr = cut;
+		if(cut == end)
+			break;
+	}
+}
+
+static bool get_units64(sweep_t *s, const func_range_t *ranges, uint32_t count)
+{
+	const Elf64_Shdr *sh = elf_shdrs64(s->ef);
+	uint32_t i, shnum = elf_section_count(s->ef);
+
+	s->units = malloc(((uint64_t)shnum + s->nloads + count + 1) * sizeof(unit_t));
+	if(!s->units)
+		return false;
+	for(i=1; i<shnum; i++) {
+		if(sh[i].sh_type != SHT_PROGBITS || !sh[i].sh_size
+				|| (sh[i].sh_flags & (SHF_ALLOC|SHF_EXECINSTR)) != (SHF_ALLOC|SHF_EXECINSTR)
+				|| sh[i].sh_offset > s->size || sh[i].sh_size > s->size - sh[i].sh_offset)
+			continue;
+		add_region(s, s->base + sh[i].sh_offset, sh[i].sh_addr, sh[i].sh_size, ranges, count);
+	}
+	return true;
+}
+
+static bool get_units(sweep_t *s, const func_range_t *ranges, uint32_t count)
+{
+	const Elf32_Shdr *sh = elf_shdrs(s->ef);
+	uint32_t i, shnum = elf_section_count(s->ef);
+
+	s->units = malloc(((uint64_t)shnum + s->nloads + count + 1) * sizeof(unit_t));
+	if(!s->units)
+		return false;
+	for(i=1; i<shnum; i++) {
+		if(sh[i].sh_type != SHT_PROGBITS || !sh[i].sh_size
+				|| (sh[i].sh_flags & (SHF_ALLOC|SHF_EXECINSTR)) != (SHF_ALLOC|SHF_EXECINSTR)
+				|| sh[i].sh_offset > s->size || sh[i].sh_size > s->size - sh[i].sh_offset)
+			continue;
+		add_region(s, s->base + sh[i].sh_offset, sh[i].sh_addr, sh[i].sh_size, ranges, count);
+	}
+	return true;
+}
+
+static void * sweep_worker(void *arg)
+{
+	worker_t *w = arg;
+	sweep_t *s = w->s;
+	run_t *from = &s->from[w->idx], *to = &s->to[w->idx];
+	uint64_t first, end, i;
+
+	/* The calling thread takes the relocations before any code */
+	if(w->idx == 0 && elf_section_count(s->ef)) {
+		if(elf_is64(s->ef))
+			scan_relocs64(s, from);
+		else
+			scan_relocs(s, from);
+	}
+
+	for(;;) {
+		first = __atomic_fetch_add(&s->next, UNIT_BATCH, __ATOMIC_RELAXED);
+		if(first >= s->nunits)
+			break;
+		end = s->nunits - first < UNIT_BATCH ? s->nunits : first + UNIT_BATCH;
+		for(i=first; i<end; i++)
+			sweep_unit(s, from, &s->units[i]);
+	}
+	if(from->failed || !from->count)
+		return NULL;
+
+	/* The same edges the other way round */
+	to->edges = malloc(from->count * sizeof(edge_t));
+	if(!to->edges) {
+		to->failed = true;
+		return NULL;
+	}
+	stats_alloc(from->count * sizeof(edge_t));
+	for(i=0; i<from->count; i++) {
+		to->edges[i].key = from->edges[i].other;
+		to->edges[i].other = from->edges[i].key;
+		to->edges[i].kind = from->edges[i].kind;
+	}
+	to->count = to->size = from->count;
+	qsort(from->edges, from->count, sizeof(edge_t), compare_edge);
+	qsort(to->edges, to->count, sizeof(edge_t), compare_edge);
+	return NULL;
+}
+
+static void * merge_worker(void *arg)
+{
+	merge_job_t *j = arg;
+	const edge_t *a = j->a->edges, *b = j->b->edges;
+	uint64_t na = j->a->count, nb = j->b->count, i = 0, k = 0, n = 0;
+	edge_t *out;
+
+	out = malloc((na + nb ? na + nb : 1) * sizeof(edge_t));
+	if(!out) {
+		j->out.failed = true;
+		return NULL;
+	}
+	stats_alloc((na + nb) * sizeof(edge_t));
+	while(i < na && k < nb)
+		out[n++] = compare_edge(&a[i], &b[k]) <= 0 ? a[i++] : b[k++];
+	while(i < na)
+		out[n++] = a[i++];
+	while(k < nb)
+		out[n++] = b[k++];
+
+	j->out.edges = out;
+	j->out.count = j->out.size = n;
+	return NULL;
+}
+
+/* Pairs of runs merged in parallel until one is left on each side */
+static bool merge_runs(run_t *from, run_t *to, uint32_t nruns)
+{
+	pthread_t threads[MAX_THREADS];
+	merge_job_t jobs[MAX_THREADS];
+	uint32_t i, njobs, half;
+	run_t *side;
+	bool ok = true;
+
+	while(nruns > 1 && ok) {
+		half = nruns / 2;
+		njobs = 0;
+		for(side=from; ; side=to) {
+			for(i=0; i<half; i++) {
+				memset(&jobs[njobs], 0, sizeof(merge_job_t));
+				jobs[njobs].a = &side[2 * i];
+				jobs[njobs].b = &side[2 * i + 1];
+				njobs++;
+			}
+			if(side == to)
+				break;
+		}
+		for(i=1; i<njobs; i++) {
+			/* Without the thread the job is run here */
+			if(pthread_create(&threads[i], NULL, merge_worker, &jobs[i]))
+				threads[i] = 0;
+		}
+		merge_worker(&jobs[0]);
+		for(i=1; i<njobs; i++) {
+			if(threads[i])
+				pthread_join(threads[i], NULL);
+			else
+				merge_worker(&jobs[i]);
+		}
+
+		for(i=0; i<njobs; i++) {
+			ok &= !jobs[i].out.failed;
+			free(jobs[i].a->edges);
+			free(jobs[i].b->edges);
+		}
+		for(i=0; i<half; i++) {
+			from[i] = jobs[i].out;
+			to[i] = jobs[half + i].out;
+		}
+		/* An odd run out moves up as it is */
+		if(nruns & 1) {
+			from[half] = from[nruns - 1];
+			to[half] = to[nruns - 1];
+		}
+		for(i=half+(nruns&1); i<nruns; i++) {
+			memset(&from[i], 0, sizeof(run_t));
+			memset(&to[i], 0, sizeof(run_t));
+		}
+		nruns = half + (nruns & 1);
+	}
+	return ok;
+}
+
+/* Keys and their ranges from one sorted run, duplicates dropped */
+static void * csr_worker(void *arg)
+{
+	csr_job_t *j = arg;
+	const edge_t *e = j->run->edges;
+	csr_t *c = j->csr;
+	uint64_t i, nkeys = 0, nrefs = 0;
+
+	for(i=0; i<j->run->count; i++) {
+		if(i && !compare_edge(&e[i - 1], &e[i]))
+			continue;
+		nrefs++;
+		if(!i || e[i - 1].key != e[i].key)
+			nkeys++;
+	}
+	c->keys = malloc((nkeys ? nkeys : 1) * sizeof(uint64_t));
+	c->first = malloc((nkeys + 1) * sizeof(uint64_t));
+	c->refs = malloc((nrefs ? nrefs : 1) * sizeof(xref_ref_t));
+	if(!c->keys || !c->first || !c->refs)
+		return NULL;
+	stats_alloc(nkeys * 2 * sizeof(uint64_t) + nrefs * sizeof(xref_ref_t));
+
+	nkeys = nrefs = 0;
+	for(i=0; i<j->run->count; i++) {
+		if(i && !compare_edge(&e[i - 1], &e[i]))
+			continue;
+		if(!i || e[i - 1].key != e[i].key) {
+			c->keys[nkeys] = e[i].key;
+			c->first[nkeys++] = nrefs;
+		}
+		c->refs[nrefs].addr = e[i].other;
+		c->refs[nrefs++].kind = e[i].kind;
+	}
+	c->first[nkeys] = nrefs;
+	c->nkeys = nkeys;
+	j->ok = true;
+	return NULL;
+}
+
+static bool build_csr(run_t *from, run_t *to, xref_index_t *x)
+{
+	csr_job_t jobs[2] = { { from, &x->from, false }, { to, &x->to, false } };
+	pthread_t thread;
+	bool threaded;
+
+	threaded = !pthread_create(&thread, NULL, csr_worker, &jobs[1]);
+	csr_worker(&jobs[0]);
+	if(threaded)
+		pthread_join(thread, NULL);
+	else
+		csr_worker(&jobs[1]);
+	return jobs[0].ok && jobs[1].ok;
+}
+
+elf_status_t xref_build(elf_file_t *ef, const func_range_t *ranges, uint32_t count,
+		xref_index_t **xi)
+{
+	pthread_t threads[MAX_THREADS];
+	worker_t workers[MAX_THREADS];
+	elf_view_t file;
+	elf_status_t status;
+	xref_index_t *x = NULL;
+	sweep_t *s;
+	uint16_t machine;
+	uint32_t i, nthreads;
+	bool ok;
+	long n;
+
+	*xi = NULL;
+	if(!ranges)
+		count = 0;
+	status = elf_file_view(ef, &file);
+	if(status != ELF_OK)
+		return status;
+	s = calloc(1, sizeof(sweep_t));
+	if(!s) {
+		elf_view_release(&file);
+		return ELF_ERR_NOMEM;
+	}
+	s->ef = ef;
+	s->base = file.data;
+	s->size = file.size;
+	if(elf_is64(ef)) {
+		machine = elf_ehdr64(ef)->e_machine;
+		s->swapped = elf_swapped(elf_ehdr64(ef)->e_ident);
+		s->nloads = get_loads64(s);
+	} else {
+		machine = elf_ehdr(ef)->e_machine;
+		s->swapped = elf_swapped(elf_ehdr(ef)->e_ident);
+		s->nloads = get_loads(s);
+	}
+	s->decode = !s->swapped && (machine == EM_X86_64 || machine == EM_386);
+	s->mode64 = machine == EM_X86_64;
+
+	status = ELF_ERR_NOTFOUND;
+	if(!s->nloads)
+		goto out;
+	status = ELF_ERR_NOMEM;
+	if(s->decode && !(elf_is64(ef) ? get_units64(s, ranges, count) : get_units(s, ranges, count)))
+		goto out;
+	/* Stripped of section headers: the executable segments are the code */
+	for(i=0; s->decode && !elf_section_count(ef) && i<s->nloads; i++) {
+		if(s->loads[i].exec && s->loads[i].filesz)
+			add_region(s, s->base + s->loads[i].offset, s->loads[i].vaddr,
+					s->loads[i].filesz, ranges, count);
+	}
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : n;
+	if(nthreads > (s->nunits + UNIT_BATCH - 1) / UNIT_BATCH)
+		nthreads = (s->nunits + UNIT_BATCH - 1) / UNIT_BATCH;
+	if(!nthreads)
+		nthreads = 1;
+	for(i=0; i<nthreads; i++) {
+		workers[i].s = s;
+		workers[i].idx = i;
+	}
+	for(i=1; i<nthreads; i++) {
+		/* Without the thread the others claim its share */
+		if(pthread_create(&threads[i], NULL, sweep_worker, &workers[i]))
+			threads[i] = 0;
+	}
+	sweep_worker(&workers[0]);
+	for(i=1; i<nthreads; i++) {
+		if(threads[i])
+			pthread_join(threads[i], NULL);
+	}
+	ok = true;
+	for(i=0; i<nthreads; i++)
+		ok &= !s->from[i].failed && !s->to[i].failed;
+
+	x = calloc(1, sizeof(xref_index_t));
+	if(!ok || !x || !merge_runs(s->from, s->to, nthreads) || !build_csr(s->from, s->to, x))
+		goto out;
+	*xi = x;
+	x = NULL;
+	status = ELF_OK;
+
+out:
+	xref_close(x);
+	for(i=0; i<MAX_THREADS; i++) {
+		free(s->from[i].edges);
+		free(s->to[i].edges);
+	}
+	free(s->units);
+	free(s->loads);
+	free(s);
+	elf_view_release(&file);
+	return status;
+}
+
+void xref_close(xref_index_t *xi)
+{
+	if(!xi)
+		return;
+	free(xi->to.keys);
+	free(xi->to.first);
+	free(xi->to.refs);
+	free(xi->from.keys);
+	free(xi->from.first);
+	free(xi->from.refs);
+	free(xi);
+}
+
+static uint64_t lookup(const csr_t *c, uint64_t addr, const xref_ref_t **refs)
+{
+	uint64_t lo = 0, hi = c->nkeys, mid;
+
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(c->keys[mid] < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == c->nkeys || c->keys[lo] != addr) {
+		*refs = NULL;
+		return 0;
+	}
+	*refs = c->refs + c->first[lo];
+	return c->first[lo + 1] - c->first[lo];
+}
+
+uint64_t xref_to(const xref_index_t *xi, uint64_t addr, const xref_ref_t **refs)
+{
+	return lookup(&xi->to, addr, refs);
+}
+
+uint64_t xref_from(const xref_index_t *xi, uint64_t addr, const xref_ref_t **refs)
+{
+	return lookup(&xi->from, addr, refs);
+}
+
+uint64_t xref_count(const xref_index_t *xi)
+{
+	return xi->to.first ? xi->to.first[xi->to.nkeys] : 0;
+}
+
+uint64_t xref_target_count(const xref_index_t *xi)
+{
+	return xi->to.nkeys;
+}
+
+uint64_t xref_source_count(const xref_index_t *xi)
+{
+	return xi->from.nkeys;
+}
@@ -0,0 +1,59 @@
+#ifndef _ELF_XREF_H
+#define _ELF_XREF_H
+
+#include "elf-parser.h"
+#include "elf-file.h"
+#include "eh-frame.h"
+
+/* Cross-reference index (-R).
+ *
+ * The executable sections, or the executable PT_LOAD segments without
+ * section headers, are disassembled by a linear sweep that starts again
+ * at every function start known from .eh_frame, so a stretch of data
+ * in the code only spoils the function it sits in.  Each x86 or x86-64
+ * instruction contributes the target of a relative branch and the
+ * address of a RIP-relative or absolute memory operand.  Dynamic
+ * relocations (RELATIVE, GLOB_DAT, JUMP_SLOT and absolute pointers)
+ * contribute the pointers stored in data, for every machine.  Only
+ * addresses inside a PT_LOAD segment are kept.
+ *
+ * The code is split at the function starts and swept on all CPUs, each
+ * worker appending to its own buffer, which it sorts in both directions.
+ * The sorted runs are merged pairwise in parallel rounds and laid out
+ * as compressed sparse rows: the distinct addresses of one side sorted,
+ * each with the range of its references in one array.  A lookup is a
+ * binary search over the addresses.
+ */
+
+typedef enum xref_kind {
+	XREF_CALL,
+	XREF_JUMP,
+	XREF_COND,		/* conditional branch */
+	XREF_READ,		/* memory operand, read or written */
+	XREF_ADDR,		/* address taken by lea */
+	XREF_POINTER,		/* pointer in data, from a relocation */
+	XREF_KIND_MAX
+} xref_kind_t;
+
+typedef struct xref_ref {
+	uint64_t addr;		/* the other end */
+	uint32_t kind;
+} xref_ref_t;
+
+typedef struct xref_index xref_index_t;
+
+/* ranges may be NULL; ELF_ERR_NOTFOUND without PT_LOAD segments */
+elf_status_t xref_build(elf_file_t *ef, const func_range_t *ranges, uint32_t count,
+		xref_index_t **xi);
+void xref_close(xref_index_t *xi);
+
+/* Sorted by the other end; *refs points into the index */
+uint64_t xref_to(const xref_index_t *xi, uint64_t addr, const xref_ref_t **refs);
+uint64_t xref_from(const xref_index_t *xi, uint64_t addr, const xref_ref_t **refs);
+
+uint64_t xref_count(const xref_index_t *xi);
+uint64_t xref_target_count(const xref_index_t *xi);
+uint64_t xref_source_count(const xref_index_t *xi);
+const char * xref_kind_name(uint32_t kind);
+
+#endif /* _ELF_XREF_H */
@@ -3,6 +3,7 @@
 #define _UAPI_LINUX_ELF_H
 
 #include <linux/types.h>
+#include <stdint.h>
 
 #ifndef _LINUX_ELF_EM_H
 #define _LINUX_ELF_EM_H
@@ -28,6 +29,7 @@
 #define EM_PPC		20	/* PowerPC */
 #define EM_PPC64	21	 /* PowerPC64 */
 #define EM_SPU		23	/* Cell BE SPU */
+#define EM_ARM		40	/* ARM 32 bit */
 #define EM_SH		42	/* SuperH */
 #define EM_SPARCV9	43	/* SPARC v9 64-bit */
 #define EM_IA_64	50	/* HP/Intel IA-64 */
@@ -69,11 +71,11 @@ typedef uint32_t	Elf32_Word;
 
 /* 64-bit ELF base types. */
 typedef uint64_t	Elf64_Addr;
-typedef int16_t	Elf64_Half;
+typedef uint16_t	Elf64_Half;
 typedef int16_t	Elf64_SHalf;
 typedef uint64_t	Elf64_Off;
 typedef int32_t	Elf64_Sword;
-typedef int32_t	Elf64_Word;
+typedef uint32_t	Elf64_Word;
 typedef uint64_t	Elf64_Xword;
 typedef int64_t	Elf64_Sxword;
 
@@ -174,6 +176,7 @@ typedef int64_t	Elf64_Sxword;
 #define STB_LOCAL  0
 #define STB_GLOBAL 1
 #define STB_WEAK   2
+#define STB_GNU_UNIQUE 10
 
 #define STT_NOTYPE  0
 #define STT_OBJECT  1
@@ -182,6 +185,13 @@ typedef int64_t	Elf64_Sxword;
 #define STT_FILE    4
 #define STT_COMMON  5
 #define STT_TLS     6
+#define STT_GNU_IFUNC 10
+
+#define STV_DEFAULT   0
+#define STV_INTERNAL  1
+#define STV_HIDDEN    2
+#define STV_PROTECTED 3
+#define ELF_ST_VISIBILITY(o)	((o) & 0x3)
 
 #define ELF_ST_BIND(x)		((x) >> 4)
 #define ELF_ST_TYPE(x)		(((unsigned int) x) & 0xf)
@@ -332,6 +342,7 @@ typedef struct elf64_phdr {
 #define SHT_SHLIB	10
 #define SHT_DYNSYM	11
 #define SHT_NUM		12
+#define SHT_SYMTAB_SHNDX	18	/* extended st_shndx, see SHN_XINDEX */
 #define SHT_LOPROC	0x70000000
 #define SHT_HIPROC	0x7fffffff
 #define SHT_LOUSER	0x80000000
@@ -353,6 +364,7 @@ typedef struct elf64_phdr {
 #define SHN_LIVEPATCH	0xff20
 #define SHN_ABS		0xfff1
 #define SHN_COMMON	0xfff2
+#define SHN_XINDEX	0xffff		/* real index is held elsewhere */
 #define SHN_HIRESERVE	0xffff
  
 typedef struct elf32_shdr {
@@ -498,6 +510,13 @@ typedef struct elf64_note {
   Elf64_Word n_type;	/* Content type */
 } Elf64_Nhdr;
 
+/* Note types with n_name "GNU" */
+#define NT_GNU_ABI_TAG		1
+#define NT_GNU_HWCAP		2
+#define NT_GNU_BUILD_ID		3	/* unique build ID bitstring */
+#define NT_GNU_GOLD_VERSION	4
+#define NT_GNU_PROPERTY_TYPE_0	5
+
 #endif /* _UAPI_LINUX_ELF_H */
 
 
@@ -534,6 +553,14 @@ typedef struct elf64_note {
 #ifndef __ELFSTRUC_H__
 #define __ELFSTRUC_H__
 
+#ifndef PACKED
+#define PACKED __attribute__((packed))
+#endif
+
+typedef uint8_t byte;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+
 /* all architectures */
 typedef unsigned char elf_unsigned_char;
 
@@ -591,14 +618,31 @@ typedef uint16_t elf64_quarter;
 #define ELFOSABI_86OPEN			5
 #define ELFOSABI_SOLARIS		6
 #define ELFOSABI_MONTEREY		7
+#define ELFOSABI_AIX			7	/* Monterey became AIX 5L */
 #define ELFOSABI_IRIX			8
 #define ELFOSABI_FREEBSD		9
 #define ELFOSABI_TRU64			10
 #define ELFOSABI_MODESTO		11
 #define ELFOSABI_OPENBSD		12
+#define ELFOSABI_ARM_AEABI		64
 #define ELFOSABI_ARM			97
 #define ELFOSABI_STANDALONE		255
 
+/* e_flags for EM_ARM */
+#define EF_ARM_RELEXEC			0x01
+#define EF_ARM_HASENTRY			0x02
+#define EF_ARM_INTERWORK		0x04
+#define EF_ARM_APCS_26			0x08
+#define EF_ARM_APCS_FLOAT		0x10
+#define EF_ARM_PIC			0x20
+#define EF_ARM_ALIGN8			0x40
+#define EF_ARM_NEW_ABI			0x80
+#define EF_ARM_OLD_ABI			0x100
+#define EF_ARM_SOFT_FLOAT		0x200
+#define EF_ARM_VFP_FLOAT		0x400
+#define EF_ARM_MAVERICK_FLOAT		0x800
+#define EF_ARM_EABIMASK			0xFF000000
+
 /* e_type */
 #define ELF_ET_NONE			0
 #define ELF_ET_REL			1
@@ -930,12 +974,9 @@ struct ELF_NHEADER32 {
 #define ELF_STT_FILE		4
 #define ELF_STT_COMMON		5
 
-#define ELF32_ST_BIND(i)		((i)>>4)
-#define ELF32_ST_TYPE(i)		((i)&0xf)
+/* ELF32/64_ST_BIND and _TYPE come from the uapi half above */
 #define ELF32_ST_INFO(b,t)	(((b)>>4)|((t)&0xf))
 
-#define ELF64_ST_BIND(i)		((i)>>4)
-#define ELF64_ST_TYPE(i)		((i)&0xf)
 #define ELF64_ST_INFO(b,t)	(((b)>>4)|((t)&0xf))
 
 struct ELF_SYMBOL32 {
@@ -960,8 +1001,6 @@ struct ELF_SYMBOL64 {
  *	ELF relocation
  */
 
-#define ELF32_R_SYM(i)		((i)>>8)
-#define ELF32_R_TYPE(i)		((unsigned char)(i))
 #define ELF32_R_INFO(s,t)	(((s)<<8)+(unsigned char)(t))
 
 #define ELF_R_386_NONE			0
@@ -975,6 +1014,16 @@ struct ELF_SYMBOL64 {
 #define ELF_R_386_RELATIVE		8
 #define ELF_R_386_GOTOFF		9
 #define ELF_R_386_GOTPC			10
+#define ELF_R_386_TLS_IE		15
+#define ELF_R_386_TLS_GOTIE		16
+#define ELF_R_386_TLS_GD		18
+#define ELF_R_386_TLS_LDM		19
+#define ELF_R_386_16			20
+#define ELF_R_386_PC16			21
+#define ELF_R_386_8			22
+#define ELF_R_386_PC8			23
+#define ELF_R_386_IRELATIVE		42
+#define ELF_R_386_GOT32X		43
 
 #define ELF_R_X86_64_NONE		0
 #define ELF_R_X86_64_64			1
@@ -992,6 +1041,31 @@ struct ELF_SYMBOL64 {
 #define ELF_R_X86_64_PC16		13
 #define ELF_R_X86_64_8			14
 #define ELF_R_X86_64_PC8		15
+#define ELF_R_X86_64_DTPOFF64		17
+#define ELF_R_X86_64_TPOFF64		18
+#define ELF_R_X86_64_TLSGD		19
+#define ELF_R_X86_64_TLSLD		20
+#define ELF_R_X86_64_GOTTPOFF		22
+#define ELF_R_X86_64_PC64		24
+#define ELF_R_X86_64_GOTOFF64		25
+#define ELF_R_X86_64_GOT64		27
+#define ELF_R_X86_64_GOTPCREL64		28
+#define ELF_R_X86_64_GOTPC64		29
+#define ELF_R_X86_64_GOTPLT64		30
+#define ELF_R_X86_64_PLTOFF64		31
+#define ELF_R_X86_64_SIZE64		33
+#define ELF_R_X86_64_IRELATIVE		37
+#define ELF_R_X86_64_GOTPCRELX		41
+#define ELF_R_X86_64_REX_GOTPCRELX	42
+
+#define ELF_R_AARCH64_ABS64		257
+#define ELF_R_AARCH64_ABS16		259
+#define ELF_R_AARCH64_PREL64		260
+#define ELF_R_AARCH64_PREL16		262
+#define ELF_R_AARCH64_GLOB_DAT		1025
+#define ELF_R_AARCH64_JUMP_SLOT		1026
+#define ELF_R_AARCH64_RELATIVE		1027
+#define ELF_R_AARCH64_IRELATIVE		1032
 
 struct ELF_REL32 {
 	elf32_addr	r_offset;
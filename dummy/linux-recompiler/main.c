@@ -0,0 +1,670 @@
+#include <getopt.h>
+
+#include "elf-parser.h"
+#include "elf-file.h"
+#include "elf-note.h"
+#include "elf-cache.h"
+#include "dwarf-line.h"
+#include "eh-frame.h"
+#include "elf-stats.h"
+#include "elf-arena.h"
+#include "elf-export.h"
+#include "elf-diff.h"
+#include "elf-hash.h"
+#include "elf-watch.h"
+#include "elf-daemon.h"
+#include "elf-filter.h"
+#include "elf-demangle.h"
+#include "elf-symview.h"
+#include "elf-scan.h"
+#include "elf-advise.h"
+#include "elf-search.h"
+#include "elf-sig.h"
+#include "elf-rewrite.h"
+#include "elf-xref.h"
+
+#define OPT_HEADER	0x01
+#define OPT_SECTIONS	0x02
+#define OPT_SYMBOLS	0x04
+#define OPT_TEXT	0x08
+#define OPT_BUILD_ID	0x10
+#define OPT_LINE	0x20
+#define OPT_FUNCTIONS	0x40
+#define OPT_STATS	0x80
+#define OPT_DIFF	0x100
+#define OPT_HASH	0x200
+#define OPT_WATCH	0x400
+#define OPT_DAEMON	0x800
+#define OPT_BY_ADDRESS	0x1000
+#define OPT_SCAN	0x2000
+#define OPT_SEARCH	0x4000
+#define OPT_SIGS	0x8000
+#define OPT_REWRITE	0x10000
+#define OPT_XREF	0x20000
+
+#define DAEMON_BUDGET_MB	256
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-hSsatbcfjC] [-l addr] [-R addr] [-F format] [-q filter] <elf-file>...\n", prog);
+	printf("       %s -x pattern... [-L] [-j] <elf-file>...\n", prog);
+	printf("       %s -g reference... [-j] <elf-file>...\n", prog);
+	printf("       %s -D [-j] <old-elf> <new-elf>\n", prog);
+	printf("       %s [-P offset:hex]... [-A name[,awx]=file]... -o out [-j] <elf-file>\n", prog);
+	printf("       %s -H fast|sha256 [-j] <elf-file>...\n", prog);
+	printf("       %s -w [-j] <elf-file>\n", prog);
+	printf("       %s -I [-j] <elf-file>...\n", prog);
+	printf("       %s -d socket [-M MiB]\n", prog);
+	printf("  -h  print ELF header\n");
+	printf("  -S  print section headers\n");
+	printf("  -s  print symbol tables\n");
+	printf("  -a  print symbols in address order, one line per address,\n"
+			"      with missing sizes inferred (marked *)\n");
+	printf("  -t  save .text to ./text.S\n");
+	printf("  -b  print GNU build-id\n");
+	printf("  -f  print function ranges recovered from .eh_frame\n");
+	printf("  -c  use the build-id keyed analysis cache\n");
+	printf("  -l  map addr to a source line using .debug_line\n");
+	printf("  -R  print the references to and from addr, found by\n"
+			"      disassembling the code and reading the relocations\n");
+	printf("  -j  print per-phase counters and timers as JSON to stderr\n");
+	printf("  -F  text (default), jsonl or columnar; the latter two\n"
+			"      only dump section headers and symbol tables\n");
+	printf("  -q  only dump symbols matching filter, e.g. \"type=func,name=foo*\"\n"
+			"      (terms: bind type vis shndx value size name prefix regex)\n");
+	printf("  -C  show C++ symbol names demangled, next to the raw name\n"
+			"      (text and jsonl)\n");
+	printf("  -D  report sections and symbols that differ between two files\n");
+	printf("  -H  print a content hash manifest of sections and PT_LOAD\n"
+			"      segments, flagging duplicates\n");
+	printf("  -w  dump again whenever the file changes, reusing what did not\n");
+	printf("  -I  one line per file (class, machine, sections, symbols,\n"
+			"      functions), reading many files at once\n");
+	printf("  -x  search sections for hex bytes, \"??\" any byte, \"4?\" any\n"
+			"      nibble, \"88/f8\" masked; repeat for several patterns\n");
+	printf("  -L  with -x, search the PT_LOAD segments instead\n");
+	printf("  -g  name the .eh_frame functions that match a function of\n"
+			"      a reference object or archive (libc.a); repeatable\n");
+	printf("  -P  overwrite bytes at a file offset, e.g. 0x1040:9090\n");
+	printf("  -A  add a section holding the contents of file; a, w or x\n"
+			"      loads it in a new segment with those permissions\n");
+	printf("  -o  write the edited file to out, copying unmodified ranges;\n"
+			"      out may be the input itself\n");
+	printf("  -d  answer queries on a Unix socket, keeping up to -M MiB\n"
+			"      (default %d) of parsed files in memory\n", DAEMON_BUDGET_MB);
+}
+
+static uint64_t line_addr;
+static uint64_t xref_addr;
+static uint32_t search_flags;
+static export_format_t format = FORMAT_TEXT;
+
+/* Diagnostics must not end up inside machine readable output */
+static FILE * msg_out(void)
+{
+	return format == FORMAT_TEXT ? stdout : stderr;
+}
+
+static void print_line_info(dwarf_line_t *dl)
+{
+	line_info_t info;
+
+	if(!dl) {
+		printf("No .debug_line\n");
+		return;
+	}
+
+	if(dwarf_line_lookup(dl, line_addr, &info))
+		printf("0x%08lx %s%s%s:%u\n", line_addr,
+				info.dir ? info.dir : "", info.dir ? "/" : "",
+				info.file ? info.file : "??", info.line);
+	else
+		printf("0x%08lx ??:0\n", line_addr);
+
+	debug("%u of %u line units decoded\n",
+			dwarf_line_decoded_count(dl), dwarf_line_unit_count(dl));
+	dwarf_line_close(dl);
+}
+
+static void print_eh_frame_functions(bool found, func_range_t *ranges, uint32_t count)
+{
+	if(!found) {
+		printf("No usable .eh_frame_hdr/.eh_frame\n");
+		return;
+	}
+
+	print_functions(ranges, count);
+	free(ranges);
+}
+
+static void print_xrefs(elf_file_t *ef, func_range_t *ranges, uint32_t count)
+{
+	xref_index_t *xi;
+	const xref_ref_t *refs;
+	elf_status_t status;
+	uint64_t i, n;
+
+	status = xref_build(ef, ranges, count, &xi);
+	free(ranges);
+	if(status == ELF_ERR_NOTFOUND) {
+		printf("No PT_LOAD segments\n");
+		return;
+	} else if(status != ELF_OK) {
+		fprintf(msg_out(), "Xrefs: %s\n", elf_strerror(status));
+		return;
+	}
+
+	n = xref_to(xi, xref_addr, &refs);
+	printf("References to 0x%08lx: %lu\n", xref_addr, n);
+	for(i=0; i<n; i++)
+		printf("  0x%08lx\t%s\n", refs[i].addr, xref_kind_name(refs[i].kind));
+	n = xref_from(xi, xref_addr, &refs);
+	printf("References from 0x%08lx: %lu\n", xref_addr, n);
+	for(i=0; i<n; i++)
+		printf("  0x%08lx\t%s\n", refs[i].addr, xref_kind_name(refs[i].kind));
+	printf("%lu references from %lu addresses to %lu addresses\n",
+			xref_count(xi), xref_source_count(xi), xref_target_count(xi));
+	xref_close(xi);
+}
+
+static void dump64(elf_file_t *ef, uint32_t opts, bool use_cache)
+{
+	int32_t fd = elf_fd(ef);
+	Elf64_Ehdr eh = *elf_ehdr64(ef);
+	Elf64_Shdr* sh_tbl;
+	elf_status_t status;
+	build_id_t bid;
+	uint32_t shnum;
+	bool has_id;
+
+	/* elf_open() checked the magic, this only prints the banner */
+	if(format == FORMAT_TEXT && !is_ELF64(eh))
+		return;
+
+	/* Only the note segment is read here, never the whole file */
+	stats_begin(PHASE_BUILD_ID);
+	has_id = read_build_id64(fd, eh, &bid);
+	if(opts & OPT_BUILD_ID)
+		printf("Build ID\t= %s\n\n", has_id ? bid.hex : "(none)");
+	if(use_cache && has_id)
+		cache_open(&bid, fd, eh.e_shoff,
+				(uint64_t)read_section_count64(fd, eh) * eh.e_shentsize);
+	stats_end();
+
+	if(opts & OPT_HEADER) {
+		stats_begin(PHASE_HEADER);
+		print_elf_header64(eh);
+		stats_end();
+	}
+
+	if(opts & (OPT_SECTIONS|OPT_SYMBOLS|OPT_BY_ADDRESS|OPT_TEXT|OPT_LINE|OPT_FUNCTIONS
+				|OPT_SEARCH|OPT_SIGS|OPT_XREF)) {
+		stats_begin(PHASE_SHDRS);
+		status = elf_read_shdrs(ef);
+		stats_end();
+		if(status != ELF_OK) {
+			fprintf(msg_out(), "Section headers: %s\n", elf_strerror(status));
+			goto EXIT;
+		}
+		shnum = elf_section_count(ef);
+		sh_tbl = elf_shdrs64(ef);
+		if(!shnum && (opts & ~(OPT_HEADER|OPT_BUILD_ID|OPT_FUNCTIONS|OPT_SIGS|OPT_XREF)))
+			fprintf(msg_out(), "No section headers\n");
+
+		if(shnum && (opts & OPT_SECTIONS)) {
+			stats_begin(PHASE_SECTIONS);
+			if(format == FORMAT_TEXT) {
+				status = print_section_headers64(fd, eh, sh_tbl);
+				if(status != ELF_OK)
+					fprintf(msg_out(), "Section headers: %s\n", elf_strerror(status));
+			} else
+				export_sections64(fd, eh, sh_tbl, format);
+			stats_end();
+		}
+		if(shnum && (opts & OPT_SYMBOLS)) {
+			stats_begin(PHASE_SYMBOLS);
+			if(format == FORMAT_TEXT) {
+				status = print_symbols64(fd, eh, sh_tbl);
+				if(status != ELF_OK)
+					fprintf(msg_out(), "Symbols: %s\n", elf_strerror(status));
+			} else
+				export_symbols64(fd, eh, sh_tbl, format);
+			stats_end();
+		}
+		if(shnum && (opts & OPT_BY_ADDRESS)) {
+			stats_begin(PHASE_SYMBOLS);
+			print_symbol_views64(fd, eh, sh_tbl);
+			stats_end();
+		}
+		if(shnum && (opts & OPT_TEXT)) {
+			stats_begin(PHASE_TEXT);
+			status = save_text_section64(fd, eh, sh_tbl);
+			if(status != ELF_OK)
+				fprintf(msg_out(), "Text section: %s\n", elf_strerror(status));
+			stats_end();
+		}
+		if(shnum && (opts & OPT_LINE)) {
+			stats_begin(PHASE_LINE);
+			print_line_info(dwarf_line_open64(fd, eh, sh_tbl));
+			stats_end();
+		}
+		if(opts & OPT_FUNCTIONS) {
+			func_range_t *ranges;
+			uint32_t count;
+			bool found;
+
+			stats_begin(PHASE_FUNCTIONS);
+			found = eh_frame_functions64(fd, eh, shnum ? sh_tbl : NULL,
+					&ranges, &count);
+			print_eh_frame_functions(found, ranges, count);
+			stats_end();
+		}
+		if(opts & OPT_SEARCH) {
+			stats_begin(PHASE_SEARCH);
+			if(!search_file(ef, search_flags))
+				fprintf(msg_out(), "Search: unable to map the file\n");
+			stats_end();
+		}
+		if(opts & OPT_SIGS) {
+			func_range_t *ranges;
+			uint32_t count;
+
+			stats_begin(PHASE_SIGS);
+			if(!eh_frame_functions64(fd, eh, shnum ? sh_tbl : NULL, &ranges, &count)) {
+				printf("No usable .eh_frame_hdr/.eh_frame\n");
+			} else {
+				if(!sig_match(ef, ranges, count))
+					fprintf(msg_out(), "Signatures: unable to map the file\n");
+				free(ranges);
+			}
+			stats_end();
+		}
+		if(opts & OPT_XREF) {
+			func_range_t *ranges = NULL;
+			uint32_t count = 0;
+
+			stats_begin(PHASE_XREF);
+			/* Function starts only resynchronize the sweep */
+			if(!eh_frame_functions64(fd, eh, shnum ? sh_tbl : NULL, &ranges, &count)) {
+				ranges = NULL;
+				count = 0;
+			}
+			print_xrefs(ef, ranges, count);
+			stats_end();
+		}
+	}
+
+EXIT:
+	cache_close();
+}
+
+static void dump32(elf_file_t *ef, uint32_t opts, bool use_cache)
+{
+	int32_t fd = elf_fd(ef);
+	Elf32_Ehdr eh = *elf_ehdr(ef);
+	Elf32_Shdr* sh_tbl;
+	elf_status_t status;
+	build_id_t bid;
+	uint32_t shnum;
+	bool has_id;
+
+	/* elf_open() checked the magic, this only prints the banner */
+	if(format == FORMAT_TEXT && !is_ELF(eh))
+		return;
+
+	stats_begin(PHASE_BUILD_ID);
+	has_id = read_build_id(fd, eh, &bid);
+	if(opts & OPT_BUILD_ID)
+		printf("Build ID\t= %s\n\n", has_id ? bid.hex : "(none)");
+	if(use_cache && has_id)
+		cache_open(&bid, fd, eh.e_shoff,
+				(uint64_t)read_section_count(fd, eh) * eh.e_shentsize);
+	stats_end();
+
+	if(opts & OPT_HEADER) {
+		stats_begin(PHASE_HEADER);
+		print_elf_header(eh);
+		stats_end();
+	}
+
+	if(opts & (OPT_SECTIONS|OPT_SYMBOLS|OPT_BY_ADDRESS|OPT_TEXT|OPT_LINE|OPT_FUNCTIONS
+				|OPT_SEARCH|OPT_SIGS|OPT_XREF)) {
+		stats_begin(PHASE_SHDRS);
+		status = elf_read_shdrs(ef);
+		stats_end();
+		if(status != ELF_OK) {
+			fprintf(msg_out(), "Section headers: %s\n", elf_strerror(status));
+			goto EXIT;
+		}
+		shnum = elf_section_count(ef);
+		sh_tbl = elf_shdrs(ef);
+		if(!shnum && (opts & ~(OPT_HEADER|OPT_BUILD_ID|OPT_FUNCTIONS|OPT_SIGS|OPT_XREF)))
+			fprintf(msg_out(), "No section headers\n");
+
+		if(shnum && (opts & OPT_SECTIONS)) {
+			stats_begin(PHASE_SECTIONS);
+			if(format == FORMAT_TEXT) {
+				status = print_section_headers(fd, eh, sh_tbl);
+				if(status != ELF_OK)
+					fprintf(msg_out(), "Section headers: %s\n", elf_strerror(status));
+			} else
+				export_sections(fd, eh, sh_tbl, format);
+			stats_end();
+		}
+		if(shnum && (opts & OPT_SYMBOLS)) {
+			stats_begin(PHASE_SYMBOLS);
+			if(format == FORMAT_TEXT) {
+				status = print_symbols(fd, eh, sh_tbl);
+				if(status != ELF_OK)
+					fprintf(msg_out(), "Symbols: %s\n", elf_strerror(status));
+			} else
+				export_symbols(fd, eh, sh_tbl, format);
+			stats_end();
+		}
+		if(shnum && (opts & OPT_BY_ADDRESS)) {
+			stats_begin(PHASE_SYMBOLS);
+			print_symbol_views(fd, eh, sh_tbl);
+			stats_end();
+		}
+		if(shnum && (opts & OPT_TEXT)) {
+			stats_begin(PHASE_TEXT);
+			status = save_text_section(fd, eh, sh_tbl);
+			if(status != ELF_OK)
+				fprintf(msg_out(), "Text section: %s\n", elf_strerror(status));
+			stats_end();
+		}
+		if(shnum && (opts & OPT_LINE)) {
+			stats_begin(PHASE_LINE);
+			print_line_info(dwarf_line_open(fd, eh, sh_tbl));
+			stats_end();
+		}
+		if(opts & OPT_FUNCTIONS) {
+			func_range_t *ranges;
+			uint32_t count;
+			bool found;
+
+			stats_begin(PHASE_FUNCTIONS);
+			found = eh_frame_functions(fd, eh, shnum ? sh_tbl : NULL,
+					&ranges, &count);
+			print_eh_frame_functions(found, ranges, count);
+			stats_end();
+		}
+		if(opts & OPT_SEARCH) {
+			stats_begin(PHASE_SEARCH);
+			if(!search_file(ef, search_flags))
+				fprintf(msg_out(), "Search: unable to map the file\n");
+			stats_end();
+		}
+		if(opts & OPT_SIGS) {
+			func_range_t *ranges;
+			uint32_t count;
+
+			stats_begin(PHASE_SIGS);
+			if(!eh_frame_functions(fd, eh, shnum ? sh_tbl : NULL, &ranges, &count)) {
+				printf("No usable .eh_frame_hdr/.eh_frame\n");
+			} else {
+				if(!sig_match(ef, ranges, count))
+					fprintf(msg_out(), "Signatures: unable to map the file\n");
+				free(ranges);
+			}
+			stats_end();
+		}
+		if(opts & OPT_XREF) {
+			func_range_t *ranges = NULL;
+			uint32_t count = 0;
+
+			stats_begin(PHASE_XREF);
+			/* Function starts only resynchronize the sweep */
+			if(!eh_frame_functions(fd, eh, shnum ? sh_tbl : NULL, &ranges, &count)) {
+				ranges = NULL;
+				count = 0;
+			}
+			print_xrefs(ef, ranges, count);
+			stats_end();
+		}
+	}
+
+EXIT:
+	cache_close();
+}
+
+static bool dump_file(const char *path, uint32_t opts, bool use_cache)
+{
+	elf_file_t *ef;
+	elf_status_t status;
+
+	stats_begin(PHASE_HEADER);
+	status = elf_open(path, &ef);
+	stats_end();
+	if(status == ELF_ERR_OPEN) {
+		fprintf(msg_out(), "Error %d Unable to open %s\n", errno, path);
+		return false;
+	} else if(status != ELF_OK) {
+		fprintf(msg_out(), "%s: %s\n", path, elf_strerror(status));
+		return false;
+	}
+
+	/* Everything read for this file is dropped by elf_close() */
+	arena_use(elf_arena(ef));
+	if(elf_is64(ef))
+		dump64(ef, opts, use_cache);
+	else
+		dump32(ef, opts, use_cache);
+
+	elf_close(ef);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t opts = 0;
+	bool use_cache = false, with_sha = false, symbol_opts = false, batch, ok = true;
+	const char *socket_path = NULL, *out_path = NULL;
+	uint64_t budget_mb = DAEMON_BUDGET_MB;
+	sym_filter_t filter;
+	int c;
+
+	while((c = getopt(argc, argv, "hSsatbcfjCDwILl:F:H:d:M:q:x:g:P:A:o:R:")) != -1) {
+		switch(c)
+		{
+			case 'h': opts |= OPT_HEADER; break;
+			case 'S': opts |= OPT_SECTIONS; break;
+			case 's': opts |= OPT_SYMBOLS; break;
+			case 'a': opts |= OPT_BY_ADDRESS; break;
+			case 't': opts |= OPT_TEXT; break;
+			case 'b': opts |= OPT_BUILD_ID; break;
+			case 'f': opts |= OPT_FUNCTIONS; break;
+			case 'c': use_cache = true; break;
+			case 'j': opts |= OPT_STATS; break;
+			case 'D': opts |= OPT_DIFF; break;
+			case 'w': opts |= OPT_WATCH; break;
+			case 'I': opts |= OPT_SCAN; break;
+			case 'L': search_flags |= SEARCH_SEGMENTS; break;
+			case 'x':
+				if(!search_add(optarg)) {
+					fprintf(stderr, "bad pattern: %s\n", optarg);
+					return 1;
+				}
+				opts |= OPT_SEARCH;
+				break;
+			case 'g':
+				if(!sig_add_reference(optarg))
+					return 1;
+				opts |= OPT_SIGS;
+				break;
+			case 'P':
+				if(!rewrite_add_patch(optarg)) {
+					fprintf(stderr, "bad patch: %s\n", optarg);
+					return 1;
+				}
+				opts |= OPT_REWRITE;
+				break;
+			case 'A':
+				if(!rewrite_add_section_file(optarg)) {
+					fprintf(stderr, "bad section: %s\n", optarg);
+					return 1;
+				}
+				opts |= OPT_REWRITE;
+				break;
+			case 'o':
+				out_path = optarg;
+				opts |= OPT_REWRITE;
+				break;
+			case 'R':
+				opts |= OPT_XREF;
+				xref_addr = strtoull(optarg, NULL, 16);
+				break;
+			case 'l':
+				opts |= OPT_LINE;
+				line_addr = strtoull(optarg, NULL, 16);
+				break;
+			case 'H':
+				opts |= OPT_HASH;
+				if(!strcmp(optarg, "sha256"))
+					with_sha = true;
+				else if(strcmp(optarg, "fast")) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'd':
+				opts |= OPT_DAEMON;
+				socket_path = optarg;
+				break;
+			case 'M':
+				budget_mb = strtoull(optarg, NULL, 10);
+				break;
+			case 'q':
+				if(filter_current() || !filter_parse(optarg, &filter)) {
+					fprintf(stderr, "bad filter: %s\n", optarg);
+					return 1;
+				}
+				filter_use(&filter);
+				symbol_opts = true;
+				break;
+			case 'C':
+				demangle_enable(true);
+				symbol_opts = true;
+				break;
+			case 'F':
+				if(!parse_export_format(optarg, &format)) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	/* -q and -C shape the symbol dump, -s unless another one was asked for */
+	if(symbol_opts && !(opts & OPT_BY_ADDRESS))
+		opts |= OPT_SYMBOLS;
+
+	if(opts & OPT_DAEMON) {
+		if(optind != argc || opts != OPT_DAEMON || format != FORMAT_TEXT) {
+			usage(argv[0]);
+			return 1;
+		}
+		return daemon_serve(socket_path, budget_mb << 20);
+	}
+
+	if(optind == argc || (format != FORMAT_TEXT
+				&& (opts & ~(OPT_SECTIONS|OPT_SYMBOLS|OPT_STATS)))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(opts & OPT_STATS)
+		stats_enable();
+
+	if(opts & OPT_DIFF) {
+		if(argc - optind != 2 || (opts & ~(OPT_DIFF|OPT_STATS))) {
+			usage(argv[0]);
+			return 2;
+		}
+		stats_begin(PHASE_DIFF);
+		c = elf_diff(argv[optind], argv[optind + 1]);
+		stats_end();
+		if(opts & OPT_STATS)
+			stats_print_json(stderr, argv[optind + 1]);
+		return c;
+	}
+
+	if(opts & OPT_REWRITE) {
+		if(argc - optind != 1 || !out_path || (opts & ~(OPT_REWRITE|OPT_STATS))) {
+			usage(argv[0]);
+			return 1;
+		}
+		stats_begin(PHASE_REWRITE);
+		ok = rewrite_run(argv[optind], out_path);
+		stats_end();
+		if(opts & OPT_STATS)
+			stats_print_json(stderr, out_path);
+		return ok ? 0 : 1;
+	}
+
+	if(opts & OPT_WATCH) {
+		if(argc - optind != 1 || (opts & ~(OPT_WATCH|OPT_STATS))) {
+			usage(argv[0]);
+			return 1;
+		}
+		return watch_file(argv[optind], opts & OPT_STATS);
+	}
+
+	if(opts & OPT_HASH) {
+		if(opts & ~(OPT_HASH|OPT_STATS)) {
+			usage(argv[0]);
+			return 1;
+		}
+		for(; optind<argc; optind++) {
+			stats_begin(PHASE_HASH);
+			ok &= hash_manifest(argv[optind], with_sha);
+			stats_end();
+			if(opts & OPT_STATS) {
+				stats_print_json(stderr, argv[optind]);
+				stats_reset();
+			}
+		}
+		return ok ? 0 : 1;
+	}
+	if(opts & OPT_SCAN) {
+		if(opts & ~(OPT_SCAN|OPT_STATS)) {
+			usage(argv[0]);
+			return 1;
+		}
+		stats_begin(PHASE_SCAN);
+		ok = scan_files(argv + optind, argc - optind);
+		stats_end();
+		if(opts & OPT_STATS)
+			stats_print_json(stderr, argv[optind]);
+		return ok ? 0 : 1;
+	}
+	if(!(opts & ~OPT_STATS))
+		opts |= OPT_HEADER|OPT_SECTIONS|OPT_SYMBOLS;
+
+	/* The references are read once for all the files */
+	if((opts & OPT_SIGS) && !sig_build())
+		return 1;
+
+	/* In batch mode every file gets its own stats line, and the pages
+	 * read for one file are given back before the next
+	 */
+	batch = argc - optind > 1;
+	if(batch)
+		advise_use(advise_flags() | ADVISE_DROP);
+	for(; optind<argc; optind++) {
+		if(format != FORMAT_TEXT)
+			export_file(format, argv[optind]);
+		else if(batch)
+			printf("%s:\n", argv[optind]);
+		ok &= dump_file(argv[optind], opts, use_cache);
+		if(opts & OPT_STATS) {
+			stats_print_json(stderr, argv[optind]);
+			stats_reset();
+		}
+	}
+
+	return ok ? 0 : 1;
+}
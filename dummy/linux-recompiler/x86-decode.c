@@ -0,0 +1,312 @@
+#include "x86-decode.h"
+
+#define M	0x0001	/* ModRM follows */
+#define I8	0x0002
+#define IZ	0x0004	/* 16 or 32 bits by operand size */
+#define I16	0x0008
+#define IV	0x0010	/* 16, 32 or 64 bits by operand size */
+#define AO	0x0020	/* moffs, by address size */
+#define FAR	0x0040	/* ptr16:16 or ptr16:32 */
+#define B64	0x0080	/* invalid in 64-bit mode */
+#define BAD	0x0100
+#define PFX	0x0200
+#define CALL	0x0400	/* relative branches, the immediate is the displacement */
+#define JMP	0x0800
+#define JCC	0x1000
+#define GRP3	0x2000	/* F6, F7: the immediate is there for /0 and /1 only */
+#define ESC	0x4000	/* 0F, 0F 38, 0F 3A */
+
+#define M16	M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M
+
+static const uint16_t one_byte[256] = {
+	/* 00 */ M, M, M, M, I8, IZ, B64, B64, M, M, M, M, I8, IZ, B64, ESC,
+	/* 10 */ M, M, M, M, I8, IZ, B64, B64, M, M, M, M, I8, IZ, B64, B64,
+	/* 20 */ M, M, M, M, I8, IZ, PFX, B64, M, M, M, M, I8, IZ, PFX, B64,
+	/* 30 */ M, M, M, M, I8, IZ, PFX, B64, M, M, M, M, I8, IZ, PFX, B64,
+	/* 40 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 50 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 60 */ B64, B64, M|B64, M, PFX, PFX, PFX, PFX, IZ, M|IZ, I8, M|I8, 0, 0, 0, 0,
+	/* 70 */ JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8,
+		 JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8, JCC|I8,
+	/* 80 */ M|I8, M|IZ, M|I8|B64, M|I8, M, M, M, M, M, M, M, M, M, M, M, M,
+	/* 90 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, FAR|B64, 0, 0, 0, 0, 0,
+	/* A0 */ AO, AO, AO, AO, 0, 0, 0, 0, I8, IZ, 0, 0, 0, 0, 0, 0,
+	/* B0 */ I8, I8, I8, I8, I8, I8, I8, I8, IV, IV, IV, IV, IV, IV, IV, IV,
+	/* C0 */ M|I8, M|I8, I16, 0, M|B64, M|B64, M|I8, M|IZ, I16|I8, 0, I16, 0, 0, I8, B64, 0,
+	/* D0 */ M, M, M, M, I8|B64, I8|B64, BAD, 0, M, M, M, M, M, M, M, M,
+	/* E0 */ JCC|I8, JCC|I8, JCC|I8, JCC|I8, I8, I8, I8, I8,
+		 CALL|IZ, JMP|IZ, FAR|B64, JMP|I8, 0, 0, 0, 0,
+	/* F0 */ PFX, 0, PFX, PFX, 0, 0, M|GRP3, M|GRP3, 0, 0, 0, 0, 0, 0, M, M,
+};
+
+/* 0F xx; also the immediates of the VEX and EVEX 0F map */
+static const uint16_t two_byte[256] = {
+	/* 00 */ M, M, M, M, BAD, 0, 0, 0, 0, 0, BAD, 0, BAD, M, 0, M|I8,
+	/* 10 */ M16,
+	/* 20 */ M, M, M, M, BAD, BAD, BAD, BAD, M, M, M, M, M, M, M, M,
+	/* 30 */ 0, 0, 0, 0, 0, 0, BAD, 0, ESC, BAD, ESC, BAD, BAD, BAD, BAD, BAD,
+	/* 40 */ M16,
+	/* 50 */ M16,
+	/* 60 */ M16,
+	/* 70 */ M|I8, M|I8, M|I8, M|I8, M, M, M, 0, M, M, BAD, BAD, M, M, M, M,
+	/* 80 */ JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ,
+		 JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ, JCC|IZ,
+	/* 90 */ M16,
+	/* A0 */ 0, 0, 0, M, M|I8, M, BAD, BAD, 0, 0, 0, M, M|I8, M, M, M,
+	/* B0 */ M, M, M, M, M, M, M, M, M, M, M|I8, M, M, M, M, M,
+	/* C0 */ M, M, M|I8, M, M|I8, M|I8, M|I8, M, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* D0 */ M16,
+	/* E0 */ M16,
+	/* F0 */ M16,
+};
+
+typedef struct state {
+	const uint8_t *p;
+	const uint8_t *end;
+	bool mode64;
+	bool opsize16;		/* 66 */
+	bool addr_toggle;	/* 67 */
+	bool rex_w;
+	bool rip;		/* mem is relative to the next instruction */
+	uint8_t reg;		/* ModRM reg field, the opcode extension */
+} state_t;
+
+static inline bool take(state_t *s, uint32_t n)
+{
+	if((uint64_t)(s->end - s->p) < n)
+		return false;
+	s->p += n;
+	return true;
+}
+
+static inline int64_t signed_at(const uint8_t *p, uint32_t n)
+{
+	switch(n)
+	{
+		case 1: return (int8_t)p[0];
+		case 2: return (int16_t)(p[0] | p[1] << 8);
+		case 4: return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8
+				| (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+	}
+	return 0;
+}
+
+static inline uint64_t unsigned_at(const uint8_t *p, uint32_t n)
+{
+	uint64_t v = 0;
+
+	while(n--)
+		v = v << 8 | p[n];
+	return v;
+}
+
+/* ModRM, SIB and displacement; notes the address when it is not made
+ * from registers
+ */
+static bool modrm(state_t *s, x86_insn_t *insn)
+{
+	uint8_t m, mod, rm, sib;
+	const uint8_t *disp;
+
+	if(!take(s, 1))
+		return false;
+	m = s->p[-1];
+	s->reg = (m >> 3) & 7;
+	mod = m >> 6;
+	rm = m & 7;
+	if(mod == 3)
+		return true;
+
+	/* 16-bit addressing, no SIB */
+	if(!s->mode64 && s->addr_toggle) {
+		if(mod == 1)
+			return take(s, 1);
+		if(mod == 2 || rm == 6)
+			return take(s, 2);
+		return true;
+	}
+
+	if(rm == 4) {
+		if(!take(s, 1))
+			return false;
+		sib = s->p[-1];
+		if(mod == 0 && (sib & 7) == 5) {
+			/* disp32, plus an index maybe: the table of a switch */
+			disp = s->p;
+			if(!take(s, 4))
+				return false;
+			insn->has_mem = true;
+			insn->mem = (uint64_t)signed_at(disp, 4);
+			return true;
+		}
+	} else if(mod == 0 && rm == 5) {
+		disp = s->p;
+		if(!take(s, 4))
+			return false;
+		insn->has_mem = true;
+		insn->mem = (uint64_t)signed_at(disp, 4);
+		s->rip = s->mode64;
+		if(!s->mode64)
+			insn->mem &= 0xffffffff;
+		return true;
+	}
+	if(mod == 1)
+		return take(s, 1);
+	if(mod == 2)
+		return take(s, 4);
+	return true;
+}
+
+static uint32_t imm_size(const state_t *s, uint16_t f)
+{
+	uint32_t n = 0;
+
+	if(f & I8)
+		n += 1;
+	if(f & I16)
+		n += 2;
+	if(f & IZ)
+		n += s->opsize16 && !s->rex_w ? 2 : 4;
+	if(f & IV)
+		n += s->rex_w ? 8 : s->opsize16 ? 2 : 4;
+	if(f & FAR)
+		n += (s->opsize16 ? 2 : 4) + 2;
+	return n;
+}
+
+/* VEX, EVEX and XOP: map is 1, 2 or 3 for 0F, 0F 38 and 0F 3A, and
+ * 8, 9 or 10 for the XOP maps
+ */
+static bool vex_body(state_t *s, uint32_t map, x86_insn_t *insn)
+{
+	uint8_t op;
+
+	if(!take(s, 1))
+		return false;
+	op = s->p[-1];
+	if(map == 1 && op == 0x77)	/* vzeroupper, vzeroall */
+		return true;
+	if(!modrm(s, insn))
+		return false;
+	switch(map)
+	{
+		case 1: return (two_byte[op] & I8) ? take(s, 1) : true;
+		case 3:
+		case 8: return take(s, 1);
+		case 10: return take(s, 4);
+	}
+	return true;
+}
+
+bool x86_decode(const uint8_t *code, uint64_t size, uint64_t addr, bool mode64, x86_insn_t *insn)
+{
+	state_t s;
+	uint16_t f;
+	uint8_t op, rex = 0;
+	const uint8_t *imm;
+	uint32_t n;
+
+	memset(insn, 0, sizeof(*insn));
+	memset(&s, 0, sizeof(s));
+	s.p = code;
+	s.end = code + (size < X86_MAX_LENGTH ? size : X86_MAX_LENGTH);
+	s.mode64 = mode64;
+
+	/* Legacy prefixes, then REX right before the opcode */
+	for(;;) {
+		if(!take(&s, 1))
+			return false;
+		op = s.p[-1];
+		if(mode64 && (op & 0xf0) == 0x40) {
+			rex = op;
+			continue;
+		}
+		if(!(one_byte[op] & PFX))
+			break;
+		if(op == 0x66)
+			s.opsize16 = true;
+		else if(op == 0x67)
+			s.addr_toggle = true;
+		rex = 0;
+	}
+	s.rex_w = (rex & 0x08) != 0;
+
+	/* VEX and EVEX reuse LES, LDS and BOUND, which need a memory operand */
+	if((op == 0xc4 || op == 0xc5 || op == 0x62)
+			&& (mode64 || (s.p < s.end && (s.p[0] & 0xc0) == 0xc0))) {
+		if(op == 0xc5) {
+			if(!take(&s, 1) || !vex_body(&s, 1, insn))
+				return false;
+		} else if(op == 0xc4) {
+			if(!take(&s, 2) || !vex_body(&s, s.p[-2] & 0x1f, insn))
+				return false;
+		} else {
+			if(!take(&s, 3) || !vex_body(&s, s.p[-3] & 0x07, insn))
+				return false;
+		}
+		goto DONE;
+	}
+	/* XOP, where POP Ev would have /0 */
+	if(op == 0x8f && s.p < s.end && (s.p[0] & 0x1f) >= 8) {
+		if(!take(&s, 2) || !vex_body(&s, s.p[-2] & 0x1f, insn))
+			return false;
+		goto DONE;
+	}
+
+	f = one_byte[op];
+	if(f & ESC) {
+		if(!take(&s, 1))
+			return false;
+		op = s.p[-1];
+		if(op == 0x38 || op == 0x3a) {
+			if(!take(&s, 1) || !modrm(&s, insn))
+				return false;
+			if(op == 0x3a && !take(&s, 1))
+				return false;
+			goto DONE;
+		}
+		f = two_byte[op];
+		if(f & BAD)
+			return false;
+	} else {
+		if((f & BAD) || (mode64 && (f & B64)))
+			return false;
+		if(op == 0x8d)
+			insn->lea = true;
+	}
+
+	if((f & M) && !modrm(&s, insn))
+		return false;
+	/* TEST has the immediate, NOT, NEG, MUL and DIV do not */
+	if((f & GRP3) && s.reg <= 1)
+		f |= op == 0xf6 ? I8 : IZ;
+	n = imm_size(&s, f);
+	if(f & AO)
+		n = mode64 ? (s.addr_toggle ? 4 : 8) : (s.addr_toggle ? 2 : 4);
+	/* Near branches take a 32-bit displacement in 64-bit mode */
+	if((f & (CALL|JMP|JCC)) && (f & IZ) && mode64)
+		n = 4;
+	imm = s.p;
+	if(!take(&s, n))
+		return false;
+
+	if(f & AO) {
+		insn->has_mem = true;
+		insn->mem = unsigned_at(imm, n);
+	}
+	if(f & (CALL|JMP|JCC)) {
+		insn->flow = f & CALL ? X86_FLOW_CALL : f & JMP ? X86_FLOW_JUMP : X86_FLOW_COND;
+		insn->target = addr + (s.p - code) + signed_at(imm, n);
+		if(!mode64)
+			insn->target &= 0xffffffff;
+	}
+
+DONE:
+	insn->length = s.p - code;
+	if(s.rip) {
+		insn->mem += addr + insn->length;
+		if(s.addr_toggle)
+			insn->mem &= 0xffffffff;
+	}
+	return true;
+}
@@ -0,0 +1,37 @@
+#ifndef _X86_DECODE_H
+#define _X86_DECODE_H
+
+#include "elf-parser.h"
+
+/* x86 and x86-64 instruction lengths, for a linear sweep.
+ *
+ * Only as much of an instruction is decoded as it takes to find its
+ * length and the addresses it names: the target of a relative branch,
+ * and the address of a memory operand when the address does not depend
+ * on a register (RIP-relative in 64-bit mode, an absolute disp32 or
+ * moffs otherwise).  Legacy, REX, VEX, EVEX and XOP encodings are
+ * covered by opcode tables; operands and registers are not.
+ */
+
+typedef enum x86_flow {
+	X86_FLOW_NONE,
+	X86_FLOW_CALL,		/* call rel */
+	X86_FLOW_JUMP,		/* jmp rel */
+	X86_FLOW_COND,		/* jcc, loop, jcxz rel */
+} x86_flow_t;
+
+typedef struct x86_insn {
+	uint8_t length;
+	uint8_t flow;		/* x86_flow_t, target valid unless NONE */
+	bool has_mem;		/* mem valid */
+	bool lea;		/* the operand is an address, not read or written */
+	uint64_t target;
+	uint64_t mem;
+} x86_insn_t;
+
+#define X86_MAX_LENGTH	15
+
+/* False for an invalid opcode or one running past size */
+bool x86_decode(const uint8_t *code, uint64_t size, uint64_t addr, bool mode64, x86_insn_t *insn);
+
+#endif /* _X86_DECODE_H */
@@ -0,0 +1,58 @@
+﻿// This source code is a part of Sharp Linux Recompiler
+// Copyright (C) 2020. rollrat. Licensed under the MIT Licence.
+
+using ELFSharp.ELF;
+using System;
+using System.Diagnostics;
+
+namespace linux_recompiler
+{
+    /// <summary>
+    /// Times ELF load and .text disassembly, the managed half of the
+    /// benchmark suite (see dummy/linux-recompiler/bench).
+    /// </summary>
+    public static class Bench
+    {
+        const int iterations = 3;
+
+        public static void Run(string[] paths)
+        {
+            foreach (var path in paths)
+            {
+                Console.WriteLine($"{path}:");
+
+                var sw = Stopwatch.StartNew();
+                for (int i = 0; i < iterations; i++)
+                    ELFReader.Load(path).Dispose();
+                report("load", sw.Elapsed.TotalSeconds / iterations, 0, 0);
+
+                using (var elf = ELFReader.Load(path))
+                {
+                    if (!elf.TryGetSection(".text", out var text))
+                    {
+                        Console.WriteLine("  no .text");
+                        continue;
+                    }
+
+                    var bytes = text.GetContents();
+                    long count = 0;
+                    sw.Restart();
+                    for (int i = 0; i < iterations; i++)
+                        count = Target.disasm(bytes).Count;
+                    report("disasm", sw.Elapsed.TotalSeconds / iterations, count, bytes.Length);
+                }
+
+                Console.WriteLine();
+            }
+        }
+
+        static void report(string phase, double seconds, long items, long bytes)
+        {
+            var peak = Process.GetCurrentProcess().PeakWorkingSet64 / 1024;
+            Console.Write($"  {phase,-10} {iterations,8} {seconds * 1e3,12:F3} ms");
+            Console.Write(items > 0 ? $" {items / seconds,12:F0} items/s" : new string(' ', 21));
+            Console.Write(bytes > 0 ? $" {bytes / seconds / (1 << 20),10:F1} MB/s" : new string(' ', 16));
+            Console.WriteLine($" {peak,10} KB");
+        }
+    }
+}
@@ -0,0 +1,44 @@
+﻿// This source code is a part of Sharp Linux Recompiler
+// Copyright (C) 2020. rollrat. Licensed under the MIT Licence.
+
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+
+namespace linux_recompiler
+{
+    /// <summary>
+    /// Function ranges for a binary without .symtab, read from the output
+    /// of the native parser's -f (one "0xstart 0xend size" line per function,
+    /// taken from .eh_frame_hdr or a walk of .eh_frame).  Other lines are
+    /// ignored, so the whole output can be saved as is.
+    /// </summary>
+    public static class EhFrame
+    {
+        static bool parse_address(string field, out ulong address)
+        {
+            address = 0;
+            return field.StartsWith("0x") &&
+                ulong.TryParse(field.Substring(2), NumberStyles.HexNumber, null, out address);
+        }
+
+        public static List<(ulong Start, ulong End)> Load(string path)
+        {
+            var functions = new List<(ulong, ulong)>();
+
+            foreach (var line in File.ReadLines(path))
+            {
+                var fields = line.Split(' ');
+                if (fields.Length < 3)
+                    continue;
+                if (!parse_address(fields[0], out var start) || !parse_address(fields[1], out var end))
+                    continue;
+                if (end > start)
+                    functions.Add((start, end));
+            }
+
+            return functions;
+        }
+    }
+}
@@ -3,6 +3,7 @@
 
 using SharpDisasm;
 using System;
+using System.Collections.Generic;
 
 namespace linux_recompiler
 {
@@ -10,7 +11,29 @@ namespace linux_recompiler
     {
         static void Main(string[] args)
         {
-            var t = new Target(@"C:\Users\rollrat\source\repos\linux-recompiler\test\1. Hello World\a.out");
+            if (args.Length >= 2 && args[0] == "--bench")
+            {
+                Bench.Run(args[1..]);
+                return;
+            }
+
+            var path = @"C:\Users\rollrat\source\repos\linux-recompiler\test\1. Hello World\a.out";
+            List<(ulong Start, ulong End)> functions = null;
+            Dictionary<ulong, string> names = null;
+
+            // --functions and --names take the saved output of the native
+            // parser's -f and -g
+            for (int i = 0; i < args.Length; i++)
+            {
+                if (args[i] == "--functions" && i + 1 < args.Length)
+                    functions = EhFrame.Load(args[++i]);
+                else if (args[i] == "--names" && i + 1 < args.Length)
+                    names = Signatures.Load(args[++i]);
+                else
+                    path = args[i];
+            }
+
+            var t = new Target(path, functions, names);
 
             foreach (var func in t.Functions)
             {
@@ -0,0 +1,35 @@
+﻿// This source code is a part of Sharp Linux Recompiler
+// Copyright (C) 2020. rollrat. Licensed under the MIT Licence.
+
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+
+namespace linux_recompiler
+{
+    /// <summary>
+    /// Library function names for a stripped binary, read from the output
+    /// of the native parser's -g (one "0xaddr\tsize\tname,alias,..." line
+    /// per identified function).  The first name of a line is used.
+    /// </summary>
+    public static class Signatures
+    {
+        public static Dictionary<ulong, string> Load(string path)
+        {
+            var names = new Dictionary<ulong, string>();
+
+            foreach (var line in File.ReadLines(path))
+            {
+                var fields = line.Split('\t');
+                if (fields.Length < 3 || !fields[0].StartsWith("0x"))
+                    continue;
+                if (!ulong.TryParse(fields[0].Substring(2), NumberStyles.HexNumber, null, out var address))
+                    continue;
+                names[address] = fields[2].Split(',')[0];
+            }
+
+            return names;
+        }
+    }
+}
@@ -19,7 +19,13 @@ namespace linux_recompiler
         FileStream fs;
         public List<(ISymbolEntry, List<Instruction>)> Functions { get; private set; }
 
-        public Target(string program_path)
+        /// <param name="functions">Function ranges for stripped binaries,
+        /// see <see cref="EhFrame.Load"/>; ignored when .symtab exists</param>
+        /// <param name="names">Function names by address for stripped binaries,
+        /// see <see cref="Signatures.Load"/>; unnamed functions are sub_address</param>
+        public Target(string program_path,
+            IReadOnlyList<(ulong Start, ulong End)> functions = null,
+            IReadOnlyDictionary<ulong, string> names = null)
         {
             Bytes = File.ReadAllBytes(program_path);
             fs = new FileStream(program_path, FileMode.Open);
@@ -28,6 +34,8 @@ namespace linux_recompiler
 
             if (ELF.Sections.Any(x => x.Name == ".symtab"))
                 symbol_table_exists();
+            else if (functions != null)
+                eh_frame_exists(functions, names);
 
         }
 
@@ -36,7 +44,7 @@ namespace linux_recompiler
             fs.Close();
         }
 
-        static List<Instruction> disasm(byte[] bytes)
+        internal static List<Instruction> disasm(byte[] bytes)
         {
             ArchitectureMode mode = ArchitectureMode.x86_64;
             var disasm = new Disassembler(
@@ -119,5 +127,32 @@ namespace linux_recompiler
             }
 
         }
+
+        void eh_frame_exists(IReadOnlyList<(ulong Start, ulong End)> functions,
+            IReadOnlyDictionary<ulong, string> names)
+        {
+            // Disassembly is x86_64 only
+            if (!(ELF is ELF<ulong> elf) || !ELF.TryGetSection(".text", out var section) ||
+                !(section is Section<ulong> text))
+                return;
+            var contents = text.GetContents();
+
+            foreach (var (start, end) in functions)
+            {
+                if (start < text.LoadAddress || end > text.LoadAddress + (ulong)contents.Length)
+                    continue;
+
+                var bytes = new byte[end - start];
+                Array.Copy(contents, (long)(start - text.LoadAddress), bytes, 0, bytes.Length);
+
+                string name = null;
+                if (names == null || !names.TryGetValue(start, out name))
+                    name = $"sub_{start:x}";
+
+                var symbol = new SymbolEntry<ulong>(name, start, end - start,
+                    SymbolBinding.Local, SymbolType.Function, elf, 0);
+                Functions.Add((symbol, disasm(bytes)));
+            }
+        }
     }
 }